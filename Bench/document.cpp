@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <random>
+#include "document.h"
+
+static const char* const NAMES[] = {"alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi"};
+static const char* const TAGS[] = {"admin", "beta", "billing", "support", "trial", "enterprise"};
+
+std::string make_document(size_t size, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::string doc = "[";
+    char record[512];
+    while (doc.size() < size) {
+        const char* name = NAMES[rng() % 8];
+        uint64_t id = rng() % 1000000;
+        snprintf(record, sizeof(record),
+                 "{\"id\": %llu, \"name\": \"%s_%llu\", \"email\": \"%s_%llu@example.com\", \"active\": %s, "
+                 "\"score\": %llu.%llu, \"tags\": [\"%s\", \"%s\"], \"created\": \"2024-%02llu-%02lluT%02llu:%02llu:00Z\"},\n",
+                 (unsigned long long) id, name, (unsigned long long) id, name, (unsigned long long) id,
+                 rng() % 2 ? "true" : "false", (unsigned long long) (rng() % 100), (unsigned long long) (rng() % 10),
+                 TAGS[rng() % 6], TAGS[rng() % 6], (unsigned long long) (rng() % 12 + 1), (unsigned long long) (rng() % 28 + 1),
+                 (unsigned long long) (rng() % 24), (unsigned long long) (rng() % 60));
+        doc += record;
+    }
+    doc.resize(size);
+    return doc;
+}
@@ -0,0 +1,18 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/**
+ * @brief Generate a JSON-like document of exactly @p size bytes: an array of
+ *        user records whose keys repeat and whose values vary, so that it
+ *        compresses about as well as typical API payloads.
+ *
+ * @param size  Length of the document.
+ * @param seed  Varies the field values.
+ */
+std::string make_document(size_t size, uint64_t seed);
+
+#endif
@@ -0,0 +1,73 @@
+#include <math.h>
+#include "histogram.h"
+
+/**
+ * @brief buckets per power of two, and how many buckets cover 64-bit values
+ */
+#define HISTOGRAM_SUB (1u << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+Histogram::Histogram() : counts(HISTOGRAM_BUCKETS, 0) {}
+
+size_t Histogram::bucket_of(uint64_t value) {
+
+    // small values are their own bucket
+    if (value < 2 * HISTOGRAM_SUB) {
+        return value;
+    }
+
+    // otherwise keep the top SUB_BITS+1 significant bits
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB + ((value >> shift) - HISTOGRAM_SUB);
+}
+
+uint64_t Histogram::bucket_top(size_t bucket) {
+    if (bucket < 2 * HISTOGRAM_SUB) {
+        return bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB - 1;
+    uint64_t top = bucket % HISTOGRAM_SUB + HISTOGRAM_SUB;
+    return ((top + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    counts[bucket_of(value)]++;
+    total++;
+    sum += value;
+    if (value > max_value) {
+        max_value = value;
+    }
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (size_t i = 0; i < counts.size(); i++) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    if (other.max_value > max_value) {
+        max_value = other.max_value;
+    }
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+    if (total == 0) {
+        return 0;
+    }
+
+    // walk buckets until the rank is reached
+    uint64_t rank = (uint64_t) ceil(percentile / 100.0 * total);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            uint64_t top = bucket_top(i);
+            return top < max_value ? top : max_value;
+        }
+    }
+    return max_value;
+}
@@ -0,0 +1,61 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief sub-buckets per power of two, as a power of two (2^7 = 128: under 1% error)
+ */
+#define HISTOGRAM_SUB_BITS 7
+
+/**
+ * @class Histogram
+ * @brief Log-linear (HDR-style) histogram of non-negative integer samples.
+ *
+ * Values below 2^(SUB_BITS+1) are counted exactly; above that each power of
+ * two is split into 2^SUB_BITS equal buckets, so every recorded value is
+ * known to within 1/2^SUB_BITS of itself across the whole 64-bit range, in
+ * constant memory and with O(1) recording.  Not thread-safe: keep one per
+ * thread and merge().
+ */
+class Histogram {
+
+    /* public methods */
+    public:
+        Histogram();
+
+        /**
+         * @brief Count one sample.
+         */
+        void record(uint64_t value);
+
+        /**
+         * @brief Add another histogram's samples to this one.
+         */
+        void merge(const Histogram& other);
+
+        /**
+         * @brief Smallest value at or above which lies (100 - @p percentile)% of samples
+         *        (reported as the upper edge of its bucket); 0 if empty.
+         */
+        uint64_t percentile(double percentile) const;
+
+        uint64_t count() const { return total; }
+        uint64_t max() const { return max_value; }
+        double mean() const { return total ? (double) sum / total : 0; }
+
+    /* private methods */
+    private:
+        static size_t bucket_of(uint64_t value);
+        static uint64_t bucket_top(size_t bucket);
+
+    /* private fields */
+    private:
+        std::vector<uint64_t> counts;
+        uint64_t total = 0;
+        uint64_t max_value = 0;
+        long double sum = 0;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include <math.h>
+#include "keychooser.h"
+
+/**
+ * @brief zeta(count, theta) = sum of 1 / i^theta for i in [1, count]
+ */
+static double zeta(uint64_t count, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= count; i++) {
+        sum += 1.0 / pow((double) i, theta);
+    }
+    return sum;
+}
+
+/**
+ * @brief Scramble a rank (splitmix64 finalizer).
+ */
+static uint64_t scramble(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+KeyChooser::KeyChooser(uint64_t n, double theta) : n(n), theta(theta), zeta_n(0), alpha(0), eta(0) {
+    if (theta > 0) {
+        zeta_n = zeta(n, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zeta_n);
+    }
+}
+
+uint64_t KeyChooser::next(std::mt19937_64& rng) const {
+
+    // uniform
+    if (theta <= 0) {
+        return rng() % n;
+    }
+
+    // Zipfian rank, then spread it over the key space
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * zeta_n;
+    uint64_t rank;
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + pow(0.5, theta)) {
+        rank = 1;
+    } else {
+        rank = (uint64_t) (n * pow(eta * u - eta + 1.0, alpha));
+        if (rank >= n) {
+            rank = n - 1;
+        }
+    }
+    return scramble(rank) % n;
+}
@@ -0,0 +1,48 @@
+#ifndef KEYCHOOSER_H
+#define KEYCHOOSER_H
+
+#include <stdint.h>
+#include <random>
+
+/**
+ * @class KeyChooser
+ * @brief Draws key indices in [0, n) uniformly or from a Zipfian distribution.
+ *
+ * The Zipfian generator is the one YCSB uses (Gray et al., "Quickly
+ * Generating Billion-Record Synthetic Databases"): rank r is drawn with
+ * probability proportional to 1 / r^theta, in O(1) per draw after an O(n)
+ * setup.  Ranks are scrambled by a hash so the hottest keys are spread over
+ * the key space (and so over shards and partitions) instead of clustered at
+ * its start.
+ */
+class KeyChooser {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a chooser.
+         *
+         * @param n      Number of keys.
+         * @param theta  Skew: 0 for uniform, 0.99 for YCSB's default hot set; must be below 1.
+         */
+        KeyChooser(uint64_t n, double theta);
+
+        /**
+         * @brief Draw the next key index.
+         */
+        uint64_t next(std::mt19937_64& rng) const;
+
+    /* private fields */
+    private:
+        uint64_t n;
+        double theta;
+
+        /**
+         * @brief precomputed Zipfian constants
+         */
+        double zeta_n;
+        double alpha;
+        double eta;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <new>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "microbench.h"
+
+/**
+ * @brief heap counters maintained by the operator new/delete replacements below
+ */
+static std::atomic<uint64_t> alloc_count{0};
+static std::atomic<uint64_t> alloc_bytes{0};
+static std::atomic<int64_t> alloc_live{0};
+
+static void* counted_alloc(size_t size, size_t align) {
+
+    // allocate, honouring over-alignment
+    void* ptr = nullptr;
+    if (align > alignof(std::max_align_t)) {
+        if (posix_memalign(&ptr, align, size ? size : 1) != 0) {
+            ptr = nullptr;
+        }
+    } else {
+        ptr = malloc(size ? size : 1);
+    }
+    if (!ptr) {
+        return nullptr;
+    }
+
+    // count the block at its real size, so frees balance exactly
+    size_t usable = malloc_usable_size(ptr);
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    alloc_live.fetch_add((int64_t) usable, std::memory_order_relaxed);
+    return ptr;
+}
+
+static void counted_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    alloc_live.fetch_sub((int64_t) malloc_usable_size(ptr), std::memory_order_relaxed);
+    free(ptr);
+}
+
+static void* counted_new(size_t size, size_t align) {
+    void* ptr = counted_alloc(size, align);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size) { return counted_new(size, 0); }
+void* operator new[](size_t size) { return counted_new(size, 0); }
+void* operator new(size_t size, std::align_val_t align) { return counted_new(size, (size_t) align); }
+void* operator new[](size_t size, std::align_val_t align) { return counted_new(size, (size_t) align); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+
+AllocStats alloc_stats() {
+    return AllocStats{alloc_count.load(std::memory_order_relaxed), alloc_bytes.load(std::memory_order_relaxed),
+                      alloc_live.load(std::memory_order_relaxed)};
+}
+
+/**
+ * @brief Cost of one repetition, in totals for the whole run.
+ */
+struct MicroRep {
+    uint64_t ns;
+    AllocStats delta;
+};
+
+static MicroRep run_once(const MicroCase& micro) {
+
+    // reset untimed, then time exactly the run
+    if (micro.reset) {
+        micro.reset();
+    }
+    AllocStats before = alloc_stats();
+    auto start = std::chrono::steady_clock::now();
+    micro.run();
+    auto stop = std::chrono::steady_clock::now();
+    AllocStats after = alloc_stats();
+
+    MicroRep rep;
+    rep.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    rep.delta = AllocStats{after.allocs - before.allocs, after.bytes - before.bytes, after.live_bytes - before.live_bytes};
+    return rep;
+}
+
+MicroResult run_micro_case(const MicroCase& micro, unsigned warmup, unsigned reps) {
+
+    // build fixtures and warm caches, branch predictors and allocator pools
+    if (micro.prepare) {
+        micro.prepare();
+    }
+    for (unsigned i = 0; i < warmup; i++) {
+        run_once(micro);
+    }
+
+    // time repetitions and take the median
+    std::vector<MicroRep> timed;
+    for (unsigned i = 0; i < std::max(reps, 1u); i++) {
+        timed.push_back(run_once(micro));
+    }
+    if (micro.finish) {
+        micro.finish();
+    }
+    std::sort(timed.begin(), timed.end(), [](const MicroRep& a, const MicroRep& b) { return a.ns < b.ns; });
+    const MicroRep& median = timed[timed.size() / 2];
+
+    // normalize per operation
+    double ops = micro.ops ? (double) micro.ops : 1;
+    MicroResult result;
+    result.name = micro.name;
+    result.ops = micro.ops;
+    result.ns_per_op = median.ns / ops;
+    result.min_ns_per_op = timed.front().ns / ops;
+    result.allocs_per_op = median.delta.allocs / ops;
+    result.bytes_per_op = median.delta.bytes / ops;
+    result.retained_per_op = median.delta.live_bytes / ops;
+    return result;
+}
+
+bool write_micro_json(const std::string& path, const std::vector<MicroResult>& results) {
+    FILE* file = path == "-" ? stdout : fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const MicroResult& r = results[i];
+        fprintf(file,
+                "{\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, "
+                "\"allocs_per_op\": %.3f, \"bytes_per_op\": %.3f, \"retained_per_op\": %.3f}%s\n",
+                r.name.c_str(), (unsigned long long) r.ops, r.ns_per_op, r.min_ns_per_op, r.allocs_per_op,
+                r.bytes_per_op, r.retained_per_op, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "]\n");
+    bool ok = !ferror(file);
+    if (file != stdout) {
+        ok = fclose(file) == 0 && ok;
+    } else {
+        fflush(file);
+    }
+    return ok;
+}
+
+bool read_micro_json(const std::string& path, std::vector<MicroResult>& results) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+
+    // one result object per line, in the layout write_micro_json produces
+    char line[1024];
+    char name[512];
+    while (fgets(line, sizeof(line), file)) {
+        MicroResult r;
+        unsigned long long ops;
+        if (sscanf(line,
+                   " {\"name\": \"%511[^\"]\", \"ops\": %llu, \"ns_per_op\": %lf, \"min_ns_per_op\": %lf, "
+                   "\"allocs_per_op\": %lf, \"bytes_per_op\": %lf, \"retained_per_op\": %lf}",
+                   name, &ops, &r.ns_per_op, &r.min_ns_per_op, &r.allocs_per_op, &r.bytes_per_op, &r.retained_per_op) == 7) {
+            r.name = name;
+            r.ops = ops;
+            results.push_back(r);
+        }
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+/**
+ * @brief One microbenchmark: a hot path timed in isolation.
+ *
+ * prepare runs once before any repetition and reset before each one (both
+ * untimed, and either may be empty); run performs exactly ops operations and
+ * is the only timed part; finish releases whatever prepare built.
+ */
+struct MicroCase {
+    std::string name;
+    uint64_t ops;
+    std::function<void()> prepare;
+    std::function<void()> reset;
+    std::function<void()> run;
+    std::function<void()> finish;
+};
+
+/**
+ * @brief Per-operation cost of one case.
+ *
+ * ns_per_op is the median over the timed repetitions and min_ns_per_op the
+ * fastest; allocation figures are from the median repetition.  retained is
+ * heap growth per operation that was still live when run returned (e.g. the
+ * memory footprint of an inserted cell).
+ */
+struct MicroResult {
+    std::string name;
+    uint64_t ops = 0;
+    double ns_per_op = 0;
+    double min_ns_per_op = 0;
+    double allocs_per_op = 0;
+    double bytes_per_op = 0;
+    double retained_per_op = 0;
+};
+
+/**
+ * @brief Heap activity since process start, counted by the replaced global operator new/delete.
+ */
+struct AllocStats {
+    uint64_t allocs;
+    uint64_t bytes;
+    int64_t live_bytes;
+};
+AllocStats alloc_stats();
+
+/**
+ * @brief Run a case: prepare, @p warmup untimed repetitions, @p reps timed ones, finish.
+ */
+MicroResult run_micro_case(const MicroCase& micro, unsigned warmup, unsigned reps);
+
+/**
+ * @brief Write results as JSON, one result object per line.
+ *
+ * @return false if the file cannot be written
+ */
+bool write_micro_json(const std::string& path, const std::vector<MicroResult>& results);
+
+/**
+ * @brief Read results written by write_micro_json.
+ *
+ * @return false if the file cannot be read
+ */
+bool read_micro_json(const std::string& path, std::vector<MicroResult>& results);
+
+#endif
@@ -0,0 +1,401 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <netdb.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <algorithm>
+#include "client.h"
+
+/**
+ * @brief longest the I/O thread sleeps before checking for stalled connections
+ */
+#define CLIENT_POLL_MS 100
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Client::Client(const std::string& host, int port, size_t max_connections)
+    : host(host), port(port), addr(host + ":" + std::to_string(port)), max_connections(std::max<size_t>(max_connections, 1)) {
+    for (size_t i = 0; i < this->max_connections; i++) {
+        conns.push_back(std::make_unique<Connection>());
+    }
+}
+
+Client::~Client() {
+
+    // stop the I/O thread, then fail whatever is left
+    if (io_thread.joinable()) {
+        stopping = true;
+        wake();
+        io_thread.join();
+    }
+    std::vector<Completion> completed;
+    for (const std::unique_ptr<Connection>& conn : conns) {
+        fail(*conn, completed);
+    }
+    for (Completion& completion : completed) {
+        completion.first(completion.second);
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+}
+
+const std::string& Client::name() const {
+    return addr;
+}
+
+/**
+ * @brief Read from a connection until @p token has arrived (text handshake).
+ */
+static bool read_until(int fd, const char* token) {
+    std::string buf;
+    char chunk[256];
+    while (buf.find(token) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(chunk, n);
+    }
+    return true;
+}
+
+int Client::open_connection() {
+
+    // resolve and connect
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // bound blocking reads during the handshake; disable Nagle, since batching happens here
+    struct timeval tv;
+    tv.tv_sec = CLIENT_TIMEOUT_MS / 1000;
+    tv.tv_usec = (CLIENT_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    // skip the prompt and switch to binary framing, which has no prompts
+    if (!read_until(fd, "% ") || send(fd, "BINARY\r\n", 8, MSG_NOSIGNAL) != 8 || !read_until(fd, "BINARY\n")) {
+        close(fd);
+        return -1;
+    }
+
+    // from here on only the I/O thread touches it, without blocking
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+bool Client::connect() {
+    if (wake_fd < 0) {
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            return false;
+        }
+    }
+    if (io_thread.joinable()) {
+        return true;
+    }
+    conns[0]->fd = open_connection();
+    if (conns[0]->fd < 0) {
+        return false;
+    }
+    io_thread = std::thread(&Client::io_loop, this);
+    return true;
+}
+
+void Client::wake() {
+
+    // one wakeup covers everything queued until the I/O thread takes it
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t n = write(wake_fd, &one, sizeof(one));
+        (void) n;
+    }
+}
+
+void Client::submit(BinOpcode opcode, const std::string& row_key, const std::string& col_key, const ValueRef& value, ClientCallback done) {
+
+    // encode without the lock; the request id is filled in once a connection is chosen
+    BinHeader req;
+    req.magic = BIN_REQ_MAGIC;
+    req.opcode = opcode;
+    req.row_len = row_key.size();
+    req.col_len = col_key.size();
+    req.flags = 0;
+    req.value_len = value ? value->size() : 0;
+    req.request_id = 0;
+    if (row_key.size() > UINT16_MAX || col_key.size() > UINT16_MAX || req.value_len > BIN_MAX_VALUE) {
+        ClientResult result;
+        result.status = BIN_BAD_REQUEST;
+        done(result);
+        return;
+    }
+    std::string frame;
+    frame.reserve(BIN_HEADER_SIZE + req.body_len());
+    encode_bin_header(frame, req);
+    frame += row_key;
+    frame += col_key;
+    if (value) {
+        frame.append(value->data(), value->size());
+    }
+
+    // queue on the row's connection, behind the row's earlier requests
+    Connection& conn = *conns[std::hash<std::string>{}(row_key) % conns.size()];
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        uint32_t id = htonl(conn.next_id);
+        memcpy(&frame[12], &id, 4);
+        conn.pending.emplace(conn.next_id++, std::move(done));
+        conn.outbox += frame;
+    }
+    wake();
+}
+
+std::future<ClientResult> Client::submit_future(BinOpcode opcode, const std::string& row_key, const std::string& col_key, const ValueRef& value) {
+    std::shared_ptr<std::promise<ClientResult>> promise = std::make_shared<std::promise<ClientResult>>();
+    std::future<ClientResult> future = promise->get_future();
+    submit(opcode, row_key, col_key, value, [promise](const ClientResult& result) {
+        promise->set_value(result);
+    });
+    return future;
+}
+
+void Client::get(const std::string& row_key, const std::string& col_key, ClientCallback done) {
+    submit(BIN_GET, row_key, col_key, nullptr, std::move(done));
+}
+
+std::future<ClientResult> Client::get(const std::string& row_key, const std::string& col_key) {
+    return submit_future(BIN_GET, row_key, col_key, nullptr);
+}
+
+void Client::put(const std::string& row_key, const std::string& col_key, const ValueRef& value, ClientCallback done) {
+    submit(BIN_PUT, row_key, col_key, value, std::move(done));
+}
+
+std::future<ClientResult> Client::put(const std::string& row_key, const std::string& col_key, const ValueRef& value) {
+    return submit_future(BIN_PUT, row_key, col_key, value);
+}
+
+void Client::del(const std::string& row_key, const std::string& col_key, ClientCallback done) {
+    submit(BIN_DEL, row_key, col_key, nullptr, std::move(done));
+}
+
+std::future<ClientResult> Client::del(const std::string& row_key, const std::string& col_key) {
+    return submit_future(BIN_DEL, row_key, col_key, nullptr);
+}
+
+bool Client::send_some(Connection& conn) {
+    while (conn.unsent_pos < conn.unsent.size()) {
+        ssize_t n = send(conn.fd, conn.unsent.data() + conn.unsent_pos, conn.unsent.size() - conn.unsent_pos, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        conn.unsent_pos += n;
+        conn.last_progress_ms = now_ms();
+    }
+    conn.unsent.clear();
+    conn.unsent_pos = 0;
+    return true;
+}
+
+bool Client::receive(Connection& conn, std::vector<char>& chunk, std::vector<Completion>& completed) {
+
+    // read what has arrived; answers that came before a close still count
+    bool ok = true;
+    while (true) {
+        ssize_t n = recv(conn.fd, chunk.data(), chunk.size(), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        conn.inbuf.append(chunk.data(), n);
+        conn.last_progress_ms = now_ms();
+        if ((size_t) n < chunk.size()) {
+            break;
+        }
+    }
+
+    // match whole response frames to their requests
+    size_t pos = 0;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        while (conn.inbuf.size() - pos >= BIN_HEADER_SIZE) {
+            BinHeader rsp;
+            decode_bin_header(conn.inbuf.data() + pos, rsp);
+            auto it = conn.pending.find(rsp.request_id);
+            if (rsp.magic != BIN_RSP_MAGIC || it == conn.pending.end()) {
+                ok = false;
+                break;
+            }
+            if (conn.inbuf.size() - pos - BIN_HEADER_SIZE < rsp.value_len) {
+                break;
+            }
+            const char* body = conn.inbuf.data() + pos + BIN_HEADER_SIZE;
+            ClientResult result;
+            result.status = (BinStatus) rsp.row_len;
+            if (rsp.value_len > 0 || (rsp.opcode == BIN_GET && result.status == BIN_OK)) {
+                result.value = make_value(std::vector<char>(body, body + rsp.value_len));
+            }
+            completed.emplace_back(std::move(it->second), std::move(result));
+            conn.pending.erase(it);
+            pos += BIN_HEADER_SIZE + rsp.value_len;
+        }
+    }
+    conn.inbuf.erase(0, pos);
+    return ok;
+}
+
+void Client::fail(Connection& conn, std::vector<Completion>& completed) {
+
+    // fail everything queued or in flight; the next request opens the connection again
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        for (auto& [id, done] : conn.pending) {
+            ClientResult result;
+            result.io_error = true;
+            completed.emplace_back(std::move(done), std::move(result));
+        }
+        conn.pending.clear();
+        conn.outbox.clear();
+    }
+    if (conn.fd >= 0) {
+        close(conn.fd);
+        conn.fd = -1;
+    }
+    conn.unsent.clear();
+    conn.unsent_pos = 0;
+    conn.inbuf.clear();
+}
+
+void Client::io_loop() {
+    std::vector<Connection*> active;
+    std::vector<struct pollfd> fds;
+    std::vector<Completion> completed;
+    std::vector<char> chunk(CLIENT_RECV_CHUNK);
+    while (!stopping.load()) {
+
+        // take the requests queued since the last pass; a request queued after
+        // the flag is cleared wakes the thread again
+        int64_t now = now_ms();
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            wake_pending.store(false);
+            for (const std::unique_ptr<Connection>& conn : conns) {
+                if (conn->outbox.empty()) {
+                    continue;
+                }
+                if (conn->unsent.empty()) {
+                    conn->unsent.swap(conn->outbox);
+                    conn->last_progress_ms = now;
+                } else {
+                    conn->unsent += conn->outbox;
+                    conn->outbox.clear();
+                }
+            }
+        }
+
+        // open connections that have requests for the first time (or again after a failure),
+        // then send each one's batch at once; usually the socket takes all of it
+        active.clear();
+        for (const std::unique_ptr<Connection>& conn : conns) {
+            if (conn->fd < 0 && conn->unsent.empty()) {
+                continue;
+            }
+            if (conn->fd < 0) {
+                conn->fd = open_connection();
+            }
+            if (conn->fd < 0 || !send_some(*conn)) {
+                fail(*conn, completed);
+                continue;
+            }
+            active.push_back(conn.get());
+        }
+
+        // wait for answers, room to send, or more requests
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        for (Connection* conn : active) {
+            short events = POLLIN | (conn->unsent.empty() ? 0 : POLLOUT);
+            fds.push_back({conn->fd, events, 0});
+        }
+        if (completed.empty()) {
+            int ready = poll(fds.data(), fds.size(), CLIENT_POLL_MS);
+            if (ready < 0 && errno != EINTR) {
+                break;
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t n = read(wake_fd, &count, sizeof(count));
+            (void) n;
+        }
+
+        now = now_ms();
+        for (size_t i = 0; i < active.size(); i++) {
+            Connection& conn = *active[i];
+            short revents = fds[i + 1].revents;
+            bool ok = !(revents & (POLLERR | POLLNVAL));
+            if (ok && (revents & POLLOUT)) {
+                ok = send_some(conn);
+            }
+            if (ok && (revents & (POLLIN | POLLHUP))) {
+                ok = receive(conn, chunk, completed);
+            }
+
+            // a connection with requests outstanding must keep moving (those
+            // still in its outbox start the clock when they are taken)
+            if (ok && now - conn.last_progress_ms > CLIENT_TIMEOUT_MS) {
+                std::lock_guard<std::mutex> guard(mtx);
+                ok = conn.pending.empty() || !conn.outbox.empty();
+            }
+            if (!ok) {
+                fail(conn, completed);
+            }
+        }
+
+        // run callbacks with no lock held
+        for (Completion& completion : completed) {
+            completion.first(completion.second);
+        }
+        completed.clear();
+    }
+}
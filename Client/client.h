@@ -0,0 +1,194 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include "../Tablet/value.h"
+#include "../Net/binproto.h"
+
+/**
+ * @brief connections a Client opens to its server at most, unless told otherwise
+ */
+#define CLIENT_DEFAULT_CONNECTIONS 4
+
+/**
+ * @brief give up on a connection whose requests make no progress for this long
+ */
+#define CLIENT_TIMEOUT_MS 5000
+
+/**
+ * @brief bytes received per recv()
+ */
+#define CLIENT_RECV_CHUNK 64 * 1024
+
+/**
+ * @brief Outcome of one request.
+ */
+struct ClientResult {
+
+    /**
+     * @brief the server's answer (BIN_FAILURE if none arrived)
+     */
+    BinStatus status = BIN_FAILURE;
+
+    /**
+     * @brief the value a GET found
+     */
+    ValueRef value;
+
+    /**
+     * @brief the connection failed before the answer arrived; the request
+     *        may or may not have been applied
+     */
+    bool io_error = false;
+
+    bool ok() const { return status == BIN_OK; }
+};
+
+/**
+ * @brief called once with a request's outcome, on the Client's I/O thread
+ */
+using ClientCallback = std::function<void(const ClientResult& result)>;
+
+/**
+ * @class Client
+ * @brief Thread-safe client of a server over pooled, pipelined binary-protocol connections.
+ *
+ * Any number of threads may issue requests at once.  Each request is
+ * encoded by the calling thread and queued on one of the pool's connections,
+ * picked by a hash of its row as the tablet picks a shard, so requests on a
+ * row are applied in the order they were issued while different rows spread
+ * over the pool.  A single I/O thread opens connections as requests first
+ * need them, sends everything queued on a connection with one send() and
+ * matches answers to requests by request id, so small requests issued close
+ * together share system calls and packets, and a connection never waits for
+ * one answer before sending the next request.
+ *
+ * Every request has a callback form, run on the I/O thread (it must not
+ * block, e.g. on another request's future), and a future form.  A connection
+ * that fails or makes no progress for CLIENT_TIMEOUT_MS is closed, and its
+ * outstanding requests complete with io_error set; the next request on it
+ * opens it again.
+ */
+class Client {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Describe a server; nothing is opened until connect().
+         *
+         * @param host             Server host name or address.
+         * @param port             Server client port.
+         * @param max_connections  Most connections opened at once.
+         */
+        Client(const std::string& host, int port, size_t max_connections = CLIENT_DEFAULT_CONNECTIONS);
+
+        /**
+         * @brief Stop the I/O thread and close the connections; requests still
+         *        outstanding complete with io_error set.
+         */
+        ~Client();
+
+        /**
+         * @brief Open the first connection and start the I/O thread; the
+         *        others are opened as requests need them.
+         *
+         * Must succeed before any request is issued.
+         *
+         * @return false if the server cannot be reached
+         */
+        bool connect();
+
+        /**
+         * @brief Read a cell; the result carries BIN_OK and the value, or BIN_NOT_FOUND.
+         */
+        void get(const std::string& row_key, const std::string& col_key, ClientCallback done);
+        std::future<ClientResult> get(const std::string& row_key, const std::string& col_key);
+
+        /**
+         * @brief Write a cell (the value is copied into the request).
+         */
+        void put(const std::string& row_key, const std::string& col_key, const ValueRef& value, ClientCallback done);
+        std::future<ClientResult> put(const std::string& row_key, const std::string& col_key, const ValueRef& value);
+
+        /**
+         * @brief Delete a cell; the result carries BIN_OK, or BIN_NOT_FOUND if it did not exist.
+         */
+        void del(const std::string& row_key, const std::string& col_key, ClientCallback done);
+        std::future<ClientResult> del(const std::string& row_key, const std::string& col_key);
+
+        /**
+         * @brief "host:port"
+         */
+        const std::string& name() const;
+
+    /* private types */
+    private:
+        /**
+         * @brief One pooled connection (fd -1 while closed).
+         *
+         * outbox, pending and next_id are guarded by the Client's mutex; fd,
+         * unsent, inbuf and last_progress_ms belong to the I/O thread.
+         */
+        struct Connection {
+            int fd = -1;
+            std::string outbox;
+            std::unordered_map<uint32_t, ClientCallback> pending;
+            uint32_t next_id = 0;
+            std::string unsent;
+            size_t unsent_pos = 0;
+            std::string inbuf;
+            int64_t last_progress_ms = 0;
+        };
+
+        /**
+         * @brief a finished request's callback and outcome, run once no lock is held
+         */
+        using Completion = std::pair<ClientCallback, ClientResult>;
+
+    /* private methods */
+    private:
+        void submit(BinOpcode opcode, const std::string& row_key, const std::string& col_key, const ValueRef& value, ClientCallback done);
+        std::future<ClientResult> submit_future(BinOpcode opcode, const std::string& row_key, const std::string& col_key, const ValueRef& value);
+        int open_connection();
+        void wake();
+        void io_loop();
+        bool send_some(Connection& conn);
+        bool receive(Connection& conn, std::vector<char>& chunk, std::vector<Completion>& completed);
+        void fail(Connection& conn, std::vector<Completion>& completed);
+
+    /* private fields */
+    private:
+        std::string host;
+        int port;
+        std::string addr;
+        size_t max_connections;
+
+        /**
+         * @brief the pool, one slot per connection, and the mutex guarding their queues
+         */
+        std::mutex mtx;
+        std::vector<std::unique_ptr<Connection>> conns;
+
+        /**
+         * @brief eventfd that wakes the I/O thread, set once per batch of queued requests
+         */
+        int wake_fd = -1;
+        std::atomic<bool> wake_pending{false};
+
+        /**
+         * @brief I/O thread and the flag that stops it
+         */
+        std::thread io_thread;
+        std::atomic<bool> stopping{false};
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include "binproto.h"
+
+void decode_bin_header(const char* buf, BinHeader& hdr) {
+
+    // copy out fixed-width fields (buf may be unaligned)
+    uint16_t u16;
+    uint32_t u32;
+    hdr.magic = (uint8_t) buf[0];
+    hdr.opcode = (uint8_t) buf[1];
+    memcpy(&u16, buf + 2, 2);
+    hdr.row_len = ntohs(u16);
+    memcpy(&u16, buf + 4, 2);
+    hdr.col_len = ntohs(u16);
+    memcpy(&u16, buf + 6, 2);
+    hdr.flags = ntohs(u16);
+    memcpy(&u32, buf + 8, 4);
+    hdr.value_len = ntohl(u32);
+    memcpy(&u32, buf + 12, 4);
+    hdr.request_id = ntohl(u32);
+}
+
+void encode_bin_header(std::string& out, const BinHeader& hdr) {
+
+    // lay fields out in network byte order
+    char buf[BIN_HEADER_SIZE];
+    uint16_t u16;
+    uint32_t u32;
+    buf[0] = (char) hdr.magic;
+    buf[1] = (char) hdr.opcode;
+    u16 = htons(hdr.row_len);
+    memcpy(buf + 2, &u16, 2);
+    u16 = htons(hdr.col_len);
+    memcpy(buf + 4, &u16, 2);
+    u16 = htons(hdr.flags);
+    memcpy(buf + 6, &u16, 2);
+    u32 = htonl(hdr.value_len);
+    memcpy(buf + 8, &u32, 4);
+    u32 = htonl(hdr.request_id);
+    memcpy(buf + 12, &u32, 4);
+    out.append(buf, BIN_HEADER_SIZE);
+}
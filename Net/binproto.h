@@ -0,0 +1,98 @@
+#ifndef BINPROTO_H
+#define BINPROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/**
+ * Binary framing, negotiated by sending the text command "BINARY".
+ *
+ * Every request and response starts with a fixed 16-byte header in network
+ * byte order, followed by exactly the number of body bytes it declares:
+ *
+ *   offset  size  request                  response
+ *   0       1     magic (BIN_REQ_MAGIC)    magic (BIN_RSP_MAGIC)
+ *   1       1     opcode                   opcode (echoed)
+ *   2       2     row length               status
+ *   4       2     column length            0
+ *   6       2     flags (0)                flags (0)
+ *   8       4     value length             value length
+ *   12      4     request id               request id (echoed)
+ *
+ * Request bodies are <row><col><value>; response bodies are <value>.  Only
+ * PUT carries a value: any other request declaring one is answered with
+ * BIN_BAD_REQUEST and the connection closed.  Since
+ * lengths are known up front, values may hold arbitrary bytes (including
+ * CRLF) and the server never scans for a delimiter.
+ */
+
+/**
+ * @brief header size and magic bytes
+ */
+#define BIN_HEADER_SIZE 16
+#define BIN_REQ_MAGIC 0xDB
+#define BIN_RSP_MAGIC 0xDC
+
+/**
+ * @brief largest value accepted in a single frame
+ */
+#define BIN_MAX_VALUE (512u * 1024 * 1024)
+
+/**
+ * @brief request opcodes
+ */
+enum BinOpcode : uint8_t {
+    BIN_GET = 1,
+    BIN_PUT = 2,
+    BIN_DEL = 3,
+    BIN_EXIT = 4,
+};
+
+/**
+ * @brief response status codes
+ */
+enum BinStatus : uint16_t {
+    BIN_OK = 0,
+    BIN_NOT_FOUND = 1,
+    BIN_FAILURE = 2,
+    BIN_BAD_REQUEST = 3,
+};
+
+/**
+ * @brief Decoded frame header (host byte order).
+ *
+ * For responses, row_len carries the status and col_len is zero.
+ */
+struct BinHeader {
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t row_len;
+    uint16_t col_len;
+    uint16_t flags;
+    uint32_t value_len;
+    uint32_t request_id;
+
+    /**
+     * @brief number of body bytes following the header
+     */
+    size_t body_len() const { return (size_t) row_len + col_len + value_len; }
+};
+
+/**
+ * @brief Decode a header from BIN_HEADER_SIZE bytes.
+ *
+ * @param buf bytes to decode (at least BIN_HEADER_SIZE)
+ * @param hdr decoded header
+ */
+void decode_bin_header(const char* buf, BinHeader& hdr);
+
+/**
+ * @brief Append an encoded header to a string.
+ *
+ * @param out string to append BIN_HEADER_SIZE bytes to
+ * @param hdr header to encode
+ */
+void encode_bin_header(std::string& out, const BinHeader& hdr);
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "../Tablet/value.h"
+#include "../Util/inbuf.h"
+
+/**
+ * @brief values up to this size are copied into the output buffer rather than queued by handle
+ */
+#define INLINE_VALUE_MAX 256
+
+/**
+ * @brief a written output buffer up to this capacity is kept for the next response rather than freed
+ */
+#define OUTBUF_KEEP_BYTES 16 * 1024
+
+/**
+ * @brief a binary PUT value at least this large that has not fully arrived is
+ *        received straight into its own buffer rather than into inbuf
+ */
+#define BODY_STREAM_MIN 64 * 1024
+
+/**
+ * @brief One pending piece of output: owned bytes or a shared cell value.
+ *
+ * Values are written straight from the Tablet's buffer; the handle keeps the
+ * bytes alive until the last of them has been sent.
+ */
+struct OutChunk {
+    std::string bytes;
+    ValueRef value;
+
+    /**
+     * @brief bytes of this chunk already written
+     */
+    size_t offset = 0;
+
+    const char* data() const { return value ? value->data() : bytes.data(); }
+    size_t size() const { return value ? value->size() : bytes.size(); }
+};
+
+/**
+ * @brief Per-client state owned by the reactor.
+ *
+ * Only one worker touches a connection at a time (the reactor arms its
+ * descriptor one-shot), so handlers may use these fields without locking.
+ */
+struct Connection {
+
+    /**
+     * @brief client socket (non-blocking)
+     */
+    int fd;
+
+    /**
+     * @brief bytes received from the client that have not been consumed yet
+     */
+    InputBuffer inbuf;
+
+    /**
+     * @brief output queued for the client that has not been written yet,
+     *        flushed with a single writev per batch
+     */
+    std::deque<OutChunk> outq;
+
+    /**
+     * @brief total unwritten bytes across outq (outq may still hold an
+     *        emptied chunk kept for its buffer, so test this, not outq.empty())
+     */
+    size_t out_bytes = 0;
+
+    /**
+     * @brief buffer of a retired owned chunk, handed to the next one opened
+     */
+    std::string spare;
+
+    /**
+     * @brief connection negotiated length-prefixed binary framing (see binproto.h)
+     */
+    bool binary = false;
+
+    /**
+     * @brief close the connection once outq has been flushed
+     */
+    bool closing = false;
+
+    /**
+     * @brief Producer of a response too long to queue at once (e.g. a scan).
+     *
+     * While set, the reactor stops reading input and calls it whenever outq
+     * runs low; it queues the next part and returns false once it has queued
+     * the last, after which it is cleared and buffered input is handled again.
+     */
+    std::function<bool(Connection&)> stream;
+
+    /**
+     * @brief Destination of a value that follows its command (e.g. PUTL).
+     *
+     * While body_left is nonzero the reactor receives straight into body,
+     * advancing it, rather than into inbuf; once the last byte lands it calls
+     * the input handler, which then finishes the command through body_done.
+     * The handler moves any bytes of the value already in inbuf over first.
+     */
+    char* body = nullptr;
+    size_t body_left = 0;
+    std::function<void(Connection&)> body_done;
+
+    /**
+     * @brief Receive a value straight into its own buffer, then finish the command that announced it.
+     *
+     * Bytes of the value already buffered are moved over and the reactor
+     * reads the rest into place (body), so inbuf never holds a large value
+     * and its bytes are copied once on the way in.
+     *
+     * @param len bytes to receive
+     * @param finish called with the complete bytes once they have all arrived
+     * @return true if the value was already buffered and finish has run
+     */
+    bool receive_body(size_t len, std::function<void(Connection&, std::vector<char>&&)> finish) {
+        auto bytes = std::make_shared<std::vector<char>>(len);
+        size_t have = std::min(len, inbuf.size());
+        memcpy(bytes->data(), inbuf.data(), have);
+        inbuf.consume(have);
+        if (have == len) {
+            finish(*this, std::move(*bytes));
+            return true;
+        }
+        body = bytes->data() + have;
+        body_left = len - have;
+        body_done = [bytes, finish](Connection& conn) {
+            finish(conn, std::move(*bytes));
+        };
+        return false;
+    }
+
+    /**
+     * @brief Run the command waiting on a value that has now fully arrived.
+     *
+     * @return false if the value is still arriving (nothing else may be handled yet)
+     */
+    bool finish_body() {
+        if (body_left > 0) {
+            return false;
+        }
+        auto done = std::move(body_done);
+        body_done = nullptr;
+        body = nullptr;
+        done(*this);
+        return true;
+    }
+
+    /**
+     * @brief Start a new owned chunk at the back of outq, reusing the spare buffer.
+     */
+    void open_chunk() {
+        outq.emplace_back();
+        outq.back().bytes.swap(spare);
+    }
+
+    /**
+     * @brief Queue owned bytes, coalescing with a trailing owned chunk.
+     */
+    void write(const char* buf, size_t len) {
+        if (len == 0) {
+            return;
+        }
+        if (outq.empty() || outq.back().value) {
+            open_chunk();
+        }
+        outq.back().bytes.append(buf, len);
+        out_bytes += len;
+    }
+    void write(std::string_view str) { write(str.data(), str.size()); }
+
+    /**
+     * @brief Queue a shared value to be sent without copying its bytes.
+     */
+    void write(ValueRef value) {
+        if (!value || value->empty()) {
+            return;
+        }
+        if (value->size() <= INLINE_VALUE_MAX) {
+            write(value->data(), value->size());
+            return;
+        }
+        out_bytes += value->size();
+        if (outq.empty() || outq.back().value || !outq.back().bytes.empty()) {
+            outq.emplace_back();
+        }
+        outq.back().value = std::move(value);
+    }
+
+    /**
+     * @brief Drop the first @p len bytes of outq once they have been sent.
+     *
+     * Fully written chunks are retired, dropping their value handles.  The
+     * last owned chunk is emptied in place rather than removed, and the
+     * buffer of any other owned chunk becomes the spare, so a connection
+     * answering one small request after another reuses the same buffer and
+     * queue slot instead of allocating them per response.
+     */
+    void retire(size_t len) {
+        out_bytes -= len;
+        while (!outq.empty()) {
+            OutChunk& front = outq.front();
+            size_t remaining = front.size() - front.offset;
+            if (len < remaining) {
+                front.offset += len;
+                break;
+            }
+            len -= remaining;
+            if (front.bytes.capacity() > OUTBUF_KEEP_BYTES) {
+                std::string().swap(front.bytes);
+            }
+            if (outq.size() == 1 && !front.value) {
+                front.bytes.clear();
+                front.offset = 0;
+                break;
+            }
+            if (front.bytes.capacity() > spare.capacity()) {
+                front.bytes.clear();
+                spare.swap(front.bytes);
+            }
+            outq.pop_front();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,369 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "reactor.h"
+
+/**
+ * @brief bytes read from a socket per read() call
+ */
+#define READ_CHUNK 64 * 1024
+
+/**
+ * @brief max read() calls per wakeup before yielding the worker to other connections
+ */
+#define MAX_READS_PER_EVENT 16
+
+/**
+ * @brief max output chunks gathered into one writev
+ */
+#define MAX_IOV 64
+
+/**
+ * @brief max events drained per epoll_wait
+ */
+#define MAX_EVENTS 256
+
+bool parse_io_backend(const std::string& name, IoBackend& backend) {
+    if (name == "epoll") {
+        backend = IoBackend::EPOLL;
+    } else if (name == "uring") {
+        backend = IoBackend::URING;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ReactorStats EventLoop::total(const IoCounters* counters, size_t num_counters) {
+    ReactorStats totals;
+    uint64_t closed = 0;
+    for (size_t i = 0; i < num_counters; i++) {
+        totals.accepted += counters[i].opened.load(std::memory_order_relaxed);
+        totals.bytes_in += counters[i].bytes_in.load(std::memory_order_relaxed);
+        totals.bytes_out += counters[i].bytes_out.load(std::memory_order_relaxed);
+        totals.syscalls += counters[i].syscalls.load(std::memory_order_relaxed);
+        closed += counters[i].closed.load(std::memory_order_relaxed);
+    }
+    totals.active = totals.accepted > closed ? totals.accepted - closed : 0;
+    return totals;
+}
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+Reactor::Reactor(int listen_fd, size_t num_workers, Handler on_open, Handler on_input)
+    : listen_fd(listen_fd), on_open(std::move(on_open)), on_input(std::move(on_input)) {
+
+    // default to one worker per core
+    if (num_workers == 0) {
+        num_workers = std::thread::hardware_concurrency();
+        if (num_workers == 0) {
+            num_workers = 1;
+        }
+    }
+
+    // create epoll instance
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // spawn workers, each with its own counters
+    num_counters = num_workers + 1;
+    counters.reset(new IoCounters[num_counters]);
+    for (size_t i = 0; i < num_workers; i++) {
+        workers.emplace_back(&Reactor::worker_loop, this, std::ref(counters[1 + i]));
+    }
+}
+
+Reactor::~Reactor() {
+
+    // wake and join workers
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // close epoll instance
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool Reactor::run() {
+
+    // epoll must have been created
+    if (epoll_fd < 0) {
+        return false;
+    }
+
+    // register listening socket, edge-triggered
+    if (!set_nonblocking(listen_fd)) {
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        return false;
+    }
+
+    // loop dispatching events
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        IoCounters::add(counters[0].syscalls, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        // accept on listener, queue ready connections for workers
+        std::vector<Connection*> batch;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) {
+                accept_all(counters[0]);
+            } else {
+                batch.push_back((Connection*) events[i].data.ptr);
+            }
+        }
+        if (!batch.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx);
+                ready.insert(ready.end(), batch.begin(), batch.end());
+            }
+            if (batch.size() == 1) {
+                queue_cv.notify_one();
+            } else {
+                queue_cv.notify_all();
+            }
+        }
+    }
+}
+
+ReactorStats Reactor::stats() const {
+    return total(counters.get(), num_counters);
+}
+
+void Reactor::accept_all(IoCounters& io) {
+
+    // edge-triggered: accept until the backlog is empty
+    while (true) {
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        IoCounters::add(io.syscalls, 1);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+
+        // disable Nagle so small responses are not delayed
+        int opt = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        IoCounters::add(io.syscalls, 1);
+
+        // set up connection and let the owner greet it
+        Connection* conn = new Connection();
+        conn->fd = client_fd;
+        on_open(*conn);
+        if (!flush(*conn, io)) {
+            close(client_fd);
+            delete conn;
+            continue;
+        }
+
+        // register connection (no other thread can see it before this point)
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT | (conn->out_bytes == 0 ? 0u : (uint32_t) EPOLLOUT);
+        ev.data.ptr = conn;
+        IoCounters::add(io.syscalls, 1);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            close(client_fd);
+            delete conn;
+            continue;
+        }
+        IoCounters::add(io.opened, 1);
+    }
+}
+
+void Reactor::worker_loop(IoCounters& io) {
+    while (true) {
+
+        // wait for a ready connection
+        Connection* conn;
+        {
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            queue_cv.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (stopping) {
+                return;
+            }
+            conn = ready.front();
+            ready.pop_front();
+        }
+
+        // this worker owns conn until it is re-armed or dropped
+        service(conn, io);
+    }
+}
+
+void Reactor::service(Connection* conn, IoCounters& io) {
+
+    // drain socket and run handler, unless we are only flushing a goodbye,
+    // still streaming an earlier response, or the client is not reading its responses
+    if (!conn->closing && !conn->stream && conn->out_bytes < OUTBUF_HIGH_WATER) {
+        size_t before = conn->inbuf.size();
+        bool receiving_body = conn->body_left > 0;
+        FillStatus status = fill(*conn, io);
+        if (status == FillStatus::FAILED) {
+            drop(conn, io);
+            return;
+        }
+
+        // peer finished sending; answer what we have, then close
+        if (status == FillStatus::CLOSED) {
+            conn->closing = true;
+        }
+        if (conn->inbuf.size() != before || (receiving_body && conn->body_left == 0)) {
+            on_input(*conn);
+        }
+    }
+
+    // write what we can
+    if (!flush(*conn, io)) {
+        drop(conn, io);
+        return;
+    }
+
+    // top up a streaming response as the socket drains; once it ends,
+    // answer any commands that were pipelined behind it
+    for (int i = 0; conn->stream && conn->out_bytes < STREAM_LOW_WATER && i < MAX_STREAM_PARTS_PER_EVENT; i++) {
+        if (!conn->stream(*conn)) {
+            conn->stream = nullptr;
+            if (!conn->inbuf.empty()) {
+                on_input(*conn);
+            }
+        }
+        if (!flush(*conn, io)) {
+            drop(conn, io);
+            return;
+        }
+    }
+
+    // close once a closing connection has nothing left to send
+    if (conn->closing && !conn->stream && conn->out_bytes == 0) {
+        drop(conn, io);
+        return;
+    }
+
+    // an idle connection keeps only a small input buffer
+    conn->inbuf.shrink();
+    rearm(conn, io);
+}
+
+FillStatus Reactor::fill(Connection& conn, IoCounters& io) {
+    char chunk[READ_CHUNK];
+    for (int i = 0; i < MAX_READS_PER_EVENT; i++) {
+
+        // the rest of a value goes straight to its final buffer
+        bool to_body = conn.body_left > 0;
+        ssize_t n = to_body ? read(conn.fd, conn.body, conn.body_left) : read(conn.fd, chunk, sizeof(chunk));
+        IoCounters::add(io.syscalls, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return FillStatus::OPEN;
+            }
+            return FillStatus::FAILED;
+        } else if (n == 0) {
+            return FillStatus::CLOSED;
+        }
+        if (to_body) {
+            conn.body += n;
+            conn.body_left -= n;
+        } else {
+            conn.inbuf.append(chunk, n);
+        }
+        IoCounters::add(io.bytes_in, n);
+    }
+    return FillStatus::OPEN;
+}
+
+bool Reactor::flush(Connection& conn, IoCounters& io) {
+    while (conn.out_bytes > 0) {
+
+        // gather as many pending chunks as fit in one writev
+        struct iovec iov[MAX_IOV];
+        int iovcnt = 0;
+        for (auto it = conn.outq.begin(); it != conn.outq.end() && iovcnt < MAX_IOV; ++it) {
+            iov[iovcnt].iov_base = (void*) (it->data() + it->offset);
+            iov[iovcnt].iov_len = it->size() - it->offset;
+            iovcnt++;
+        }
+
+        // scatter/gather write straight from owned and shared buffers
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        IoCounters::add(io.syscalls, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            return false;
+        }
+
+        // retire fully written chunks, dropping their value handles
+        IoCounters::add(io.bytes_out, n);
+        conn.retire(n);
+    }
+    return true;
+}
+
+void Reactor::rearm(Connection* conn, IoCounters& io) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLET | EPOLLONESHOT;
+    if (!conn->closing && !conn->stream && conn->out_bytes < OUTBUF_HIGH_WATER) {
+        ev.events |= EPOLLIN;
+    }
+    if (conn->out_bytes > 0 || conn->stream) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = conn;
+    IoCounters::add(io.syscalls, 1);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+        drop(conn, io);
+    }
+}
+
+void Reactor::drop(Connection* conn, IoCounters& io) {
+    IoCounters::add(io.closed, 1);
+    IoCounters::add(io.syscalls, 2);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    delete conn;
+}
@@ -0,0 +1,213 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "connection.h"
+
+/**
+ * @brief stop reading from a client whose pending output exceeds this many bytes
+ */
+#define OUTBUF_HIGH_WATER 4 * 1024 * 1024
+
+/**
+ * @brief ask a streaming response for more output while less than this many bytes are pending
+ */
+#define STREAM_LOW_WATER 64 * 1024
+
+/**
+ * @brief max stream() calls per wakeup before yielding the worker to other connections
+ */
+#define MAX_STREAM_PARTS_PER_EVENT 16
+
+/**
+ * @brief result of draining a socket
+ */
+enum class FillStatus { OPEN, CLOSED, FAILED };
+
+/**
+ * @brief Connection and traffic totals since a reactor started
+ */
+struct ReactorStats {
+    uint64_t accepted = 0;
+    uint64_t active = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+
+    /**
+     * @brief system calls the event loop made for client I/O (accepting, polling, reading, writing, closing)
+     */
+    uint64_t syscalls = 0;
+};
+
+/**
+ * @brief connection I/O implementations a server can run
+ */
+enum class IoBackend {
+    EPOLL,  // readiness events, read() and sendmsg() per connection (Reactor)
+    URING,  // io_uring completions, batched across connections (UringReactor, Net/uring.h)
+};
+
+/**
+ * @brief Parse a backend name ("epoll", "uring").
+ *
+ * @param name backend name
+ * @param backend parsed backend
+ * @return false if the name is unknown
+ */
+bool parse_io_backend(const std::string& name, IoBackend& backend);
+
+/**
+ * @class EventLoop
+ * @brief Accepts clients on a listening socket and runs handlers on their input.
+ */
+class EventLoop {
+
+    /* public types */
+    public:
+        /**
+         * @brief Callback invoked on a connection; consumes inbuf and queues output.
+         */
+        using Handler = std::function<void(Connection&)>;
+
+    /* public methods */
+    public:
+        virtual ~EventLoop() = default;
+
+        /**
+         * @brief Run the event loop on the calling thread; does not return unless it fails.
+         *
+         * @return false on fatal error
+         */
+        virtual bool run() = 0;
+
+        /**
+         * @brief Sum the per-thread traffic counters (safe to call from any thread).
+         */
+        virtual ReactorStats stats() const = 0;
+
+    /* protected types */
+    protected:
+        /**
+         * @brief Traffic counted by one thread.
+         *
+         * Each counter has a single writer, so it is bumped with a relaxed load
+         * and store rather than a locked add; threads' counters sit on separate
+         * cache lines so counting never contends.
+         */
+        struct alignas(64) IoCounters {
+            std::atomic<uint64_t> bytes_in{0};
+            std::atomic<uint64_t> bytes_out{0};
+            std::atomic<uint64_t> opened{0};
+            std::atomic<uint64_t> closed{0};
+            std::atomic<uint64_t> syscalls{0};
+
+            static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+                counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+        };
+
+    /* protected methods */
+    protected:
+        /**
+         * @brief Sum @p num_counters threads' counters.
+         */
+        static ReactorStats total(const IoCounters* counters, size_t num_counters);
+};
+
+/**
+ * @class Reactor
+ * @brief Edge-triggered epoll event loop feeding a fixed worker pool.
+ *
+ * One I/O thread waits on epoll, accepts new clients onto non-blocking
+ * sockets and hands ready connections to a queue.  Workers drain the
+ * socket into Connection::inbuf, run the input handler, and flush
+ * Connection::outq with writev.  Descriptors are armed EPOLLONESHOT, so a connection is
+ * owned by at most one worker at a time and is re-armed once that worker is
+ * done with it.  Idle connections cost only their Connection struct.
+ * Long responses are produced incrementally through Connection::stream as
+ * the client drains them.
+ */
+class Reactor : public EventLoop {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a reactor over a bound, listening socket.
+         *
+         * @param listen_fd    Listening socket (made non-blocking by the reactor).
+         * @param num_workers  Worker threads to spawn, 0 for one per core.
+         * @param on_open      Called once when a connection is accepted (e.g. to queue a prompt).
+         * @param on_input     Called whenever new bytes have been appended to inbuf, or Connection::body has been filled.
+         */
+        Reactor(int listen_fd, size_t num_workers, Handler on_open, Handler on_input);
+
+        /**
+         * @brief Stop workers and close all remaining connections.
+         */
+        ~Reactor();
+
+        /**
+         * @brief Run the event loop on the calling thread; does not return unless epoll fails.
+         *
+         * @return false on fatal epoll error
+         */
+        bool run() override;
+
+        /**
+         * @brief Sum the per-thread traffic counters (safe to call from any thread).
+         */
+        ReactorStats stats() const override;
+
+    /* private methods */
+    private:
+        void accept_all(IoCounters& io);
+        void worker_loop(IoCounters& io);
+        void service(Connection* conn, IoCounters& io);
+        FillStatus fill(Connection& conn, IoCounters& io);
+        bool flush(Connection& conn, IoCounters& io);
+        void rearm(Connection* conn, IoCounters& io);
+        void drop(Connection* conn, IoCounters& io);
+
+    /* private fields */
+    private:
+        /**
+         * @brief listening socket and epoll instance
+         */
+        int listen_fd;
+        int epoll_fd;
+
+        /**
+         * @brief connection callbacks
+         */
+        Handler on_open;
+        Handler on_input;
+
+        /**
+         * @brief ready connections waiting for a worker
+         */
+        std::mutex queue_mtx;
+        std::condition_variable queue_cv;
+        std::deque<Connection*> ready;
+        bool stopping = false;
+
+        /**
+         * @brief worker pool
+         */
+        std::vector<std::thread> workers;
+
+        /**
+         * @brief traffic counters: [0] for the event loop thread, [1 + i] for worker i
+         */
+        std::unique_ptr<IoCounters[]> counters;
+        size_t num_counters;
+};
+
+#endif
@@ -0,0 +1,585 @@
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <iterator>
+#include "uring.h"
+
+/**
+ * @brief buffer group id of each ring's receive buffers
+ */
+#define URING_BUF_GROUP 0
+
+/**
+ * @brief operation a completion belongs to, kept in the low bits of user_data
+ *        (the rest is the UringConn, if any)
+ */
+#define URING_OP_MASK 7
+#define URING_OP_ACCEPT 1
+#define URING_OP_WAKE 2
+#define URING_OP_RECV 3
+#define URING_OP_SEND 4
+#define URING_OP_CANCEL 5
+
+static inline uint64_t op_data(void* ptr, uint64_t op) {
+    return (uint64_t) (uintptr_t) ptr | op;
+}
+
+UringReactor::UringReactor(int listen_fd, size_t num_workers, Handler on_open, Handler on_input)
+    : listen_fd(listen_fd), on_open(std::move(on_open)), on_input(std::move(on_input)) {
+
+    // default to one ring per core
+    if (num_workers == 0) {
+        num_workers = std::thread::hardware_concurrency();
+        if (num_workers == 0) {
+            num_workers = 1;
+        }
+    }
+    num_counters = num_workers;
+    counters.reset(new IoCounters[num_counters]);
+}
+
+UringReactor::~UringReactor() {
+    stop();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& ring : rings) {
+        teardown(*ring);
+    }
+}
+
+bool UringReactor::run() {
+
+    // set up every ring before serving on any, so a kernel without io_uring fails cleanly
+    for (size_t i = 0; i < num_counters; i++) {
+        rings.emplace_back(new Ring());
+        if (!setup(*rings.back())) {
+            int saved = errno;
+            for (auto& ring : rings) {
+                teardown(*ring);
+            }
+            rings.clear();
+            errno = saved;
+            return false;
+        }
+    }
+
+    // serve the first ring here and the rest on their own threads; any failure stops them all
+    for (size_t i = 1; i < rings.size(); i++) {
+        threads.emplace_back([this, i]() {
+            if (!loop(*rings[i], counters[i])) {
+                failed = true;
+                stop();
+            }
+        });
+    }
+    if (!loop(*rings[0], counters[0])) {
+        failed = true;
+        stop();
+    }
+    return !failed;
+}
+
+ReactorStats UringReactor::stats() const {
+    return total(counters.get(), num_counters);
+}
+
+bool UringReactor::setup(Ring& ring) {
+
+    // create the ring, with a completion queue roomy enough for a burst from
+    // every connection; it starts disabled so the thread that serves it can
+    // claim it, and completion work then waits until that thread asks for
+    // events instead of interrupting it (kernels before 6.1 lack the latter)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = URING_CQ_ENTRIES;
+    ring.fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring.fd < 0 && errno == EINVAL) {
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED | IORING_SETUP_COOP_TASKRUN;
+        ring.fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (ring.fd < 0) {
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        errno = ENOSYS;
+        return false;
+    }
+
+    // map the submission and completion rings (one mapping) and the submission entries
+    ring.ring_map_len = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                         params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    ring.ring_map = mmap(NULL, ring.ring_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.ring_map == MAP_FAILED) {
+        ring.ring_map = nullptr;
+        return false;
+    }
+    ring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    ring.sqes = (struct io_uring_sqe*) sqes;
+    char* base = (char*) ring.ring_map;
+    ring.sq_head = (unsigned*) (base + params.sq_off.head);
+    ring.sq_tail = (unsigned*) (base + params.sq_off.tail);
+    ring.sq_mask = *(unsigned*) (base + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.cq_head = (unsigned*) (base + params.cq_off.head);
+    ring.cq_tail = (unsigned*) (base + params.cq_off.tail);
+    ring.cq_mask = *(unsigned*) (base + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*) (base + params.cq_off.cqes);
+
+    // submission slots map one to one onto entries
+    unsigned* array = (unsigned*) (base + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    // provide the receive buffers (the buffer ring must be page aligned, which mmap gives)
+    ring.buf_ring_len = URING_BUFFERS * sizeof(struct io_uring_buf);
+    void* buf_ring = mmap(NULL, ring.buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        return false;
+    }
+    ring.buf_ring = (struct io_uring_buf_ring*) buf_ring;
+    ring.buf_mem_len = (size_t) URING_BUFFERS * URING_BUFFER_SIZE;
+    void* buf_mem = mmap(NULL, ring.buf_mem_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_mem == MAP_FAILED) {
+        return false;
+    }
+    ring.buf_mem = (char*) buf_mem;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring.buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return false;
+    }
+    for (unsigned bid = 0; bid < URING_BUFFERS; bid++) {
+        recycle_buffer(ring, bid);
+    }
+
+    // eventfd for stop() to wake the ring with
+    ring.wake_fd = eventfd(0, EFD_CLOEXEC);
+    return ring.wake_fd >= 0;
+}
+
+void UringReactor::teardown(Ring& ring) {
+
+    // close what is still connected
+    for (UringConn* uc : ring.conns) {
+        close(uc->conn.fd);
+        delete uc;
+    }
+    ring.conns.clear();
+
+    // closing the ring cancels its requests and unregisters its buffers
+    if (ring.fd >= 0) {
+        close(ring.fd);
+        ring.fd = -1;
+    }
+    if (ring.ring_map) {
+        munmap(ring.ring_map, ring.ring_map_len);
+        ring.ring_map = nullptr;
+    }
+    if (ring.sqes) {
+        munmap(ring.sqes, ring.sqes_len);
+        ring.sqes = nullptr;
+    }
+    if (ring.buf_ring) {
+        munmap(ring.buf_ring, ring.buf_ring_len);
+        ring.buf_ring = nullptr;
+    }
+    if (ring.buf_mem) {
+        munmap(ring.buf_mem, ring.buf_mem_len);
+        ring.buf_mem = nullptr;
+    }
+    if (ring.wake_fd >= 0) {
+        close(ring.wake_fd);
+        ring.wake_fd = -1;
+    }
+}
+
+void UringReactor::stop() {
+    stopping = true;
+    for (auto& ring : rings) {
+        if (ring->wake_fd >= 0) {
+            uint64_t one = 1;
+            ssize_t n = write(ring->wake_fd, &one, sizeof(one));
+            (void) n;
+        }
+    }
+}
+
+bool UringReactor::loop(Ring& ring, IoCounters& io) {
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0) {
+        return false;
+    }
+    arm_accept(ring, io);
+    arm_wake(ring, io);
+    while (!stopping) {
+
+        // submit everything queued since the last pass and wait for at least one completion
+        if (!enter(ring, 1, io)) {
+            return false;
+        }
+
+        // handle completions, freeing each slot before acting on it (acting may queue more work)
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = ring.cqes[head & ring.cq_mask];
+            head++;
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+            UringConn* uc = (UringConn*) (uintptr_t) (cqe.user_data & ~(uint64_t) URING_OP_MASK);
+            switch (cqe.user_data & URING_OP_MASK) {
+                case URING_OP_ACCEPT:
+                    if (cqe.res >= 0) {
+                        on_accept(ring, cqe.res, io);
+                    }
+                    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                        arm_accept(ring, io);
+                    }
+                    break;
+                case URING_OP_WAKE:
+                    arm_wake(ring, io);
+                    break;
+                case URING_OP_RECV:
+                    on_recv(ring, uc, cqe, io);
+                    break;
+                case URING_OP_SEND:
+                    on_send(ring, uc, cqe, io);
+                    break;
+                case URING_OP_CANCEL:
+                    break;
+            }
+        }
+    }
+    return true;
+}
+
+struct io_uring_sqe* UringReactor::get_sqe(Ring& ring, IoCounters& io) {
+
+    // submit early if the queue is full (no SQPOLL, so the kernel only reads the tail during enter)
+    unsigned tail = *ring.sq_tail;
+    while (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries) {
+        enter(ring, 0, io);
+    }
+    struct io_uring_sqe* sqe = &ring.sqes[tail & ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+    return sqe;
+}
+
+bool UringReactor::enter(Ring& ring, unsigned min_complete, IoCounters& io) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long submitted = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, min_complete, flags, NULL, 0);
+    IoCounters::add(io.syscalls, 1);
+    if (submitted < 0) {
+        return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+    }
+    ring.to_submit -= std::min<unsigned>(ring.to_submit, (unsigned) submitted);
+    return true;
+}
+
+void UringReactor::recycle_buffer(Ring& ring, unsigned bid) {
+
+    // the tail shares its slot with the first buffer's unused field, so set fields one by one;
+    // entries are indexed from the ring's start, since in C++ the header's bufs[] sits past an
+    // empty struct that takes space
+    unsigned short tail = ring.buf_ring->tail;
+    struct io_uring_buf* buf = (struct io_uring_buf*) ring.buf_ring + (tail & (URING_BUFFERS - 1));
+    buf->addr = (uint64_t) (uintptr_t) (ring.buf_mem + (size_t) bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = (unsigned short) bid;
+    __atomic_store_n(&ring.buf_ring->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+void UringReactor::arm_accept(Ring& ring, IoCounters& io) {
+
+    // one multishot accept keeps delivering clients until it reports otherwise
+    struct io_uring_sqe* sqe = get_sqe(ring, io);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = op_data(nullptr, URING_OP_ACCEPT);
+}
+
+void UringReactor::arm_wake(Ring& ring, IoCounters& io) {
+    struct io_uring_sqe* sqe = get_sqe(ring, io);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ring.wake_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &ring.wake_value;
+    sqe->len = sizeof(ring.wake_value);
+    sqe->user_data = op_data(nullptr, URING_OP_WAKE);
+}
+
+void UringReactor::on_accept(Ring& ring, int client_fd, IoCounters& io) {
+
+    // disable Nagle so small responses are not delayed
+    int opt = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    IoCounters::add(io.syscalls, 1);
+
+    // set up connection, let the owner greet it, and start receiving
+    UringConn* uc = new UringConn();
+    uc->conn.fd = client_fd;
+    ring.conns.insert(uc);
+    IoCounters::add(io.opened, 1);
+    on_open(uc->conn);
+    service(ring, uc, io);
+}
+
+void UringReactor::on_recv(Ring& ring, UringConn* uc, const struct io_uring_cqe& cqe, IoCounters& io) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        uc->recv_armed = false;
+        uc->recv_cancelling = false;
+    }
+    Connection& conn = uc->conn;
+    bool was_closing = conn.closing;
+
+    // copy the bytes out and hand the buffer straight back
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe.res > 0 && !uc->dead) {
+            const char* bytes = ring.buf_mem + (size_t) bid * URING_BUFFER_SIZE;
+            size_t len = cqe.res;
+            IoCounters::add(io.bytes_in, len);
+
+            // the rest of a value goes to its final buffer, and is handled once complete
+            if (conn.body_left > 0) {
+                size_t n = std::min(len, conn.body_left);
+                memcpy(conn.body, bytes, n);
+                conn.body += n;
+                conn.body_left -= n;
+                bytes += n;
+                len -= n;
+                uc->input_pending |= conn.body_left == 0;
+            }
+            if (len > 0) {
+                conn.inbuf.append(bytes, len);
+                uc->input_pending = true;
+            }
+        }
+        recycle_buffer(ring, bid);
+    }
+    if (uc->dead) {
+        release(ring, uc, io);
+        return;
+    }
+
+    // peer finished sending: answer what we have, then close; ENOBUFS
+    // (every buffer was in use) or a pause just receives again later
+    if (cqe.res == 0) {
+        conn.closing = true;
+    } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED && cqe.res != -EINTR && cqe.res != -EAGAIN) {
+        drop(ring, uc, io);
+        return;
+    }
+
+    // drain what the socket holds (including the end of input) before
+    // handling it, as Reactor::fill does; input arriving behind a stream
+    // waits for it to end, and input after a goodbye is ignored
+    bool more = cqe.res > 0 && (cqe.flags & IORING_CQE_F_SOCK_NONEMPTY) && conn.inbuf.size() < URING_RECV_BATCH;
+    if (uc->input_pending && !more && !was_closing && !conn.stream) {
+        uc->input_pending = false;
+        on_input(conn);
+    }
+    service(ring, uc, io);
+}
+
+void UringReactor::on_send(Ring& ring, UringConn* uc, const struct io_uring_cqe& cqe, IoCounters& io) {
+    Connection& conn = uc->conn;
+
+    // the kernel is done with a zero-copy send's pages
+    if (cqe.flags & IORING_CQE_F_NOTIF) {
+        if (--uc->zc_pending == 0) {
+            uc->zc_held.clear();
+        }
+        if (uc->dead) {
+            release(ring, uc, io);
+        }
+        return;
+    }
+
+    // a zero-copy send without a notification to come (it failed) is done with them too
+    uc->send_armed = false;
+    if (uc->send_zc && !(cqe.flags & IORING_CQE_F_MORE) && --uc->zc_pending == 0) {
+        uc->zc_held.clear();
+    }
+    if (uc->dead) {
+        release(ring, uc, io);
+        return;
+    }
+    if (cqe.res < 0) {
+        if (uc->send_zc && cqe.res == -EOPNOTSUPP) {
+            ring.zc_disabled = true;
+        } else if (cqe.res != -EINTR && cqe.res != -EAGAIN) {
+            drop(ring, uc, io);
+            return;
+        }
+        service(ring, uc, io);
+        return;
+    }
+
+    // retire fully written chunks, dropping their value handles
+    IoCounters::add(io.bytes_out, cqe.res);
+    conn.retire(cqe.res);
+    service(ring, uc, io);
+}
+
+void UringReactor::service(Ring& ring, UringConn* uc, IoCounters& io) {
+    Connection& conn = uc->conn;
+
+    // top up a streaming response as output drains; once it ends, answer
+    // any commands that were pipelined behind it
+    for (int i = 0; conn.stream && conn.out_bytes < STREAM_LOW_WATER && i < MAX_STREAM_PARTS_PER_EVENT; i++) {
+        if (!conn.stream(conn)) {
+            conn.stream = nullptr;
+            if (!conn.inbuf.empty()) {
+                uc->input_pending = false;
+                on_input(conn);
+            }
+        }
+    }
+
+    // send what is queued, one send in flight at a time
+    if (!uc->send_armed && conn.out_bytes > 0) {
+        arm_send(ring, uc, io);
+    }
+
+    // close once a closing connection has nothing left to send
+    if (conn.closing && !conn.stream && conn.out_bytes == 0 && !uc->send_armed) {
+        drop(ring, uc, io);
+        return;
+    }
+
+    // a stream that queued nothing yet is asked again on the next pass
+    if (conn.stream && !uc->send_armed) {
+        struct io_uring_sqe* sqe = get_sqe(ring, io);
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = op_data(uc, URING_OP_SEND);
+        uc->send_armed = true;
+        uc->send_zc = false;
+    }
+
+    // receive more unless closing, streaming, or the client is not reading
+    // its responses; a receive still armed then is cancelled until it may resume
+    bool receive = !conn.closing && !conn.stream && conn.out_bytes < OUTBUF_HIGH_WATER;
+    if (receive && !uc->recv_armed) {
+        arm_recv(ring, uc, io);
+    } else if (!receive && uc->recv_armed && !uc->recv_cancelling) {
+        struct io_uring_sqe* sqe = get_sqe(ring, io);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = op_data(uc, URING_OP_RECV);
+        sqe->user_data = op_data(nullptr, URING_OP_CANCEL);
+        uc->recv_cancelling = true;
+    }
+
+    // an idle connection keeps only a small input buffer
+    conn.inbuf.shrink();
+}
+
+void UringReactor::arm_recv(Ring& ring, UringConn* uc, IoCounters& io) {
+
+    // one multishot receive keeps delivering bytes, each completion in a
+    // buffer the kernel picks, until it ends or is cancelled; with nothing
+    // buffered the next request is usually still on its way, so wait for it first
+    struct io_uring_sqe* sqe = get_sqe(ring, io);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc->conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT | (uc->conn.inbuf.empty() ? IORING_RECVSEND_POLL_FIRST : 0);
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = op_data(uc, URING_OP_RECV);
+    uc->recv_armed = true;
+}
+
+void UringReactor::arm_send(Ring& ring, UringConn* uc, IoCounters& io) {
+    Connection& conn = uc->conn;
+    struct io_uring_sqe* sqe = get_sqe(ring, io);
+    sqe->fd = conn.fd;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = op_data(uc, URING_OP_SEND);
+    uc->send_armed = true;
+
+    // a large value at the front goes alone and zero-copy, its handle held until the kernel lets go
+    auto zero_copy = [&ring](const OutChunk& chunk) {
+        return !ring.zc_disabled && chunk.value && chunk.size() - chunk.offset >= URING_ZC_MIN;
+    };
+    const OutChunk& front = conn.outq.front();
+    if (zero_copy(front)) {
+        sqe->opcode = IORING_OP_SEND_ZC;
+        sqe->addr = (uint64_t) (uintptr_t) (front.data() + front.offset);
+        sqe->len = (unsigned) std::min<size_t>(front.size() - front.offset, 1u << 30);
+        uc->send_zc = true;
+        uc->zc_pending++;
+        uc->zc_held.push_back(front.value);
+        return;
+    }
+
+    // otherwise gather chunks up to the next large value into one sendmsg
+    int iovcnt = 0;
+    bool gathered_last = false;
+    for (auto it = conn.outq.begin(); it != conn.outq.end() && iovcnt < URING_MAX_IOV; ++it) {
+        if (iovcnt > 0 && zero_copy(*it)) {
+            break;
+        }
+        uc->iov[iovcnt].iov_base = (void*) (it->data() + it->offset);
+        uc->iov[iovcnt].iov_len = it->size() - it->offset;
+        iovcnt++;
+        gathered_last = std::next(it) == conn.outq.end();
+    }
+    memset(&uc->msg, 0, sizeof(uc->msg));
+    uc->msg.msg_iov = uc->iov;
+    uc->msg.msg_iovlen = iovcnt;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64_t) (uintptr_t) &uc->msg;
+    sqe->len = 1;
+    uc->send_zc = false;
+
+    // handlers append to a trailing owned chunk, which could move bytes the
+    // kernel is still reading, so start a fresh one behind the send
+    if (gathered_last && !conn.outq.back().value) {
+        conn.open_chunk();
+    }
+}
+
+void UringReactor::drop(Ring& ring, UringConn* uc, IoCounters& io) {
+    if (uc->dead) {
+        return;
+    }
+    uc->dead = true;
+    IoCounters::add(io.closed, 1);
+
+    // shutting the socket down completes whatever is still in flight on it
+    if (uc->recv_armed || uc->send_armed || uc->zc_pending > 0) {
+        shutdown(uc->conn.fd, SHUT_RDWR);
+        IoCounters::add(io.syscalls, 1);
+        return;
+    }
+    release(ring, uc, io);
+}
+
+void UringReactor::release(Ring& ring, UringConn* uc, IoCounters& io) {
+
+    // free a dead connection once no request refers to it
+    if (uc->recv_armed || uc->send_armed || uc->zc_pending > 0) {
+        return;
+    }
+    close(uc->conn.fd);
+    IoCounters::add(io.syscalls, 1);
+    ring.conns.erase(uc);
+    delete uc;
+}
@@ -0,0 +1,219 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "reactor.h"
+
+/**
+ * @brief submission and completion queue entries per ring
+ */
+#define URING_ENTRIES 1024
+#define URING_CQ_ENTRIES 64 * 1024
+
+/**
+ * @brief receive buffers each ring provides to the kernel, and their size
+ */
+#define URING_BUFFERS 512
+#define URING_BUFFER_SIZE 16 * 1024
+
+/**
+ * @brief while the socket still holds bytes, keep receiving until this many are buffered before handling them
+ */
+#define URING_RECV_BATCH 1024 * 1024
+
+/**
+ * @brief a value at least this large is sent zero-copy, straight from the cell's buffer
+ */
+#define URING_ZC_MIN 64 * 1024
+
+/**
+ * @brief max output chunks gathered into one send
+ */
+#define URING_MAX_IOV 64
+
+/**
+ * @class UringReactor
+ * @brief io_uring event loop: one ring per worker thread, each serving its own connections.
+ *
+ * Every ring keeps an accept armed on the shared listening socket, so the
+ * kernel spreads new clients across them, and a connection stays on the
+ * ring that accepted it.  A thread queues receives, sends and closes for
+ * all of its connections and submits them with the same io_uring_enter call
+ * that waits for completions, so a busy ring serves many requests per
+ * system call.
+ *
+ * Each connection keeps one multishot receive armed, cancelled only while
+ * its input is paused.  Receives draw from a ring of buffers provided to the
+ * kernel (IORING_REGISTER_PBUF_RING), so an idle connection pins no buffer
+ * of its own; the bytes are appended to Connection::inbuf and the buffer
+ * goes straight back.  Sends gather Connection::outq as Reactor::flush does; a
+ * queued value of URING_ZC_MIN bytes or more is sent zero-copy from the
+ * cell's buffer, whose handle is held until the kernel reports it is done
+ * with the pages.
+ *
+ * Handlers run on the ring's thread, so a handler that blocks (e.g. a
+ * semisync write waiting for its backup) stalls the other connections of
+ * its ring rather than only its own; the server therefore refuses this
+ * loop with sync durability or semisync replication.  Requires Linux 6.0 or later (6.1 to
+ * defer completion work until the thread asks for it).
+ */
+class UringReactor : public EventLoop {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a reactor over a bound, listening socket; rings are set up by run().
+         *
+         * @param listen_fd    Listening socket.
+         * @param num_workers  Rings (one thread each, the first being the caller of run()), 0 for one per core.
+         * @param on_open      Called once when a connection is accepted (e.g. to queue a prompt).
+         * @param on_input     Called whenever new bytes have been appended to inbuf, or Connection::body has been filled.
+         */
+        UringReactor(int listen_fd, size_t num_workers, Handler on_open, Handler on_input);
+
+        /**
+         * @brief Stop the ring threads and close all remaining connections.
+         */
+        ~UringReactor();
+
+        /**
+         * @brief Set up the rings, start their threads and serve the first on the calling thread.
+         *
+         * @return false if a ring cannot be set up (e.g. io_uring is unavailable) or fails
+         */
+        bool run() override;
+
+        /**
+         * @brief Sum the per-ring traffic counters (safe to call from any thread).
+         */
+        ReactorStats stats() const override;
+
+    /* private types */
+    private:
+        /**
+         * @brief A connection and the ring operations it has in flight.
+         *
+         * input_pending marks bytes received but not yet handed to on_input.
+         * msg and iov describe the send in flight and must stay put until it
+         * completes.  zc_held keeps the values of zero-copy sends alive until
+         * their notifications arrive.  The connection is freed once dead and
+         * no operation refers to it.
+         */
+        struct UringConn {
+            Connection conn;
+            bool recv_armed = false;
+            bool recv_cancelling = false;
+            bool input_pending = false;
+            bool send_armed = false;
+            bool send_zc = false;
+            size_t zc_pending = 0;
+            std::vector<ValueRef> zc_held;
+            bool dead = false;
+            struct msghdr msg;
+            struct iovec iov[URING_MAX_IOV];
+        };
+
+        /**
+         * @brief One io_uring instance, its mapped queues and its receive buffers.
+         */
+        struct Ring {
+            int fd = -1;
+            void* ring_map = nullptr;
+            size_t ring_map_len = 0;
+            struct io_uring_sqe* sqes = nullptr;
+            size_t sqes_len = 0;
+            unsigned* sq_tail = nullptr;
+            unsigned sq_mask = 0;
+            unsigned sq_entries = 0;
+            unsigned* sq_head = nullptr;
+            unsigned* cq_head = nullptr;
+            unsigned* cq_tail = nullptr;
+            unsigned cq_mask = 0;
+            struct io_uring_cqe* cqes = nullptr;
+
+            /**
+             * @brief entries queued since the last io_uring_enter
+             */
+            unsigned to_submit = 0;
+
+            /**
+             * @brief provided buffer ring and the memory its buffers point into
+             */
+            struct io_uring_buf_ring* buf_ring = nullptr;
+            size_t buf_ring_len = 0;
+            char* buf_mem = nullptr;
+            size_t buf_mem_len = 0;
+
+            /**
+             * @brief eventfd the destructor writes to wake the ring, and where its read lands
+             */
+            int wake_fd = -1;
+            uint64_t wake_value = 0;
+
+            /**
+             * @brief zero-copy sends are unsupported by the kernel; send everything by copying
+             */
+            bool zc_disabled = false;
+
+            /**
+             * @brief connections accepted by this ring and not yet freed
+             */
+            std::unordered_set<UringConn*> conns;
+        };
+
+    /* private methods */
+    private:
+        bool setup(Ring& ring);
+        void teardown(Ring& ring);
+        bool loop(Ring& ring, IoCounters& io);
+        struct io_uring_sqe* get_sqe(Ring& ring, IoCounters& io);
+        bool enter(Ring& ring, unsigned min_complete, IoCounters& io);
+        void recycle_buffer(Ring& ring, unsigned bid);
+        void arm_accept(Ring& ring, IoCounters& io);
+        void arm_wake(Ring& ring, IoCounters& io);
+        void on_accept(Ring& ring, int client_fd, IoCounters& io);
+        void on_recv(Ring& ring, UringConn* uc, const struct io_uring_cqe& cqe, IoCounters& io);
+        void on_send(Ring& ring, UringConn* uc, const struct io_uring_cqe& cqe, IoCounters& io);
+        void service(Ring& ring, UringConn* uc, IoCounters& io);
+        void arm_recv(Ring& ring, UringConn* uc, IoCounters& io);
+        void arm_send(Ring& ring, UringConn* uc, IoCounters& io);
+        void stop();
+        void drop(Ring& ring, UringConn* uc, IoCounters& io);
+        void release(Ring& ring, UringConn* uc, IoCounters& io);
+
+    /* private fields */
+    private:
+        /**
+         * @brief listening socket
+         */
+        int listen_fd;
+
+        /**
+         * @brief connection callbacks
+         */
+        Handler on_open;
+        Handler on_input;
+
+        /**
+         * @brief rings, the threads serving all but the first, and the flags that stop them
+         */
+        std::vector<std::unique_ptr<Ring>> rings;
+        std::vector<std::thread> threads;
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> failed{false};
+
+        /**
+         * @brief traffic counters, [i] for ring i
+         */
+        std::unique_ptr<IoCounters[]> counters;
+        size_t num_counters;
+};
+
+#endif
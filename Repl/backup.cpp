@@ -0,0 +1,184 @@
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <thread>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "backup.h"
+#include "repl.h"
+#include "../Wal/wal.h"
+#include "../Util/coding.h"
+
+/**
+ * @brief wait this long before reconnecting to the primary
+ */
+#define REPL_RETRY_MS 1000
+
+/**
+ * @brief bytes received per recv()
+ */
+#define REPL_RECV_CHUNK 256 * 1024
+
+ReplBackup::ReplBackup(Tablet& tab, const std::string& host, int port)
+    : tab(tab), host(host), port(port), caught_up_at(std::chrono::steady_clock::now()) {}
+
+void ReplBackup::start() {
+    std::thread(&ReplBackup::run, this).detach();
+}
+
+std::string ReplBackup::status() {
+    std::lock_guard<std::mutex> lock(mtx);
+    uint64_t lag_seq = primary_seq - std::min(primary_seq, applied);
+    uint64_t lag_ms = 0;
+    if (lag_seq > 0 || !connected) {
+        lag_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - caught_up_at).count();
+    }
+    const char* state = !connected ? "disconnected" : syncing ? "syncing" : "streaming";
+    return "BACKUP " + std::to_string(applied) + " " + std::to_string(primary_seq) + " "
+         + std::to_string(lag_seq) + " " + std::to_string(lag_ms) + " " + state;
+}
+
+void ReplBackup::run() {
+    while (true) {
+
+        // resolve and connect to the primary
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* res = nullptr;
+        int fd = -1;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) == 0) {
+            fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+            if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+                close(fd);
+                fd = -1;
+            }
+            freeaddrinfo(res);
+        }
+
+        // replicate until the connection fails, then retry
+        if (fd >= 0) {
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            fprintf(stderr, "Replication: connected to primary %s:%d\n", host.c_str(), port);
+            session(fd);
+            close(fd);
+            fprintf(stderr, "Replication: lost primary %s:%d, retrying\n", host.c_str(), port);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(REPL_RETRY_MS));
+    }
+}
+
+bool ReplBackup::session(int fd) {
+
+    // announce where we are
+    std::string hello(REPL_MAGIC, REPL_MAGIC_LEN);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        put_u64(hello, epoch);
+        put_u64(hello, applied);
+        connected = true;
+    }
+    bool ok = repl_send(fd, hello);
+
+    // apply frames as they arrive, acking after each burst
+    std::string buf;
+    std::vector<char> chunk(REPL_RECV_CHUNK);
+    while (ok) {
+        ssize_t n = recv(fd, chunk.data(), chunk.size(), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        buf.append(chunk.data(), n);
+
+        // consume whole frames
+        size_t pos = 0;
+        while (ok && buf.size() - pos >= REPL_FRAME_HEADER) {
+            uint8_t kind = buf[pos];
+            uint64_t arg = get_u64(buf.data() + pos + 1);
+            uint32_t len = get_u32(buf.data() + pos + 9);
+            if (buf.size() - pos - REPL_FRAME_HEADER < len) {
+                break;
+            }
+            ok = apply_frame(kind, arg, buf.data() + pos + REPL_FRAME_HEADER, len);
+            pos += REPL_FRAME_HEADER + len;
+        }
+        buf.erase(0, pos);
+
+        // ack progress, noting when we are caught up
+        std::string ack;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!syncing && applied >= primary_seq) {
+                caught_up_at = std::chrono::steady_clock::now();
+            }
+            put_u64(ack, applied);
+        }
+        ok = ok && repl_send(fd, ack);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    connected = false;
+    return ok;
+}
+
+bool ReplBackup::apply_frame(uint8_t kind, uint64_t arg, const char* payload, size_t len) {
+
+    // decode the record carried by cell and change frames
+    LogRecord rec;
+    if (kind == REPL_CELL || kind == REPL_RECORD) {
+        size_t consumed;
+        if (decode_record(payload, len, rec, consumed) != RecordStatus::OK || consumed != len) {
+            fprintf(stderr, "Replication: corrupt record from primary\n");
+            return false;
+        }
+    }
+
+    // branch on frame kind
+    if (kind == REPL_SNAPSHOT_BEGIN) {
+
+        // discard our state; the copy replaces it
+        fprintf(stderr, "Replication: receiving full copy from primary\n");
+        tab.clear();
+        std::lock_guard<std::mutex> lock(mtx);
+        syncing = true;
+        sync_epoch = arg;
+        applied = 0;
+    } else if (kind == REPL_CELL) {
+        tab.restore(rec.row, rec.col, rec.value, arg, rec.compressed, rec.seq);
+    } else if (kind == REPL_SNAPSHOT_END) {
+
+        // the copy is complete through arg; changes after it follow
+        tab.advance_seq(arg);
+        std::lock_guard<std::mutex> lock(mtx);
+        syncing = false;
+        epoch = sync_epoch;
+        applied = arg;
+        primary_seq = std::max(primary_seq, arg);
+        fprintf(stderr, "Replication: full copy complete through seq %llu\n", (unsigned long long) arg);
+    } else if (kind == REPL_RECORD) {
+
+        // apply under the primary's numbering (a DEL of a missing cell still advances it)
+        if (!tab.apply(rec.mutation())) {
+            tab.advance_seq(rec.seq);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        applied = rec.seq;
+        primary_seq = std::max(primary_seq, rec.seq);
+    } else if (kind == REPL_HEARTBEAT) {
+        std::lock_guard<std::mutex> lock(mtx);
+        primary_seq = std::max(primary_seq, arg);
+    } else {
+        fprintf(stderr, "Replication: unknown frame %u from primary\n", kind);
+        return false;
+    }
+    return true;
+}
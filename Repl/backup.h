@@ -0,0 +1,77 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stdint.h>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include "../Tablet/tablet.h"
+
+/**
+ * @class ReplBackup
+ * @brief Keeps a read-only Tablet in step with a primary.
+ *
+ * A background thread connects to the primary's replication port, applies
+ * the full copy and change records it streams (under the primary's sequence
+ * numbers), acks what it applied, and reconnects after failures, resuming
+ * from its last applied change.  Reads during a full copy may miss cells.
+ */
+class ReplBackup {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a backup of the primary at host:port; nothing happens until start().
+         *
+         * @param tab   Tablet to keep in step (no other writer may use it).
+         * @param host  Primary host name or address.
+         * @param port  Primary replication port.
+         */
+        ReplBackup(Tablet& tab, const std::string& host, int port);
+
+        /**
+         * @brief Start replicating in the background.
+         */
+        void start();
+
+        /**
+         * @brief Describe replication state:
+         *        "BACKUP <applied seq> <primary seq> <lag in changes> <lag in ms> <state>",
+         *        where lag in ms is how long ago the backup was last known to be caught up
+         *        and state is one of streaming, syncing, disconnected.
+         */
+        std::string status();
+
+    /* private methods */
+    private:
+        void run();
+        bool session(int fd);
+        bool apply_frame(uint8_t kind, uint64_t arg, const char* payload, size_t len);
+
+    /* private fields */
+    private:
+        /**
+         * @brief configuration
+         */
+        Tablet& tab;
+        std::string host;
+        int port;
+
+        /**
+         * @brief replication state, guarded by mtx
+         */
+        std::mutex mtx;
+        uint64_t epoch = 0;
+        uint64_t applied = 0;
+        uint64_t primary_seq = 0;
+        bool connected = false;
+        bool syncing = false;
+        std::chrono::steady_clock::time_point caught_up_at;
+
+        /**
+         * @brief epoch announced by the full copy in progress
+         */
+        uint64_t sync_epoch = 0;
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "primary.h"
+#include "repl.h"
+#include "../Util/coding.h"
+#include "../Util/iotool.h"
+
+/**
+ * @brief approximate bytes of recent changes kept for backups that fall behind
+ */
+#define REPL_BACKLOG_BYTES 64 * 1024 * 1024
+
+/**
+ * @brief max records encoded per send
+ */
+#define REPL_BATCH_RECORDS 1024
+
+/**
+ * @brief send a full copy in pieces of about this many bytes
+ */
+#define REPL_SYNC_CHUNK 1024 * 1024
+
+/**
+ * @brief heartbeat an idle backup this often, so it can measure its lag
+ */
+#define REPL_HEARTBEAT_MS 100
+
+/**
+ * @brief seq of the last change made by this thread, which sync() waits for
+ */
+static thread_local uint64_t last_ticket = 0;
+
+bool parse_repl_mode(const std::string& name, ReplMode& mode) {
+    if (name == "async") {
+        mode = ReplMode::ASYNC;
+    } else if (name == "semisync") {
+        mode = ReplMode::SEMISYNC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ReplPrimary::Backup::~Backup() {
+    close(fd);
+}
+
+ReplPrimary::ReplPrimary(Tablet& tab, ReplMode mode, uint64_t timeout_ms)
+    : tab(tab), mode(mode), timeout_ms(timeout_ms), epoch(std::random_device{}() | 1), last_seq(tab.last_seq()) {}
+
+bool ReplPrimary::start(int port) {
+
+    // bind replication port
+    listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return false;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    // accept backups in the background
+    std::thread(&ReplPrimary::accept_loop, this).detach();
+    return true;
+}
+
+void ReplPrimary::on_mutation(const Mutation& mutation) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        backlog.push_back(LogRecord{mutation.type, mutation.seq, mutation.row, mutation.col, mutation.value, mutation.compressed});
+        backlog_bytes += mutation.row.size() + mutation.col.size() + (mutation.value ? mutation.value->size() : 0) + sizeof(LogRecord);
+        last_seq = mutation.seq;
+
+        // forget the oldest changes once over budget (a backup still needing them is re-copied)
+        while (backlog_bytes > REPL_BACKLOG_BYTES && backlog.size() > 1) {
+            const LogRecord& oldest = backlog.front();
+            backlog_bytes -= oldest.row.size() + oldest.col.size() + (oldest.value ? oldest.value->size() : 0) + sizeof(LogRecord);
+            backlog.pop_front();
+        }
+    }
+    last_ticket = mutation.seq;
+    data_cv.notify_all();
+}
+
+bool ReplPrimary::any_acked(uint64_t seq) const {
+    for (const auto& backup : backups) {
+        if (backup->streaming && backup->acked >= seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReplPrimary::sync() {
+    uint64_t ticket = last_ticket;
+    if (mode != ReplMode::SEMISYNC || ticket == 0) {
+        return;
+    }
+
+    // wait for one streaming backup to ack, unless none is streaming or we already gave up
+    std::unique_lock<std::mutex> lock(mtx);
+    bool acked = ack_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+        return degraded || any_acked(ticket)
+            || std::none_of(backups.begin(), backups.end(), [](const std::shared_ptr<Backup>& b) { return b->streaming; });
+    });
+    if (!acked) {
+        degraded = true;
+        fprintf(stderr, "Replication: no backup acked seq %llu within %llu ms, continuing asynchronously\n",
+                (unsigned long long) ticket, (unsigned long long) timeout_ms);
+    }
+}
+
+std::string ReplPrimary::status() {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::string out = "PRIMARY " + std::to_string(last_seq) + " " + std::to_string(backups.size());
+    for (const auto& backup : backups) {
+        out += "\n" + backup->addr + " " + std::to_string(backup->acked) + " " + std::to_string(last_seq - std::min(last_seq, backup->acked));
+    }
+    return out;
+}
+
+void ReplPrimary::accept_loop() {
+    while (true) {
+
+        // accept next backup
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept(listen_fd, (struct sockaddr*) &peer, &peer_len);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Replication: accept failed (%s)\n", strerror(errno));
+            return;
+        }
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        // describe it by address
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, ip_str, sizeof(ip_str));
+        std::shared_ptr<Backup> backup = std::make_shared<Backup>();
+        backup->fd = fd;
+        backup->addr = std::string(ip_str) + ":" + std::to_string(ntohs(peer.sin_port));
+
+        // each backup gets a sender, which spawns its ack reader after the handshake
+        std::thread(&ReplPrimary::serve, this, backup).detach();
+    }
+}
+
+bool ReplPrimary::full_sync(Backup& backup, uint64_t& next) {
+
+    // every change after snap_seq is in (or will enter) the backlog
+    uint64_t snap_seq;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        snap_seq = last_seq;
+        backup.streaming = false;
+    }
+
+    // the copy is taken as of a view no older than snap_seq; changes between
+    // the two are in both, and replaying them over the copy is harmless
+    uint64_t view_seq = tab.open_view();
+    fprintf(stderr, "Replication: sending full copy through seq %llu to %s\n", (unsigned long long) snap_seq, backup.addr.c_str());
+
+    // announce the copy and the epoch it belongs to
+    std::string out;
+    encode_repl_frame(out, REPL_SNAPSHOT_BEGIN, epoch, nullptr);
+
+    // copy shards one at a time, as a snapshot would
+    std::vector<CellEntry> cells;
+    for (size_t i = 0; i < tab.num_shards(); i++) {
+        cells.clear();
+        tab.collect_shard(i, cells, view_seq);
+        for (CellEntry& cell : cells) {
+            if (!tab.load_value(cell)) {
+                tab.close_view(view_seq);
+                return false;
+            }
+            Mutation mutation{MutationType::PUT, cell.row, cell.col, cell.value, cell.version, cell.compressed};
+            encode_repl_frame(out, REPL_CELL, cell.expires_ms, &mutation);
+            if (out.size() >= REPL_SYNC_CHUNK) {
+                if (!repl_send(backup.fd, out)) {
+                    tab.close_view(view_seq);
+                    return false;
+                }
+                out.clear();
+            }
+        }
+    }
+    tab.close_view(view_seq);
+
+    // close the copy; records after snap_seq follow
+    encode_repl_frame(out, REPL_SNAPSHOT_END, snap_seq, nullptr);
+    if (!repl_send(backup.fd, out)) {
+        return false;
+    }
+    next = snap_seq + 1;
+    return true;
+}
+
+void ReplPrimary::serve(std::shared_ptr<Backup> backup) {
+
+    // read handshake
+    char hello[REPL_HANDSHAKE_LEN];
+    if (do_read(backup->fd, hello, REPL_HANDSHAKE_LEN) != REPL_HANDSHAKE_LEN || memcmp(hello, REPL_MAGIC, REPL_MAGIC_LEN) != 0) {
+        fprintf(stderr, "Replication: bad handshake from %s\n", backup->addr.c_str());
+        return;
+    }
+    uint64_t backup_epoch = get_u64(hello + REPL_MAGIC_LEN);
+    uint64_t backup_seq = get_u64(hello + REPL_MAGIC_LEN + 8);
+    fprintf(stderr, "Replication: backup %s connected at seq %llu\n", backup->addr.c_str(), (unsigned long long) backup_seq);
+
+    // register it and start collecting its acks
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        backup->acked = backup_seq;
+        backups.push_back(backup);
+    }
+    std::thread(&ReplPrimary::read_acks, this, backup).detach();
+
+    // a backup synced from another primary process, or ahead of us, starts over
+    uint64_t next = backup_seq + 1;
+    bool resync = backup_epoch != epoch;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        resync = resync || backup_seq > last_seq;
+    }
+
+    // stream changes until the backup goes away
+    std::vector<LogRecord> batch;
+    std::string out;
+    bool ok = true;
+    while (ok) {
+        if (resync) {
+            ok = full_sync(*backup, next);
+            resync = false;
+            continue;
+        }
+
+        // wait for changes past next, or time to heartbeat
+        uint64_t primary_seq;
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            data_cv.wait_for(lock, std::chrono::milliseconds(REPL_HEARTBEAT_MS), [&] {
+                return backup->closed || last_seq >= next;
+            });
+            if (backup->closed) {
+                break;
+            }
+            primary_seq = last_seq;
+
+            // copy out the next batch, or resync if it already left the backlog
+            if (last_seq >= next) {
+                auto it = std::lower_bound(backlog.begin(), backlog.end(), next,
+                                           [](const LogRecord& rec, uint64_t seq) { return rec.seq < seq; });
+                if (backlog.empty() || backlog.front().seq > next) {
+                    resync = true;
+                    continue;
+                }
+                for (; it != backlog.end() && batch.size() < REPL_BATCH_RECORDS; ++it) {
+                    batch.push_back(*it);
+                }
+            }
+            backup->streaming = true;
+        }
+
+        // encode and send outside the lock
+        out.clear();
+        for (const LogRecord& rec : batch) {
+            Mutation mutation = rec.mutation();
+            encode_repl_frame(out, REPL_RECORD, 0, &mutation);
+        }
+        if (batch.empty()) {
+            encode_repl_frame(out, REPL_HEARTBEAT, primary_seq, nullptr);
+        } else {
+            next = batch.back().seq + 1;
+        }
+        ok = repl_send(backup->fd, out);
+    }
+
+    // unregister; the ack reader sees the shutdown and exits
+    fprintf(stderr, "Replication: backup %s disconnected\n", backup->addr.c_str());
+    shutdown(backup->fd, SHUT_RDWR);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        backups.remove(backup);
+    }
+    ack_cv.notify_all();
+}
+
+void ReplPrimary::read_acks(std::shared_ptr<Backup> backup) {
+    char buf[8];
+    while (do_read(backup->fd, buf, sizeof(buf)) == sizeof(buf)) {
+        uint64_t acked = get_u64(buf);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            backup->acked = acked;
+
+            // a backup that caught up ends a semi-sync timeout
+            if (degraded && backup->streaming && acked >= last_seq) {
+                degraded = false;
+                fprintf(stderr, "Replication: backup %s caught up, semi-synchronous again\n", backup->addr.c_str());
+            }
+        }
+        ack_cv.notify_all();
+    }
+
+    // wake the sender so it notices
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        backup->closed = true;
+    }
+    data_cv.notify_all();
+}
@@ -0,0 +1,143 @@
+#ifndef PRIMARY_H
+#define PRIMARY_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "../Tablet/tablet.h"
+#include "../Wal/wal.h"
+
+/**
+ * @brief how long a PUT/DEL may be acknowledged before a backup has it
+ */
+enum class ReplMode {
+    ASYNC,     // writers never wait for backups
+    SEMISYNC,  // writers wait until one backup acks their changes (or the timeout expires)
+};
+
+/**
+ * @brief Parse a replication mode name ("async", "semisync").
+ *
+ * @param name mode name
+ * @param mode parsed mode
+ * @return false if the name is unknown
+ */
+bool parse_repl_mode(const std::string& name, ReplMode& mode);
+
+/**
+ * @class ReplPrimary
+ * @brief Ships every Tablet change to connected backups.
+ *
+ * Attached to a Tablet as a MutationListener, the primary keeps a bounded
+ * in-memory backlog of recent changes in commit order.  Each backup gets a
+ * sender thread that streams the backlog from the backup's position (after
+ * a full copy if that position is no longer in the backlog) and a thread
+ * that collects its acks.  In semi-synchronous mode sync() waits for an ack
+ * from one streaming backup; if none arrives in time the primary degrades to
+ * asynchronous until a backup catches up again.
+ */
+class ReplPrimary : public MutationListener {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a primary for a tablet; must happen before the tablet is shared.
+         *
+         * @param tab          Tablet to replicate (the primary is attached to it by the caller).
+         * @param mode         Replication mode.
+         * @param timeout_ms   Longest sync() waits in semi-synchronous mode.
+         */
+        ReplPrimary(Tablet& tab, ReplMode mode, uint64_t timeout_ms);
+
+        /**
+         * @brief Listen for backups on a port and start accepting them.
+         *
+         * @return false if the port could not be bound
+         */
+        bool start(int port);
+
+        /**
+         * @brief Append a change to the backlog (called by the Tablet under its sequencer).
+         */
+        void on_mutation(const Mutation& mutation) override;
+
+        /**
+         * @brief In semi-synchronous mode, wait until a backup has every change made by the calling thread.
+         */
+        void sync();
+
+        /**
+         * @brief Describe the primary and each backup: "PRIMARY <seq> <backups>", then
+         *        one "<address> <acked seq> <lag in changes>" line per backup.
+         */
+        std::string status();
+
+    /* private types */
+    private:
+        /**
+         * @brief one connected backup; shared by its sender and ack threads
+         */
+        struct Backup {
+            int fd;
+            std::string addr;
+            uint64_t acked = 0;
+            bool streaming = false;
+            bool closed = false;
+            ~Backup();
+        };
+
+    /* private methods */
+    private:
+        void accept_loop();
+        void serve(std::shared_ptr<Backup> backup);
+        void read_acks(std::shared_ptr<Backup> backup);
+        bool full_sync(Backup& backup, uint64_t& next);
+        bool any_acked(uint64_t seq) const;
+
+    /* private fields */
+    private:
+        /**
+         * @brief configuration
+         */
+        Tablet& tab;
+        ReplMode mode;
+        uint64_t timeout_ms;
+        int listen_fd = -1;
+
+        /**
+         * @brief identifies this primary process, so backups synced from an
+         *        earlier one are re-copied rather than resumed
+         */
+        uint64_t epoch;
+
+        /**
+         * @brief recent changes, their approximate size, and the last seq
+         *        appended, guarded by mtx
+         */
+        std::mutex mtx;
+        std::deque<LogRecord> backlog;
+        size_t backlog_bytes = 0;
+        uint64_t last_seq;
+
+        /**
+         * @brief connected backups, guarded by mtx
+         */
+        std::list<std::shared_ptr<Backup>> backups;
+
+        /**
+         * @brief semi-sync gave up waiting and is acknowledging without backups, guarded by mtx
+         */
+        bool degraded = false;
+
+        /**
+         * @brief wakes senders on new changes, and semi-sync writers on acks
+         */
+        std::condition_variable data_cv;
+        std::condition_variable ack_cv;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include "repl.h"
+#include "../Wal/wal.h"
+#include "../Util/coding.h"
+
+void encode_repl_frame(std::string& out, ReplFrame kind, uint64_t arg, const Mutation* mutation) {
+
+    // header with a placeholder length
+    size_t start = out.size();
+    out.push_back((char) kind);
+    put_u64(out, arg);
+    put_u32(out, 0);
+
+    // payload, then patch its length in
+    if (mutation) {
+        encode_record(out, *mutation);
+    }
+    uint32_t len = out.size() - start - REPL_FRAME_HEADER;
+    for (int i = 0; i < 4; i++) {
+        out[start + 9 + i] = (char) (len >> (8 * i));
+    }
+}
+
+bool repl_send(int fd, const std::string& buf) {
+    size_t sent = 0;
+    while (sent < buf.size()) {
+        ssize_t n = send(fd, buf.data() + sent, buf.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef REPL_H
+#define REPL_H
+
+#include <stdint.h>
+#include <string>
+#include "../Tablet/mutation.h"
+
+/**
+ * Replication stream (integers little-endian):
+ *
+ *   backup -> primary, once   "DBREPL01" | u64 epoch of the primary it last synced from (0 = none)
+ *                             | u64 last sequence number it applied
+ *   primary -> backup         frames [u8 kind][u64 arg][u32 payload length][payload]
+ *   backup -> primary         u64 last applied sequence number (ack), after each burst it applies
+ *
+ * A backup that is not in the primary's backlog (too far behind, never
+ * synced, or synced from an earlier primary process) is sent a fuzzy copy
+ * of every cell between SNAPSHOT_BEGIN and SNAPSHOT_END, the latter carrying
+ * the sequence number the copy is complete through, followed by the records
+ * after it.  Replaying those records over the copy reproduces the primary.
+ */
+
+/**
+ * @brief handshake magic sent by a backup
+ */
+#define REPL_MAGIC "DBREPL01"
+#define REPL_MAGIC_LEN 8
+
+/**
+ * @brief bytes of the handshake (magic, epoch, seq) and of a frame header (kind, arg, length)
+ */
+#define REPL_HANDSHAKE_LEN 24
+#define REPL_FRAME_HEADER 13
+
+/**
+ * @brief kinds of primary -> backup frame
+ */
+enum ReplFrame : uint8_t {
+    REPL_SNAPSHOT_BEGIN = 1,  // arg: primary epoch
+    REPL_CELL = 2,            // payload: log record (Wal/wal.h) of a PUT whose seq is the cell's version; arg: its deadline (0 for none)
+    REPL_SNAPSHOT_END = 3,    // arg: seq the copy is complete through
+    REPL_RECORD = 4,          // payload: log record of one change
+    REPL_HEARTBEAT = 5,       // arg: primary's last seq, sent when idle
+};
+
+/**
+ * @brief Append one frame; @p mutation (if any) is encoded as the payload.
+ *
+ * @param out string to append to
+ * @param kind frame kind
+ * @param arg frame argument
+ * @param mutation change to carry as a log record, or nullptr
+ */
+void encode_repl_frame(std::string& out, ReplFrame kind, uint64_t arg, const Mutation* mutation);
+
+/**
+ * @brief Write all of a buffer to a blocking socket (without raising SIGPIPE).
+ *
+ * @return false if the peer went away
+ */
+bool repl_send(int fd, const std::string& buf);
+
+#endif
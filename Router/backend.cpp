@@ -0,0 +1,335 @@
+#include <unistd.h>
+#include <chrono>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "backend.h"
+
+/**
+ * @brief give up on a backend that makes no progress for this long
+ */
+#define BACKEND_TIMEOUT_MS 5000
+
+/**
+ * @brief after a failure, steer reads away from a backend for this long
+ */
+#define BACKEND_RETRY_MS 1000
+
+/**
+ * @brief idle connections kept per backend
+ */
+#define BACKEND_MAX_IDLE 32
+
+/**
+ * @brief bytes received per recv()
+ */
+#define BACKEND_RECV_CHUNK 64 * 1024
+
+Backend::Backend(const std::string& host, int port) : host(host), port(port), addr(host + ":" + std::to_string(port)) {}
+
+Backend::~Backend() {
+    for (int fd : idle) {
+        close(fd);
+    }
+}
+
+const std::string& Backend::name() const {
+    return addr;
+}
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool Backend::available() const {
+    return now_ms() >= down_until_ms.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Read from a connection until @p token has arrived (text handshake).
+ */
+static bool read_until(int fd, const char* token) {
+    std::string buf;
+    char chunk[256];
+    while (buf.find(token) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(chunk, n);
+    }
+    return true;
+}
+
+int Backend::open_connection() {
+
+    // resolve and connect
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // bound blocking reads during the handshake; disable Nagle for small frames
+    struct timeval tv;
+    tv.tv_sec = BACKEND_TIMEOUT_MS / 1000;
+    tv.tv_usec = (BACKEND_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    // skip the prompt and switch to binary framing
+    if (!read_until(fd, "% ") || send(fd, "BINARY\r\n", 8, MSG_NOSIGNAL) != 8 || !read_until(fd, "BINARY\n")) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int Backend::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(pool_mtx);
+        if (!idle.empty()) {
+            int fd = idle.back();
+            idle.pop_back();
+            return fd;
+        }
+    }
+    return open_connection();
+}
+
+void Backend::release(int fd) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mtx);
+        if (idle.size() < BACKEND_MAX_IDLE) {
+            idle.push_back(fd);
+            return;
+        }
+    }
+    close(fd);
+}
+
+/**
+ * @brief One backend's batch in flight: its connection, the encoded requests
+ *        and how much of them is sent, and the answers received so far
+ */
+struct Backend::Exchange {
+    Backend* backend = nullptr;
+    std::vector<BackendCall*>* calls = nullptr;
+    int fd = -1;
+    std::string out;
+    size_t sent = 0;
+    std::string in;
+    size_t answered = 0;
+
+    /**
+     * @brief steady-clock time (ms) the connection last made progress
+     */
+    int64_t progress_ms = 0;
+
+    /**
+     * @brief finished, and whether every answer arrived
+     */
+    bool done = false;
+    bool ok = false;
+};
+
+bool Backend::call(std::vector<BackendCall*>& calls) {
+    std::vector<std::pair<Backend*, std::vector<BackendCall*>>> groups{{this, calls}};
+    std::vector<Backend*> failed;
+    call_many(groups, failed);
+    return failed.empty();
+}
+
+void Backend::call_many(std::vector<std::pair<Backend*, std::vector<BackendCall*>>>& groups, std::vector<Backend*>& failed) {
+
+    // take a connection and send to every backend before waiting on any
+    std::vector<Exchange> exchanges(groups.size());
+    for (size_t i = 0; i < groups.size(); i++) {
+        Exchange& ex = exchanges[i];
+        ex.backend = groups[i].first;
+        ex.calls = &groups[i].second;
+        if (ex.calls->empty()) {
+            ex.done = ex.ok = true;
+        } else if (!ex.backend->start(ex)) {
+            ex.backend->finish(ex, false);
+        }
+    }
+
+    // send and receive on all of them at once, so neither side's buffers can
+    // fill up and stall the other; a connection making no progress for
+    // BACKEND_TIMEOUT_MS is given up on
+    std::vector<char> chunk(BACKEND_RECV_CHUNK);
+    std::vector<struct pollfd> pfds;
+    std::vector<Exchange*> polled;
+    while (true) {
+        pfds.clear();
+        polled.clear();
+        int64_t now = now_ms();
+        int64_t timeout = BACKEND_TIMEOUT_MS;
+        for (Exchange& ex : exchanges) {
+            if (ex.done) {
+                continue;
+            }
+            if (now - ex.progress_ms >= BACKEND_TIMEOUT_MS) {
+                ex.backend->finish(ex, false);
+                continue;
+            }
+            struct pollfd pfd;
+            pfd.fd = ex.fd;
+            pfd.events = POLLIN | (ex.sent < ex.out.size() ? POLLOUT : 0);
+            pfd.revents = 0;
+            pfds.push_back(pfd);
+            polled.push_back(&ex);
+            timeout = std::min(timeout, ex.progress_ms + BACKEND_TIMEOUT_MS - now);
+        }
+        if (pfds.empty()) {
+            break;
+        }
+        int ready = poll(pfds.data(), pfds.size(), (int) timeout);
+        if (ready < 0 && errno != EINTR) {
+            for (Exchange* ex : polled) {
+                ex->backend->finish(*ex, false);
+            }
+            break;
+        }
+        for (size_t i = 0; ready > 0 && i < pfds.size(); i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            Exchange& ex = *polled[i];
+            if (!ex.backend->progress(ex, pfds[i].revents, chunk)) {
+                ex.backend->finish(ex, false);
+            } else if (ex.answered == ex.calls->size()) {
+                ex.backend->finish(ex, true);
+            }
+        }
+    }
+    for (const Exchange& ex : exchanges) {
+        if (!ex.ok) {
+            failed.push_back(ex.backend);
+        }
+    }
+}
+
+bool Backend::start(Exchange& ex) {
+
+    // forward on a pooled connection
+    inflight += ex.calls->size();
+    ex.fd = acquire();
+    if (ex.fd < 0) {
+        return false;
+    }
+
+    // encode every request, numbered by batch position
+    for (size_t i = 0; i < ex.calls->size(); i++) {
+        const BackendCall& call = *(*ex.calls)[i];
+        BinHeader req;
+        req.magic = BIN_REQ_MAGIC;
+        req.opcode = call.opcode;
+        req.row_len = call.row.size();
+        req.col_len = call.col.size();
+        req.flags = 0;
+        req.value_len = call.value ? call.value->size() : 0;
+        req.request_id = i;
+        encode_bin_header(ex.out, req);
+        ex.out += call.row;
+        ex.out += call.col;
+        if (call.value) {
+            ex.out.append(call.value->data(), call.value->size());
+        }
+    }
+    ex.progress_ms = now_ms();
+    return true;
+}
+
+bool Backend::progress(Exchange& ex, short revents, std::vector<char>& chunk) {
+    if (revents & (POLLERR | POLLNVAL)) {
+        return false;
+    }
+
+    // write what the socket takes
+    if (revents & POLLOUT) {
+        ssize_t n = send(ex.fd, ex.out.data() + ex.sent, ex.out.size() - ex.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return false;
+        }
+        if (n > 0) {
+            ex.sent += n;
+            ex.progress_ms = now_ms();
+        }
+    }
+
+    // read what has arrived
+    if (revents & (POLLIN | POLLHUP)) {
+        ssize_t n = recv(ex.fd, chunk.data(), chunk.size(), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        }
+        if (n > 0) {
+            ex.in.append(chunk.data(), n);
+            ex.progress_ms = now_ms();
+        }
+    }
+
+    // match whole response frames to their requests
+    size_t pos = 0;
+    while (ex.in.size() - pos >= BIN_HEADER_SIZE) {
+        BinHeader rsp;
+        decode_bin_header(ex.in.data() + pos, rsp);
+        if (rsp.magic != BIN_RSP_MAGIC || rsp.request_id >= ex.calls->size()) {
+            return false;
+        }
+        if (ex.in.size() - pos - BIN_HEADER_SIZE < rsp.value_len) {
+            break;
+        }
+        BackendCall& call = *(*ex.calls)[rsp.request_id];
+        const char* body = ex.in.data() + pos + BIN_HEADER_SIZE;
+        call.status = (BinStatus) rsp.row_len;
+        if (rsp.value_len > 0) {
+            call.result = make_value(std::vector<char>(body, body + rsp.value_len));
+        }
+        call.answered = true;
+        ex.answered++;
+        served++;
+        pos += BIN_HEADER_SIZE + rsp.value_len;
+    }
+    ex.in.erase(0, pos);
+    return true;
+}
+
+void Backend::finish(Exchange& ex, bool ok) {
+
+    // keep a connection that answered everything, discard one that went wrong
+    if (ok) {
+        release(ex.fd);
+    } else {
+        if (ex.fd >= 0) {
+            close(ex.fd);
+        }
+        down_until_ms = now_ms() + BACKEND_RETRY_MS;
+    }
+    inflight -= ex.calls->size();
+    ex.done = true;
+    ex.ok = ok;
+}
@@ -0,0 +1,149 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include "../Tablet/value.h"
+#include "../Net/binproto.h"
+
+/**
+ * @brief One request forwarded to a backend server, and its answer.
+ */
+struct BackendCall {
+    BinOpcode opcode;
+    std::string row;
+    std::string col;
+
+    /**
+     * @brief value to PUT
+     */
+    ValueRef value;
+
+    /**
+     * @brief set once the backend has answered: its status and (for GET) value
+     */
+    bool answered = false;
+    BinStatus status = BIN_FAILURE;
+    ValueRef result;
+};
+
+/**
+ * @class Backend
+ * @brief A server instance reached over pooled, persistent binary-protocol connections.
+ *
+ * Each call() takes an idle connection from the pool (or opens one),
+ * pipelines a batch of requests on it, and returns it to the pool once every
+ * answer has arrived; call_many() does the same for several backends at
+ * once, waiting on all of their connections together.  A connection that
+ * fails or times out is closed rather than reused.  inflight counts requests sent but not yet answered, so the
+ * router can send reads to the least busy replica.
+ */
+class Backend {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Describe a backend; connections are opened on demand.
+         *
+         * @param host  Server host name or address.
+         * @param port  Server client port.
+         */
+        Backend(const std::string& host, int port);
+
+        /**
+         * @brief Close pooled connections.
+         */
+        ~Backend();
+
+        /**
+         * @brief Send a batch of requests and wait for all of their answers.
+         *
+         * @param calls  Requests to send; answered ones are filled in.
+         * @return false if the backend could not be reached or failed mid-batch
+         *         (calls without answered set were not answered)
+         */
+        bool call(std::vector<BackendCall*>& calls);
+
+        /**
+         * @brief Send a batch to each of several backends, then wait for every
+         *        answer with one poll over all of their connections, so the
+         *        round trips overlap rather than add up.
+         *
+         * @param groups  Backends and the requests for each; answered ones are filled in.
+         * @param failed  Receives each backend that could not be reached or failed mid-batch.
+         */
+        static void call_many(std::vector<std::pair<Backend*, std::vector<BackendCall*>>>& groups, std::vector<Backend*>& failed);
+
+        /**
+         * @brief "host:port"
+         */
+        const std::string& name() const;
+
+        /**
+         * @brief false for a while after a failed call, so reads prefer other members
+         */
+        bool available() const;
+
+    /* public fields */
+    public:
+        /**
+         * @brief requests sent and not yet answered, and requests answered in total
+         */
+        std::atomic<int> inflight{0};
+        std::atomic<uint64_t> served{0};
+
+        /**
+         * @brief steady-clock time (ms) before which the backend counts as down
+         */
+        std::atomic<int64_t> down_until_ms{0};
+
+    /* private types */
+    private:
+        /**
+         * @brief One backend's batch in flight (defined in backend.cpp)
+         */
+        struct Exchange;
+
+    /* private methods */
+    private:
+        int open_connection();
+        int acquire();
+        void release(int fd);
+
+        /**
+         * @brief Take a connection and encode the batch.
+         *
+         * @return false if the backend could not be reached
+         */
+        bool start(Exchange& ex);
+
+        /**
+         * @brief Send what the socket takes and match the answers that have arrived.
+         *
+         * @return false if the connection failed or answered garbage
+         */
+        bool progress(Exchange& ex, short revents, std::vector<char>& chunk);
+
+        /**
+         * @brief Return the connection to the pool, or close it and mark the backend down.
+         */
+        void finish(Exchange& ex, bool ok);
+
+    /* private fields */
+    private:
+        std::string host;
+        int port;
+        std::string addr;
+
+        /**
+         * @brief idle connections, guarded by pool_mtx
+         */
+        std::mutex pool_mtx;
+        std::vector<int> idle;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "ring.h"
+
+HashRing::HashRing(size_t vnodes) : vnodes(vnodes) {}
+
+uint64_t HashRing::hash(const char* data, size_t len) {
+
+    // FNV-1a over the bytes
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 0x100000001b3ull;
+    }
+
+    // finalize (murmur3 fmix64) so similar keys spread across the ring
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+void HashRing::add(size_t partition, const std::string& name) {
+    for (size_t i = 0; i < vnodes; i++) {
+        std::string point = name + "#" + std::to_string(i);
+        points[hash(point.data(), point.size())] = partition;
+    }
+}
+
+size_t HashRing::lookup(const std::string& row_key) const {
+
+    // first point clockwise from the key, wrapping past the top
+    auto it = points.lower_bound(hash(row_key.data(), row_key.size()));
+    if (it == points.end()) {
+        it = points.begin();
+    }
+    return it->second;
+}
@@ -0,0 +1,63 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+
+/**
+ * @brief points each partition places on the ring by default
+ */
+#define RING_DEFAULT_VNODES 128
+
+/**
+ * @class HashRing
+ * @brief Consistent-hash ring mapping row keys to partitions.
+ *
+ * Each partition is placed at several pseudo-random points ("virtual
+ * nodes") derived from its name; a row belongs to the first point at or
+ * after its hash.  Adding or removing a partition only moves the rows
+ * between its points and their predecessors.  The hash is fixed (not
+ * std::hash), so every router with the same partitions routes identically.
+ */
+class HashRing {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct an empty ring.
+         *
+         * @param vnodes  Points placed per partition.
+         */
+        explicit HashRing(size_t vnodes = RING_DEFAULT_VNODES);
+
+        /**
+         * @brief Place a partition on the ring.
+         *
+         * @param partition  Index returned by lookup() for its rows.
+         * @param name       Stable identity of the partition (e.g. its primary's address).
+         */
+        void add(size_t partition, const std::string& name);
+
+        /**
+         * @brief Partition owning a row; the ring must not be empty.
+         */
+        size_t lookup(const std::string& row_key) const;
+
+        /**
+         * @brief 64-bit FNV-1a with a final avalanche, stable across processes.
+         */
+        static uint64_t hash(const char* data, size_t len);
+
+    /* private fields */
+    private:
+        size_t vnodes;
+
+        /**
+         * @brief ring point → partition
+         */
+        std::map<uint64_t, size_t> points;
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+#include <queue>
+#include <algorithm>
+#include "snapshot.h"
+#include "../Util/crc32.h"
+#include "../Util/coding.h"
+#include "../Util/iotool.h"
+
+/**
+ * @brief file magic, and sizes of the fixed parts of the format
+ */
+#define SNAPSHOT_MAGIC "DBSNAP01"
+#define SNAPSHOT_HEADER 40
+#define SNAPSHOT_INDEX_ENTRY 28
+#define SNAPSHOT_CELL_FIXED 29
+
+/**
+ * @brief cell flag marking a value stored as a compressed block
+ */
+#define SNAPSHOT_CELL_COMPRESSED 0x01
+
+/**
+ * @brief flush the write buffer once it holds this many bytes
+ */
+#define SNAPSHOT_WRITE_BUF 1024 * 1024
+
+/**
+ * @brief Order cells by (row, col).
+ */
+static bool cell_less(const CellEntry& a, const CellEntry& b) {
+    int c = a.row.compare(b.row);
+    return c < 0 || (c == 0 && a.col < b.col);
+}
+
+/**
+ * @brief fsync the directory holding @p path so a rename into it is durable
+ */
+static void sync_parent_dir(const std::string& path) {
+    std::string copy = path;
+    int dir_fd = open(dirname(&copy[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+bool write_snapshot(const std::string& path, Tablet& tab, uint64_t& seq, uint64_t& cells) {
+
+    // copy each shard, already sorted, as of one sequence number: writes
+    // carry on while the copy is taken, and are left for the log to replay
+    seq = tab.open_view();
+    std::vector<std::vector<CellEntry>> runs(tab.num_shards());
+    for (size_t i = 0; i < runs.size(); i++) {
+        tab.collect_shard(i, runs[i], seq);
+    }
+    tab.close_view(seq);
+
+    // open temporary file
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // placeholder header, rewritten once counts are known
+    std::string buf(SNAPSHOT_HEADER, '\0');
+    uint64_t offset = 0;
+    std::string index;
+    uint64_t num_blocks = 0;
+    bool ok = true;
+
+    // current block
+    uint64_t block_start = SNAPSHOT_HEADER;
+    uint64_t block_cells = 0;
+    uint32_t block_crc = 0;
+    auto close_block = [&](uint64_t end) {
+        put_u64(index, block_start);
+        put_u64(index, end - block_start);
+        put_u64(index, block_cells);
+        put_u32(index, block_crc);
+        num_blocks++;
+        block_start = end;
+        block_cells = 0;
+        block_crc = 0;
+    };
+
+    // k-way merge of the sorted shard runs
+    using Cursor = std::pair<size_t, size_t>;
+    auto greater = [&](const Cursor& a, const Cursor& b) {
+        return cell_less(runs[b.first][b.second], runs[a.first][a.second]);
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(greater);
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (!runs[i].empty()) {
+            heap.emplace(i, 0);
+        }
+    }
+    cells = 0;
+    while (!heap.empty() && ok) {
+        Cursor top = heap.top();
+        heap.pop();
+        CellEntry& cell = runs[top.first][top.second];
+
+        // a value moved to disk is read back only now, one at a time
+        if (!tab.load_value(cell)) {
+            ok = false;
+            break;
+        }
+
+        // encode cell into the buffer and the running block checksum
+        size_t cell_start = buf.size();
+        put_u32(buf, cell.row.size());
+        put_u32(buf, cell.col.size());
+        put_u32(buf, cell.value->size());
+        put_u64(buf, cell.expires_ms);
+        buf.push_back((char) (cell.compressed ? SNAPSHOT_CELL_COMPRESSED : 0));
+        put_u64(buf, cell.version);
+        buf += cell.row;
+        buf += cell.col;
+        buf.append(cell.value->data(), cell.value->size());
+        block_crc = crc32(buf.data() + cell_start, buf.size() - cell_start, block_crc);
+        block_cells++;
+        cells++;
+
+        // release the cell early; the value handle may be its last reference
+        cell = CellEntry();
+        if (top.second + 1 < runs[top.first].size()) {
+            heap.emplace(top.first, top.second + 1);
+        }
+
+        // cut blocks and flush the buffer as they fill
+        if (block_cells == SNAPSHOT_BLOCK_CELLS) {
+            close_block(offset + buf.size());
+        }
+        if (buf.size() >= SNAPSHOT_WRITE_BUF) {
+            ok = do_write(fd, buf.data(), buf.size()) == (ssize_t) buf.size();
+            offset += buf.size();
+            buf.clear();
+        }
+    }
+    if (block_cells > 0) {
+        close_block(offset + buf.size());
+    }
+    uint64_t index_offset = offset + buf.size();
+
+    // header, index, and trailer checksum over both
+    std::string header(SNAPSHOT_MAGIC, 8);
+    put_u64(header, seq);
+    put_u64(header, cells);
+    put_u64(header, num_blocks);
+    put_u64(header, index_offset);
+    buf += index;
+    put_u32(buf, crc32(index.data(), index.size(), crc32(header.data(), header.size())));
+    ok = ok && do_write(fd, buf.data(), buf.size()) == (ssize_t) buf.size();
+    ok = ok && pwrite(fd, header.data(), header.size(), 0) == (ssize_t) header.size();
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+
+    // publish atomically
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) < 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    sync_parent_dir(path);
+    return true;
+}
+
+/**
+ * @brief Verify and load one block of a mapped snapshot.
+ */
+static bool load_block(const char* base, size_t file_size, const char* entry, Tablet& tab, uint64_t& loaded) {
+
+    // locate block and check it lies inside the file
+    uint64_t offset = get_u64(entry);
+    uint64_t length = get_u64(entry + 8);
+    uint64_t count = get_u64(entry + 16);
+    if (offset < SNAPSHOT_HEADER || offset > file_size || length > file_size - offset) {
+        return false;
+    }
+    const char* p = base + offset;
+    const char* end = p + length;
+    if (crc32(p, length) != get_u32(entry + 24)) {
+        return false;
+    }
+
+    // decode cells
+    for (uint64_t i = 0; i < count; i++) {
+        if ((size_t) (end - p) < SNAPSHOT_CELL_FIXED) {
+            return false;
+        }
+        uint64_t row_len = get_u32(p);
+        uint64_t col_len = get_u32(p + 4);
+        uint64_t value_len = get_u32(p + 8);
+        uint64_t expires_ms = get_u64(p + 12);
+        bool compressed = p[20] & SNAPSHOT_CELL_COMPRESSED;
+        uint64_t version = get_u64(p + 21);
+        p += SNAPSHOT_CELL_FIXED;
+        if ((uint64_t) (end - p) < row_len + col_len + value_len) {
+            return false;
+        }
+        std::string row(p, row_len);
+        std::string col(p + row_len, col_len);
+        p += row_len + col_len;
+        tab.restore(row, col, make_value(std::vector<char>(p, p + value_len)), expires_ms, compressed, version);
+        p += value_len;
+    }
+    loaded += count;
+    return p == end;
+}
+
+bool load_snapshot(const std::string& path, Tablet& tab, size_t num_threads, uint64_t& seq, uint64_t& cells) {
+    seq = 0;
+    cells = 0;
+
+    // a missing snapshot is an empty one
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < SNAPSHOT_HEADER + 4) {
+        close(fd);
+        return false;
+    }
+    size_t file_size = st.st_size;
+
+    // map the whole file; blocks are read once, in parallel
+    void* mapped = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapped, file_size, MADV_WILLNEED);
+    const char* base = (const char*) mapped;
+
+    // validate header, index, and trailer
+    uint64_t num_blocks = get_u64(base + 24);
+    uint64_t index_offset = get_u64(base + 32);
+    bool ok = memcmp(base, SNAPSHOT_MAGIC, 8) == 0
+        && index_offset <= file_size
+        && num_blocks <= (file_size - index_offset) / SNAPSHOT_INDEX_ENTRY
+        && index_offset + num_blocks * SNAPSHOT_INDEX_ENTRY + 4 == file_size;
+    if (ok) {
+        const char* index = base + index_offset;
+        size_t index_len = num_blocks * SNAPSHOT_INDEX_ENTRY;
+        ok = crc32(index, index_len, crc32(base, SNAPSHOT_HEADER)) == get_u32(index + index_len);
+    }
+    if (!ok) {
+        munmap(mapped, file_size);
+        return false;
+    }
+
+    // load blocks on a pool of threads, each claiming the next unclaimed block
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min<size_t>(num_threads, std::max<uint64_t>(num_blocks, 1));
+    std::atomic<uint64_t> next_block{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> loaders;
+    for (size_t t = 0; t < num_threads; t++) {
+        loaders.emplace_back([&] {
+            uint64_t loaded = 0;
+            uint64_t b;
+            while (!failed.load(std::memory_order_relaxed) && (b = next_block.fetch_add(1)) < num_blocks) {
+                const char* entry = base + index_offset + b * SNAPSHOT_INDEX_ENTRY;
+                if (!load_block(base, file_size, entry, tab, loaded)) {
+                    failed = true;
+                }
+            }
+            total += loaded;
+        });
+    }
+    for (auto& loader : loaders) {
+        loader.join();
+    }
+    seq = get_u64(base + 8);
+    munmap(mapped, file_size);
+    if (failed) {
+        seq = 0;
+        return false;
+    }
+
+    // later changes are numbered after the snapshot
+    cells = total;
+    tab.advance_seq(seq);
+    return true;
+}
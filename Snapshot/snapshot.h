@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <string>
+#include "../Tablet/tablet.h"
+
+/**
+ * Snapshot file layout (integers little-endian):
+ *
+ *   header  "DBSNAP01" | u64 seq | u64 cell count | u64 block count | u64 index offset
+ *   blocks  cells sorted by (row, col), each
+ *           [u32 row len][u32 col len][u32 value len][u64 deadline ms, 0 for none]
+ *           [u8 flags, bit 0 = value is a compressed block][u64 version][row][col][value],
+ *           at most SNAPSHOT_BLOCK_CELLS per block
+ *   index   per block: u64 offset | u64 byte length | u64 cell count | u32 crc32 of block
+ *   trailer u32 crc32 of header + index
+ *
+ * Blocks are independently checksummed so that a memory-mapped snapshot can
+ * be verified and loaded by several threads at once.
+ */
+
+/**
+ * @brief cells per snapshot block
+ */
+#define SNAPSHOT_BLOCK_CELLS 4096
+
+/**
+ * @brief Write a point-in-time snapshot of a tablet.
+ *
+ * The copy is read through a view (Tablet::open_view()), so it is exact as
+ * of the returned sequence number: it holds every change up to it and none
+ * after.  Each shard is copied a page (TABLET_COLLECT_BATCH cells) at a time
+ * under its shared lock, and values are shared, so only keys are copied and
+ * writers are never blocked for more than one page.  Replaying the log after
+ * that sequence number on top of the snapshot reproduces the live state.
+ * The file is written to a temporary name, synced, and renamed into place.
+ *
+ * @param path  Destination file.
+ * @param tab   Tablet to snapshot.
+ * @param seq   Sequence number the snapshot is complete through.
+ * @param cells Number of cells written.
+ * @return false on I/O error (the previous snapshot, if any, is untouched)
+ */
+bool write_snapshot(const std::string& path, Tablet& tab, uint64_t& seq, uint64_t& cells);
+
+/**
+ * @brief Memory-map a snapshot and load it into a tablet with several threads.
+ *
+ * @param path         Snapshot file; a missing file is an empty snapshot.
+ * @param tab          Tablet to load into (should be empty, with no listeners).
+ * @param num_threads  Loader threads, 0 for one per core.
+ * @param seq          Sequence number the snapshot is complete through (0 if missing).
+ * @param cells        Number of cells loaded.
+ * @return false if the file is unreadable or fails its checksums
+ */
+bool load_snapshot(const std::string& path, Tablet& tab, size_t num_threads, uint64_t& seq, uint64_t& cells);
+
+#endif
@@ -0,0 +1,317 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <thread>
+#include "stats.h"
+#include "../Util/iotool.h"
+
+/**
+ * @brief how long a scraper may take to send its request
+ */
+#define METRICS_REQUEST_TIMEOUT_SEC 2
+
+/**
+ * @brief largest scrape request read before answering
+ */
+#define METRICS_MAX_REQUEST 8192
+
+/**
+ * @brief latency percentiles reported for each command
+ */
+static const double PERCENTILES[] = {50, 90, 99, 99.9};
+static const char* const PERCENTILE_NAMES[] = {"p50", "p90", "p99", "p999"};
+static const char* const QUANTILE_NAMES[] = {"0.5", "0.9", "0.99", "0.999"};
+
+const char* const STAT_COMMAND_NAMES[NUM_STAT_COMMANDS] = {
+    "get", "put", "del", "mget", "mput", "mdel", "getrow", "scan", "pscan", "snapshot", "repl", "stats", "putex", "expire", "ttl", "getv", "cas", "append", "incrby", "putl", "getl", "find", "other"
+};
+
+/**
+ * @brief A method word of up to 8 bytes packed into an integer, so that methods
+ *        can be told apart by one switch (longer words pack to 0, like no method)
+ */
+static constexpr uint64_t method_code(std::string_view method) {
+    uint64_t code = 0;
+    for (size_t i = 0; i < method.size() && method.size() <= 8; i++) {
+        code = code << 8 | (unsigned char) method[i];
+    }
+    return code;
+}
+
+StatCommand classify_command(std::string_view method) {
+    static const char* const METHODS[NUM_STAT_COMMANDS - 1] = {
+        "GET", "PUT", "DEL", "MGET", "MPUT", "MDEL", "GETROW", "SCAN", "PSCAN", "SNAPSHOT", "REPL", "STATS", "PUTEX", "EXPIRE", "TTL", "GETV", "CAS", "APPEND", "INCRBY", "PUTL", "GETL", "FIND"
+    };
+
+    // the packed word picks the only method it can be; a word holding NUL
+    // bytes can pack like a shorter one, so the pick is confirmed
+    StatCommand kind;
+    switch (method_code(method)) {
+        case method_code("GET"): kind = STAT_GET; break;
+        case method_code("PUT"): kind = STAT_PUT; break;
+        case method_code("DEL"): kind = STAT_DEL; break;
+        case method_code("MGET"): kind = STAT_MGET; break;
+        case method_code("MPUT"): kind = STAT_MPUT; break;
+        case method_code("MDEL"): kind = STAT_MDEL; break;
+        case method_code("GETROW"): kind = STAT_GETROW; break;
+        case method_code("SCAN"): kind = STAT_SCAN; break;
+        case method_code("PSCAN"): kind = STAT_PSCAN; break;
+        case method_code("SNAPSHOT"): kind = STAT_SNAPSHOT; break;
+        case method_code("REPL"): kind = STAT_REPL; break;
+        case method_code("STATS"): kind = STAT_STATS; break;
+        case method_code("PUTEX"): kind = STAT_PUTEX; break;
+        case method_code("EXPIRE"): kind = STAT_EXPIRE; break;
+        case method_code("TTL"): kind = STAT_TTL; break;
+        case method_code("GETV"): kind = STAT_GETV; break;
+        case method_code("CAS"): kind = STAT_CAS; break;
+        case method_code("APPEND"): kind = STAT_APPEND; break;
+        case method_code("INCRBY"): kind = STAT_INCRBY; break;
+        case method_code("PUTL"): kind = STAT_PUTL; break;
+        case method_code("GETL"): kind = STAT_GETL; break;
+        case method_code("FIND"): kind = STAT_FIND; break;
+        default: return STAT_OTHER;
+    }
+    return method == METHODS[kind] ? kind : STAT_OTHER;
+}
+
+size_t CommandStats::bucket_of(uint64_t value) {
+
+    // small values are their own bucket
+    if (value < 2 * STATS_SUB) {
+        return value;
+    }
+
+    // otherwise keep the top SUB_BITS+1 significant bits
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB + ((value >> shift) - STATS_SUB);
+}
+
+uint64_t CommandStats::bucket_top(size_t bucket) {
+    if (bucket < 2 * STATS_SUB) {
+        return bucket;
+    }
+    int shift = bucket / STATS_SUB - 1;
+    uint64_t top = bucket % STATS_SUB + STATS_SUB;
+    return ((top + 1) << shift) - 1;
+}
+
+uint64_t CommandTotals::percentile_ns(double percentile) const {
+    if (calls == 0) {
+        return 0;
+    }
+
+    // walk buckets until the rank is reached
+    uint64_t rank = (uint64_t) ceil(percentile / 100.0 * calls);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen >= rank) {
+            return CommandStats::bucket_top(i);
+        }
+    }
+    return CommandStats::bucket_top(STATS_LATENCY_BUCKETS - 1);
+}
+
+CommandStats::ThreadBlock& CommandStats::local() {
+
+    // cache this thread's block for the stats object it was registered with
+    static thread_local CommandStats* owner = nullptr;
+    static thread_local ThreadBlock* block = nullptr;
+    if (owner == this) {
+        return *block;
+    }
+
+    // first record on this thread: register a new block
+    std::unique_ptr<ThreadBlock> created(new ThreadBlock());
+    block = created.get();
+    owner = this;
+    std::lock_guard<std::mutex> guard(blocks_mtx);
+    blocks.push_back(std::move(created));
+    return *block;
+}
+
+/**
+ * @brief Add to a counter only the calling thread writes (no locked instruction needed).
+ */
+static inline void bump(uint64_t& counter, uint64_t n) {
+    __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Read a counter another thread may be bumping.
+ */
+static inline uint64_t peek(const uint64_t& counter) {
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+void CommandStats::record(StatCommand command, uint64_t latency_ns, bool failed) {
+    ThreadBlock& block = local();
+    bump(block.calls[command], 1);
+    bump(block.latency_sum_ns[command], latency_ns);
+    bump(block.latency[command][bucket_of(latency_ns)], 1);
+    if (failed) {
+        bump(block.failures[command], 1);
+    }
+}
+
+std::vector<CommandTotals> CommandStats::collect() {
+    std::vector<CommandTotals> totals(NUM_STAT_COMMANDS);
+    std::lock_guard<std::mutex> guard(blocks_mtx);
+    for (const auto& block : blocks) {
+        for (int i = 0; i < NUM_STAT_COMMANDS; i++) {
+            CommandTotals& total = totals[i];
+            total.calls += peek(block->calls[i]);
+            total.failures += peek(block->failures[i]);
+            total.latency_sum_ns += peek(block->latency_sum_ns[i]);
+            for (size_t j = 0; j < STATS_LATENCY_BUCKETS; j++) {
+                total.latency[j] += peek(block->latency[i][j]);
+            }
+        }
+    }
+    return totals;
+}
+
+std::vector<std::string> format_stats_lines(const std::vector<StatValue>& values, const std::vector<CommandTotals>& commands) {
+    std::vector<std::string> lines;
+    char line[256];
+    for (const StatValue& value : values) {
+        snprintf(line, sizeof(line), "%s %llu", value.name, (unsigned long long) value.value);
+        lines.push_back(line);
+    }
+
+    // commands that were never called are left out
+    for (int i = 0; i < NUM_STAT_COMMANDS; i++) {
+        const CommandTotals& total = commands[i];
+        if (total.calls == 0) {
+            continue;
+        }
+        const char* name = STAT_COMMAND_NAMES[i];
+        snprintf(line, sizeof(line), "cmd_%s_calls %llu", name, (unsigned long long) total.calls);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "cmd_%s_failures %llu", name, (unsigned long long) total.failures);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "cmd_%s_mean_us %.1f", name, total.latency_sum_ns / 1e3 / total.calls);
+        lines.push_back(line);
+        for (size_t p = 0; p < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); p++) {
+            snprintf(line, sizeof(line), "cmd_%s_%s_us %.1f", name, PERCENTILE_NAMES[p], total.percentile_ns(PERCENTILES[p]) / 1e3);
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+std::string format_prometheus(const std::vector<StatValue>& values, const std::vector<CommandTotals>& commands) {
+    std::string out;
+    char line[256];
+    for (const StatValue& value : values) {
+        const char* suffix = value.counter ? "_total" : "";
+        snprintf(line, sizeof(line), "# HELP databass_%s%s %s\n# TYPE databass_%s%s %s\ndatabass_%s%s %llu\n",
+                 value.name, suffix, value.help, value.name, suffix, value.counter ? "counter" : "gauge",
+                 value.name, suffix, (unsigned long long) value.value);
+        out += line;
+    }
+
+    // per-command counters
+    out += "# HELP databass_commands_total Commands executed.\n# TYPE databass_commands_total counter\n";
+    for (int i = 0; i < NUM_STAT_COMMANDS; i++) {
+        snprintf(line, sizeof(line), "databass_commands_total{command=\"%s\"} %llu\n", STAT_COMMAND_NAMES[i],
+                 (unsigned long long) commands[i].calls);
+        out += line;
+    }
+    out += "# HELP databass_command_failures_total Commands answered with a failure status.\n"
+           "# TYPE databass_command_failures_total counter\n";
+    for (int i = 0; i < NUM_STAT_COMMANDS; i++) {
+        snprintf(line, sizeof(line), "databass_command_failures_total{command=\"%s\"} %llu\n", STAT_COMMAND_NAMES[i],
+                 (unsigned long long) commands[i].failures);
+        out += line;
+    }
+
+    // per-command latency as a summary
+    out += "# HELP databass_command_latency_seconds Time to execute a command and queue its response.\n"
+           "# TYPE databass_command_latency_seconds summary\n";
+    for (int i = 0; i < NUM_STAT_COMMANDS; i++) {
+        const CommandTotals& total = commands[i];
+        for (size_t p = 0; p < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); p++) {
+            snprintf(line, sizeof(line), "databass_command_latency_seconds{command=\"%s\",quantile=\"%s\"} %.9f\n",
+                     STAT_COMMAND_NAMES[i], QUANTILE_NAMES[p], total.percentile_ns(PERCENTILES[p]) / 1e9);
+            out += line;
+        }
+        snprintf(line, sizeof(line), "databass_command_latency_seconds_sum{command=\"%s\"} %.9f\n"
+                 "databass_command_latency_seconds_count{command=\"%s\"} %llu\n",
+                 STAT_COMMAND_NAMES[i], total.latency_sum_ns / 1e9, STAT_COMMAND_NAMES[i], (unsigned long long) total.calls);
+        out += line;
+    }
+    return out;
+}
+
+/**
+ * @brief Answer scrapers one at a time: read the request, write the current metrics, close.
+ */
+static void metrics_loop(int listen_fd, std::function<std::string()> format) {
+    while (true) {
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Metrics port failed (%s)\n", strerror(errno));
+            return;
+        }
+
+        // read the request head (its contents do not matter), giving up on a silent client
+        struct timeval timeout = {METRICS_REQUEST_TIMEOUT_SEC, 0};
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char chunk[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_MAX_REQUEST) {
+            ssize_t n = read(client_fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            request.append(chunk, n);
+        }
+
+        // respond and close
+        std::string body = format();
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                               + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        do_write(client_fd, response.data(), response.size());
+        close(client_fd);
+    }
+}
+
+bool start_metrics_server(int port, std::function<std::string()> format) {
+
+    // bind metrics port
+    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return false;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        close(listen_fd);
+        return false;
+    }
+
+    // serve scrapes in the background
+    std::thread(metrics_loop, listen_fd, std::move(format)).detach();
+    return true;
+}
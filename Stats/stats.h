@@ -0,0 +1,147 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+
+/**
+ * @brief latency sub-buckets per power of two, as a power of two (2^3 = 8: within 12.5%)
+ */
+#define STATS_SUB_BITS 3
+#define STATS_SUB (1u << STATS_SUB_BITS)
+#define STATS_LATENCY_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB)
+
+/**
+ * @brief command kinds counted separately
+ */
+enum StatCommand {
+    STAT_GET, STAT_PUT, STAT_DEL, STAT_MGET, STAT_MPUT, STAT_MDEL,
+    STAT_GETROW, STAT_SCAN, STAT_PSCAN, STAT_SNAPSHOT, STAT_REPL, STAT_STATS,
+    STAT_PUTEX, STAT_EXPIRE, STAT_TTL, STAT_GETV, STAT_CAS, STAT_APPEND, STAT_INCRBY,
+    STAT_PUTL, STAT_GETL, STAT_FIND, STAT_OTHER, NUM_STAT_COMMANDS
+};
+
+/**
+ * @brief lowercase name of each StatCommand
+ */
+extern const char* const STAT_COMMAND_NAMES[NUM_STAT_COMMANDS];
+
+/**
+ * @brief Kind of a text command from its method word (everything else is STAT_OTHER).
+ */
+StatCommand classify_command(std::string_view method);
+
+/**
+ * @brief Totals for one command kind across all threads.
+ */
+struct CommandTotals {
+    uint64_t calls = 0;
+    uint64_t failures = 0;
+    uint64_t latency_sum_ns = 0;
+    uint64_t latency[STATS_LATENCY_BUCKETS] = {0};
+
+    /**
+     * @brief Smallest latency at or above which lies (100 - @p percentile)% of calls
+     *        (the upper edge of its bucket); 0 if there were none.
+     */
+    uint64_t percentile_ns(double percentile) const;
+};
+
+/**
+ * @class CommandStats
+ * @brief Per-thread command counters and latency histograms, summed on demand.
+ *
+ * Each recording thread gets its own cache-line-aligned block the first time
+ * it records, and only that thread writes it, so recording is a few relaxed
+ * loads and stores with no locked instructions and no sharing.  collect()
+ * reads every block without stopping the writers; a concurrent call may be
+ * counted in one field and not yet in another.  Blocks outlive their threads
+ * so totals never go backwards.
+ */
+class CommandStats {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Count one command.
+         *
+         * @param command     Kind of command.
+         * @param latency_ns  Time to execute it and queue its response.
+         * @param failed      Whether it was answered with a failure status.
+         */
+        void record(StatCommand command, uint64_t latency_ns, bool failed);
+
+        /**
+         * @brief Sum every thread's counters.
+         */
+        std::vector<CommandTotals> collect();
+
+        /**
+         * @brief Bucket a latency falls in, and the largest latency in a bucket.
+         */
+        static size_t bucket_of(uint64_t value);
+        static uint64_t bucket_top(size_t bucket);
+
+    /* private types */
+    private:
+        /**
+         * @brief One thread's counters, written by it alone and read by collect()
+         *        with relaxed atomic builtins (plain loads and stores on x86)
+         */
+        struct alignas(64) ThreadBlock {
+            uint64_t calls[NUM_STAT_COMMANDS] = {0};
+            uint64_t failures[NUM_STAT_COMMANDS] = {0};
+            uint64_t latency_sum_ns[NUM_STAT_COMMANDS] = {0};
+            uint64_t latency[NUM_STAT_COMMANDS][STATS_LATENCY_BUCKETS] = {{0}};
+        };
+
+    /* private methods */
+    private:
+        /**
+         * @brief The calling thread's block, registering it on first use.
+         */
+        ThreadBlock& local();
+
+    /* private fields */
+    private:
+        /**
+         * @brief every thread's block, guarded by blocks_mtx (taken only to register and collect)
+         */
+        std::mutex blocks_mtx;
+        std::vector<std::unique_ptr<ThreadBlock>> blocks;
+};
+
+/**
+ * @brief One named value reported alongside the command totals.
+ */
+struct StatValue {
+    const char* name;
+    const char* help;
+    bool counter;
+    uint64_t value;
+};
+
+/**
+ * @brief Format for the STATS command: "<name> <value>" lines, then per-command
+ *        calls, failures and latency percentiles for every command seen.
+ */
+std::vector<std::string> format_stats_lines(const std::vector<StatValue>& values, const std::vector<CommandTotals>& commands);
+
+/**
+ * @brief Format in the Prometheus text exposition format (version 0.0.4).
+ */
+std::string format_prometheus(const std::vector<StatValue>& values, const std::vector<CommandTotals>& commands);
+
+/**
+ * @brief Serve format() over HTTP on @p port to scrapers, one request per connection, in a background thread.
+ *
+ * @return false if the port cannot be bound
+ */
+bool start_metrics_server(int port, std::function<std::string()> format);
+
+#endif
@@ -0,0 +1,305 @@
+#include <string.h>
+#include <utility>
+#include "cellmap.h"
+
+/**
+ * @brief initial FlatCellMap capacity (power of two)
+ */
+#define FLAT_INITIAL_SLOTS 16
+
+/**
+ * @brief Heap bytes a std::string key holds beyond the object itself (0 when stored inline).
+ */
+static size_t key_heap_size(const std::string& key) {
+    return key.size() > 15 ? key.size() + 1 : 0;
+}
+
+bool parse_cell_engine(const std::string& name, CellEngine& engine) {
+    if (name == "nested") {
+        engine = CellEngine::NESTED;
+    } else if (name == "flat") {
+        engine = CellEngine::FLAT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<CellMap> make_cell_map(CellEngine engine) {
+    if (engine == CellEngine::FLAT) {
+        return std::unique_ptr<CellMap>(new FlatCellMap());
+    }
+    return std::unique_ptr<CellMap>(new NestedCellMap());
+}
+
+/* NestedCellMap */
+
+Cell* NestedCellMap::find(const std::string& row_key, const std::string& col_key) {
+
+    // look up row_key map, then column in row_key map
+    auto row_it = table.find(row_key);
+    if (row_it == table.end()) {
+        return nullptr;
+    }
+    auto col_it = row_it->second.find(col_key);
+    if (col_it == row_it->second.end()) {
+        return nullptr;
+    }
+    return &col_it->second;
+}
+
+Cell& NestedCellMap::insert(const std::string& row_key, const std::string& col_key) {
+
+    // lookup row_key, creating it if it does not exist
+    auto row_it = table.find(row_key);
+    if (row_it == table.end()) {
+        row_it = table.emplace(row_key, std::unordered_map<std::string, Cell>()).first;
+        key_heap_bytes += key_heap_size(row_key);
+    }
+
+    // find or create entry for col_key, tracking the row map's bucket growth
+    // (a new map's single bucket is not allocated, so it counts from 1)
+    size_t buckets_before = row_it->second.bucket_count();
+    auto inserted = row_it->second.try_emplace(col_key);
+    if (inserted.second) {
+        num_cells++;
+        key_heap_bytes += key_heap_size(col_key);
+        row_buckets += row_it->second.bucket_count() - buckets_before;
+    }
+    return inserted.first->second;
+}
+
+bool NestedCellMap::erase(const std::string& row_key, const std::string& col_key, Cell& removed) {
+
+    // lookup row_key in table, then col_key in row_key map
+    auto row_it = table.find(row_key);
+    if (row_it == table.end()) {
+        return false;
+    }
+    std::unordered_map<std::string, Cell>& retrieved_row = row_it->second;
+    auto col_it = retrieved_row.find(col_key);
+    if (col_it == retrieved_row.end()) {
+        return false;
+    }
+
+    // remove entry (col_key, cell) from row_key map
+    removed = std::move(col_it->second);
+    retrieved_row.erase(col_it);
+    num_cells--;
+    key_heap_bytes -= key_heap_size(col_key);
+
+    // check if row_key is empty, and if so, delete (row_key, row_map) from table
+    if (retrieved_row.empty()) {
+        row_buckets -= retrieved_row.bucket_count() - 1;
+        key_heap_bytes -= key_heap_size(row_key);
+        table.erase(row_it);
+    }
+    return true;
+}
+
+void NestedCellMap::for_each(const std::function<void(std::string_view row_key, std::string_view col_key, Cell& cell)>& fn) {
+    for (auto& row : table) {
+        for (auto& col : row.second) {
+            fn(row.first, col.first, col.second);
+        }
+    }
+}
+
+Cell* NestedCellMap::sample(uint64_t seed, std::string& row_key, std::string& col_key) {
+    if (num_cells == 0) {
+        return nullptr;
+    }
+
+    // first non-empty row bucket at or after a random one, then likewise a column bucket
+    size_t row_bucket = seed % table.bucket_count();
+    while (table.bucket_size(row_bucket) == 0) {
+        row_bucket = (row_bucket + 1) % table.bucket_count();
+    }
+    auto& row = *table.begin(row_bucket);
+    size_t col_bucket = (seed >> 32) % row.second.bucket_count();
+    while (row.second.bucket_size(col_bucket) == 0) {
+        col_bucket = (col_bucket + 1) % row.second.bucket_count();
+    }
+    auto& col = *row.second.begin(col_bucket);
+    row_key = row.first;
+    col_key = col.first;
+    return &col.second;
+}
+
+size_t NestedCellMap::size() const {
+    return num_cells;
+}
+
+size_t NestedCellMap::memory_bytes() const {
+
+    // hash nodes carry a next pointer and a cached hash besides their pair
+    const size_t node_extra = sizeof(void*) + sizeof(size_t);
+    const size_t row_node = sizeof(std::pair<const std::string, std::unordered_map<std::string, Cell>>) + node_extra;
+    const size_t cell_node = sizeof(std::pair<const std::string, Cell>) + node_extra;
+    return (table.bucket_count() + row_buckets) * sizeof(void*) + table.size() * row_node + num_cells * cell_node + key_heap_bytes;
+}
+
+/* FlatCellMap */
+
+FlatCellMap::FlatCellMap() : slots(FLAT_INITIAL_SLOTS), mask(FLAT_INITIAL_SLOTS - 1) {}
+
+FlatCellMap::~FlatCellMap() {
+
+    // slab memory is released with the slab; only oversized keys need freeing
+    for (Slot& slot : slots) {
+        if (slot.hash != 0 && slot.row_len + slot.col_len > FLAT_INLINE_KEY) {
+            slab.free(slot.slab_key, slot.row_len + slot.col_len);
+        }
+    }
+}
+
+uint64_t FlatCellMap::hash_key(const std::string& row_key, const std::string& col_key) {
+
+    // combine per-key hashes, then finalize (splitmix64) so low bits are well mixed
+    uint64_t h = std::hash<std::string>{}(row_key) * 0x9E3779B97F4A7C15ull ^ std::hash<std::string>{}(col_key);
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+
+    // zero marks an empty slot
+    return h == 0 ? 1 : h;
+}
+
+size_t FlatCellMap::probe(uint64_t hash, const std::string& row_key, const std::string& col_key) const {
+
+    // walk the probe chain until the key or an empty slot
+    size_t i = hash & mask;
+    while (true) {
+        const Slot& slot = slots[i];
+        if (slot.hash == 0) {
+            return i;
+        }
+        if (slot.hash == hash && slot.row_len == row_key.size() && slot.col_len == col_key.size()) {
+            const char* key = slot.key();
+            if (memcmp(key, row_key.data(), row_key.size()) == 0
+                && memcmp(key + row_key.size(), col_key.data(), col_key.size()) == 0) {
+                return i;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+Cell* FlatCellMap::find(const std::string& row_key, const std::string& col_key) {
+    Slot& slot = slots[probe(hash_key(row_key, col_key), row_key, col_key)];
+    return slot.hash == 0 ? nullptr : &slot.cell;
+}
+
+Cell& FlatCellMap::insert(const std::string& row_key, const std::string& col_key) {
+
+    // keep load factor at or below 3/4
+    if ((num_cells + 1) * 4 > slots.size() * 3) {
+        grow();
+    }
+
+    // existing cell
+    uint64_t hash = hash_key(row_key, col_key);
+    Slot& slot = slots[probe(hash, row_key, col_key)];
+    if (slot.hash != 0) {
+        return slot.cell;
+    }
+
+    // claim the empty slot, storing key bytes inline or in the slab
+    size_t key_len = row_key.size() + col_key.size();
+    slot.hash = hash;
+    slot.row_len = row_key.size();
+    slot.col_len = col_key.size();
+    char* key = key_len <= FLAT_INLINE_KEY ? slot.inline_key : (slot.slab_key = slab.alloc(key_len));
+    memcpy(key, row_key.data(), row_key.size());
+    memcpy(key + row_key.size(), col_key.data(), col_key.size());
+    num_cells++;
+    return slot.cell;
+}
+
+bool FlatCellMap::erase(const std::string& row_key, const std::string& col_key, Cell& removed) {
+
+    // locate cell
+    size_t i = probe(hash_key(row_key, col_key), row_key, col_key);
+    if (slots[i].hash == 0) {
+        return false;
+    }
+
+    // release key and cell
+    Slot& slot = slots[i];
+    if (slot.row_len + slot.col_len > FLAT_INLINE_KEY) {
+        slab.free(slot.slab_key, slot.row_len + slot.col_len);
+    }
+    removed = std::move(slot.cell);
+    num_cells--;
+
+    // backward-shift deletion: pull later chain members into the hole
+    // unless their home slot lies cyclically in (hole, j]
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (slots[j].hash != 0) {
+        size_t home = slots[j].hash & mask;
+        bool stays = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stays) {
+            slots[hole] = std::move(slots[j]);
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    slots[hole].hash = 0;
+    slots[hole].cell = Cell();
+    return true;
+}
+
+void FlatCellMap::grow() {
+
+    // rehash every occupied slot into a table twice the size, reusing cached hashes
+    std::vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+    mask = slots.size() - 1;
+    for (Slot& slot : old) {
+        if (slot.hash == 0) {
+            continue;
+        }
+        size_t i = slot.hash & mask;
+        while (slots[i].hash != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = std::move(slot);
+    }
+}
+
+void FlatCellMap::for_each(const std::function<void(std::string_view row_key, std::string_view col_key, Cell& cell)>& fn) {
+    for (Slot& slot : slots) {
+        if (slot.hash != 0) {
+            const char* key = slot.key();
+            fn(std::string_view(key, slot.row_len), std::string_view(key + slot.row_len, slot.col_len), slot.cell);
+        }
+    }
+}
+
+Cell* FlatCellMap::sample(uint64_t seed, std::string& row_key, std::string& col_key) {
+    if (num_cells == 0) {
+        return nullptr;
+    }
+
+    // first occupied slot at or after a random one
+    size_t i = seed & mask;
+    while (slots[i].hash == 0) {
+        i = (i + 1) & mask;
+    }
+    Slot& slot = slots[i];
+    const char* key = slot.key();
+    row_key.assign(key, slot.row_len);
+    col_key.assign(key + slot.row_len, slot.col_len);
+    return &slot.cell;
+}
+
+size_t FlatCellMap::size() const {
+    return num_cells;
+}
+
+size_t FlatCellMap::memory_bytes() const {
+    return slots.capacity() * sizeof(Slot) + slab.reserved_bytes();
+}
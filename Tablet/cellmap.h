@@ -0,0 +1,203 @@
+#ifndef CELLMAP_H
+#define CELLMAP_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "value.h"
+#include "../Util/slab.h"
+
+/**
+ * @brief Everything a Tablet stores for one (row, column).
+ */
+struct Cell {
+    ValueRef value;
+
+    /**
+     * @brief commit sequence number of the write that stored value
+     */
+    uint64_t version = 0;
+
+    /**
+     * @brief wall-clock deadline in ms since the epoch after which the cell no longer exists, 0 for none
+     */
+    uint64_t expires_ms = 0;
+
+    /**
+     * @brief Tablet clock tick of the last read or write, for eviction (only kept with a memory limit)
+     */
+    uint32_t access = 0;
+
+    /**
+     * @brief whether value holds a compressed block (Util/lz.h) rather than the bytes themselves
+     */
+    bool compressed = false;
+
+    /**
+     * @brief whether value is a SegmentStore handle to the bytes moved to disk (Tier/segment.h)
+     */
+    bool cold = false;
+};
+
+/**
+ * @brief storage engines a Tablet shard can use
+ */
+enum class CellEngine {
+    NESTED,  // row map of column maps (node per row and per cell)
+    FLAT,    // one open-addressing table keyed by (row, column)
+};
+
+/**
+ * @brief Parse an engine name ("nested", "flat").
+ *
+ * @param name engine name
+ * @param engine parsed engine
+ * @return false if the name is unknown
+ */
+bool parse_cell_engine(const std::string& name, CellEngine& engine);
+
+/**
+ * @class CellMap
+ * @brief Unsynchronized (row, column) → Cell index backing one Tablet shard.
+ *
+ * The owning shard's lock serializes access.  Pointers and references
+ * returned by find/insert are invalidated by the next insert or erase.
+ */
+class CellMap {
+    public:
+        virtual ~CellMap() = default;
+
+        /**
+         * @brief Look up a cell; nullptr if absent.
+         */
+        virtual Cell* find(const std::string& row_key, const std::string& col_key) = 0;
+
+        /**
+         * @brief Look up a cell, creating an empty one if absent.
+         */
+        virtual Cell& insert(const std::string& row_key, const std::string& col_key) = 0;
+
+        /**
+         * @brief Remove a cell, moving it into @p removed.
+         *
+         * @return false if the cell was absent
+         */
+        virtual bool erase(const std::string& row_key, const std::string& col_key, Cell& removed) = 0;
+
+        /**
+         * @brief Visit every cell, in no particular order.
+         */
+        virtual void for_each(const std::function<void(std::string_view row_key, std::string_view col_key, Cell& cell)>& fn) = 0;
+
+        /**
+         * @brief Pick a cell pseudo-randomly, copying out its keys; nullptr if the map is empty.
+         *
+         * @param seed  Random bits choosing the cell.
+         */
+        virtual Cell* sample(uint64_t seed, std::string& row_key, std::string& col_key) = 0;
+
+        /**
+         * @brief Number of cells.
+         */
+        virtual size_t size() const = 0;
+
+        /**
+         * @brief Estimated heap bytes held by the index itself (tables, nodes, keys), excluding values.
+         */
+        virtual size_t memory_bytes() const = 0;
+};
+
+/**
+ * @brief Create an empty map for an engine.
+ */
+std::unique_ptr<CellMap> make_cell_map(CellEngine engine);
+
+/**
+ * @class NestedCellMap
+ * @brief Two‐level map: row key → (column key → cell).
+ *
+ * The outer map’s key is the row identifier.  Each value is another
+ * unordered_map whose key is the column identifier and whose value
+ * is the stored cell.  Empty rows are removed.
+ */
+class NestedCellMap : public CellMap {
+    public:
+        Cell* find(const std::string& row_key, const std::string& col_key) override;
+        Cell& insert(const std::string& row_key, const std::string& col_key) override;
+        bool erase(const std::string& row_key, const std::string& col_key, Cell& removed) override;
+        void for_each(const std::function<void(std::string_view row_key, std::string_view col_key, Cell& cell)>& fn) override;
+        Cell* sample(uint64_t seed, std::string& row_key, std::string& col_key) override;
+        size_t size() const override;
+        size_t memory_bytes() const override;
+
+    private:
+        std::unordered_map<std::string, std::unordered_map<std::string, Cell>> table;
+        size_t num_cells = 0;
+
+        /**
+         * @brief bucket slots across all row maps, and key bytes too long for std::string's inline buffer
+         */
+        size_t row_buckets = 0;
+        size_t key_heap_bytes = 0;
+};
+
+/**
+ * @brief combined key bytes stored inside a FlatCellMap slot; longer keys go to the slab
+ */
+#define FLAT_INLINE_KEY 24
+
+/**
+ * @class FlatCellMap
+ * @brief Single open-addressing table keyed by (row, column).
+ *
+ * Slots live in one contiguous array probed linearly, each caching the full
+ * hash of its key.  Row and column bytes are stored back to back, inline in
+ * the slot when they fit in FLAT_INLINE_KEY bytes and otherwise in a slab
+ * arena, so a lookup is one hash and usually one cache miss, with no node or
+ * per-key heap allocation.  Deletion shifts later probe-chain entries back,
+ * so there are no tombstones.
+ */
+class FlatCellMap : public CellMap {
+    public:
+        FlatCellMap();
+        ~FlatCellMap() override;
+
+        Cell* find(const std::string& row_key, const std::string& col_key) override;
+        Cell& insert(const std::string& row_key, const std::string& col_key) override;
+        bool erase(const std::string& row_key, const std::string& col_key, Cell& removed) override;
+        void for_each(const std::function<void(std::string_view row_key, std::string_view col_key, Cell& cell)>& fn) override;
+        Cell* sample(uint64_t seed, std::string& row_key, std::string& col_key) override;
+        size_t size() const override;
+        size_t memory_bytes() const override;
+
+    private:
+        /**
+         * @brief One table slot; hash 0 marks an empty slot.
+         */
+        struct Slot {
+            uint64_t hash = 0;
+            uint32_t row_len = 0;
+            uint32_t col_len = 0;
+            union {
+                char inline_key[FLAT_INLINE_KEY];
+                char* slab_key;
+            };
+            Cell cell;
+
+            const char* key() const { return row_len + col_len <= FLAT_INLINE_KEY ? inline_key : slab_key; }
+        };
+
+        static uint64_t hash_key(const std::string& row_key, const std::string& col_key);
+        size_t probe(uint64_t hash, const std::string& row_key, const std::string& col_key) const;
+        void grow();
+
+        std::vector<Slot> slots;
+        size_t mask;
+        size_t num_cells = 0;
+        SlabAllocator slab;
+};
+
+#endif
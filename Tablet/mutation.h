@@ -0,0 +1,75 @@
+#ifndef MUTATION_H
+#define MUTATION_H
+
+#include <stdint.h>
+#include <string>
+#include "value.h"
+#include "../Util/coding.h"
+
+/**
+ * @brief kinds of state change a Tablet reports
+ */
+enum class MutationType : uint8_t {
+    PUT = 1,
+    DEL = 2,
+    EXPIRE = 3,
+};
+
+/**
+ * @brief One applied change to a cell, tagged with its commit sequence number.
+ *
+ * Sequence numbers are assigned by the Tablet, start at 1, and are strictly
+ * increasing in the order listeners observe them.
+ */
+struct Mutation {
+    MutationType type;
+    const std::string& row;
+    const std::string& col;
+
+    /**
+     * @brief new value for PUT, the encoded deadline for EXPIRE, nullptr for DEL
+     */
+    ValueRef value;
+    uint64_t seq;
+
+    /**
+     * @brief whether a PUT's value is a compressed block (Util/lz.h), passed on as is
+     */
+    bool compressed = false;
+};
+
+/**
+ * @brief Encode an EXPIRE mutation's deadline (ms since the epoch, 0 to clear) as its value.
+ */
+inline ValueRef make_expiry_value(uint64_t expires_ms) {
+    std::string encoded;
+    put_u64(encoded, expires_ms);
+    return make_value(std::vector<char>(encoded.begin(), encoded.end()));
+}
+
+/**
+ * @brief Decode the deadline carried by an EXPIRE mutation's value.
+ */
+inline uint64_t expiry_of(const ValueRef& value) {
+    return value && value->size() == 8 ? get_u64(value->data()) : 0;
+}
+
+/**
+ * @class MutationListener
+ * @brief Observer of every change applied to a Tablet (e.g. a write-ahead log).
+ *
+ * on_mutation is called while the cell's shard is still locked and while
+ * the Tablet's sequencer is held, so it must be quick and must not call back
+ * into the Tablet.  Every writer in every shard passes through the
+ * sequencer, so work that does not need the sequence number (e.g. encoding
+ * the change) belongs in prepare(), which the same thread calls for the same
+ * change just before taking it; mutation.seq is not set yet there.
+ */
+class MutationListener {
+    public:
+        virtual ~MutationListener() = default;
+        virtual void prepare(const Mutation& mutation) { (void) mutation; }
+        virtual void on_mutation(const Mutation& mutation) = 0;
+};
+
+#endif
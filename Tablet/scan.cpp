@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <utility>
+#include "scan.h"
+
+TabletScan::TabletScan(Tablet& tab, std::string start_row, std::string end_row)
+    : tab(tab), end_row(std::move(end_row)), view_seq(tab.open_view()), sources(tab.num_shards()) {
+
+    // load each shard's first batch and heap the non-empty ones
+    for (size_t i = 0; i < sources.size(); i++) {
+        sources[i].resume = CellKey(start_row, "");
+        if (refill(i)) {
+            heap.push_back(i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return after(a, b); });
+}
+
+TabletScan::~TabletScan() {
+    tab.close_view(view_seq);
+}
+
+bool TabletScan::refill(size_t shard_idx) {
+    Source& source = sources[shard_idx];
+    if (source.exhausted) {
+        return false;
+    }
+
+    // copy the next batch
+    source.batch.clear();
+    source.pos = 0;
+    tab.scan_shard(shard_idx, source.resume, end_row, SCAN_SHARD_BATCH, source.batch, view_seq);
+    if (source.batch.size() < SCAN_SHARD_BATCH) {
+        source.exhausted = true;
+    }
+    if (source.batch.empty()) {
+        return false;
+    }
+
+    // resume just past the last cell copied (col + '\0' is the next possible column)
+    const CellEntry& last = source.batch.back();
+    source.resume = CellKey(last.row, last.col + '\0');
+    return true;
+}
+
+bool TabletScan::after(size_t a, size_t b) const {
+    const CellEntry& x = sources[a].batch[sources[a].pos];
+    const CellEntry& y = sources[b].batch[sources[b].pos];
+    int cmp = x.row.compare(y.row);
+    return cmp > 0 || (cmp == 0 && x.col > y.col);
+}
+
+bool TabletScan::next(CellEntry& cell) {
+    if (heap.empty()) {
+        return false;
+    }
+
+    // take the smallest current cell
+    auto order = [this](size_t a, size_t b) { return after(a, b); };
+    std::pop_heap(heap.begin(), heap.end(), order);
+    size_t shard_idx = heap.back();
+    Source& source = sources[shard_idx];
+    cell = std::move(source.batch[source.pos++]);
+
+    // put its source back if it has more cells
+    if (source.pos < source.batch.size() || refill(shard_idx)) {
+        std::push_heap(heap.begin(), heap.end(), order);
+    } else {
+        heap.pop_back();
+    }
+    return true;
+}
+
+std::string TabletScan::prefix_end(const std::string& prefix) {
+
+    // increment the last byte that is not 0xff, dropping the ones after it
+    std::string end = prefix;
+    while (!end.empty() && (unsigned char) end.back() == 0xff) {
+        end.pop_back();
+    }
+    if (!end.empty()) {
+        end.back() = (char) ((unsigned char) end.back() + 1);
+    }
+    return end;
+}
@@ -0,0 +1,94 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <string>
+#include <vector>
+#include "tablet.h"
+
+/**
+ * @brief cells copied from one shard each time its buffer runs dry
+ */
+#define SCAN_SHARD_BATCH 64
+
+/**
+ * @class TabletScan
+ * @brief Iterates the cells of a row range in (row, col) order.
+ *
+ * Each shard is read in small batches (Tablet::scan_shard) and the batches
+ * are merged, so a shard's lock is held only while one batch is copied and
+ * writers are never blocked for the length of a scan.  The scan holds a read
+ * view (Tablet::open_view) for its lifetime, so it sees every cell as of the
+ * moment it was constructed, whatever is written or deleted meanwhile.
+ */
+class TabletScan {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Prepare a scan over rows in [start_row, end_row).
+         *
+         * @param tab        Tablet to read, which must outlive the scan.
+         * @param start_row  First row (inclusive).
+         * @param end_row    Stop before this row (exclusive), or "" for no bound.
+         */
+        TabletScan(Tablet& tab, std::string start_row, std::string end_row);
+
+        /**
+         * @brief Close the scan's read view.
+         */
+        ~TabletScan();
+
+        TabletScan(const TabletScan&) = delete;
+        TabletScan& operator=(const TabletScan&) = delete;
+
+        /**
+         * @brief Advance to the next cell.
+         *
+         * @param cell  Receives the next cell.
+         * @return false once the range is exhausted
+         */
+        bool next(CellEntry& cell);
+
+        /**
+         * @brief Smallest row key greater than every key starting with @p prefix, or "" if none.
+         */
+        static std::string prefix_end(const std::string& prefix);
+
+    /* private types */
+    private:
+        /**
+         * @brief buffered cells of one shard, and where to resume reading it
+         */
+        struct Source {
+            std::vector<CellEntry> batch;
+            size_t pos = 0;
+            CellKey resume;
+            bool exhausted = false;
+        };
+
+    /* private methods */
+    private:
+        /**
+         * @brief Refill a source's batch; false if the shard has no more cells in range.
+         */
+        bool refill(size_t shard_idx);
+
+        /**
+         * @brief Heap order: the source whose current cell sorts first is on top.
+         */
+        bool after(size_t a, size_t b) const;
+
+    /* private fields */
+    private:
+        Tablet& tab;
+        std::string end_row;
+        uint64_t view_seq;
+
+        /**
+         * @brief one source per shard, and a min-heap of the non-empty ones
+         */
+        std::vector<Source> sources;
+        std::vector<size_t> heap;
+};
+
+#endif
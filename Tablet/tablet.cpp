@@ -1,82 +1,1368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
 #include <iostream>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include <chrono>
 #include "tablet.h"
+#include "../Util/lz.h"
 
-std::optional<std::vector<char>> Tablet::get(const std::string& row_key, const std::string& col_key) {
+Tablet::Tablet(size_t num_shards, CellEngine engine) : engine(engine) {
 
-    // look up row_key map in tablet
-    auto it_row = table.find(row_key);
+    // round shard count up to a power of two so a mask can select the shard
+    size_t count = 1;
+    while (count < num_shards) {
+        count <<= 1;
+    }
 
-    // if not found, return nullopt
-    if (it_row == table.end()) {
-        return std::nullopt;
+    // allocate shards
+    shards.reset(new Shard[count]);
+    shard_mask = count - 1;
+    for (size_t i = 0; i < count; i++) {
+        shards[i].cells = make_cell_map(engine);
+        shards[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
     }
+}
+
+size_t Tablet::num_shards() const {
+    return shard_mask + 1;
+}
+
+size_t Tablet::shard_index(const std::string& row_key) const {
+    return std::hash<std::string>{}(row_key) & shard_mask;
+}
 
-    // otherwise, retrieve row_key map
-    std::unordered_map<std::string, std::vector<char>>& row_map = it_row->second;
+Tablet::Shard& Tablet::shard_for(const std::string& row_key) {
+    return shards[shard_index(row_key)];
+}
+
+void Tablet::add_listener(MutationListener* listener) {
+    listeners.push_back(listener);
+}
+
+uint64_t Tablet::clock_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void Tablet::set_compression(size_t min_bytes) {
+    compress_min_bytes = min_bytes;
+}
+
+bool Tablet::set_tier(const std::string& dir, size_t min_bytes) {
+    std::unique_ptr<SegmentStore> store(new SegmentStore(dir));
+    if (!store->open()) {
+        return false;
+    }
+    tier = std::move(store);
+    tier_min_bytes = min_bytes;
+    return true;
+}
+
+void Tablet::set_max_memory(uint64_t max_bytes) {
+
+    // each shard keeps to an equal share, so no shard needs to know the others' usage
+    shard_max_bytes = max_bytes == 0 ? 0 : std::max<uint64_t>(max_bytes / num_shards(), 1);
+}
 
-    // look up column in row_key map
-    auto col_it = row_map.find(col_key);
+void Tablet::add_index(const std::string& col_key) {
+    for (size_t i = 0; i <= shard_mask; i++) {
+        Shard& shard = shards[i];
+        auto [index_it, added] = shard.indexes.emplace(col_key, ColumnIndex());
+        if (!added) {
+            return;
+        }
 
-    // if not found, return nullopt
-    if (col_it == row_map.end()) {
-        return std::nullopt;
+        // enter the cells already stored (rows also keeps the keys of deleted cells that views still need)
+        for (const auto& [row_key, cols] : shard.rows) {
+            Cell* cell = cols.count(col_key) ? shard.cells->find(row_key, col_key) : nullptr;
+            if (cell) {
+                index_locked(index_it->second, row_key, load(shard, cell->value, cell->compressed, cell->cold));
+            }
+        }
     }
-    
-    // otherwise return found value
-    return col_it->second;
 }
 
+bool Tablet::find(const std::string& col_key, const std::string& value, size_t limit, std::vector<std::string>& rows) {
+
+    // every shard indexes the same columns
+    rows.clear();
+    if (!shards[0].indexes.count(col_key)) {
+        return false;
+    }
+
+    // rows keeps the smallest matches seen so far: once it holds twice the
+    // limit it is cut back to the limit smallest, and later matches past the
+    // largest of those are skipped, so a common value with a small limit is
+    // never copied and sorted in full
+    std::string bound;
+    bool bounded = false;
+    for (size_t i = 0; i <= shard_mask && limit > 0; i++) {
+        Shard& shard = shards[i];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        const ColumnIndex& index = shard.indexes.find(col_key)->second;
+        auto value_it = index.rows_by_value.find(value);
+        if (value_it == index.rows_by_value.end()) {
+            continue;
+        }
+
+        // expired cells are absent (only a shard with deadlines can hold one)
+        for (const std::string& row_key : value_it->second) {
+            if (!shard.expiries.empty() && is_expired(*shard.cells->find(row_key, col_key))) {
+                continue;
+            }
+            if (bounded && !(row_key < bound)) {
+                continue;
+            }
+            rows.push_back(row_key);
+            if (rows.size() >= limit && rows.size() - limit >= limit) {
+                std::nth_element(rows.begin(), rows.begin() + (limit - 1), rows.end());
+                rows.resize(limit);
+                bound = rows.back();
+                bounded = true;
+            }
+        }
+    }
+
+    // put the rows kept in order
+    std::sort(rows.begin(), rows.end());
+    if (rows.size() > limit) {
+        rows.resize(limit);
+    }
+    return true;
+}
+
+uint64_t Tablet::last_seq() const {
+    return seq.load(std::memory_order_acquire);
+}
+
+uint64_t Tablet::commit(MutationType type, const std::string& row_key, const std::string& col_key, const ValueRef& value, uint64_t at_seq, bool compressed) {
+
+    // the counter moves sequentially consistently: retire_locked() reads
+    // views_open after it, and open_view() the counter after views_open
+
+    // without listeners only the counter has to move
+    if (listeners.empty() && at_seq == 0) {
+        return seq.fetch_add(1, std::memory_order_seq_cst) + 1;
+    }
+
+    // let listeners do their work that does not need the number (e.g.
+    // encoding a log record) before the sequencer, which every shard shares
+    Mutation mutation{type, row_key, col_key, value, 0, compressed};
+    for (MutationListener* listener : listeners) {
+        listener->prepare(mutation);
+    }
+
+    // number and report the change in one critical section, so listeners
+    // observe strictly increasing sequence numbers
+    std::lock_guard<std::mutex> guard(seq_mtx);
+    if (at_seq == 0) {
+        at_seq = seq.load(std::memory_order_relaxed) + 1;
+    }
+    if (at_seq > seq.load(std::memory_order_relaxed)) {
+        seq.store(at_seq, std::memory_order_seq_cst);
+    }
+    mutation.seq = at_seq;
+    for (MutationListener* listener : listeners) {
+        listener->on_mutation(mutation);
+    }
+    return at_seq;
+}
+
+void Tablet::group_by_shard(const std::vector<CellKey>& keys, std::vector<std::pair<size_t, size_t>>& tagged) const {
+
+    // tag each batch position with its shard
+    tagged.clear();
+    tagged.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        tagged.emplace_back(shard_index(keys[i].first), i);
+    }
+
+    // sort by shard, then position, so same-cell operations keep batch order
+    std::sort(tagged.begin(), tagged.end());
+}
+
+bool Tablet::is_expired(const Cell& cell) {
+    return cell.expires_ms != 0 && cell.expires_ms <= clock_ms();
+}
+
+Cell* Tablet::get_locked(Shard& shard, const std::string& row_key, const std::string& col_key, bool& expired) {
+
+    // look up cell; if not found (or past its deadline), return nullptr
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (!cell) {
+        return nullptr;
+    }
+    if (cell->expires_ms != 0 && is_expired(*cell)) {
+        expired = true;
+        return nullptr;
+    }
+
+    // note the access for eviction; other readers may be stamping it too, and
+    // the cell's cache line is only dirtied when the clock has moved on
+    if (shard_max_bytes != 0) {
+        uint32_t now = access_clock.load(std::memory_order_relaxed);
+        if (__atomic_load_n(&cell->access, __ATOMIC_RELAXED) != now) {
+            __atomic_store_n(&cell->access, now, __ATOMIC_RELAXED);
+        }
+    }
+
+    // otherwise return the found cell
+    return cell;
+}
+
+void Tablet::count_value_locked(Shard& shard, const Cell& cell, bool add) {
+    if (!cell.value) {
+        return;
+    }
+    size_t stored = cell.value->size();
+
+    // a cold cell holds only its handle in memory
+    if (cell.cold) {
+        size_t on_disk = SegmentStore::value_size(cell.value);
+        if (add) {
+            shard.value_bytes += stored;
+            shard.cold_cells++;
+            shard.cold_bytes += on_disk;
+        } else {
+            shard.value_bytes -= stored;
+            shard.cold_cells--;
+            shard.cold_bytes -= on_disk;
+        }
+        return;
+    }
+    size_t raw = cell.compressed ? lz_raw_size(cell.value->data(), stored) : 0;
+    if (add) {
+        shard.value_bytes += stored;
+        if (cell.compressed) {
+            shard.compressed_cells++;
+            shard.compressed_bytes += stored;
+            shard.compressed_raw_bytes += raw;
+        }
+    } else {
+        shard.value_bytes -= stored;
+        if (cell.compressed) {
+            shard.compressed_cells--;
+            shard.compressed_bytes -= stored;
+            shard.compressed_raw_bytes -= raw;
+        }
+    }
+}
+
+bool Tablet::deflate(ValueRef& value) const {
+    if (compress_min_bytes == 0 || !value || value->size() < compress_min_bytes) {
+        return false;
+    }
+
+    // keep the block only if it is worth the decompression on every read
+    std::vector<char> block;
+    lz_compress(value->data(), value->size(), block);
+    if (block.size() > value->size() - value->size() / TABLET_COMPRESS_MIN_SAVING) {
+        return false;
+    }
+
+    // the compressor sized its buffer for the worst case; keep only the block
+    block.shrink_to_fit();
+    value = make_value(std::move(block));
+    return true;
+}
+
+ValueRef Tablet::inflate(Shard& shard, const ValueRef& block) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<char> bytes;
+    if (!lz_decompress(block->data(), block->size(), bytes)) {
+        fprintf(stderr, "Tablet: corrupt compressed value (%zu bytes)\n", block->size());
+        return nullptr;
+    }
+    ValueRef value = make_value(std::move(bytes));
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    shard.decompressions.fetch_add(1, std::memory_order_relaxed);
+    shard.decompress_ns.fetch_add(ns, std::memory_order_relaxed);
+    return value;
+}
+
+ValueRef Tablet::plain_for_index(Shard& shard, const std::string& col_key, const ValueRef& block) {
+
+    // the indexed columns are fixed once the tablet is shared, so this needs no lock
+    if (!shard.indexes.count(col_key)) {
+        return nullptr;
+    }
+    return inflate(shard, block);
+}
+
+ValueRef Tablet::load(Shard& shard, ValueRef value, bool compressed, bool cold) {
+    if (cold && value) {
+        value = tier->read(value);
+    }
+    if (compressed && value) {
+        value = inflate(shard, value);
+    }
+    return value;
+}
+
+Cell& Tablet::put_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef value, bool compressed,
+                         const ValueRef& plain, Cell& replaced) {
+
+    // find or create cell, handing back what it held
+    Cell& cell = shard.cells->insert(row_key, col_key);
+    count_value_locked(shard, cell, false);
+    replaced.value = std::exchange(cell.value, std::move(value));
+    replaced.version = cell.version;
+    replaced.expires_ms = cell.expires_ms;
+    replaced.compressed = std::exchange(cell.compressed, compressed);
+    replaced.cold = std::exchange(cell.cold, false);
+    count_value_locked(shard, cell, true);
+    if (shard_max_bytes != 0) {
+        cell.access = access_clock.load(std::memory_order_relaxed);
+    }
+
+    // a write replaces the deadline too
+    if (cell.expires_ms != 0) {
+        set_expiry_locked(shard, row_key, col_key, cell, 0);
+    }
+
+    // a new cell also enters the ordered index
+    if (!replaced.value) {
+        shard.rows[row_key].insert(col_key);
+        shard.key_bytes += row_key.size() + col_key.size();
+    }
+
+    // and an indexed column's index, by the value's original bytes
+    if (!shard.indexes.empty()) {
+        auto index_it = shard.indexes.find(col_key);
+        if (index_it != shard.indexes.end()) {
+            index_locked(index_it->second, row_key, compressed ? plain : cell.value);
+        }
+    }
+    return cell;
+}
+
+uint64_t Tablet::write_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef value, bool compressed,
+                              const ValueRef& plain, uint64_t expires_ms, Cell& replaced) {
+
+    // the deadline is logged as its own change right after the value
+    Cell& cell = put_locked(shard, row_key, col_key, value, compressed, plain, replaced);
+    cell.version = commit(MutationType::PUT, row_key, col_key, value, 0, compressed);
+    retire_locked(shard, row_key, col_key, replaced, cell.version, false);
+    if (expires_ms != 0) {
+        set_expiry_locked(shard, row_key, col_key, cell, expires_ms);
+        commit(MutationType::EXPIRE, row_key, col_key, make_expiry_value(expires_ms));
+    }
+    return cell.version;
+}
+
+bool Tablet::read_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef& bytes, bool& exists,
+                         uint64_t& expires_ms, ValueRef& removed) {
+    exists = false;
+    expires_ms = 0;
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (!cell || expire_locked(shard, row_key, col_key, removed)) {
+        return true;
+    }
+    exists = true;
+    expires_ms = cell->expires_ms;
+
+    // a cold value is read under the lock, since the new value is built from it
+    bytes = cell->compressed || cell->cold ? load(shard, cell->value, cell->compressed, cell->cold) : cell->value;
+    return bytes != nullptr;
+}
+
+void Tablet::set_expiry_locked(Shard& shard, const std::string& row_key, const std::string& col_key, Cell& cell, uint64_t expires_ms) {
+    if (cell.expires_ms != 0) {
+        shard.expiries.erase(std::make_pair(cell.expires_ms, CellKey(row_key, col_key)));
+    }
+    cell.expires_ms = expires_ms;
+    if (expires_ms != 0) {
+        shard.expiries.emplace(expires_ms, CellKey(row_key, col_key));
+    }
+}
+
+bool Tablet::del_locked(Shard& shard, const std::string& row_key, const std::string& col_key, Cell& removed) {
+
+    // remove cell if it exists
+    if (!shard.cells->erase(row_key, col_key, removed)) {
+        return false;
+    }
+    count_value_locked(shard, removed, false);
+    shard.key_bytes -= row_key.size() + col_key.size();
+    if (removed.expires_ms != 0) {
+        shard.expiries.erase(std::make_pair(removed.expires_ms, CellKey(row_key, col_key)));
+    }
+
+    // drop it from the ordered index, along with its row if that emptied
+    auto row_it = shard.rows.find(row_key);
+    row_it->second.erase(col_key);
+    if (row_it->second.empty()) {
+        shard.rows.erase(row_it);
+    }
+    if (!shard.indexes.empty()) {
+        auto index_it = shard.indexes.find(col_key);
+        if (index_it != shard.indexes.end()) {
+            index_locked(index_it->second, row_key, nullptr);
+        }
+    }
+    return true;
+}
+
+void Tablet::index_locked(ColumnIndex& index, const std::string& row_key, const ValueRef& value) {
+
+    // take the row out from under its old value, unless that is unchanged; the
+    // set node is kept to file it under the new value without reallocating
+    std::unordered_set<std::string>::node_type node;
+    auto row_it = index.value_by_row.find(row_key);
+    if (row_it != index.value_by_row.end()) {
+        const std::string& old = row_it->second;
+        if (value && old.size() == value->size() && std::equal(old.begin(), old.end(), value->begin())) {
+            return;
+        }
+        auto value_it = index.rows_by_value.find(old);
+        node = value_it->second.extract(row_key);
+        if (value_it->second.empty()) {
+            index.rows_by_value.erase(value_it);
+        }
+        if (!value) {
+            index.value_by_row.erase(row_it);
+            return;
+        }
+        row_it->second.assign(value->data(), value->size());
+    } else if (!value) {
+        return;
+    } else {
+        row_it = index.value_by_row.emplace(row_key, std::string(value->data(), value->size())).first;
+    }
+
+    // and file it under the new one
+    std::unordered_set<std::string>& rows = index.rows_by_value[row_it->second];
+    if (node) {
+        rows.insert(std::move(node));
+    } else {
+        rows.insert(row_key);
+    }
+}
+
+bool Tablet::expire_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef& removed) {
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (!cell || !is_expired(*cell)) {
+        return false;
+    }
+    Cell removed_cell;
+    del_locked(shard, row_key, col_key, removed_cell);
+    removed = std::move(removed_cell.value);
+    shard.expired++;
+    return true;
+}
+
+void Tablet::retire_locked(Shard& shard, const std::string& row_key, const std::string& col_key, Cell& old, uint64_t superseded, bool deleted) {
+
+    // a view opened before the change was numbered is counted by now (see commit())
+    if (!old.value || views_open.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+    size_t bytes = old.value->size();
+    shard.history[CellKey(row_key, col_key)].push_back(OldVersion{std::move(old.value), old.version, superseded, old.expires_ms, old.compressed, old.cold});
+    shard.history_versions++;
+    shard.history_bytes += bytes;
+
+    // views still walk to a deleted cell through the ordered index
+    if (deleted) {
+        shard.rows[row_key].insert(col_key);
+    }
+}
+
+size_t Tablet::charged_locked(const Shard& shard) {
+    return shard.value_bytes + shard.key_bytes + shard.cells->size() * TABLET_CELL_OVERHEAD;
+}
+
+void Tablet::evict_locked(Shard& shard, std::vector<ValueRef>& released) {
+    if (shard_max_bytes == 0 || tier) {
+        return;
+    }
+    uint32_t now = access_clock.load(std::memory_order_relaxed);
+    std::string row_key, col_key, victim_row, victim_col;
+    while (charged_locked(shard) > shard_max_bytes && shard.cells->size() > 0) {
+
+        // of a few sampled cells take the one idle longest, or any expired one at once
+        uint32_t victim_age = 0;
+        bool victim_expired = false;
+        for (int i = 0; i < TABLET_EVICT_SAMPLES && !victim_expired; i++) {
+            shard.rng ^= shard.rng << 13;
+            shard.rng ^= shard.rng >> 7;
+            shard.rng ^= shard.rng << 17;
+            Cell* cell = shard.cells->sample(shard.rng, row_key, col_key);
+            uint32_t age = now - __atomic_load_n(&cell->access, __ATOMIC_RELAXED);
+            bool expired = is_expired(*cell);
+            if (i == 0 || expired || age > victim_age) {
+                victim_row.swap(row_key);
+                victim_col.swap(col_key);
+                victim_age = age;
+                victim_expired = expired;
+            }
+        }
+
+        // an expired cell is gone everywhere already; an evicted one is deleted through the log
+        Cell removed;
+        del_locked(shard, victim_row, victim_col, removed);
+        if (victim_expired) {
+            shard.expired++;
+        } else {
+            shard.evicted++;
+            retire_locked(shard, victim_row, victim_col, removed, commit(MutationType::DEL, victim_row, victim_col, nullptr), true);
+        }
+        released.push_back(std::move(removed.value));
+    }
+}
+
+bool Tablet::spill_cell(Shard& shard, const std::string& row_key, const std::string& col_key, const ValueRef& value) {
+    ValueRef handle = tier->write(row_key, col_key, value);
+    if (!handle) {
+        return false;
+    }
+
+    // a write that replaced the value meanwhile wins, leaving the record dead from the start
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (!cell || cell->value != value) {
+        return false;
+    }
+    count_value_locked(shard, *cell, false);
+    cell->value.swap(handle);
+    cell->cold = true;
+    count_value_locked(shard, *cell, true);
+
+    // release the bytes (possibly their last reference) outside the lock
+    lock.unlock();
+
+    return true;
+}
+
+void Tablet::spill_lru(Shard& shard) {
+    if (shard_max_bytes == 0) {
+        return;
+    }
+    static thread_local uint64_t rng = 0x9E3779B97F4A7C15ull;
+    std::string row_key, col_key;
+    while (true) {
+
+        // under the shared lock, pick values until they cover what the shard is over by
+        std::vector<std::pair<CellKey, ValueRef>> victims;
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            size_t charged = charged_locked(shard);
+            if (charged <= shard_max_bytes) {
+                return;
+            }
+            size_t over = charged - shard_max_bytes;
+            size_t picked = 0;
+            uint32_t now = access_clock.load(std::memory_order_relaxed);
+            for (int round = 0; round < TABLET_SPILL_BATCH && picked < over; round++) {
+
+                // of a few sampled values still in memory take the one idle longest;
+                // one no bigger than its handle would free nothing
+                Cell* victim = nullptr;
+                uint32_t victim_age = 0;
+                CellKey victim_key;
+                for (int i = 0; i < TABLET_EVICT_SAMPLES; i++) {
+                    rng ^= rng << 13;
+                    rng ^= rng >> 7;
+                    rng ^= rng << 17;
+                    Cell* cell = shard.cells->sample(rng, row_key, col_key);
+                    if (!cell || cell->cold || cell->value->size() <= SEGMENT_HANDLE_BYTES) {
+                        continue;
+                    }
+                    uint32_t age = now - __atomic_load_n(&cell->access, __ATOMIC_RELAXED);
+                    if (!victim || age > victim_age) {
+                        victim = cell;
+                        victim_age = age;
+                        victim_key.first.swap(row_key);
+                        victim_key.second.swap(col_key);
+                    }
+                }
+                if (victim) {
+                    picked += victim->value->size();
+                    victims.emplace_back(std::move(victim_key), victim->value);
+                }
+            }
+        }
+
+        // write them out unlocked; stop once nothing more can move
+        size_t spilled = 0;
+        for (const auto& [key, value] : victims) {
+            spilled += spill_cell(shard, key.first, key.second, value);
+        }
+        if (spilled == 0) {
+            return;
+        }
+    }
+}
+
+void Tablet::spill(Shard& shard, const std::string& row_key, const std::string& col_key) {
+    if (!tier) {
+        return;
+    }
+
+    // a large value moves as soon as it is written
+    if (tier_min_bytes != 0) {
+        ValueRef value;
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            Cell* cell = shard.cells->find(row_key, col_key);
+            if (cell && !cell->cold && cell->value->size() >= tier_min_bytes) {
+                value = cell->value;
+            }
+        }
+        if (value) {
+            spill_cell(shard, row_key, col_key, value);
+        }
+    }
+    spill_lru(shard);
+}
+
+ValueRef Tablet::get(const std::string& row_key, const std::string& col_key) {
+    uint64_t version;
+    return get(row_key, col_key, version);
+}
+
+ValueRef Tablet::get(const std::string& row_key, const std::string& col_key, uint64_t& version) {
+
+    // lock owning shard for reading
+    Shard& shard = shard_for(row_key);
+    bool expired = false;
+    bool compressed = false;
+    bool cold = false;
+    ValueRef value;
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        Cell* cell = get_locked(shard, row_key, col_key, expired);
+        if (cell) {
+            value = cell->value;
+            compressed = cell->compressed;
+            cold = cell->cold;
+            version = cell->version;
+        }
+    }
+
+    // read from disk and decompress after unlocking, so a large value does not hold up writers
+    if (!expired) {
+        return compressed || cold ? load(shard, std::move(value), compressed, cold) : value;
+    }
+
+    // remove an expired cell as soon as it is seen rather than waiting for the sweeper
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    ValueRef removed;
+    expire_locked(shard, row_key, col_key, removed);
+
+    // release the removed blob (possibly its last reference) outside the lock
+    lock.unlock();
+
+    return nullptr;
+}
 
 bool Tablet::put(const std::string& row_key, const std::string& col_key, const std::vector<char>& bytes) {
-    
-    // lookup row_key in database
-    auto row_it = table.find(row_key);
-    
-    // if row_key does not exist, create it
-    if (row_it == table.end()) {
-        table.emplace(row_key, std::unordered_map<std::string, std::vector<char>>());
-        row_it = table.find(row_key);
+    return put(row_key, col_key, make_value(std::vector<char>(bytes)));
+}
+
+bool Tablet::put(const std::string& row_key, const std::string& col_key, ValueRef value, uint64_t expires_ms) {
+
+    // compress before locking; the block is what is stored, logged and
+    // replicated, and the original bytes are what an index keys by
+    ValueRef plain = value;
+    bool compressed = deflate(value);
+
+    // lock owning shard for writing
+    Shard& shard = shard_for(row_key);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    Cell replaced;
+    write_locked(shard, row_key, col_key, std::move(value), compressed, plain, expires_ms, replaced);
+
+    // make room if this took the shard over its share of the memory limit
+    std::vector<ValueRef> evicted;
+    evict_locked(shard, evicted);
+
+    // release the replaced and evicted blobs (possibly their last references) outside the lock
+    lock.unlock();
+
+    spill(shard, row_key, col_key);
+    return true;
+}
+
+bool Tablet::cas(const std::string& row_key, const std::string& col_key, uint64_t expected, ValueRef value, uint64_t& version) {
+    ValueRef plain = value;
+    bool compressed = deflate(value);
+
+    // lock owning shard for writing; a cell already past its deadline does not exist
+    Shard& shard = shard_for(row_key);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    ValueRef removed;
+    Cell replaced;
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (cell && expire_locked(shard, row_key, col_key, removed)) {
+        cell = nullptr;
     }
 
-    // if row_key was not created successfully, fail
-    if (row_it == table.end()) {
+    // store only over the expected version (or into an empty cell for version 0)
+    version = cell ? cell->version : 0;
+    if (cell ? cell->version != expected : expected != 0) {
         return false;
     }
+    version = write_locked(shard, row_key, col_key, std::move(value), compressed, plain, 0, replaced);
+    std::vector<ValueRef> evicted;
+    evict_locked(shard, evicted);
 
-    // set entry for col_key
-    std::unordered_map<std::string, std::vector<char>>& retrieved_row = row_it->second;
-    retrieved_row[col_key] = bytes;
+    // release the replaced and evicted blobs (possibly their last references) outside the lock
+    lock.unlock();
 
+    spill(shard, row_key, col_key);
     return true;
 }
 
-bool Tablet::del(const std::string& row_key, const std::string& col_key) {
+bool Tablet::append(const std::string& row_key, const std::string& col_key, const char* bytes, size_t len,
+                    size_t& length, uint64_t& version) {
+
+    // lock owning shard for writing and read the current value
+    Shard& shard = shard_for(row_key);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    ValueRef current, removed;
+    Cell replaced;
+    bool exists;
+    uint64_t expires_ms;
+    if (!read_locked(shard, row_key, col_key, current, exists, expires_ms, removed)) {
+        return false;
+    }
+
+    // build the longer value; recompressing it is the one step that grows with it
+    std::vector<char> joined;
+    joined.reserve((current ? current->size() : 0) + len);
+    if (current) {
+        joined.insert(joined.end(), current->begin(), current->end());
+    }
+    joined.insert(joined.end(), bytes, bytes + len);
+    length = joined.size();
+    ValueRef value = make_value(std::move(joined));
+    ValueRef plain = value;
+    bool compressed = deflate(value);
+    version = write_locked(shard, row_key, col_key, std::move(value), compressed, plain, expires_ms, replaced);
+    std::vector<ValueRef> evicted;
+    evict_locked(shard, evicted);
+
+    // release the old values (possibly their last references) outside the lock
+    lock.unlock();
+
+    spill(shard, row_key, col_key);
+    return true;
+}
+
+bool Tablet::incrby(const std::string& row_key, const std::string& col_key, int64_t delta, int64_t& result, uint64_t& version) {
+
+    // lock owning shard for writing and read the current value
+    Shard& shard = shard_for(row_key);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    ValueRef current, removed;
+    Cell replaced;
+    bool exists;
+    uint64_t expires_ms;
+    if (!read_locked(shard, row_key, col_key, current, exists, expires_ms, removed)) {
+        return false;
+    }
+
+    // the value must be a whole decimal integer, and the sum must fit
+    int64_t number = 0;
+    if (exists) {
+        std::string text(current->begin(), current->end());
+        char* end;
+        errno = 0;
+        number = strtoll(text.c_str(), &end, 10);
+        if (text.empty() || isspace((unsigned char) text[0]) || *end != '\0' || errno == ERANGE) {
+            return false;
+        }
+    }
+    if (__builtin_add_overflow(number, delta, &result)) {
+        return false;
+    }
+
+    // store the sum as text
+    std::string text = std::to_string(result);
+    ValueRef value = make_value(std::vector<char>(text.begin(), text.end()));
+    version = write_locked(shard, row_key, col_key, std::move(value), false, nullptr, expires_ms, replaced);
+    std::vector<ValueRef> evicted;
+    evict_locked(shard, evicted);
+
+    // release the old values (possibly their last references) outside the lock
+    lock.unlock();
+
+    spill(shard, row_key, col_key);
+    return true;
+}
+
+bool Tablet::expire(const std::string& row_key, const std::string& col_key, uint64_t expires_ms) {
+    ValueRef deadline = make_expiry_value(expires_ms);
+
+    // lock owning shard for writing; a cell already past its deadline does not exist
+    Shard& shard = shard_for(row_key);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    ValueRef removed;
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (!cell || expire_locked(shard, row_key, col_key, removed)) {
+        return false;
+    }
+    set_expiry_locked(shard, row_key, col_key, *cell, expires_ms);
+    commit(MutationType::EXPIRE, row_key, col_key, deadline);
+    return true;
+}
 
-    // lookup row_key in table
-    auto row_it = table.find(row_key);
+bool Tablet::expiry(const std::string& row_key, const std::string& col_key, uint64_t& expires_ms) {
 
-    // if it does not exist, fail
-    if (row_it == table.end()) {
+    // lock owning shard for reading
+    Shard& shard = shard_for(row_key);
+    std::shared_lock<std::shared_mutex> lock(shard.mtx);
+    Cell* cell = shard.cells->find(row_key, col_key);
+    if (!cell || is_expired(*cell)) {
         return false;
     }
+    expires_ms = cell->expires_ms;
+    return true;
+}
+
+bool Tablet::del(const std::string& row_key, const std::string& col_key) {
+
+    // lock owning shard for writing; a cell already past its deadline does not exist
+    Shard& shard = shard_for(row_key);
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    ValueRef expired;
+    Cell removed;
+    bool deleted = !expire_locked(shard, row_key, col_key, expired) && del_locked(shard, row_key, col_key, removed);
+    if (deleted) {
+        retire_locked(shard, row_key, col_key, removed, commit(MutationType::DEL, row_key, col_key, nullptr), true);
+    }
+
+    // release the removed blob (possibly its last reference) outside the lock
+    lock.unlock();
+
+    return deleted;
+}
+
+void Tablet::multi_get(const std::vector<CellKey>& keys, std::vector<ValueRef>& results) {
+
+    // per-thread scratch that keeps its capacity from one batch to the next
+    static thread_local std::vector<std::pair<size_t, size_t>> order;
+    static thread_local std::vector<bool> compressed, cold;
+    results.assign(keys.size(), nullptr);
+    compressed.assign(keys.size(), false);
+    cold.assign(keys.size(), false);
+
+    // visit keys grouped by shard, locking each shard once
+    group_by_shard(keys, order);
+    size_t i = 0;
+    while (i < order.size()) {
+        size_t shard_idx = order[i].first;
+        Shard& shard = shards[shard_idx];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        bool expired = false;
+        for (; i < order.size() && order[i].first == shard_idx; i++) {
+            const CellKey& key = keys[order[i].second];
+            Cell* cell = get_locked(shard, key.first, key.second, expired);
+            if (cell) {
+                results[order[i].second] = cell->value;
+                compressed[order[i].second] = cell->compressed;
+                cold[order[i].second] = cell->cold;
+            }
+        }
+    }
+
+    // read from disk and decompress with every lock released
+    for (const auto& [shard_idx, pos] : order) {
+        if (compressed[pos] || cold[pos]) {
+            results[pos] = load(shards[shard_idx], std::move(results[pos]), compressed[pos], cold[pos]);
+        }
+    }
+}
+
+std::vector<bool> Tablet::multi_put(const std::vector<CellKey>& keys, std::vector<ValueRef>& values) {
+    std::vector<bool> results(keys.size(), true);
+
+    // visit keys grouped by shard, locking each shard once; replaced values
+    // are swapped back into the caller's vector so they are freed unlocked
+    std::vector<std::pair<size_t, size_t>> order;
+    group_by_shard(keys, order);
+    std::vector<ValueRef> evicted;
+
+    // compress before locking anything, keeping the original bytes of what was compressed
+    std::vector<bool> compressed(keys.size());
+    std::vector<ValueRef> plain(keys.size());
+    for (size_t pos = 0; pos < keys.size(); pos++) {
+        ValueRef original = values[pos];
+        compressed[pos] = deflate(values[pos]);
+        if (compressed[pos]) {
+            plain[pos] = std::move(original);
+        }
+    }
+
+    size_t i = 0;
+    while (i < order.size()) {
+        size_t shard_idx = order[i].first;
+        Shard& shard = shards[shard_idx];
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        for (; i < order.size() && order[i].first == shard_idx; i++) {
+            size_t pos = order[i].second;
+            Cell replaced;
+            write_locked(shard, keys[pos].first, keys[pos].second, values[pos], compressed[pos], plain[pos], 0, replaced);
+            values[pos] = std::move(replaced.value);
+        }
+        evict_locked(shard, evicted);
+    }
+
+    // move values to disk with every lock released
+    if (tier) {
+        for (const auto& [shard_idx, pos] : order) {
+            spill(shards[shard_idx], keys[pos].first, keys[pos].second);
+        }
+    }
+    return results;
+}
+
+std::vector<bool> Tablet::multi_del(const std::vector<CellKey>& keys) {
+    std::vector<bool> results(keys.size());
+    std::vector<Cell> removed(keys.size());
+
+    // visit keys grouped by shard, locking each shard once
+    std::vector<std::pair<size_t, size_t>> order;
+    group_by_shard(keys, order);
+    size_t i = 0;
+    while (i < order.size()) {
+        size_t shard_idx = order[i].first;
+        Shard& shard = shards[shard_idx];
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        for (; i < order.size() && order[i].first == shard_idx; i++) {
+            size_t pos = order[i].second;
+            results[pos] = !expire_locked(shard, keys[pos].first, keys[pos].second, removed[pos].value)
+                && del_locked(shard, keys[pos].first, keys[pos].second, removed[pos]);
+            if (results[pos]) {
+                uint64_t at_seq = commit(MutationType::DEL, keys[pos].first, keys[pos].second, nullptr);
+                retire_locked(shard, keys[pos].first, keys[pos].second, removed[pos], at_seq, true);
+            }
+        }
+    }
+    return results;
+}
 
-    // lookup col_key in row_key map
-    std::unordered_map<std::string, std::vector<char>>& retrieved_row = row_it->second;
-    auto col_it = retrieved_row.find(col_key);
+bool Tablet::apply(const Mutation& mutation) {
 
-    // if it does not exist, fail
-    if (col_it == retrieved_row.end()) {
+    // lock owning shard for writing, decompressing first what an index needs
+    Shard& shard = shard_for(mutation.row);
+    ValueRef plain = mutation.type == MutationType::PUT && mutation.compressed
+        ? plain_for_index(shard, mutation.col, mutation.value) : nullptr;
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+
+    // apply change under its original sequence number
+    Cell released;
+    Cell* written = nullptr;
+    if (mutation.type == MutationType::PUT) {
+        written = &put_locked(shard, mutation.row, mutation.col, mutation.value, mutation.compressed, plain, released);
+    } else if (mutation.type == MutationType::EXPIRE) {
+        Cell* cell = shard.cells->find(mutation.row, mutation.col);
+        if (!cell) {
+            return false;
+        }
+        set_expiry_locked(shard, mutation.row, mutation.col, *cell, expiry_of(mutation.value));
+    } else if (!del_locked(shard, mutation.row, mutation.col, released)) {
         return false;
     }
+    uint64_t version = commit(mutation.type, mutation.row, mutation.col, mutation.value, mutation.seq, mutation.compressed);
+    if (written) {
+        written->version = version;
+    }
+    if (mutation.type != MutationType::EXPIRE) {
+        retire_locked(shard, mutation.row, mutation.col, released, version, written == nullptr);
+    }
+
+    // release the replaced blob (possibly its last reference) outside the lock
+    lock.unlock();
+
+    if (written) {
+        spill(shard, mutation.row, mutation.col);
+    }
+    return true;
+}
+
+void Tablet::scan_locked(Shard& shard, const CellKey& from, const std::string& end_row, size_t max_cells, std::vector<CellEntry>& out,
+                         uint64_t view_seq) {
+
+    // walk rows from the starting row up to the end bound
+    size_t copied = 0;
+    for (auto row_it = shard.rows.lower_bound(from.first); row_it != shard.rows.end() && copied < max_cells; ++row_it) {
+        if (!end_row.empty() && row_it->first >= end_row) {
+            break;
+        }
+
+        // the starting row resumes at the starting column; later rows start at their first column
+        const std::set<std::string>& cols = row_it->second;
+        auto col_it = row_it->first == from.first ? cols.lower_bound(from.second) : cols.begin();
+        for (; col_it != cols.end() && copied < max_cells; ++col_it) {
+
+            // the current value, unless it was written after the view opened
+            Cell* cell = shard.cells->find(row_it->first, *col_it);
+            if (cell && cell->version <= view_seq) {
+                if (!is_expired(*cell)) {
+                    out.push_back(CellEntry{row_it->first, *col_it, cell->value, cell->expires_ms, cell->compressed, cell->version, cell->cold});
+                    copied++;
+                }
+                continue;
+            }
+
+            // else the value it replaced that was current at the view, if one was kept
+            if (shard.history.empty()) {
+                continue;
+            }
+            auto hist_it = shard.history.find(CellKey(row_it->first, *col_it));
+            if (hist_it == shard.history.end()) {
+                continue;
+            }
+            for (const OldVersion& old : hist_it->second) {
+                if (old.version > view_seq || old.superseded <= view_seq) {
+                    continue;
+                }
+                if (old.expires_ms != 0 && old.expires_ms <= clock_ms()) {
+                    break;
+                }
+                out.push_back(CellEntry{row_it->first, *col_it, old.value, old.expires_ms, old.compressed, old.version, old.cold});
+                copied++;
+                break;
+            }
+        }
+    }
+}
+
+void Tablet::collect_shard(size_t shard_idx, std::vector<CellEntry>& out, uint64_t view_seq) {
+
+    // copy a page at a time under the shared lock so writers get in between pages;
+    // values are shared, so this only copies keys
+    Shard& shard = shards[shard_idx];
+    CellKey from;
+    while (true) {
+        size_t first = out.size();
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            scan_locked(shard, from, "", TABLET_COLLECT_BATCH, out, view_seq);
+        }
+        if (out.size() - first < TABLET_COLLECT_BATCH) {
+            return;
+        }
+
+        // resume just past the last cell copied
+        from = CellKey(out.back().row, out.back().col + '\0');
+    }
+}
 
-    // if it does exist, remove entry (col_key, val) from row_key map
-    retrieved_row.erase(col_it);
+void Tablet::scan_shard(size_t shard_idx, const CellKey& from, const std::string& end_row, size_t max_cells, std::vector<CellEntry>& out,
+                        uint64_t view_seq) {
 
-    // check if row_key is empty, and if so, delete (row_key, row_map) from table
-    if (retrieved_row.empty()) {
-        table.erase(row_it);
+    // lock shard for reading
+    Shard& shard = shards[shard_idx];
+    std::shared_lock<std::shared_mutex> lock(shard.mtx);
+    size_t first = out.size();
+    scan_locked(shard, from, end_row, max_cells, out, view_seq);
+
+    // read from disk and decompress after unlocking, dropping any value that fails to load
+    lock.unlock();
+    size_t kept = first;
+    for (size_t i = first; i < out.size(); i++) {
+        if (out[i].compressed || out[i].cold) {
+            out[i].value = load(shard, std::move(out[i].value), out[i].compressed, out[i].cold);
+            out[i].compressed = false;
+            out[i].cold = false;
+            if (!out[i].value) {
+                continue;
+            }
+        }
+        if (kept != i) {
+            out[kept] = std::move(out[i]);
+        }
+        kept++;
     }
+    out.resize(kept);
+}
 
-    // lastly, return true
+bool Tablet::load_value(CellEntry& cell) {
+    if (!cell.cold) {
+        return true;
+    }
+    ValueRef value = tier->read(cell.value);
+    if (!value) {
+        return false;
+    }
+    cell.value = std::move(value);
+    cell.cold = false;
     return true;
-}
\ No newline at end of file
+}
+
+void Tablet::restore(const std::string& row_key, const std::string& col_key, ValueRef value, uint64_t expires_ms, bool compressed,
+                     uint64_t version) {
+
+    // lock owning shard for writing, decompressing first what an index needs
+    Shard& shard = shard_for(row_key);
+    ValueRef plain = compressed ? plain_for_index(shard, col_key, value) : nullptr;
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    Cell replaced;
+    Cell& cell = put_locked(shard, row_key, col_key, std::move(value), compressed, plain, replaced);
+    cell.version = version;
+    if (expires_ms != 0) {
+        set_expiry_locked(shard, row_key, col_key, cell, expires_ms);
+    }
+
+    // release the replaced blob (possibly its last reference) outside the lock
+    lock.unlock();
+
+    spill(shard, row_key, col_key);
+}
+
+void Tablet::clear() {
+    for (size_t i = 0; i <= shard_mask; i++) {
+
+        // swap in an empty index under the shard's lock
+        Shard& shard = shards[i];
+        std::unique_ptr<CellMap> old_cells = make_cell_map(engine);
+        std::map<std::string, std::set<std::string>> old_rows;
+        std::set<std::pair<uint64_t, CellKey>> old_expiries;
+        std::map<CellKey, std::vector<OldVersion>> old_history;
+        std::unordered_map<std::string, ColumnIndex> old_indexes;
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        shard.cells.swap(old_cells);
+        shard.rows.swap(old_rows);
+        shard.expiries.swap(old_expiries);
+        shard.history.swap(old_history);
+        for (auto& [col_key, index] : shard.indexes) {
+            ColumnIndex& old_index = old_indexes[col_key];
+            old_index.rows_by_value.swap(index.rows_by_value);
+            old_index.value_by_row.swap(index.value_by_row);
+        }
+        shard.history_versions = 0;
+        shard.history_bytes = 0;
+        shard.value_bytes = 0;
+        shard.key_bytes = 0;
+        shard.compressed_cells = 0;
+        shard.compressed_bytes = 0;
+        shard.compressed_raw_bytes = 0;
+        shard.cold_cells = 0;
+        shard.cold_bytes = 0;
+
+        // free the old cells outside the lock
+        lock.unlock();
+    }
+    seq.store(0, std::memory_order_release);
+}
+
+TabletUsage Tablet::usage() {
+
+    // ordered index nodes: a tree node (three links and a colour) around each row or column key
+    const size_t tree_node = 4 * sizeof(void*);
+    const size_t row_node = tree_node + sizeof(std::pair<const std::string, std::set<std::string>>);
+    const size_t col_node = tree_node + sizeof(std::string);
+    const size_t expiry_node = tree_node + sizeof(std::pair<uint64_t, CellKey>);
+
+    TabletUsage usage;
+    for (size_t i = 0; i <= shard_mask; i++) {
+        Shard& shard = shards[i];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        size_t cells = shard.cells->size();
+        usage.cells += cells;
+        usage.rows += shard.rows.size();
+        usage.value_bytes += shard.value_bytes;
+        usage.index_bytes += shard.cells->memory_bytes() + shard.rows.size() * row_node + cells * col_node
+                             + shard.expiries.size() * expiry_node;
+        usage.charged_bytes += charged_locked(shard);
+        usage.evicted += shard.evicted;
+        usage.expired += shard.expired;
+        usage.compressed_cells += shard.compressed_cells;
+        usage.compressed_bytes += shard.compressed_bytes;
+        usage.compressed_raw_bytes += shard.compressed_raw_bytes;
+        usage.decompressions += shard.decompressions.load(std::memory_order_relaxed);
+        usage.decompress_ns += shard.decompress_ns.load(std::memory_order_relaxed);
+        usage.retained_versions += shard.history_versions;
+        usage.retained_bytes += shard.history_bytes;
+        usage.cold_cells += shard.cold_cells;
+        usage.cold_bytes += shard.cold_bytes;
+        for (const auto& [col_key, index] : shard.indexes) {
+            usage.indexed_cells += index.value_by_row.size();
+        }
+    }
+    usage.views = views_open.load(std::memory_order_relaxed);
+    if (tier) {
+        usage.tier = tier->stats();
+    }
+    return usage;
+}
+
+size_t Tablet::sweep_expired() {
+
+    // age every cell by one tick for eviction
+    access_clock.fetch_add(1, std::memory_order_relaxed);
+
+    size_t removed_total = 0;
+    for (size_t i = 0; i <= shard_mask; i++) {
+        Shard& shard = shards[i];
+        while (true) {
+
+            // peek under the shared lock, so shards with nothing due are never locked exclusively
+            uint64_t now = clock_ms();
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                if (shard.expiries.empty() || shard.expiries.begin()->first > now) {
+                    break;
+                }
+            }
+
+            // remove one batch of due cells in deadline order
+            std::vector<ValueRef> released;
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            while (released.size() < TABLET_SWEEP_BATCH && !shard.expiries.empty() && shard.expiries.begin()->first <= now) {
+                CellKey key = shard.expiries.begin()->second;
+                Cell removed;
+                del_locked(shard, key.first, key.second, removed);
+                shard.expired++;
+                released.push_back(std::move(removed.value));
+            }
+
+            // release the removed blobs outside the lock, then give waiting requests a turn
+            lock.unlock();
+            removed_total += released.size();
+            if (released.size() < TABLET_SWEEP_BATCH) {
+                break;
+            }
+        }
+    }
+    return removed_total;
+}
+
+uint64_t Tablet::open_view() {
+
+    // count the view before reading the counter: a change numbered after this
+    // read then sees the count and keeps the value it replaces (see commit())
+    std::lock_guard<std::mutex> guard(views_mtx);
+    views_open.fetch_add(1, std::memory_order_seq_cst);
+    uint64_t view_seq = seq.load(std::memory_order_seq_cst);
+    views.insert(view_seq);
+    return view_seq;
+}
+
+void Tablet::close_view(uint64_t view_seq) {
+    std::lock_guard<std::mutex> guard(views_mtx);
+    auto it = views.find(view_seq);
+    if (it != views.end()) {
+        views.erase(it);
+        views_open.fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+
+size_t Tablet::reclaim_versions() {
+
+    // values superseded at or before the oldest open view are visible to no view, open or yet to open
+    uint64_t oldest;
+    {
+        std::lock_guard<std::mutex> guard(views_mtx);
+        oldest = views.empty() ? seq.load(std::memory_order_seq_cst) : *views.begin();
+    }
+
+    size_t dropped_total = 0;
+    for (size_t i = 0; i <= shard_mask; i++) {
+
+        // peek under the shared lock, so shards keeping nothing are never locked exclusively
+        Shard& shard = shards[i];
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            if (shard.history.empty()) {
+                continue;
+            }
+        }
+
+        // each key's old values are in the order they were replaced, so drop a prefix
+        std::vector<ValueRef> released;
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        for (auto it = shard.history.begin(); it != shard.history.end();) {
+            std::vector<OldVersion>& versions = it->second;
+            size_t n = 0;
+            while (n < versions.size() && versions[n].superseded <= oldest) {
+                shard.history_bytes -= versions[n].value->size();
+                released.push_back(std::move(versions[n].value));
+                n++;
+            }
+            shard.history_versions -= n;
+            versions.erase(versions.begin(), versions.begin() + n);
+            if (!versions.empty()) {
+                ++it;
+                continue;
+            }
+
+            // a deleted cell leaves the ordered index with its last old value
+            const CellKey& key = it->first;
+            if (!shard.cells->find(key.first, key.second)) {
+                auto row_it = shard.rows.find(key.first);
+                if (row_it != shard.rows.end()) {
+                    row_it->second.erase(key.second);
+                    if (row_it->second.empty()) {
+                        shard.rows.erase(row_it);
+                    }
+                }
+            }
+            it = shard.history.erase(it);
+        }
+
+        // release the dropped blobs outside the lock
+        lock.unlock();
+        dropped_total += released.size();
+    }
+    return dropped_total;
+}
+
+size_t Tablet::compact_tier() {
+    if (!tier) {
+        return 0;
+    }
+    tier->remove_dead();
+    uint32_t file_id;
+    if (!tier->pick_compaction(file_id)) {
+        return 0;
+    }
+
+    // move each value its cell still holds; values only views hold die with the views
+    size_t moved = 0;
+    bool ok = tier->scan(file_id, [&](const std::string& row_key, const std::string& col_key, uint64_t value_offset) {
+        Shard& shard = shard_for(row_key);
+        ValueRef handle;
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            Cell* cell = shard.cells->find(row_key, col_key);
+            if (cell && cell->cold && SegmentStore::locates(cell->value, file_id, value_offset)) {
+                handle = cell->value;
+            }
+        }
+        if (!handle) {
+            return;
+        }
+
+        // copy it unlocked, then swap handles unless a write got there first;
+        // both locate the same bytes, so the shard's totals stay as they are
+        ValueRef bytes = tier->read(handle);
+        ValueRef moved_handle = bytes ? tier->write(row_key, col_key, bytes) : nullptr;
+        if (!moved_handle) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        Cell* cell = shard.cells->find(row_key, col_key);
+        if (cell && cell->value == handle) {
+            cell->value.swap(moved_handle);
+            moved++;
+        }
+    });
+    if (!ok) {
+        fprintf(stderr, "Tablet: cannot compact segment file %u\n", file_id);
+        tier->abandon_compaction(file_id);
+    }
+    return moved;
+}
+
+void Tablet::advance_seq(uint64_t at_seq) {
+    uint64_t current = seq.load(std::memory_order_relaxed);
+    while (current < at_seq && !seq.compare_exchange_weak(current, at_seq, std::memory_order_acq_rel)) {
+    }
+}
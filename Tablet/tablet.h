@@ -1,42 +1,251 @@
 #ifndef tablet_header
 #define tablet_header
 
-#include <optional>
 #include <vector>
-#include <unordered_map>
 #include <string>
+#include <memory>
+#include <shared_mutex>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include "value.h"
+#include "mutation.h"
+#include "cellmap.h"
+#include "../Tier/segment.h"
+
+/**
+ * @brief default number of lock stripes in a Tablet (rounded up to a power of two)
+ */
+#define TABLET_DEFAULT_SHARDS 64
+
+/**
+ * @brief bytes charged against a memory limit for each cell besides its keys and value (index entries)
+ */
+#define TABLET_CELL_OVERHEAD 128
+
+/**
+ * @brief cells sampled per eviction; the least recently used of them is evicted
+ */
+#define TABLET_EVICT_SAMPLES 5
+
+/**
+ * @brief most expired cells removed per shard lock hold by sweep_expired()
+ */
+#define TABLET_SWEEP_BATCH 64
+
+/**
+ * @brief a value is kept compressed only if that saves at least 1/TABLET_COMPRESS_MIN_SAVING of it
+ */
+#define TABLET_COMPRESS_MIN_SAVING 8
+
+/**
+ * @brief view_seq that reads cells as they are now rather than as of a view
+ */
+#define TABLET_VIEW_LATEST UINT64_MAX
+
+/**
+ * @brief cells collect_shard() copies per acquisition of the shard's lock
+ */
+#define TABLET_COLLECT_BATCH 1024
+
+/**
+ * @brief most cells moved to the segment store per pass over an overfull shard
+ */
+#define TABLET_SPILL_BATCH 64
+
+/**
+ * @brief (row key, column key) pair naming one cell
+ */
+using CellKey = std::pair<std::string, std::string>;
+
+/**
+ * @brief one cell copied out of a Tablet (the value is shared, not copied; it
+ *        is a compressed block if compressed is set, and a segment store
+ *        handle if cold is set, see Tablet::load_value())
+ */
+struct CellEntry {
+    std::string row;
+    std::string col;
+    ValueRef value;
+    uint64_t expires_ms = 0;
+    bool compressed = false;
+    uint64_t version = 0;
+    bool cold = false;
+};
+
+/**
+ * @brief Size of a Tablet's contents, summed over its shards
+ */
+struct TabletUsage {
+    uint64_t cells = 0;
+    uint64_t rows = 0;
+
+    /**
+     * @brief bytes of stored values, and estimated bytes of the cell and ordered indexes holding them
+     */
+    uint64_t value_bytes = 0;
+    uint64_t index_bytes = 0;
+
+    /**
+     * @brief bytes counted against the memory limit (values, keys and TABLET_CELL_OVERHEAD per cell)
+     */
+    uint64_t charged_bytes = 0;
+
+    /**
+     * @brief cells removed to stay under the memory limit, and cells removed after their deadline passed
+     */
+    uint64_t evicted = 0;
+    uint64_t expired = 0;
+
+    /**
+     * @brief cells stored compressed, their stored and original value bytes,
+     *        and reads that decompressed a value and the time they spent doing so
+     */
+    uint64_t compressed_cells = 0;
+    uint64_t compressed_bytes = 0;
+    uint64_t compressed_raw_bytes = 0;
+    uint64_t decompressions = 0;
+    uint64_t decompress_ns = 0;
+
+    /**
+     * @brief open read views, and the superseded values kept for them and their bytes
+     */
+    uint64_t views = 0;
+    uint64_t retained_versions = 0;
+    uint64_t retained_bytes = 0;
+
+    /**
+     * @brief cells whose value is in the segment store and those values' bytes
+     *        (value_bytes and the compressed totals count only what is in memory)
+     */
+    uint64_t cold_cells = 0;
+    uint64_t cold_bytes = 0;
+
+    /**
+     * @brief the segment store's files and counters
+     */
+    SegmentStats tier;
+
+    /**
+     * @brief cells entered in secondary indexes
+     */
+    uint64_t indexed_cells = 0;
+};
 
 /**
  * @class Tablet
- * @brief In‐memory two‐level key→(row, column)→blob store.
+ * @brief Thread-safe in‐memory two‐level key→(row, column)→blob store.
+ *
+ * Rows are hash-partitioned across a fixed number of independently locked
+ * shards.  Each shard indexes its cells with a CellMap (nested row/column
+ * maps or one flat open-addressing table) holding immutable shared blobs,
+ * plus an ordered index of its row and column keys for range scans.  Readers
+ * take a shard's lock shared, writers take it exclusive, so operations on rows
+ * in different shards never contend.
+ *
+ * Every change is stamped with a commit sequence number and reported to the
+ * attached MutationListeners (write-ahead log, replication) in that order.
+ *
+ * A cell may carry a wall-clock deadline, after which reads treat it as
+ * absent.  An expired cell is removed when a read finds it or when
+ * sweep_expired() reaches it; since deadlines are logged and replicated, every
+ * copy of the tablet expires the same cells, so removals are not logged.
+ * With a memory limit, each shard keeps to an equal share of it by evicting
+ * the least recently used of a few sampled cells whenever a write takes it
+ * over; evictions are logged as deletes.
+ *
+ * With a segment store attached (set_tier()), values move to disk instead:
+ * a value from a size threshold up as soon as it is written, and, with a
+ * memory limit, the least recently used of a few sampled values whenever a
+ * write takes its shard over its share.  Keys, deadlines and versions stay in
+ * memory, so only reading a cold value touches the disk (one pread, outside
+ * the shard's lock), and a lookup of a missing cell never does.  The value is
+ * written to disk outside the lock too and swapped for its handle only if
+ * the cell still holds it.  Nothing is evicted, and nothing about the move
+ * is logged: the log, snapshots and replication carry the values themselves.
  *
- * Uses an outer unordered_map keyed by row, and an inner unordered_map
- * keyed by column, to hold std::vector<char> blobs.
+ * With compression enabled, values from a size threshold up are stored as
+ * compressed blocks when that saves space.  Reads decompress outside the
+ * shard's lock; the log, snapshots and replication carry the blocks as they
+ * are, so a value is compressed once, where it is first written.
+ *
+ * Each cell's version is the sequence number of the write that stored its
+ * value.  cas(), append() and incrby() read, check and replace a cell under
+ * its shard's lock, so they need one round trip and concurrent callers never
+ * retry; they are logged as the PUT of the value they produce, so replaying
+ * them is as idempotent as replaying any other write.
+ *
+ * A read view (open_view()) fixes a sequence number; scan_shard() and
+ * collect_shard() at that view return cells exactly as they were then, while
+ * writes carry on.  As long as any view is open, a write that replaces or
+ * deletes a value keeps the old one in its shard's history, stamped with the
+ * range of sequence numbers it was current for.  reclaim_versions() drops old
+ * values no open view can see.  Deadlines are not versioned: a view sees a
+ * cell's deadline as it is now, and expired cells are absent from every view.
+ *
+ * A secondary index (add_index()) maps the values of one column to the rows
+ * holding them.  Each shard indexes its own rows, updated under the shard's
+ * lock by the same write that changes the cell, so find() never sees an
+ * index that disagrees with the cells; it looks the value up in every shard
+ * in turn.  Indexes hold the latest values only, and are not logged or
+ * snapshotted: every copy of the tablet declares its own and builds them
+ * from the cells it stores.
  */
 class Tablet {
 
     /* public methods */
     public:
         /**
-         * @brief Retrieve the byte vector at the specified row and column.
+         * @brief Construct an empty tablet.
+         *
+         * @param num_shards  Number of lock stripes, rounded up to a power of two.
+         * @param engine      Cell index used by every shard.
+         */
+        explicit Tablet(size_t num_shards = TABLET_DEFAULT_SHARDS, CellEngine engine = CellEngine::NESTED);
+
+        /**
+         * @brief Retrieve the blob at the specified row and column.
          *
-         * Looks up the outer map by @p row_key, then the inner map by @p col_key.
-         * If found, returns a copy of the stored std::vector<char>;
-         * otherwise returns std::nullopt.
+         * Looks up the cell in the shard owning @p row_key.
+         * If found, returns a shared handle to the stored blob without copying
+         * its bytes; otherwise returns nullptr.
          *
          * @param row_key  The row identifier in the table.
          * @param col_key  The column identifier within that row.
-         * @return A std::optional containing the blob if present,
-         *         or std::nullopt if the row or column does not exist.
+         * @return A handle to the blob if present,
+         *         or nullptr if the row or column does not exist.
          */
-        std::optional<std::vector<char>> get(const std::string& row_key, const std::string& col_key);
+        ValueRef get(const std::string& row_key, const std::string& col_key);
+
+        /**
+         * @brief Retrieve a blob together with its version.
+         *
+         * @param version  Set to the cell's version if it exists.
+         * @return as get()
+         */
+        ValueRef get(const std::string& row_key, const std::string& col_key, uint64_t& version);
 
         /**
          * @brief Insert or overwrite a blob at the specified row and column.
          *
-         * If the row does not exist, it is created.  The blob in @p bytes
-         * is copied into the table at (row_key, col_key), replacing any
-         * existing data.
+         * If the row does not exist, it is created.  The handle in @p value
+         * is stored at (row_key, col_key), replacing any existing data and
+         * deadline; the bytes themselves are not copied.
+         *
+         * @param row_key     The row identifier in the table.
+         * @param col_key     The column identifier within that row.
+         * @param value       The data blob to store (shared).
+         * @param expires_ms  Deadline for the new cell (see clock_ms()), or 0 for none.
+         * @return true if the operation succeeded, false if entry does not exist and entry allocation failed
+         */
+        bool put(const std::string& row_key, const std::string& col_key, ValueRef value, uint64_t expires_ms = 0);
+
+        /**
+         * @brief Insert or overwrite a blob at the specified row and column.
          *
          * @param row_key  The row identifier in the table.
          * @param col_key  The column identifier within that row.
@@ -45,28 +254,593 @@ class Tablet {
          */
         bool put(const std::string& row_key, const std::string& col_key, const std::vector<char>& bytes);
 
+        /**
+         * @brief Store a blob only if the cell is still at an expected version.
+         *
+         * Like put(), this replaces the cell's deadline.
+         *
+         * @param expected  Version the cell must have, or 0 if it must not exist.
+         * @param value     The data blob to store (shared).
+         * @param version   Set to the new version on success, else to the current one (0 if absent).
+         * @return false if the cell's version did not match
+         */
+        bool cas(const std::string& row_key, const std::string& col_key, uint64_t expected, ValueRef value, uint64_t& version);
+
+        /**
+         * @brief Append bytes to a cell's value, creating the cell if it does not exist.
+         *
+         * The cell keeps its deadline.
+         *
+         * @param bytes    Bytes to append.
+         * @param len      Number of bytes.
+         * @param length   Set to the length of the new value.
+         * @param version  Set to the new version.
+         * @return false if the stored value could not be read (a corrupt compressed block)
+         */
+        bool append(const std::string& row_key, const std::string& col_key, const char* bytes, size_t len,
+                    size_t& length, uint64_t& version);
+
+        /**
+         * @brief Add to a cell holding a decimal 64-bit integer, treating a missing cell as 0.
+         *
+         * The cell keeps its deadline.
+         *
+         * @param delta    Amount to add (may be negative).
+         * @param result   Set to the new value.
+         * @param version  Set to the new version.
+         * @return false if the cell does not hold an integer or the sum overflows (the cell is unchanged)
+         */
+        bool incrby(const std::string& row_key, const std::string& col_key, int64_t delta, int64_t& result, uint64_t& version);
+
         /**
          * @brief Delete the blob at the specified row and column.
          *
-         * If the cell exists, removes it and, if that leaves the row empty,
-         * also removes the row from the table.
+         * If the cell exists, removes it (an emptied row no longer exists).
          *
          * @param row_key  The row identifier in the table.
          * @param col_key  The column identifier within that row.
          * @return true if a blob was present and removed, false if resource does not exist
          */
         bool del(const std::string& row_key, const std::string& col_key);
-    
-    /* private fields */
+
+        /**
+         * @brief Set or clear the deadline of an existing cell.
+         *
+         * @param row_key     The row identifier in the table.
+         * @param col_key     The column identifier within that row.
+         * @param expires_ms  New deadline (see clock_ms()), or 0 to keep the cell indefinitely.
+         * @return false if the cell does not exist
+         */
+        bool expire(const std::string& row_key, const std::string& col_key, uint64_t expires_ms);
+
+        /**
+         * @brief Read the deadline of a cell.
+         *
+         * @param expires_ms  The cell's deadline, 0 if it has none.
+         * @return false if the cell does not exist
+         */
+        bool expiry(const std::string& row_key, const std::string& col_key, uint64_t& expires_ms);
+
+        /**
+         * @brief Retrieve many cells, taking each shard's lock once for the whole batch.
+         *
+         * Once a thread has read a batch this large, further batches allocate
+         * nothing beyond what @p results needs to grow.
+         *
+         * @param keys  Cells to read.
+         * @param results  Replaced with one handle per key, in key order; nullptr where the cell does not exist.
+         */
+        void multi_get(const std::vector<CellKey>& keys, std::vector<ValueRef>& results);
+
+        /**
+         * @brief Insert or overwrite many cells, taking each shard's lock once for the whole batch.
+         *
+         * Writes to the same cell within a batch are applied in batch order.
+         *
+         * @param keys    Cells to write.
+         * @param values  One value per key; on return holds the values they replaced.
+         * @return One result per key, as for put().
+         */
+        std::vector<bool> multi_put(const std::vector<CellKey>& keys, std::vector<ValueRef>& values);
+
+        /**
+         * @brief Delete many cells, taking each shard's lock once for the whole batch.
+         *
+         * @param keys  Cells to delete.
+         * @return One result per key, as for del().
+         */
+        std::vector<bool> multi_del(const std::vector<CellKey>& keys);
+
+        /**
+         * @brief Apply a change that already has a sequence number (log replay, replication).
+         *
+         * The change is reported to listeners with its original sequence
+         * number, and later local changes are numbered after it.
+         *
+         * @param mutation  Change to apply; mutation.seq must be non-zero.
+         * @return true if the cell changed (a DEL of a missing cell is a no-op)
+         */
+        bool apply(const Mutation& mutation);
+
+        /**
+         * @brief Open a read view of the tablet as of now.
+         *
+         * @return the view's sequence number: every change up to it, and none
+         *         after, is visible through it.  Pass it to close_view() when done.
+         */
+        uint64_t open_view();
+
+        /**
+         * @brief Close a view returned by open_view(), letting the old values only it could see be reclaimed.
+         */
+        void close_view(uint64_t view_seq);
+
+        /**
+         * @brief Drop old values that no open view can see, one shard at a time.
+         *
+         * Should be called regularly (e.g. alongside sweep_expired()).
+         *
+         * @return number of old values dropped
+         */
+        size_t reclaim_versions();
+
+        /**
+         * @brief Copy out every cell of one shard as of a view, in (row, col) order.
+         *
+         * The shard's lock is taken (shared) for TABLET_COLLECT_BATCH cells at
+         * a time, so writers wait for one batch rather than the whole shard.
+         * Values are copied as stored (possibly compressed).
+         *
+         * @param shard_idx  Shard to copy, below num_shards().
+         * @param out        Cells are appended here.
+         * @param view_seq   A view from open_view().
+         */
+        void collect_shard(size_t shard_idx, std::vector<CellEntry>& out, uint64_t view_seq);
+
+        /**
+         * @brief Copy out the next cells of one shard in (row, col) order, holding only that shard's lock (shared).
+         *
+         * @param shard_idx  Shard to read, below num_shards().
+         * @param from       First cell to return (inclusive); it need not exist.
+         * @param end_row    Stop before this row (exclusive), or "" for no bound.
+         * @param max_cells  Most cells to copy.
+         * @param out        Cells are appended here, their values decompressed; fewer than
+         *                   @p max_cells means the shard is exhausted.
+         * @param view_seq   A view from open_view(), or TABLET_VIEW_LATEST to read the cells as they are now.
+         */
+        void scan_shard(size_t shard_idx, const CellKey& from, const std::string& end_row, size_t max_cells, std::vector<CellEntry>& out,
+                        uint64_t view_seq = TABLET_VIEW_LATEST);
+
+        /**
+         * @brief Replace a cold entry's handle by the value it locates (left as stored, possibly compressed).
+         *
+         * @param cell  Entry from collect_shard(); unchanged unless cold.
+         * @return false if the value could not be read
+         */
+        bool load_value(CellEntry& cell);
+
+        /**
+         * @brief Insert a cell without sequencing it or notifying listeners (snapshot load).
+         *
+         * @param row_key     The row identifier in the table.
+         * @param col_key     The column identifier within that row.
+         * @param value       The data blob to store (shared).
+         * @param expires_ms  The cell's deadline, or 0 for none.
+         * @param compressed  Whether @p value is a compressed block.
+         * @param version     The cell's version.
+         */
+        void restore(const std::string& row_key, const std::string& col_key, ValueRef value, uint64_t expires_ms = 0,
+                     bool compressed = false, uint64_t version = 0);
+
+        /**
+         * @brief Remove every cell and reset last_seq() to 0, without notifying listeners
+         *        (a replica discarding its state before a full resync).
+         *
+         * Shards are emptied one at a time, so concurrent readers may briefly
+         * see some shards emptied and others not.
+         */
+        void clear();
+
+        /**
+         * @brief Raise last_seq() to at least @p at_seq (after restoring a snapshot taken at that point).
+         */
+        void advance_seq(uint64_t at_seq);
+
+        /**
+         * @brief Remove cells whose deadline has passed, one shard at a time.
+         *
+         * Takes each shard's lock for at most TABLET_SWEEP_BATCH removals at a
+         * time, so requests are never held up for long.  Also advances the
+         * clock that eviction ages cells by, so it should be called regularly
+         * (e.g. every few hundred milliseconds).
+         *
+         * @return number of cells removed
+         */
+        size_t sweep_expired();
+
+        /**
+         * @brief Store values of at least @p min_bytes compressed when that saves space.
+         *
+         * Must be called before the tablet is shared between threads.
+         *
+         * @param min_bytes  Smallest value worth compressing, or 0 to store every value as is.
+         */
+        void set_compression(size_t min_bytes);
+
+        /**
+         * @brief Move values to segment files under @p dir rather than keeping them all in memory.
+         *
+         * Values of at least @p min_bytes move as they are written, and with a
+         * memory limit cells are moved instead of evicted.  Must be called
+         * before the tablet is shared between threads.
+         *
+         * @param dir        Directory for segment files (files from an earlier run are deleted).
+         * @param min_bytes  Smallest value moved as soon as it is written, or 0 to move values only to stay under the memory limit.
+         * @return false if the directory cannot be used
+         */
+        bool set_tier(const std::string& dir, size_t min_bytes);
+
+        /**
+         * @brief Compact one segment file whose values are mostly dead, moving its live
+         *        values to the current file, and delete files nothing refers to.
+         *
+         * Should be called regularly (e.g. alongside sweep_expired()).
+         *
+         * @return number of values moved
+         */
+        size_t compact_tier();
+
+        /**
+         * @brief Maintain a secondary index on column @p col_key, indexing the cells already stored.
+         *
+         * Must be called before the tablet is shared between threads.
+         */
+        void add_index(const std::string& col_key);
+
+        /**
+         * @brief Look up the rows whose cell in an indexed column holds @p value.
+         *
+         * @param col_key  An indexed column.
+         * @param value    Bytes the cell must hold (decompressed).
+         * @param limit    Most rows to return.
+         * @param rows     Receives the rows in order.
+         * @return false if @p col_key is not indexed
+         */
+        bool find(const std::string& col_key, const std::string& value, size_t limit, std::vector<std::string>& rows);
+
+        /**
+         * @brief Bound the tablet's memory, evicting cells as writes exceed it.
+         *
+         * Must be called before the tablet is shared between threads.
+         *
+         * @param max_bytes  Limit on TabletUsage::charged_bytes, or 0 for none.
+         */
+        void set_max_memory(uint64_t max_bytes);
+
+        /**
+         * @brief Attach an observer for every subsequent change.
+         *
+         * Must be called before the tablet is shared between threads.
+         *
+         * @param listener  Observer, which must outlive the tablet.
+         */
+        void add_listener(MutationListener* listener);
+
+        /**
+         * @brief Count cells, rows and memory, holding one shard's lock (shared) at a time.
+         */
+        TabletUsage usage();
+
+        /**
+         * @brief Sequence number of the most recent change (0 if none).
+         */
+        uint64_t last_seq() const;
+
+        /**
+         * @brief Number of lock stripes rows are partitioned across.
+         */
+        size_t num_shards() const;
+
+        /**
+         * @brief Wall-clock milliseconds since the epoch, the clock deadlines are measured by.
+         */
+        static uint64_t clock_ms();
+
+    /* private types */
     private:
         /**
-         * @brief Two‐level map: row key → (column key → byte‐vector blob).
+         * @brief One shard's part of a secondary index: the rows holding each value
+         *        in the column, and each row's value, so that an entry is dropped
+         *        without reading the cell (which may be compressed or cold).
+         */
+        struct ColumnIndex {
+            std::unordered_map<std::string, std::unordered_set<std::string>> rows_by_value;
+            std::unordered_map<std::string, std::string> value_by_row;
+        };
+
+        /**
+         * @brief A value superseded while a view was open, current for sequence numbers [version, superseded).
+         */
+        struct OldVersion {
+            ValueRef value;
+            uint64_t version;
+            uint64_t superseded;
+            uint64_t expires_ms;
+            bool compressed;
+            bool cold;
+        };
+
+        /**
+         * @brief One lock stripe: a reader/writer lock and the cells of the rows hashed to it.
+         *
+         * rows orders the shard's keys (row, then column) for scans; it is
+         * only touched when a cell is created or removed, never on overwrite,
+         * and keeps a deleted cell's key while history holds old values of it.
+         * history holds each cell's old values, oldest first.
+         * expiries orders the cells that have a deadline by it.  value_bytes
+         * and key_bytes total the sizes of the shard's values and keys.
+         * Aligned to a cache line so that lock traffic on one shard does not
+         * invalidate its neighbours.
+         */
+        struct alignas(64) Shard {
+            std::shared_mutex mtx;
+            std::unique_ptr<CellMap> cells;
+            std::map<std::string, std::set<std::string>> rows;
+            std::set<std::pair<uint64_t, CellKey>> expiries;
+            size_t value_bytes = 0;
+            size_t key_bytes = 0;
+
+            /**
+             * @brief eviction sampling state, and removal counters, all guarded by mtx (exclusive)
+             */
+            uint64_t rng = 0;
+            uint64_t evicted = 0;
+            uint64_t expired = 0;
+
+            /**
+             * @brief compressed value totals, guarded by mtx; decompressions happen
+             *        outside it and are counted atomically
+             */
+            size_t compressed_cells = 0;
+            size_t compressed_bytes = 0;
+            size_t compressed_raw_bytes = 0;
+            std::atomic<uint64_t> decompressions{0};
+            std::atomic<uint64_t> decompress_ns{0};
+
+            /**
+             * @brief cells whose value is in the segment store and those values' bytes, guarded by mtx
+             */
+            size_t cold_cells = 0;
+            size_t cold_bytes = 0;
+
+            /**
+             * @brief old values kept for open views, and their count and bytes, guarded by mtx
+             */
+            std::map<CellKey, std::vector<OldVersion>> history;
+            size_t history_versions = 0;
+            size_t history_bytes = 0;
+
+            /**
+             * @brief secondary indexes by column, guarded by mtx (the columns are fixed once the tablet is shared)
+             */
+            std::unordered_map<std::string, ColumnIndex> indexes;
+        };
+
+    /* private methods */
+    private:
+        /**
+         * @brief Select the shard owning @p row_key.
+         */
+        Shard& shard_for(const std::string& row_key);
+        size_t shard_index(const std::string& row_key) const;
+
+        /**
+         * @brief Tag batch positions with their shard and sort by (shard, position),
+         *        so same-cell writes keep batch order.
+         *
+         * @param keys batch to group
+         * @param tagged replaced with the (shard, position) pairs; its capacity is reused
+         */
+        void group_by_shard(const std::vector<CellKey>& keys, std::vector<std::pair<size_t, size_t>>& tagged) const;
+
+        /**
+         * @brief Unlocked single-cell operations; the caller holds the shard's lock.
+         *
+         * get_locked() needs it only shared: it treats an expired cell as
+         * absent, setting @p expired.  put_locked() hands back the cell as it
+         * was in @p replaced (no value if it is new) and the written cell,
+         * whose version the caller sets; del_locked() hands back the removed
+         * cell.  get_locked() and put_locked() stamp the cell's access tick
+         * when there is a memory limit.  A compressed value comes with its
+         * original bytes in @p plain for an indexed column's index, so
+         * nothing is decompressed under the lock (see plain_for_index()).
+         */
+        Cell* get_locked(Shard& shard, const std::string& row_key, const std::string& col_key, bool& expired);
+        Cell& put_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef value, bool compressed,
+                         const ValueRef& plain, Cell& replaced);
+        static bool del_locked(Shard& shard, const std::string& row_key, const std::string& col_key, Cell& removed);
+
+        /**
+         * @brief Enter a row's value in one shard's part of a column index (@p value
+         *        nullptr drops the entry); the caller holds the shard's lock exclusively.
+         *
+         * @param value  The cell's bytes, decompressed.
+         */
+        static void index_locked(ColumnIndex& index, const std::string& row_key, const ValueRef& value);
+
+        /**
+         * @brief Keep a replaced or deleted cell's value for the open views, if there are any; the caller holds the shard's lock exclusively.
+         *
+         * @param old         The cell as it was; its value is moved into the history.
+         * @param superseded  Sequence number of the change that replaced or deleted it.
+         * @param deleted     Whether the change deleted the cell (its key stays in rows for the views).
+         */
+        void retire_locked(Shard& shard, const std::string& row_key, const std::string& col_key, Cell& old, uint64_t superseded, bool deleted);
+
+        /**
+         * @brief Copy the cells visible at a view, starting at @p from, as scan_shard() does but without decompressing; the caller holds the shard's lock.
+         */
+        static void scan_locked(Shard& shard, const CellKey& from, const std::string& end_row, size_t max_cells, std::vector<CellEntry>& out,
+                                uint64_t view_seq);
+
+        /**
+         * @brief Store a new value, commit it, and give the cell @p expires_ms; the caller holds the shard's lock exclusively.
+         *
+         * @return the cell's new version
+         */
+        uint64_t write_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef value, bool compressed,
+                              const ValueRef& plain, uint64_t expires_ms, Cell& replaced);
+
+        /**
+         * @brief Read a cell's current bytes for a read-modify-write, removing it if it has expired.
+         *
+         * @param bytes       Set to the value (decompressed), or left empty if the cell does not exist.
+         * @param exists      Set to whether the cell exists.
+         * @param expires_ms  Set to the cell's deadline.
+         * @param removed     Receives the value of an expired cell, to be released unlocked.
+         * @return false if the stored value is a corrupt compressed block
+         */
+        bool read_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef& bytes, bool& exists,
+                         uint64_t& expires_ms, ValueRef& removed);
+        static void set_expiry_locked(Shard& shard, const std::string& row_key, const std::string& col_key, Cell& cell, uint64_t expires_ms);
+
+        /**
+         * @brief Add a cell's value to (or, with @p add false, remove it from) the shard's byte totals.
+         */
+        static void count_value_locked(Shard& shard, const Cell& cell, bool add);
+
+        /**
+         * @brief Compress a value about to be written if it is large enough and compresses well enough.
+         *
+         * @return whether @p value was replaced by a compressed block
+         */
+        bool deflate(ValueRef& value) const;
+
+        /**
+         * @brief Decompress a stored block read from @p shard (without its lock), counting the time taken.
          *
-         * The outer map’s key is the row identifier.  Each value is another
-         * unordered_map whose key is the column identifier and whose value
-         * is the stored std::vector<char> blob.
+         * @return the original bytes, or nullptr if the block is corrupt
+         */
+        static ValueRef inflate(Shard& shard, const ValueRef& block);
+
+        /**
+         * @brief Decompress a block bound for @p col_key in @p shard, before taking its lock, if the column is indexed.
+         *
+         * @return the original bytes for put_locked()'s @p plain, or nullptr if the column is not indexed
+         */
+        static ValueRef plain_for_index(Shard& shard, const std::string& col_key, const ValueRef& block);
+
+        /**
+         * @brief Turn a stored value read from @p shard into its bytes: read it
+         *        from the segment store if cold, then decompress it if compressed.
+         *
+         * @return the bytes, or nullptr if they could not be read
+         */
+        ValueRef load(Shard& shard, ValueRef value, bool compressed, bool cold);
+
+        /**
+         * @brief Move a cell's value to the segment store if it is large enough, then
+         *        least recently used values while the shard is over its share of the
+         *        memory limit; the caller holds no lock.
+         */
+        void spill(Shard& shard, const std::string& row_key, const std::string& col_key);
+
+        /**
+         * @brief Move values sampled least recently used while the shard is over its share of the memory limit; the caller holds no lock.
+         */
+        void spill_lru(Shard& shard);
+
+        /**
+         * @brief Write @p value to the segment store and give the cell its handle, if the cell still holds @p value; the caller holds no lock.
+         *
+         * @return whether the cell now holds the handle
+         */
+        bool spill_cell(Shard& shard, const std::string& row_key, const std::string& col_key, const ValueRef& value);
+
+        /**
+         * @brief Whether a cell's deadline has passed.
+         */
+        static bool is_expired(const Cell& cell);
+
+        /**
+         * @brief Remove a cell if its deadline has passed, without logging it; the caller holds the shard's lock (exclusive).
+         *
+         * @param removed  Receives the removed value, to be released unlocked.
+         * @return true if the cell was removed
+         */
+        static bool expire_locked(Shard& shard, const std::string& row_key, const std::string& col_key, ValueRef& removed);
+
+        /**
+         * @brief Bytes of a shard counted against the memory limit; the caller holds its lock.
+         */
+        static size_t charged_locked(const Shard& shard);
+
+        /**
+         * @brief Evict sampled cells while the shard is over its share of the memory limit,
+         *        unless a segment store takes them (spill()); the caller holds the shard's lock (exclusive).
+         *
+         * @param released  Receives the evicted values, to be released unlocked.
+         */
+        void evict_locked(Shard& shard, std::vector<ValueRef>& released);
+
+        /**
+         * @brief Stamp a change with a sequence number and report it to listeners.
+         *
+         * Called with the cell's shard still locked, so changes to one cell are
+         * numbered in the order they were applied.
+         *
+         * @param seq         Sequence number to record, or 0 to assign the next one.
+         * @param compressed  Whether @p value is a compressed block.
+         * @return the change's sequence number
+         */
+        uint64_t commit(MutationType type, const std::string& row_key, const std::string& col_key, const ValueRef& value, uint64_t seq = 0, bool compressed = false);
+
+    /* private fields */
+    private:
+        /**
+         * @brief segment store for cold values (nullptr for none), declared before
+         *        the shards so the handles they hold are dropped first, and the
+         *        smallest value moved to it as soon as it is written (0 = none)
+         */
+        std::unique_ptr<SegmentStore> tier;
+        size_t tier_min_bytes = 0;
+
+        /**
+         * @brief shard array and mask (shard count - 1) used to pick a shard from a row hash
+         */
+        std::unique_ptr<Shard[]> shards;
+        size_t shard_mask;
+
+        /**
+         * @brief cell index used by every shard
+         */
+        CellEngine engine;
+
+        /**
+         * @brief each shard's share of the memory limit (0 for none), and the
+         *        coarse clock cell accesses are stamped with for eviction
+         */
+        size_t shard_max_bytes = 0;
+        std::atomic<uint32_t> access_clock{1};
+
+        /**
+         * @brief smallest value stored compressed (0 = compression off)
+         */
+        size_t compress_min_bytes = 0;
+
+        /**
+         * @brief sequence numbers of the open views, and how many there are (read by writers without the mutex)
+         */
+        std::mutex views_mtx;
+        std::multiset<uint64_t> views;
+        std::atomic<size_t> views_open{0};
+
+        /**
+         * @brief change observers, and the sequencer that orders their notifications
          */
-        std::unordered_map<std::string, std::unordered_map<std::string, std::vector<char>>> table;
+        std::vector<MutationListener*> listeners;
+        std::mutex seq_mtx;
+        std::atomic<uint64_t> seq{0};
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,27 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Immutable, reference-counted cell value.
+ *
+ * The Tablet stores blobs behind shared handles so that a read only bumps a
+ * reference count; the bytes stay alive for as long as any reader (e.g. a
+ * response still queued on a socket) holds the handle, even if the cell is
+ * overwritten or deleted in the meantime.
+ */
+using ValueRef = std::shared_ptr<const std::vector<char>>;
+
+/**
+ * @brief Wrap a byte vector in a shared handle without copying the bytes.
+ *
+ * @param bytes blob to take ownership of
+ * @return shared, immutable handle to the blob
+ */
+inline ValueRef make_value(std::vector<char>&& bytes) {
+    return std::make_shared<const std::vector<char>>(std::move(bytes));
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <vector>
+#include "segment.h"
+#include "../Util/crc32.h"
+#include "../Util/coding.h"
+
+/**
+ * @brief prefix of segment file names (followed by the file id)
+ */
+#define SEGMENT_FILE_PREFIX "segment-"
+
+/**
+ * @brief Read exactly @p len bytes at @p offset, retrying short reads.
+ */
+static bool pread_full(int fd, char* buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * @brief Write exactly @p len bytes at @p offset, retrying short writes.
+ */
+static bool pwrite_full(int fd, const char* buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+SegmentStore::Segment::~Segment() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+SegmentStore::SegmentStore(const std::string& dir) : dir(dir) {}
+
+SegmentStore::~SegmentStore() {
+    for (const auto& [id, segment] : segments) {
+        unlink(segment->path.c_str());
+    }
+}
+
+bool SegmentStore::open() {
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+
+    // values in files from an earlier run are restored from the snapshot and log instead
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return false;
+    }
+    while (struct dirent* entry = readdir(d)) {
+        if (strncmp(entry->d_name, SEGMENT_FILE_PREFIX, strlen(SEGMENT_FILE_PREFIX)) == 0) {
+            unlink((dir + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(d);
+
+    std::lock_guard<std::mutex> guard(mtx);
+    return roll_locked();
+}
+
+bool SegmentStore::roll_locked() {
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    segment->id = next_id++;
+    segment->path = dir + "/" SEGMENT_FILE_PREFIX + std::to_string(segment->id);
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segment->fd < 0) {
+        fprintf(stderr, "SegmentStore: cannot create %s (%s)\n", segment->path.c_str(), strerror(errno));
+        return false;
+    }
+    segments[segment->id] = segment;
+    current = std::move(segment);
+    return true;
+}
+
+std::shared_ptr<SegmentStore::Segment> SegmentStore::find(uint32_t file_id) {
+    std::lock_guard<std::mutex> guard(mtx);
+    auto it = segments.find(file_id);
+    return it == segments.end() ? nullptr : it->second;
+}
+
+ValueRef SegmentStore::write(const std::string& row_key, const std::string& col_key, const ValueRef& value) {
+
+    // lay out the record: header, keys, value
+    uint32_t crc = crc32(value->data(), value->size());
+    std::string record;
+    record.reserve(SEGMENT_RECORD_HEADER + row_key.size() + col_key.size() + value->size());
+    put_u32(record, crc);
+    put_u32(record, row_key.size());
+    put_u32(record, col_key.size());
+    put_u32(record, value->size());
+    record += row_key;
+    record += col_key;
+    record.append(value->data(), value->size());
+
+    // reserve its place in the current file, starting a new file when that one is full;
+    // the bytes count as live from here, and the handle's deleter takes them back
+    std::shared_ptr<Segment> segment;
+    uint64_t offset;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (current->size > 0 && current->size + record.size() > SEGMENT_FILE_BYTES && !roll_locked()) {
+            return nullptr;
+        }
+        segment = current;
+        offset = segment->size;
+        segment->size += record.size();
+        segment->live_bytes += record.size();
+    }
+
+    // the handle is built first so a failed write is taken back like any other dead record
+    std::string handle;
+    put_u32(handle, segment->id);
+    put_u64(handle, offset + SEGMENT_RECORD_HEADER + row_key.size() + col_key.size());
+    put_u32(handle, value->size());
+    put_u32(handle, crc);
+    put_u32(handle, record.size());
+    ValueRef ref(new std::vector<char>(handle.begin(), handle.end()), [this](const std::vector<char>* bytes) {
+        release(*bytes);
+        delete bytes;
+    });
+
+    // appenders write their reserved ranges concurrently, outside the lock
+    if (!pwrite_full(segment->fd, record.data(), record.size(), offset)) {
+        fprintf(stderr, "SegmentStore: write to %s failed (%s)\n", segment->path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    return ref;
+}
+
+ValueRef SegmentStore::read(const ValueRef& handle) {
+    auto start = std::chrono::steady_clock::now();
+    uint32_t file_id = get_u32(handle->data());
+    uint64_t offset = get_u64(handle->data() + 4);
+    uint32_t len = get_u32(handle->data() + 12);
+    uint32_t crc = get_u32(handle->data() + 16);
+
+    // the handle keeps its record live, so its file is still there
+    std::shared_ptr<Segment> segment = find(file_id);
+    std::vector<char> bytes(len);
+    if (!segment || !pread_full(segment->fd, bytes.data(), len, offset)) {
+        fprintf(stderr, "SegmentStore: cannot read %u bytes at %llu of segment %u\n", len, (unsigned long long) offset, file_id);
+        return nullptr;
+    }
+    if (crc32(bytes.data(), len) != crc) {
+        fprintf(stderr, "SegmentStore: checksum mismatch at %llu of segment %u\n", (unsigned long long) offset, file_id);
+        return nullptr;
+    }
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    reads.fetch_add(1, std::memory_order_relaxed);
+    read_ns.fetch_add(ns, std::memory_order_relaxed);
+    return make_value(std::move(bytes));
+}
+
+size_t SegmentStore::value_size(const ValueRef& handle) {
+    return get_u32(handle->data() + 12);
+}
+
+bool SegmentStore::locates(const ValueRef& handle, uint32_t file_id, uint64_t value_offset) {
+    return get_u32(handle->data()) == file_id && get_u64(handle->data() + 4) == value_offset;
+}
+
+void SegmentStore::release(const std::vector<char>& handle) {
+    std::lock_guard<std::mutex> guard(mtx);
+    auto it = segments.find(get_u32(handle.data()));
+    if (it != segments.end()) {
+        it->second->live_bytes -= get_u32(handle.data() + 20);
+    }
+}
+
+bool SegmentStore::pick_compaction(uint32_t& file_id) {
+    std::lock_guard<std::mutex> guard(mtx);
+    Segment* best = nullptr;
+    for (const auto& [id, segment] : segments) {
+        if (segment == current || segment->compacting || segment->live_bytes * 100 >= segment->size * SEGMENT_COMPACT_LIVE_PCT) {
+            continue;
+        }
+        if (!best || segment->live_bytes * best->size < best->live_bytes * segment->size) {
+            best = segment.get();
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    best->compacting = true;
+    compactions++;
+    file_id = best->id;
+    return true;
+}
+
+void SegmentStore::abandon_compaction(uint32_t file_id) {
+    std::lock_guard<std::mutex> guard(mtx);
+    auto it = segments.find(file_id);
+    if (it != segments.end()) {
+        it->second->compacting = false;
+    }
+}
+
+bool SegmentStore::scan(uint32_t file_id, const std::function<void(const std::string& row_key, const std::string& col_key, uint64_t value_offset)>& fn) {
+    std::shared_ptr<Segment> segment = find(file_id);
+    if (!segment) {
+        return true;
+    }
+
+    // a full file no longer grows, so its size can be read once
+    uint64_t size;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        size = segment->size;
+    }
+
+    // read each record's header and keys, skipping its value
+    char header[SEGMENT_RECORD_HEADER];
+    std::string row_key, col_key;
+    uint64_t offset = 0;
+    while (offset < size) {
+        if (size - offset < SEGMENT_RECORD_HEADER || !pread_full(segment->fd, header, SEGMENT_RECORD_HEADER, offset)) {
+            return false;
+        }
+        uint64_t row_len = get_u32(header + 4);
+        uint64_t col_len = get_u32(header + 8);
+        uint64_t value_len = get_u32(header + 12);
+        uint64_t value_offset = offset + SEGMENT_RECORD_HEADER + row_len + col_len;
+        if (value_offset + value_len > size) {
+            return false;
+        }
+        row_key.resize(row_len);
+        col_key.resize(col_len);
+        if (!pread_full(segment->fd, &row_key[0], row_len, offset + SEGMENT_RECORD_HEADER)
+            || !pread_full(segment->fd, &col_key[0], col_len, offset + SEGMENT_RECORD_HEADER + row_len)) {
+            return false;
+        }
+        fn(row_key, col_key, value_offset);
+        offset = value_offset + value_len;
+    }
+    return true;
+}
+
+size_t SegmentStore::remove_dead() {
+
+    // drop dead files from the map under the lock, then unlink them outside it
+    std::vector<std::shared_ptr<Segment>> dead;
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        for (auto it = segments.begin(); it != segments.end();) {
+            if (it->second != current && it->second->live_bytes == 0) {
+                dead.push_back(std::move(it->second));
+                it = segments.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        removed_files += dead.size();
+    }
+    for (const std::shared_ptr<Segment>& segment : dead) {
+        unlink(segment->path.c_str());
+    }
+    return dead.size();
+}
+
+SegmentStats SegmentStore::stats() {
+    SegmentStats stats;
+    std::lock_guard<std::mutex> guard(mtx);
+    for (const auto& [id, segment] : segments) {
+        stats.files++;
+        stats.disk_bytes += segment->size;
+        stats.live_bytes += segment->live_bytes;
+    }
+    stats.reads = reads.load(std::memory_order_relaxed);
+    stats.read_ns = read_ns.load(std::memory_order_relaxed);
+    stats.compactions = compactions;
+    stats.removed_files = removed_files;
+    return stats;
+}
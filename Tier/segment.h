@@ -0,0 +1,225 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include "../Tablet/value.h"
+
+/**
+ * @brief a segment file stops taking records once it reaches this size
+ */
+#define SEGMENT_FILE_BYTES 64 * 1024 * 1024
+
+/**
+ * @brief a full segment file is compacted once less than this percentage of its bytes is live
+ */
+#define SEGMENT_COMPACT_LIVE_PCT 50
+
+/**
+ * @brief bytes of a record header: [u32 crc32 of value][u32 row len][u32 col len][u32 value len]
+ */
+#define SEGMENT_RECORD_HEADER 16
+
+/**
+ * @brief bytes of a handle: [u32 file][u64 value offset][u32 value len][u32 value crc][u32 record len]
+ */
+#define SEGMENT_HANDLE_BYTES 24
+
+/**
+ * @brief Size and activity of a SegmentStore
+ */
+struct SegmentStats {
+
+    /**
+     * @brief segment files, their bytes, and the bytes of records still referenced
+     */
+    uint64_t files = 0;
+    uint64_t disk_bytes = 0;
+    uint64_t live_bytes = 0;
+
+    /**
+     * @brief values read back and the time the reads took
+     */
+    uint64_t reads = 0;
+    uint64_t read_ns = 0;
+
+    /**
+     * @brief files picked for compaction, and files deleted once nothing referred to them
+     */
+    uint64_t compactions = 0;
+    uint64_t removed_files = 0;
+};
+
+/**
+ * @class SegmentStore
+ * @brief Append-only segment files holding values moved out of memory.
+ *
+ * write() appends a record of a cell's keys and value to the current
+ * segment file and returns a handle: a small ValueRef whose bytes locate the
+ * record, which takes the value's place in the cell.  read() turns a handle
+ * back into the value with one pread.  A record stays live for as long as
+ * any copy of its handle exists (in a cell, in a read view's history, or in
+ * a reader's hands); when the last one is dropped its bytes are counted dead.
+ * Full files with few live bytes are compacted by the tablet, which moves
+ * the values still in use into the current file (scan()); a full file with
+ * no live bytes left is deleted by remove_dead().
+ *
+ * The store is a capacity tier, not a durable copy: the log and snapshots
+ * still carry every value, so open() deletes segment files left by an
+ * earlier run and nothing is ever fsynced.
+ */
+class SegmentStore {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a store over a directory; no I/O happens until open().
+         *
+         * @param dir  Directory for segment files, created if missing.
+         */
+        explicit SegmentStore(const std::string& dir);
+
+        /**
+         * @brief Close and delete every segment file (all handles must be gone).
+         */
+        ~SegmentStore();
+
+        /**
+         * @brief Create the directory if needed and delete segment files from an earlier run.
+         *
+         * @return false on I/O error
+         */
+        bool open();
+
+        /**
+         * @brief Append a cell's value and return the handle locating it.
+         *
+         * @param row_key  The cell's row, recorded for compaction.
+         * @param col_key  The cell's column, recorded for compaction.
+         * @param value    Bytes to store (as the cell holds them, possibly a compressed block).
+         * @return the handle, or nullptr on I/O error
+         */
+        ValueRef write(const std::string& row_key, const std::string& col_key, const ValueRef& value);
+
+        /**
+         * @brief Read back the value a handle locates, with one pread.
+         *
+         * @return the bytes, or nullptr on I/O error or checksum mismatch
+         */
+        ValueRef read(const ValueRef& handle);
+
+        /**
+         * @brief Bytes of the value a handle locates.
+         */
+        static size_t value_size(const ValueRef& handle);
+
+        /**
+         * @brief Whether a handle locates the value at @p value_offset of segment file @p file_id.
+         */
+        static bool locates(const ValueRef& handle, uint32_t file_id, uint64_t value_offset);
+
+        /**
+         * @brief Pick the full file with the smallest share of live bytes below
+         *        SEGMENT_COMPACT_LIVE_PCT, if any; each file is picked once
+         *        unless its compaction is abandoned.
+         *
+         * @param file_id  Set to the picked file.
+         * @return false if no file needs compacting
+         */
+        bool pick_compaction(uint32_t& file_id);
+
+        /**
+         * @brief Let a picked file whose compaction failed (e.g. scan() hit an
+         *        I/O error) be picked again.
+         */
+        void abandon_compaction(uint32_t file_id);
+
+        /**
+         * @brief Visit the records of a file in order, passing each one's keys and value offset.
+         *
+         * No lock is held while @p fn runs, so it may write and read the store.
+         *
+         * @return false on I/O error or a malformed record
+         */
+        bool scan(uint32_t file_id, const std::function<void(const std::string& row_key, const std::string& col_key, uint64_t value_offset)>& fn);
+
+        /**
+         * @brief Delete full files that no handle refers to any more.
+         *
+         * @return number of files deleted
+         */
+        size_t remove_dead();
+
+        /**
+         * @brief Sizes and counters (safe to call from any thread).
+         */
+        SegmentStats stats();
+
+    /* private types */
+    private:
+        /**
+         * @brief One segment file; size and live_bytes are guarded by the store's mutex.
+         *
+         * The descriptor is closed when the last reference is dropped, so a
+         * reader that looked the file up keeps it open even if it is deleted.
+         */
+        struct Segment {
+            uint32_t id = 0;
+            int fd = -1;
+            std::string path;
+            uint64_t size = 0;
+            uint64_t live_bytes = 0;
+            bool compacting = false;
+
+            ~Segment();
+        };
+
+    /* private methods */
+    private:
+        /**
+         * @brief Look up a file by id, or nullptr if it is gone.
+         */
+        std::shared_ptr<Segment> find(uint32_t file_id);
+
+        /**
+         * @brief Start a new current file; the caller holds mtx.
+         *
+         * @return false if the file could not be created
+         */
+        bool roll_locked();
+
+        /**
+         * @brief Count a record dead once its last handle is dropped.
+         */
+        void release(const std::vector<char>& handle);
+
+    /* private fields */
+    private:
+        /**
+         * @brief directory holding the files
+         */
+        std::string dir;
+
+        /**
+         * @brief every file by id, the current file, and the next id, guarded by mtx
+         */
+        std::mutex mtx;
+        std::unordered_map<uint32_t, std::shared_ptr<Segment>> segments;
+        std::shared_ptr<Segment> current;
+        uint32_t next_id = 1;
+
+        /**
+         * @brief counters reported by stats()
+         */
+        std::atomic<uint64_t> reads{0};
+        std::atomic<uint64_t> read_ns{0};
+        uint64_t compactions = 0;
+        uint64_t removed_files = 0;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef CODING_H
+#define CODING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+/**
+ * Fixed-width little-endian integer encoding shared by the on-disk formats.
+ */
+
+inline void put_u32(std::string& out, uint32_t v) {
+    char buf[4];
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (char) (v >> (8 * i));
+    }
+    out.append(buf, 4);
+}
+
+inline void put_u64(std::string& out, uint64_t v) {
+    char buf[8];
+    for (int i = 0; i < 8; i++) {
+        buf[i] = (char) (v >> (8 * i));
+    }
+    out.append(buf, 8);
+}
+
+inline void set_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (char) (v >> (8 * i));
+    }
+}
+
+inline void set_u64(char* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (char) (v >> (8 * i));
+    }
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) {
+        v = (v << 8) | (unsigned char) p[i];
+    }
+    return v;
+}
+
+inline uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | (unsigned char) p[i];
+    }
+    return v;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include "crc32.h"
+
+/**
+ * @brief Build the slicing-by-8 lookup tables for the reflected polynomial:
+ *        [0] is the byte-at-a-time table, and [k][i] is the CRC of byte i
+ *        followed by k zero bytes.
+ */
+static const uint32_t (*crc32_tables())[256] {
+    static uint32_t tables[8][256];
+    static bool built = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            tables[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                tables[k][i] = tables[0][tables[k - 1][i] & 0xFF] ^ (tables[k - 1][i] >> 8);
+            }
+        }
+        return true;
+    }();
+    (void) built;
+    return tables;
+}
+
+uint32_t crc32(const void* data, size_t len, uint32_t crc) {
+    const uint32_t (*t)[256] = crc32_tables();
+    const unsigned char* p = (const unsigned char*) data;
+    crc = ~crc;
+
+    // eight bytes per step, each looked up in its own table
+    while (len >= 8) {
+        uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+            ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Multiply two polynomials modulo the (reflected) CRC polynomial.
+ */
+static uint32_t crc32_multiply(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31, product = 0;
+    while (true) {
+        if (a & m) {
+            product ^= b;
+            if ((a & (m - 1)) == 0) {
+                return product;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? 0xEDB88320u ^ (b >> 1) : b >> 1;
+    }
+}
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+
+    // [k] is x^(2^k) modulo the polynomial
+    static uint32_t powers[32];
+    static bool built = [] {
+        uint32_t p = 1u << 30;
+        for (int k = 0; k < 32; k++) {
+            powers[k] = p;
+            p = crc32_multiply(p, p);
+        }
+        return true;
+    }();
+    (void) built;
+
+    // shift crc1 past len2 bytes (x^(8 * len2)), then add crc2
+    uint32_t shift = 1u << 31;
+    for (unsigned k = 3; len2 != 0; len2 >>= 1, k++) {
+        if (len2 & 1) {
+            shift = crc32_multiply(powers[k & 31], shift);
+        }
+    }
+    return crc32_multiply(shift, crc1) ^ crc2;
+}
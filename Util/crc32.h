@@ -0,0 +1,30 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Compute (or continue) a CRC-32 (IEEE 802.3) checksum.
+ *
+ * @param data bytes to checksum
+ * @param len number of bytes
+ * @param crc checksum of preceding bytes when continuing, 0 to start
+ * @return checksum of all bytes so far
+ */
+uint32_t crc32(const void* data, size_t len, uint32_t crc = 0);
+
+/**
+ * @brief Checksum of two byte ranges laid end to end, from their own checksums.
+ *
+ * Lets the checksum of a long tail be computed ahead of time and a short
+ * head checksummed later; costs O(log len2), independent of the bytes.
+ *
+ * @param crc1 checksum of the first range
+ * @param crc2 checksum of the second range
+ * @param len2 length of the second range
+ * @return checksum of the first range followed by the second
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+#endif
@@ -0,0 +1,75 @@
+#include <string.h>
+#include <algorithm>
+#include "inbuf.h"
+#include "iotool.h"
+
+void InputBuffer::make_room(size_t len) {
+    if (capacity - tail >= len) {
+        return;
+    }
+
+    // slide unread bytes to the front if that frees enough space, else grow
+    size_t unread = size();
+    if (capacity - unread >= len && head > 0) {
+        memmove(buf.get(), buf.get() + head, unread);
+    } else {
+        size_t grown = std::max(capacity * 2, unread + len);
+        std::unique_ptr<char[]> bigger(new char[grown]);
+        if (unread > 0) {
+            memcpy(bigger.get(), buf.get() + head, unread);
+        }
+        buf = std::move(bigger);
+        capacity = grown;
+    }
+    scanned -= head;
+    tail = unread;
+    head = 0;
+}
+
+void InputBuffer::append(const char* bytes, size_t len) {
+    make_room(len);
+    memcpy(buf.get() + tail, bytes, len);
+    tail += len;
+}
+
+void InputBuffer::consume(size_t len) {
+    head += std::min(len, size());
+    scanned = std::max(scanned, head);
+
+    // an emptied buffer starts again from the front, without moving anything
+    if (head == tail) {
+        head = tail = scanned = 0;
+    }
+}
+
+void InputBuffer::reserve(size_t len) {
+    if (len > size()) {
+        make_room(len - size());
+    }
+}
+
+void InputBuffer::shrink() {
+    if (empty() && capacity > INBUF_RETAIN_BYTES) {
+        buf.reset();
+        capacity = 0;
+    }
+}
+
+std::optional<std::string_view> InputBuffer::next_line(std::string_view delim) {
+
+    // search only bytes not already searched
+    size_t from = std::max(scanned, head);
+    size_t at = from + find_delimiter(buf.get() + from, tail - from, delim);
+    if (at == tail) {
+
+        // a delimiter may still start in the last few bytes once more arrive
+        size_t keep = std::min(delim.size() > 0 ? delim.size() - 1 : 0, tail - head);
+        scanned = tail - keep;
+        return std::nullopt;
+    }
+
+    // hand out the command in place and consume it with its delimiter
+    std::string_view line(buf.get() + head, at - head);
+    consume(at - head + delim.size());
+    return line;
+}
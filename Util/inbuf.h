@@ -0,0 +1,89 @@
+#ifndef INBUF_H
+#define INBUF_H
+
+#include <stddef.h>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief an emptied buffer gives back storage beyond this many bytes when shrunk
+ */
+#define INBUF_RETAIN_BYTES 64 * 1024
+
+/**
+ * @class InputBuffer
+ * @brief Per-connection input buffer that hands out delimited commands as views.
+ *
+ * Unread bytes occupy [head, tail) of one contiguous allocation.  Consuming
+ * only advances head; the unread bytes are moved back to the front only when
+ * new input would not fit after them, so each byte is copied at most once
+ * per reallocation rather than once per command.  next_line() remembers how
+ * far it has searched, so bytes are scanned for the delimiter once no matter
+ * how many reads a long command arrives in.
+ *
+ * Pointers and views into the buffer stay valid until the next append(),
+ * reserve() or shrink().
+ */
+class InputBuffer {
+
+    /* public methods */
+    public:
+        InputBuffer() = default;
+        InputBuffer(const InputBuffer&) = delete;
+        InputBuffer& operator=(const InputBuffer&) = delete;
+
+        const char* data() const { return buf.get() + head; }
+        size_t size() const { return tail - head; }
+        bool empty() const { return head == tail; }
+
+        /**
+         * @brief Copy bytes in after the unread ones.
+         */
+        void append(const char* bytes, size_t len);
+
+        /**
+         * @brief Drop the first @p len unread bytes.
+         */
+        void consume(size_t len);
+
+        /**
+         * @brief Make room for @p len unread bytes in total, so that filling up to that many does not reallocate.
+         */
+        void reserve(size_t len);
+
+        /**
+         * @brief Release storage beyond INBUF_RETAIN_BYTES if the buffer is empty (e.g. before a connection idles).
+         */
+        void shrink();
+
+        /**
+         * @brief Take the next complete command.
+         *
+         * @param delim  Delimiter ending each command.
+         * @return the command without its delimiter, which is consumed along
+         *         with it; nullopt if no complete command is buffered yet
+         */
+        std::optional<std::string_view> next_line(std::string_view delim);
+
+    /* private methods */
+    private:
+        /**
+         * @brief Ensure at least @p len bytes are free after tail, compacting or growing.
+         */
+        void make_room(size_t len);
+
+    /* private fields */
+    private:
+        std::unique_ptr<char[]> buf;
+        size_t capacity = 0;
+
+        /**
+         * @brief unread bytes are [head, tail); bytes in [head, scanned) are known not to start a delimiter
+         */
+        size_t head = 0;
+        size_t tail = 0;
+        size_t scanned = 0;
+};
+
+#endif
@@ -1,5 +1,13 @@
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
 #include "iotool.h"
 
+/**
+ * @brief most bytes read_until_delimiter reads per read() call
+ */
+#define IOTOOL_READ_CHUNK 64 * 1024
+
 ssize_t do_read(int fd, char* buf, ssize_t bytes_expected) {
 
     // track bytes read
@@ -29,14 +37,16 @@ ssize_t read_until_delimiter(int fd, std::string& buf, ssize_t chunk_size, const
 
     // track bytes read
     ssize_t bytes_read = 0;
-    char temp_buf[chunk_size];
 
     // clear buf
     buf.clear();
 
-    // loop while we have not read the expected number of bytes
+    // loop reading through a fixed stack chunk until the delimiter arrives
+    char temp_buf[IOTOOL_READ_CHUNK];
+    size_t read_size = std::min<size_t>(chunk_size, sizeof(temp_buf));
     while (true) {
-        ssize_t temp_num_read = read(fd, temp_buf, chunk_size);
+        size_t old_size = buf.size();
+        ssize_t temp_num_read = read(fd, temp_buf, read_size);
         if (temp_num_read < 0) {
             if (errno == EINTR) {
                 continue;
@@ -45,18 +55,14 @@ ssize_t read_until_delimiter(int fd, std::string& buf, ssize_t chunk_size, const
         } else if (temp_num_read == 0) {
             return 0;
         }
-
-        // add data to buf
         buf.append(temp_buf, temp_num_read);
         bytes_read += temp_num_read;
-        
 
-        // search for delimiter and if found return true
-        size_t pos = buf.find(delim);
-        if (pos != std::string::npos) {
+        // search only the new bytes (and any delimiter prefix just before them)
+        size_t from = old_size >= delim.size() ? old_size - delim.size() + 1 : 0;
+        if (find_delimiter(buf.data() + from, buf.size() - from, delim) != buf.size() - from) {
             break;
         }
-
     }
 
     // if we break on EOF return bytes read
@@ -82,20 +88,40 @@ ssize_t do_write(int fd, const char* buf, ssize_t bytes_expected) {
     return bytes_written;
 }
 
+size_t find_delimiter(const char* data, size_t len, std::string_view delim) {
+    if (delim.empty() || len < delim.size()) {
+        return len;
+    }
+
+    // memchr finds candidates for the first delimiter byte (CR) many bytes
+    // per step, then the rest of the delimiter is compared in place
+    const char* end = data + len - delim.size() + 1;
+    for (const char* p = data; p < end; p++) {
+        p = (const char*) memchr(p, delim[0], end - p);
+        if (!p) {
+            break;
+        }
+        if (memcmp(p + 1, delim.data() + 1, delim.size() - 1) == 0) {
+            return p - data;
+        }
+    }
+    return len;
+}
+
 std::optional<std::string> parse_next_command(std::string& buf, const std::string& delim) {
-    
+
     // ensure delimiter is present, if not return nullopt
-    auto it = buf.find(delim);
-    if (it == std::string::npos) {
+    size_t it = find_delimiter(buf.data(), buf.size(), delim);
+    if (it == buf.size()) {
         return std::nullopt;
     }
 
     // extract portion of buf up to delim
     std::string res = buf.substr(0, it);
 
-    // clear portion of buf up to delim
-    buf = buf.substr(it + delim.size());
+    // clear portion of buf through delim in place
+    buf.erase(0, it + delim.size());
 
     // return extract
     return res;
-}
\ No newline at end of file
+}
@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 #include <string>
+#include <string_view>
 #include <optional>
 
 /**
@@ -40,6 +41,16 @@ ssize_t read_until_delimiter(int fd, std::string& buf, ssize_t chunk_size, const
  */
 ssize_t do_write(int fd, const char* buf, ssize_t bytes_expected);
 
+/**
+ * @brief Find the first occurrence of a delimiter, locating first-byte candidates with memchr (vectorized by libc).
+ *
+ * @param data bytes to search
+ * @param len number of bytes
+ * @param delim delimiter to find (non-empty)
+ * @return offset of the delimiter's first byte, or len if it does not occur in full
+ */
+size_t find_delimiter(const char* data, size_t len, std::string_view delim);
+
 /**
  * @brief Parse next command from string buffer by extracting up to delim, returning and clearing through delim
  *
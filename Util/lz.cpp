@@ -0,0 +1,213 @@
+#include <string.h>
+#include <algorithm>
+#include "lz.h"
+#include "coding.h"
+
+/**
+ * @brief bytes of the block header (decompressed length)
+ */
+#define LZ_HEADER 4
+
+/**
+ * @brief farthest back a match may point (offsets are 16 bits)
+ */
+#define LZ_MAX_OFFSET 0xFFFF
+
+/**
+ * @brief log2 of how many unmatched bytes pass before the search stride grows by one
+ */
+#define LZ_SKIP_BITS 6
+
+static inline uint32_t load32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t load64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Write the bytes of a length beyond its 15 in the token.
+ */
+static char* put_length(char* op, size_t n) {
+    while (n >= 255) {
+        *op++ = (char) 255;
+        n -= 255;
+    }
+    *op++ = (char) n;
+    return op;
+}
+
+/**
+ * @brief Write one sequence; a match length of 0 writes the final, literal-only one.
+ */
+static char* put_sequence(char* op, const char* literals, size_t literal_len, size_t offset, size_t match_len) {
+    size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    *op++ = (char) ((std::min<size_t>(literal_len, 15) << 4) | std::min<size_t>(match_code, 15));
+    if (literal_len >= 15) {
+        op = put_length(op, literal_len - 15);
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len > 0) {
+        *op++ = (char) (offset & 0xFF);
+        *op++ = (char) (offset >> 8);
+        if (match_code >= 15) {
+            op = put_length(op, match_code - 15);
+        }
+    }
+    return op;
+}
+
+/**
+ * @brief Read the bytes of a length beyond its 15 in the token.
+ */
+static bool get_length(const unsigned char*& ip, const unsigned char* end, size_t& n) {
+    while (true) {
+        if (ip == end) {
+            return false;
+        }
+        unsigned char b = *ip++;
+        n += b;
+        if (b < 255) {
+            return true;
+        }
+    }
+}
+
+void lz_compress(const char* src, size_t len, std::vector<char>& out) {
+
+    // worst case: every byte a literal, plus a length byte per 255 of them
+    out.resize(LZ_HEADER + len + len / 255 + 16);
+    char* op = out.data();
+    for (int i = 0; i < 4; i++) {
+        *op++ = (char) (len >> (8 * i));
+    }
+
+    // find matches, leaving the last bytes as literals
+    size_t anchor = 0;
+    if (len > LZ_MIN_MATCH + LZ_LAST_LITERALS) {
+        uint32_t table[1 << LZ_HASH_BITS];
+        memset(table, 0, sizeof(table));
+        size_t match_limit = len - LZ_LAST_LITERALS;
+        size_t i = 0;
+        while (i + LZ_MIN_MATCH <= match_limit) {
+            uint32_t seq = load32(src + i);
+            uint32_t h = hash32(seq);
+            size_t cand = table[h];
+            table[h] = (uint32_t) i;
+            if (cand >= i || i - cand > LZ_MAX_OFFSET || load32(src + cand) != seq) {
+
+                // no match: stride further the longer the current literal run
+                i += 1 + ((i - anchor) >> LZ_SKIP_BITS);
+                continue;
+            }
+
+            // extend the match forwards eight bytes at a time, then backwards over pending literals
+            size_t end = i + LZ_MIN_MATCH;
+            size_t offset = i - cand;
+            while (end + 8 <= match_limit) {
+                uint64_t diff = load64(src + end) ^ load64(src + end - offset);
+                if (diff != 0) {
+                    end += __builtin_ctzll(diff) / 8;
+                    break;
+                }
+                end += 8;
+            }
+            while (end < match_limit && src[end] == src[end - offset]) {
+                end++;
+            }
+            end = std::min(end, match_limit);
+            while (i > anchor && cand > 0 && src[i - 1] == src[cand - 1]) {
+                i--;
+                cand--;
+            }
+
+            op = put_sequence(op, src + anchor, i - anchor, offset, end - i);
+            i = end;
+            anchor = end;
+
+            // seed the table just behind the match, where the next one often starts
+            table[hash32(load32(src + end - 2))] = (uint32_t) (end - 2);
+        }
+    }
+
+    // trailing literals end the block
+    op = put_sequence(op, src + anchor, len - anchor, 0, 0);
+    out.resize(op - out.data());
+}
+
+size_t lz_raw_size(const char* block, size_t len) {
+    return len < LZ_HEADER ? 0 : get_u32(block);
+}
+
+bool lz_decompress(const char* block, size_t len, std::vector<char>& out) {
+    if (len < LZ_HEADER + 1) {
+        return false;
+    }
+    size_t raw_len = get_u32(block);
+
+    // no byte of a block stands for more than 255 output bytes, so a larger claim is corrupt
+    if (raw_len > (len - LZ_HEADER) * 255) {
+        return false;
+    }
+    out.resize(raw_len);
+    char* dst = out.data();
+    size_t op = 0;
+    const unsigned char* ip = (const unsigned char*) block + LZ_HEADER;
+    const unsigned char* end = (const unsigned char*) block + len;
+    while (true) {
+
+        // literals
+        if (ip == end) {
+            return false;
+        }
+        unsigned char token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !get_length(ip, end, literal_len)) {
+            return false;
+        }
+        if (literal_len > (size_t) (end - ip) || literal_len > raw_len - op) {
+            return false;
+        }
+        if (literal_len > 0) {
+            memcpy(dst + op, ip, literal_len);
+        }
+        ip += literal_len;
+        op += literal_len;
+
+        // the literal-only sequence ends the block
+        if (ip == end) {
+            return op == raw_len;
+        }
+
+        // match, copied in pieces no longer than its offset so no piece overlaps itself
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !get_length(ip, end, match_len)) {
+            return false;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || match_len > raw_len - op) {
+            return false;
+        }
+        while (match_len > 0) {
+            size_t piece = std::min(match_len, offset);
+            memcpy(dst + op, dst + op - offset, piece);
+            op += piece;
+            match_len -= piece;
+        }
+    }
+}
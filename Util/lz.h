@@ -0,0 +1,59 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Byte-oriented LZ77 block codec in the style of LZ4, for compressing cell
+ * values in memory and on the wire.
+ *
+ * A block is [u32 decompressed length, little-endian] followed by sequences.
+ * Each sequence is a token byte (high nibble literal count, low nibble match
+ * length - LZ_MIN_MATCH), further literal count bytes if the nibble is 15
+ * (each adds up to 255, ending at the first byte below 255), the literals,
+ * then a u16 little-endian match offset and further match length bytes
+ * likewise.  The last sequence has literals only and ends the block.
+ */
+
+/**
+ * @brief shortest match encoded, and bytes at the end of the input always kept as literals
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+
+/**
+ * @brief log2 of the compressor's hash table size (entries are input positions)
+ */
+#define LZ_HASH_BITS 12
+
+/**
+ * @brief Compress a buffer into a block.
+ *
+ * Greedy single-pass matching against the most recent position with the same
+ * 4-byte hash, skipping ahead faster the longer no match is found, so
+ * incompressible input costs little more than a copy.
+ *
+ * @param src bytes to compress
+ * @param len number of bytes (below 4 GiB)
+ * @param out receives the block (replacing its contents)
+ */
+void lz_compress(const char* src, size_t len, std::vector<char>& out);
+
+/**
+ * @brief Decompressed length recorded in a block's header (0 if it is too short to have one).
+ */
+size_t lz_raw_size(const char* block, size_t len);
+
+/**
+ * @brief Decompress a block, checking every length and offset against its bounds.
+ *
+ * @param block block to decompress
+ * @param len number of bytes in the block
+ * @param out receives the decompressed bytes (replacing its contents)
+ * @return false if the block is malformed
+ */
+bool lz_decompress(const char* block, size_t len, std::vector<char>& out);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include "slab.h"
+
+/**
+ * @brief bytes per chunk carved into blocks
+ */
+#define SLAB_CHUNK 64 * 1024
+
+SlabAllocator::~SlabAllocator() {
+    for (char* chunk : chunks) {
+        ::free(chunk);
+    }
+}
+
+char* SlabAllocator::alloc(size_t size) {
+
+    // oversized requests bypass the slabs
+    if (size > SLAB_MAX_CLASS) {
+        oversized_bytes += size;
+        return (char*) malloc(size);
+    }
+
+    // reuse a freed block of this class
+    size_t cls = (size - 1) / SLAB_GRANULE;
+    if (free_lists[cls]) {
+        char* block = free_lists[cls];
+        free_lists[cls] = *(char**) block;
+        return block;
+    }
+
+    // otherwise carve from the current chunk, starting a new one if needed
+    size_t rounded = (cls + 1) * SLAB_GRANULE;
+    if (remaining < rounded) {
+        cursor = (char*) malloc(SLAB_CHUNK);
+        chunks.push_back(cursor);
+        remaining = SLAB_CHUNK;
+    }
+    char* block = cursor;
+    cursor += rounded;
+    remaining -= rounded;
+    return block;
+}
+
+void SlabAllocator::free(char* block, size_t size) {
+    if (size > SLAB_MAX_CLASS) {
+        oversized_bytes -= size;
+        ::free(block);
+        return;
+    }
+    size_t cls = (size - 1) / SLAB_GRANULE;
+    *(char**) block = free_lists[cls];
+    free_lists[cls] = block;
+}
+
+size_t SlabAllocator::reserved_bytes() const {
+    return chunks.size() * SLAB_CHUNK + oversized_bytes;
+}
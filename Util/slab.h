@@ -0,0 +1,66 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief largest request served from a size class; bigger ones go to malloc
+ */
+#define SLAB_MAX_CLASS 512
+
+/**
+ * @brief size-class granularity in bytes
+ */
+#define SLAB_GRANULE 16
+
+/**
+ * @class SlabAllocator
+ * @brief Size-class arena for small variable-length allocations (e.g. keys).
+ *
+ * Requests are rounded up to a multiple of SLAB_GRANULE and carved from
+ * large chunks; freed blocks go on a per-class free list for reuse.  This
+ * avoids a malloc header and call per small object.  Not thread-safe: each
+ * owner (e.g. a locked shard) keeps its own allocator.
+ */
+class SlabAllocator {
+
+    /* public methods */
+    public:
+        SlabAllocator() = default;
+        SlabAllocator(const SlabAllocator&) = delete;
+        SlabAllocator& operator=(const SlabAllocator&) = delete;
+        ~SlabAllocator();
+
+        /**
+         * @brief Allocate @p size bytes (size > 0).
+         */
+        char* alloc(size_t size);
+
+        /**
+         * @brief Return a block from alloc(); @p size must match the request.
+         */
+        void free(char* block, size_t size);
+
+        /**
+         * @brief Bytes held from the system (chunks plus oversized blocks).
+         */
+        size_t reserved_bytes() const;
+
+    /* private fields */
+    private:
+        /**
+         * @brief free list heads per size class (linked through the blocks)
+         */
+        char* free_lists[SLAB_MAX_CLASS / SLAB_GRANULE] = {nullptr};
+
+        /**
+         * @brief chunks carved so far, and the unused tail of the newest one
+         */
+        std::vector<char*> chunks;
+        char* cursor = nullptr;
+        size_t remaining = 0;
+        size_t oversized_bytes = 0;
+};
+
+#endif
@@ -0,0 +1,436 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "wal.h"
+#include "../Util/crc32.h"
+#include "../Util/coding.h"
+#include "../Util/iotool.h"
+
+/**
+ * @brief bytes of framing before each record body (length + checksum)
+ */
+#define RECORD_FRAME 8
+
+/**
+ * @brief fixed-size part of a record body (type, seq, three lengths)
+ */
+#define RECORD_FIXED 21
+
+/**
+ * @brief type bit marking a compressed value
+ */
+#define RECORD_COMPRESSED 0x80
+
+/**
+ * @brief wake the group flusher early once this many bytes are pending
+ */
+#define GROUP_COMMIT_BYTES 1024 * 1024
+
+/**
+ * @brief bytes read per call while replaying
+ */
+#define REPLAY_CHUNK 1024 * 1024
+
+/**
+ * @brief a staged record at least this large is moved into the pending batch rather than copied
+ */
+#define RECORD_MOVE_MIN 64 * 1024
+
+/**
+ * @brief number of the last record appended by this thread, which sync() waits for
+ */
+static thread_local uint64_t last_ticket = 0;
+
+/**
+ * @brief record this thread encoded in prepare(), the change it is for, and
+ *        the checksum of its keys and value
+ */
+static thread_local std::string staged;
+static thread_local const Mutation* staged_for = nullptr;
+static thread_local uint32_t staged_crc = 0;
+
+bool parse_durability(const std::string& name, Durability& mode) {
+    if (name == "sync") {
+        mode = Durability::SYNC;
+    } else if (name == "group") {
+        mode = Durability::GROUP;
+    } else if (name == "async") {
+        mode = Durability::ASYNC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Append a record whose sequence number is still unknown: the seq
+ *        field is zero and the checksum field is left for finish_record.
+ *
+ * @return checksum of the body past its fixed part (keys and value)
+ */
+static uint32_t stage_record(std::string& out, const Mutation& mutation) {
+
+    // reserve frame, then lay out body
+    size_t value_len = mutation.value ? mutation.value->size() : 0;
+    size_t body_len = RECORD_FIXED + mutation.row.size() + mutation.col.size() + value_len;
+    size_t start = out.size();
+    out.reserve(start + RECORD_FRAME + body_len);
+    put_u32(out, body_len);
+    put_u32(out, 0);
+    out.push_back((char) ((uint8_t) mutation.type | (mutation.compressed ? RECORD_COMPRESSED : 0)));
+    put_u64(out, 0);
+    put_u32(out, mutation.row.size());
+    put_u32(out, mutation.col.size());
+    put_u32(out, value_len);
+    out += mutation.row;
+    out += mutation.col;
+    if (value_len > 0) {
+        out.append(mutation.value->data(), value_len);
+    }
+    return crc32(out.data() + start + RECORD_FRAME + RECORD_FIXED, body_len - RECORD_FIXED);
+}
+
+/**
+ * @brief Fill in a staged record's sequence number and checksum, touching only its fixed part.
+ *
+ * @param record start of the record's frame
+ * @param seq sequence number
+ * @param tail_crc checksum returned by stage_record
+ */
+static void finish_record(char* record, uint64_t seq, uint32_t tail_crc) {
+    char* body = record + RECORD_FRAME;
+    set_u64(body + 1, seq);
+    uint32_t body_len = get_u32(record);
+    set_u32(record + 4, crc32_combine(crc32(body, RECORD_FIXED), tail_crc, body_len - RECORD_FIXED));
+}
+
+void encode_record(std::string& out, const Mutation& mutation) {
+    size_t start = out.size();
+    uint32_t tail_crc = stage_record(out, mutation);
+    finish_record(&out[start], mutation.seq, tail_crc);
+}
+
+RecordStatus decode_record(const char* buf, size_t len, LogRecord& rec, size_t& consumed) {
+
+    // need the frame and the whole body
+    if (len < RECORD_FRAME) {
+        return RecordStatus::INCOMPLETE;
+    }
+    uint32_t body_len = get_u32(buf);
+    if (body_len < RECORD_FIXED) {
+        return RecordStatus::CORRUPT;
+    }
+    if (len - RECORD_FRAME < body_len) {
+        return RecordStatus::INCOMPLETE;
+    }
+
+    // verify checksum, then field lengths against the body
+    const char* body = buf + RECORD_FRAME;
+    if (crc32(body, body_len) != get_u32(buf + 4)) {
+        return RecordStatus::CORRUPT;
+    }
+    uint8_t type = (uint8_t) body[0] & ~RECORD_COMPRESSED;
+    uint64_t row_len = get_u32(body + 9);
+    uint64_t col_len = get_u32(body + 13);
+    uint64_t value_len = get_u32(body + 17);
+    if (RECORD_FIXED + row_len + col_len + value_len != body_len) {
+        return RecordStatus::CORRUPT;
+    }
+    if (type != (uint8_t) MutationType::PUT && type != (uint8_t) MutationType::DEL && type != (uint8_t) MutationType::EXPIRE) {
+        return RecordStatus::CORRUPT;
+    }
+
+    // copy out fields
+    const char* p = body + RECORD_FIXED;
+    rec.type = (MutationType) type;
+    rec.compressed = (body[0] & RECORD_COMPRESSED) != 0;
+    rec.seq = get_u64(body + 1);
+    rec.row.assign(p, row_len);
+    rec.col.assign(p + row_len, col_len);
+    p += row_len + col_len;
+    rec.value = rec.type != MutationType::DEL ? make_value(std::vector<char>(p, p + value_len)) : nullptr;
+    consumed = RECORD_FRAME + body_len;
+    return RecordStatus::OK;
+}
+
+/**
+ * @brief Write a batch of encoded records in order.
+ *
+ * @return false on I/O error
+ */
+static bool write_all(int fd, const std::vector<std::string>& batch) {
+    for (const std::string& piece : batch) {
+        if (do_write(fd, piece.data(), piece.size()) != (ssize_t) piece.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Wal::Wal(const std::string& path, Durability mode, uint64_t max_delay_us)
+    : path(path), mode(mode), max_delay_us(max_delay_us) {}
+
+Wal::~Wal() {
+
+    // stop flusher, then write anything it left behind
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        flush_cv.notify_all();
+        flusher.join();
+    }
+    if (fd >= 0) {
+        flush();
+        close(fd);
+    }
+}
+
+bool Wal::replay(const std::string& path, Tablet& tab, uint64_t min_seq, uint64_t& applied) {
+    applied = 0;
+
+    // a missing log is an empty log
+    int replay_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (replay_fd < 0) {
+        return errno == ENOENT;
+    }
+
+    // stream the file through a buffer, applying whole records
+    std::string buf;
+    std::vector<char> chunk(REPLAY_CHUNK);
+    off_t good_end = 0;
+    bool at_eof = false;
+    bool corrupt = false;
+    while (!corrupt) {
+
+        // decode every complete record in the buffer
+        size_t pos = 0;
+        while (true) {
+            LogRecord rec;
+            size_t consumed;
+            RecordStatus status = decode_record(buf.data() + pos, buf.size() - pos, rec, consumed);
+            if (status == RecordStatus::INCOMPLETE) {
+                break;
+            }
+            if (status == RecordStatus::CORRUPT) {
+                corrupt = true;
+                break;
+            }
+            if (rec.seq > min_seq) {
+                tab.apply(rec.mutation());
+                applied++;
+            }
+            pos += consumed;
+            good_end += consumed;
+        }
+        buf.erase(0, pos);
+        if (corrupt || at_eof) {
+            break;
+        }
+
+        // read more
+        ssize_t n = read(replay_fd, chunk.data(), chunk.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(replay_fd);
+            return false;
+        }
+        if (n == 0) {
+            at_eof = true;
+        }
+        buf.append(chunk.data(), n);
+    }
+
+    // drop a torn or corrupt tail so new records follow the last good one
+    if (corrupt || !buf.empty()) {
+        fprintf(stderr, "WAL %s: discarding %s tail after byte %lld\n",
+                path.c_str(), corrupt ? "corrupt" : "torn", (long long) good_end);
+        if (ftruncate(replay_fd, good_end) < 0) {
+            close(replay_fd);
+            return false;
+        }
+    }
+    close(replay_fd);
+    return true;
+}
+
+bool Wal::open() {
+
+    // open for append
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    // group and async modes fsync from the background
+    if (mode != Durability::SYNC) {
+        flusher = std::thread(&Wal::flusher_loop, this);
+    }
+    return true;
+}
+
+void Wal::prepare(const Mutation& mutation) {
+    staged.clear();
+    staged_crc = stage_record(staged, mutation);
+    staged_for = &mutation;
+}
+
+void Wal::on_mutation(const Mutation& mutation) {
+
+    // number the record staged by prepare() (encoding it now if there was none)
+    if (staged_for != &mutation) {
+        prepare(mutation);
+    }
+    staged_for = nullptr;
+    finish_record(&staged[0], mutation.seq, staged_crc);
+
+    // queue it: small records are copied onto the open batch, large ones moved in whole
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        wake = pending_bytes == 0;
+        pending_bytes += staged.size();
+        if (staged.size() >= RECORD_MOVE_MIN) {
+            pending.push_back(std::move(staged));
+            staged = std::string();
+        } else {
+            if (pending.empty() || pending.back().size() >= RECORD_MOVE_MIN) {
+                pending.emplace_back();
+            }
+            pending.back() += staged;
+        }
+        wake = wake || pending_bytes >= GROUP_COMMIT_BYTES;
+        last_ticket = ++appended;
+    }
+    if (wake && mode != Durability::SYNC) {
+        flush_cv.notify_one();
+    }
+}
+
+bool Wal::sync() {
+    uint64_t ticket = last_ticket;
+
+    // async: acknowledge immediately
+    if (mode == Durability::ASYNC) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return !failed;
+    }
+
+    // sync: flush ourselves (concurrent callers share one fsync)
+    if (mode == Durability::SYNC) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (durable >= ticket || failed) {
+                return !failed;
+            }
+        }
+        return flush();
+    }
+
+    // group: wait for the flusher's next shared fsync
+    std::unique_lock<std::mutex> lock(mtx);
+    durable_cv.wait(lock, [&] { return durable >= ticket || failed; });
+    return !failed;
+}
+
+bool Wal::flush() {
+
+    // one writer to the file at a time
+    std::lock_guard<std::mutex> flush_lock(flush_mtx);
+
+    // take everything buffered so far
+    std::vector<std::string> batch;
+    uint64_t upto;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (failed) {
+            return false;
+        }
+        if (durable >= appended) {
+            return true;
+        }
+        batch.swap(pending);
+        pending_bytes = 0;
+        upto = appended;
+    }
+
+    // write and sync it
+    bool ok = write_all(fd, batch) && fdatasync(fd) == 0;
+    if (!ok) {
+        fprintf(stderr, "WAL %s: write failed (%s)\n", path.c_str(), strerror(errno));
+    }
+
+    // publish durability
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (ok) {
+            durable = upto;
+        } else {
+            failed = true;
+        }
+    }
+    durable_cv.notify_all();
+    return ok;
+}
+
+bool Wal::rotate(const std::string& retired_path) {
+
+    // keep the previous unfinished rotation, see header
+    if (access(retired_path.c_str(), F_OK) == 0) {
+        return true;
+    }
+
+    // hold off flushes and appends while the file is swapped
+    std::lock_guard<std::mutex> flush_lock(flush_mtx);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (failed) {
+        return false;
+    }
+
+    // everything appended so far goes to the file being retired
+    bool ok = write_all(fd, pending) && fdatasync(fd) == 0;
+    pending.clear();
+    pending_bytes = 0;
+
+    // swap in a fresh file
+    int new_fd = -1;
+    if (ok && rename(path.c_str(), retired_path.c_str()) == 0) {
+        new_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if (new_fd < 0) {
+        fprintf(stderr, "WAL %s: rotation failed (%s)\n", path.c_str(), strerror(errno));
+        failed = true;
+        durable_cv.notify_all();
+        return false;
+    }
+    close(fd);
+    fd = new_fd;
+    durable = appended;
+    durable_cv.notify_all();
+    return true;
+}
+
+void Wal::flusher_loop() {
+    while (true) {
+        {
+            // wait for something to flush
+            std::unique_lock<std::mutex> lock(mtx);
+            flush_cv.wait(lock, [&] { return stopping || pending_bytes > 0; });
+            if (stopping) {
+                return;
+            }
+
+            // give concurrent writers up to max_delay to join this batch
+            flush_cv.wait_for(lock, std::chrono::microseconds(max_delay_us), [&] {
+                return stopping || pending_bytes >= GROUP_COMMIT_BYTES;
+            });
+        }
+        flush();
+    }
+}
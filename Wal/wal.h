@@ -0,0 +1,201 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../Tablet/tablet.h"
+#include "../Tablet/mutation.h"
+
+/**
+ * @brief how long a PUT/DEL may be acknowledged before it is on disk
+ */
+enum class Durability {
+    SYNC,   // every acknowledged write has been fsynced; no deliberate batching
+    GROUP,  // writers wait for a shared fsync issued at most max_delay after the first of them
+    ASYNC,  // writers never wait; a background thread fsyncs every max_delay
+};
+
+/**
+ * @brief Parse a durability mode name ("sync", "group", "async").
+ *
+ * @param name mode name
+ * @param mode parsed mode
+ * @return false if the name is unknown
+ */
+bool parse_durability(const std::string& name, Durability& mode);
+
+/**
+ * @brief A decoded log record that owns its keys and value.
+ */
+struct LogRecord {
+    MutationType type;
+    uint64_t seq;
+    std::string row;
+    std::string col;
+    ValueRef value;
+    bool compressed = false;
+
+    Mutation mutation() const { return Mutation{type, row, col, value, seq, compressed}; }
+};
+
+/**
+ * @brief result of decoding one record from a byte range
+ */
+enum class RecordStatus { OK, INCOMPLETE, CORRUPT };
+
+/**
+ * @brief Append one framed, checksummed record for a mutation.
+ *
+ * Layout: [u32 body length][u32 crc32 of body][body], where body is
+ * [u8 type][u64 seq][u32 row len][u32 col len][u32 value len][row][col][value],
+ * all integers little-endian.  The type's top bit (RECORD_COMPRESSED) marks a
+ * value stored as a compressed block.
+ *
+ * @param out string to append to
+ * @param mutation change to encode
+ */
+void encode_record(std::string& out, const Mutation& mutation);
+
+/**
+ * @brief Decode one record from the front of a byte range.
+ *
+ * @param buf bytes to decode
+ * @param len number of bytes available
+ * @param rec decoded record (on OK)
+ * @param consumed bytes the record occupied (on OK)
+ * @return OK, INCOMPLETE if more bytes are needed, or CORRUPT on a bad frame
+ */
+RecordStatus decode_record(const char* buf, size_t len, LogRecord& rec, size_t& consumed);
+
+/**
+ * @class Wal
+ * @brief Append-only write-ahead log of Tablet mutations with group commit.
+ *
+ * Attached to a Tablet as a MutationListener, the log buffers an encoded
+ * record for every change in commit order.  Records are encoded and
+ * checksummed before the Tablet's sequencer is taken (prepare()); under it
+ * only the sequence number and the checksum of the record's fixed part are
+ * filled in, so a large PUT does not hold up writers in other shards.  A connection calls sync() before
+ * acknowledging its writes; depending on the durability mode that flushes and
+ * fsyncs immediately, waits for a shared group fsync, or returns at once.
+ */
+class Wal : public MutationListener {
+
+    /* public methods */
+    public:
+        /**
+         * @brief Construct a log over a file; no I/O happens until open().
+         *
+         * @param path          Log file, created if missing.
+         * @param mode          Durability mode.
+         * @param max_delay_us  Longest a group/async fsync is deferred to batch writers.
+         */
+        Wal(const std::string& path, Durability mode, uint64_t max_delay_us);
+
+        /**
+         * @brief Flush outstanding records and stop the background flusher.
+         */
+        ~Wal();
+
+        /**
+         * @brief Rebuild a tablet from a log file.
+         *
+         * Applies every intact record in order, then truncates a torn or
+         * corrupt tail (e.g. from a crash mid-append) so later appends follow
+         * the last good record.  A missing file is an empty log.
+         *
+         * @param path     Log file.
+         * @param tab      Tablet to apply records to (must not have the log attached yet).
+         * @param min_seq  Skip records with a sequence number at or below this.
+         * @param applied  Number of records applied.
+         * @return false on I/O error
+         */
+        static bool replay(const std::string& path, Tablet& tab, uint64_t min_seq, uint64_t& applied);
+
+        /**
+         * @brief Open the log for appending and start the flusher if the mode needs one.
+         *
+         * @return false if the file could not be opened
+         */
+        bool open();
+
+        /**
+         * @brief Encode and checksum a change's record, leaving its sequence number
+         *        for on_mutation (called by the Tablet before its sequencer).
+         */
+        void prepare(const Mutation& mutation) override;
+
+        /**
+         * @brief Number the record prepare() encoded and queue it (called by the Tablet under its sequencer).
+         */
+        void on_mutation(const Mutation& mutation) override;
+
+        /**
+         * @brief Wait until every record appended by the calling thread is as durable as the mode promises.
+         *
+         * @return false if the log could not be written or synced
+         */
+        bool sync();
+
+        /**
+         * @brief Retire the current log file and continue in a fresh one.
+         *
+         * Everything appended so far is written and synced to the current
+         * file, which is then renamed to @p retired_path; later records go to
+         * a new file at the original path.  A snapshot taken after this call
+         * covers every retired record, so the retired file can be deleted
+         * once the snapshot is durable.  Nothing is rotated if @p retired_path
+         * already exists (an earlier snapshot did not finish); it still only
+         * holds records older than any new snapshot.
+         *
+         * @param retired_path  Where to move the current file.
+         * @return false on I/O error
+         */
+        bool rotate(const std::string& retired_path);
+
+    /* private methods */
+    private:
+        bool flush();
+        void flusher_loop();
+
+    /* private fields */
+    private:
+        /**
+         * @brief configuration
+         */
+        std::string path;
+        Durability mode;
+        uint64_t max_delay_us;
+        int fd = -1;
+
+        /**
+         * @brief encoded records not yet written (in order, small ones
+         *        coalesced and large ones in pieces of their own), their total
+         *        size, and counters of records appended / made durable, guarded by mtx
+         */
+        std::mutex mtx;
+        std::vector<std::string> pending;
+        size_t pending_bytes = 0;
+        uint64_t appended = 0;
+        uint64_t durable = 0;
+        bool failed = false;
+        bool stopping = false;
+        std::condition_variable flush_cv;
+        std::condition_variable durable_cv;
+
+        /**
+         * @brief serializes write+fsync of batches to the file
+         */
+        std::mutex flush_mtx;
+
+        /**
+         * @brief background group-commit / async flusher
+         */
+        std::thread flusher;
+};
+
+#endif
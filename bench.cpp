@@ -0,0 +1,650 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Net/binproto.h"
+#include "Bench/histogram.h"
+#include "Bench/keychooser.h"
+#include "Bench/document.h"
+
+/**
+ * @brief prompt the server writes before each batch of text commands
+ */
+#define PROMPT "DataStore% "
+
+/**
+ * @brief keep reading for completions this long after the run ends
+ */
+#define DRAIN_NS 2000000000ull
+
+/**
+ * @brief cells per request when preloading the key space
+ */
+#define PRELOAD_BATCH 256
+
+/**
+ * @brief operation kinds, indexing per-kind histograms
+ */
+enum Op { OP_GET = 0, OP_PUT = 1, OP_DEL = 2, NUM_OPS = 3 };
+static const char* OP_NAMES[NUM_OPS] = {"GET", "PUT", "DEL"};
+
+/**
+ * @brief Benchmark configuration (see usage())
+ */
+struct Config {
+    std::string host = "127.0.0.1";
+    int port = 9000;
+    size_t connections = 16;
+    size_t threads = 1;
+    double duration = 10;
+    double rate = 0;
+    unsigned mix[NUM_OPS] = {90, 10, 0};
+    uint64_t keys = 100000;
+    double theta = 0;
+    size_t value_min = 100;
+    size_t value_max = 100;
+    size_t batch = 1;
+    bool binary = true;
+    bool preload = false;
+    bool documents = false;
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief One request on the wire, waiting for its response
+ */
+struct Pending {
+
+    /**
+     * @brief when the request was due (open loop) or sent (closed loop), in ns
+     */
+    uint64_t start_ns;
+    Op op;
+
+    /**
+     * @brief response lines (text) or frames (binary) still to come
+     */
+    size_t remaining;
+};
+
+/**
+ * @brief One client connection driven by a bench thread
+ */
+struct BenchConn {
+    int fd;
+    std::string out;
+    size_t out_off = 0;
+    std::string in;
+    std::deque<Pending> pending;
+    uint64_t next_due_ns = 0;
+    uint32_t next_id = 0;
+};
+
+/**
+ * @brief Per-thread results, merged at the end
+ */
+struct Results {
+    Histogram all;
+    Histogram by_op[NUM_OPS];
+    uint64_t ops[NUM_OPS] = {0, 0, 0};
+    uint64_t misses = 0;
+    uint64_t errors = 0;
+    uint64_t sent = 0;
+};
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: bench [options]\n"
+        "  -h <host>          server host (default 127.0.0.1)\n"
+        "  -p <port>          server port (default 9000)\n"
+        "  -c <conns>         connections (default 16)\n"
+        "  -t <threads>       client threads (default 1)\n"
+        "  -d <secs>          run time (default 10)\n"
+        "  -r <ops/s>         open loop at this total request rate; 0 = closed loop (default 0)\n"
+        "  -m <get:put:del>   operation mix weights (default 90:10:0)\n"
+        "  -k <keys>          key space size (default 100000)\n"
+        "  -z <theta>         Zipfian skew in [0, 1); 0 = uniform (default 0)\n"
+        "  -s <n>|<min-max>   value size in bytes, fixed or uniform (default 100)\n"
+        "  -J                 JSON-like document values, which compress like real payloads (default: repeated bytes)\n"
+        "  -B <n>             cells per request: MGET/MPUT/MDEL (text) or n pipelined frames (binary)\n"
+        "  -P <binary|text>   protocol (default binary)\n"
+        "  -L                 PUT every key once before the run\n"
+        "  -S <seed>          random seed (default 1)\n");
+}
+
+/**
+ * @brief Connect to the server, consume its prompt, and negotiate framing
+ *
+ * @return blocking socket, or -1
+ */
+static int open_connection(const Config& config) {
+
+    // resolve and connect
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(config.host.c_str(), std::to_string(config.port).c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    // read until the prompt (and, for binary, the switch confirmation)
+    std::string buf;
+    const char* token = PROMPT;
+    bool switched = false;
+    char chunk[256];
+    while (true) {
+        if (buf.find(token) != std::string::npos) {
+            if (!config.binary || switched) {
+                return fd;
+            }
+            if (send(fd, "BINARY\r\n", 8, MSG_NOSIGNAL) != 8) {
+                break;
+            }
+            buf.clear();
+            token = "BINARY\n";
+            switched = true;
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        buf.append(chunk, n);
+    }
+    close(fd);
+    return -1;
+}
+
+/**
+ * @brief Generates requests for one thread
+ */
+class Workload {
+    public:
+        Workload(const Config& config, uint64_t seed)
+            : config(config), chooser(config.keys, config.theta), rng(seed), value_bytes(config.documents ? make_document(config.value_max, seed) : std::string(config.value_max, 'x')) {}
+
+        /**
+         * @brief Append one request (a batch of config.batch cells) to conn's output.
+         */
+        void issue(BenchConn& conn, uint64_t start_ns) {
+            Op op = pick_op();
+            size_t cells = config.batch;
+            if (config.binary) {
+                for (size_t i = 0; i < cells; i++) {
+                    append_frame(conn, op, chooser.next(rng));
+                }
+                conn.pending.push_back(Pending{start_ns, op, cells});
+            } else {
+                append_text(conn, op, cells);
+                conn.pending.push_back(Pending{start_ns, op, cells == 1 ? 1 : cells + 1});
+            }
+        }
+
+        /**
+         * @brief Append a PUT of every key in [first, last) (preload).
+         */
+        void issue_puts(BenchConn& conn, uint64_t first, uint64_t last) {
+            for (uint64_t key = first; key < last; key++) {
+                append_frame(conn, OP_PUT, key);
+            }
+            conn.pending.push_back(Pending{now_ns(), OP_PUT, (size_t) (last - first)});
+        }
+
+    private:
+        Op pick_op() {
+            unsigned total = config.mix[OP_GET] + config.mix[OP_PUT] + config.mix[OP_DEL];
+            unsigned roll = rng() % total;
+            if (roll < config.mix[OP_GET]) {
+                return OP_GET;
+            }
+            return roll < config.mix[OP_GET] + config.mix[OP_PUT] ? OP_PUT : OP_DEL;
+        }
+
+        size_t pick_size() {
+            if (config.value_max == config.value_min) {
+                return config.value_min;
+            }
+            return config.value_min + rng() % (config.value_max - config.value_min + 1);
+        }
+
+        static std::string row_of(uint64_t key) {
+            return "r" + std::to_string(key);
+        }
+
+        void append_frame(BenchConn& conn, Op op, uint64_t key) {
+            std::string row = row_of(key);
+            size_t value_len = op == OP_PUT ? pick_size() : 0;
+            BinHeader req;
+            req.magic = BIN_REQ_MAGIC;
+            req.opcode = op == OP_GET ? BIN_GET : op == OP_PUT ? BIN_PUT : BIN_DEL;
+            req.row_len = row.size();
+            req.col_len = 1;
+            req.flags = 0;
+            req.value_len = value_len;
+            req.request_id = conn.next_id++;
+            encode_bin_header(conn.out, req);
+            conn.out += row;
+            conn.out += 'c';
+            conn.out.append(value_bytes.data(), value_len);
+        }
+
+        void append_text(BenchConn& conn, Op op, size_t cells) {
+            if (cells == 1) {
+                conn.out += op == OP_GET ? "GET " : op == OP_PUT ? "PUT " : "DEL ";
+                conn.out += row_of(chooser.next(rng)) + " c";
+                if (op == OP_PUT) {
+                    conn.out += ' ';
+                    conn.out.append(value_bytes.data(), pick_size());
+                }
+            } else {
+                conn.out += op == OP_GET ? "MGET" : op == OP_PUT ? "MPUT" : "MDEL";
+                for (size_t i = 0; i < cells; i++) {
+                    conn.out += " " + row_of(chooser.next(rng)) + " c";
+                    if (op == OP_PUT) {
+                        size_t len = pick_size();
+                        conn.out += " " + std::to_string(len) + " ";
+                        conn.out.append(value_bytes.data(), len);
+                    }
+                }
+            }
+            conn.out += "\r\n";
+        }
+
+        const Config& config;
+        KeyChooser chooser;
+        std::mt19937_64 rng;
+        std::string value_bytes;
+};
+
+/**
+ * @brief Write as much pending output as the socket takes
+ *
+ * @return false on a broken connection
+ */
+static bool flush_out(BenchConn& conn) {
+    while (conn.out_off < conn.out.size()) {
+        ssize_t n = send(conn.fd, conn.out.data() + conn.out_off, conn.out.size() - conn.out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.out_off += n;
+    }
+    conn.out.clear();
+    conn.out_off = 0;
+    return true;
+}
+
+/**
+ * @brief Account one response unit (frame or line) against the oldest pending request
+ *
+ * @return true if that completed the request
+ */
+static bool complete_unit(BenchConn& conn, Results& results, bool miss, bool error, uint64_t now) {
+    if (conn.pending.empty()) {
+        results.errors++;
+        return false;
+    }
+    results.misses += miss;
+    results.errors += error;
+    Pending& front = conn.pending.front();
+    if (--front.remaining > 0) {
+        return false;
+    }
+    uint64_t latency = now > front.start_ns ? now - front.start_ns : 0;
+    results.all.record(latency);
+    results.by_op[front.op].record(latency);
+    results.ops[front.op]++;
+    conn.pending.pop_front();
+    return true;
+}
+
+/**
+ * @brief Consume complete responses from conn.in
+ *
+ * @return number of requests completed
+ */
+static size_t parse_responses(BenchConn& conn, bool binary, Results& results) {
+    uint64_t now = now_ns();
+    size_t completed = 0;
+    size_t pos = 0;
+    if (binary) {
+        while (conn.in.size() - pos >= BIN_HEADER_SIZE) {
+            BinHeader rsp;
+            decode_bin_header(conn.in.data() + pos, rsp);
+            if (conn.in.size() - pos - BIN_HEADER_SIZE < rsp.value_len) {
+                break;
+            }
+            pos += BIN_HEADER_SIZE + rsp.value_len;
+            completed += complete_unit(conn, results, rsp.row_len == BIN_NOT_FOUND, rsp.row_len != BIN_OK && rsp.row_len != BIN_NOT_FOUND, now);
+        }
+    } else {
+        while (true) {
+
+            // prompts are interleaved between batches; skip them
+            while (conn.in.compare(pos, sizeof(PROMPT) - 1, PROMPT) == 0) {
+                pos += sizeof(PROMPT) - 1;
+            }
+            size_t eol = conn.in.find('\n', pos);
+            if (eol == std::string::npos) {
+                break;
+            }
+            bool miss = conn.in.compare(pos, 28, "-550 Resource Does Not Exist") == 0;
+            bool error = !miss && conn.in.compare(pos, 1, "-") == 0;
+            pos = eol + 1;
+            completed += complete_unit(conn, results, miss, error, now);
+        }
+    }
+    conn.in.erase(0, pos);
+    return completed;
+}
+
+/**
+ * @brief Read everything available on a connection
+ *
+ * @return false on a closed or broken connection
+ */
+static bool fill_in(BenchConn& conn) {
+    char chunk[64 * 1024];
+    while (true) {
+        ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            return false;
+        }
+        conn.in.append(chunk, n);
+    }
+}
+
+/**
+ * @brief Drive a set of connections until the deadline, then drain
+ */
+static void run_thread(const Config& config, std::vector<BenchConn>& conns, uint64_t seed, uint64_t start, uint64_t end, Results& results) {
+    Workload workload(config, seed);
+    int epoll_fd = epoll_create1(0);
+    for (size_t i = 0; i < conns.size(); i++) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u64 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+
+    // open loop: each connection sends at rate / connections, with staggered phases
+    uint64_t interval = config.rate > 0 ? (uint64_t) (1e9 * config.connections / config.rate) : 0;
+    for (size_t i = 0; i < conns.size(); i++) {
+        conns[i].next_due_ns = start + (interval * i) / conns.size();
+        if (interval == 0) {
+            workload.issue(conns[i], now_ns());
+            results.sent++;
+            flush_out(conns[i]);
+        }
+    }
+
+    // event loop
+    struct epoll_event events[256];
+    while (true) {
+        uint64_t now = now_ns();
+        bool running = now < end;
+        size_t outstanding = 0;
+        for (BenchConn& conn : conns) {
+            outstanding += conn.pending.size();
+        }
+        if (!running && (outstanding == 0 || now >= end + DRAIN_NS)) {
+            break;
+        }
+
+        // open loop: send everything that has come due, timed from when it was due
+        int timeout_ms = 10;
+        if (interval > 0 && running) {
+            uint64_t next_due = UINT64_MAX;
+            for (BenchConn& conn : conns) {
+                if (conn.fd < 0) {
+                    continue;
+                }
+                while (conn.next_due_ns <= now && conn.next_due_ns < end) {
+                    workload.issue(conn, conn.next_due_ns);
+                    results.sent++;
+                    conn.next_due_ns += interval;
+                }
+                flush_out(conn);
+                next_due = std::min(next_due, conn.next_due_ns);
+            }
+            timeout_ms = next_due > now ? (int) ((next_due - now) / 1000000) : 0;
+        }
+
+        // handle socket readiness
+        int n = epoll_wait(epoll_fd, events, 256, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            BenchConn& conn = conns[events[i].data.u64];
+            if (conn.fd < 0) {
+                continue;
+            }
+            if (!fill_in(conn) || !flush_out(conn)) {
+                fprintf(stderr, "Connection lost\n");
+                results.errors += conn.pending.size();
+                conn.pending.clear();
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, NULL);
+                close(conn.fd);
+                conn.fd = -1;
+                continue;
+            }
+            size_t completed = parse_responses(conn, config.binary, results);
+
+            // closed loop: replace each completed request immediately
+            if (interval == 0 && now_ns() < end) {
+                for (size_t j = 0; j < completed; j++) {
+                    workload.issue(conn, now_ns());
+                    results.sent++;
+                }
+                flush_out(conn);
+            }
+        }
+    }
+    close(epoll_fd);
+}
+
+/**
+ * @brief PUT every key once over the first connection
+ */
+static bool preload(const Config& config, BenchConn& conn) {
+    Workload workload(config, config.seed);
+    Results ignored;
+    int flags = fcntl(conn.fd, F_GETFL, 0);
+    fcntl(conn.fd, F_SETFL, flags & ~O_NONBLOCK);
+    for (uint64_t first = 0; first < config.keys; first += PRELOAD_BATCH) {
+        workload.issue_puts(conn, first, std::min(config.keys, first + PRELOAD_BATCH));
+        if (!flush_out(conn)) {
+            return false;
+        }
+        while (!conn.pending.empty()) {
+            char chunk[64 * 1024];
+            ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                return false;
+            }
+            conn.in.append(chunk, n);
+            parse_responses(conn, true, ignored);
+        }
+    }
+    fcntl(conn.fd, F_SETFL, flags);
+    return ignored.errors == 0;
+}
+
+static void print_latency(const char* name, const Histogram& hist) {
+    printf("%-4s  n=%-10llu p50=%9.1f  p90=%9.1f  p99=%9.1f  p99.9=%9.1f  max=%9.1f  mean=%9.1f us\n", name,
+           (unsigned long long) hist.count(), hist.percentile(50) / 1e3, hist.percentile(90) / 1e3, hist.percentile(99) / 1e3,
+           hist.percentile(99.9) / 1e3, hist.max() / 1e3, hist.mean() / 1e3);
+}
+
+int main(int argc, char* argv[]) {
+
+    // parse options
+    Config config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool takes_value = strcmp(arg, "-L") != 0 && strcmp(arg, "-J") != 0;
+        if (takes_value && !val) {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(arg, "-h") == 0) {
+            config.host = val;
+        } else if (strcmp(arg, "-p") == 0) {
+            config.port = std::atoi(val);
+        } else if (strcmp(arg, "-c") == 0) {
+            config.connections = std::atoi(val);
+        } else if (strcmp(arg, "-t") == 0) {
+            config.threads = std::atoi(val);
+        } else if (strcmp(arg, "-d") == 0) {
+            config.duration = std::atof(val);
+        } else if (strcmp(arg, "-r") == 0) {
+            config.rate = std::atof(val);
+        } else if (strcmp(arg, "-m") == 0) {
+            if (sscanf(val, "%u:%u:%u", &config.mix[OP_GET], &config.mix[OP_PUT], &config.mix[OP_DEL]) != 3
+                || config.mix[OP_GET] + config.mix[OP_PUT] + config.mix[OP_DEL] == 0) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(arg, "-k") == 0) {
+            config.keys = std::atoll(val);
+        } else if (strcmp(arg, "-z") == 0) {
+            config.theta = std::atof(val);
+        } else if (strcmp(arg, "-s") == 0) {
+            if (sscanf(val, "%zu-%zu", &config.value_min, &config.value_max) != 2) {
+                config.value_min = config.value_max = std::atoll(val);
+            }
+        } else if (strcmp(arg, "-B") == 0) {
+            config.batch = std::atoi(val);
+        } else if (strcmp(arg, "-P") == 0) {
+            config.binary = strcmp(val, "text") != 0;
+        } else if (strcmp(arg, "-S") == 0) {
+            config.seed = std::atoll(val);
+        } else if (strcmp(arg, "-L") == 0) {
+            config.preload = true;
+            continue;
+        } else if (strcmp(arg, "-J") == 0) {
+            config.documents = true;
+            continue;
+        } else {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        i++;
+    }
+    if (config.connections == 0 || config.threads == 0 || config.keys == 0 || config.batch == 0
+        || config.theta < 0 || config.theta >= 1 || config.value_min > config.value_max) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    if (config.threads > config.connections) {
+        config.threads = config.connections;
+    }
+
+    // connect everything up front
+    std::vector<std::vector<BenchConn>> per_thread(config.threads);
+    for (size_t i = 0; i < config.connections; i++) {
+        BenchConn conn;
+        conn.fd = open_connection(config);
+        if (conn.fd < 0) {
+            fprintf(stderr, "Failed to connect to %s:%d (%s)\n", config.host.c_str(), config.port, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fcntl(conn.fd, F_SETFL, fcntl(conn.fd, F_GETFL, 0) | O_NONBLOCK);
+        per_thread[i % config.threads].push_back(std::move(conn));
+    }
+
+    // optionally populate the key space (binary framing only)
+    if (config.preload) {
+        if (!config.binary) {
+            fprintf(stderr, "-L requires binary framing\n");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "Preloading %llu keys...\n", (unsigned long long) config.keys);
+        if (!preload(config, per_thread[0][0])) {
+            fprintf(stderr, "Preload failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // run
+    std::vector<Results> results(config.threads);
+    std::vector<std::thread> threads;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t) (config.duration * 1e9);
+    for (size_t i = 0; i < config.threads; i++) {
+        threads.emplace_back(run_thread, std::cref(config), std::ref(per_thread[i]), config.seed + i + 1, start, end, std::ref(results[i]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    // merge and report
+    Results total;
+    for (Results& r : results) {
+        total.all.merge(r.all);
+        for (int op = 0; op < NUM_OPS; op++) {
+            total.by_op[op].merge(r.by_op[op]);
+            total.ops[op] += r.ops[op];
+        }
+        total.misses += r.misses;
+        total.errors += r.errors;
+        total.sent += r.sent;
+    }
+    double window = std::min(elapsed, config.duration);
+    uint64_t completed = total.all.count();
+    printf("%s %s, %zu conns, %zu threads, batch %zu, keys %llu (%s), %svalues %zu-%zu B\n",
+           config.rate > 0 ? "open loop" : "closed loop", config.binary ? "binary" : "text", config.connections, config.threads,
+           config.batch, (unsigned long long) config.keys, config.theta > 0 ? ("zipf " + std::to_string(config.theta)).c_str() : "uniform",
+           config.documents ? "document " : "", config.value_min, config.value_max);
+    printf("requests %llu completed of %llu sent in %.2fs: %.0f req/s, %.0f cells/s",
+           (unsigned long long) completed, (unsigned long long) total.sent, window, completed / window, completed * config.batch / window);
+    if (config.rate > 0) {
+        printf(" (target %.0f req/s)", config.rate);
+    }
+    printf("\nmisses %llu, errors %llu\n", (unsigned long long) total.misses, (unsigned long long) total.errors);
+    print_latency("ALL", total.all);
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (total.ops[op] > 0) {
+            print_latency(OP_NAMES[op], total.by_op[op]);
+        }
+    }
+    return total.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,855 @@
+/*
+ * Microbenchmarks for the server's hot paths, timed in isolation: Tablet
+ * operations for each cell engine, value compression, tiered storage,
+ * secondary indexes, contended atomic updates, read views, the iotool delimiter helpers, and the text command parser.  The server is compiled in without its main() so that
+ * execute_command runs exactly as it does under the reactor.
+ */
+#define SERVER_NO_MAIN
+#include "server.cpp"
+
+#include <fcntl.h>
+#include <random>
+#include <algorithm>
+#include "Bench/microbench.h"
+#include "Bench/document.h"
+#include "Util/lz.h"
+
+/**
+ * @brief cells in each Tablet fixture unless -n says otherwise
+ */
+#define MICRO_DEFAULT_CELLS 100000
+
+/**
+ * @brief capacity requested for the pipe read_until_delimiter reads from
+ */
+#define MICRO_PIPE_BYTES (1 << 20)
+
+/**
+ * @brief distinct documents cycled through by the compression cases, and most cells they store
+ */
+#define MICRO_DOCUMENTS 64
+#define MICRO_DOCUMENT_CELLS 10000
+
+/**
+ * @brief value size and most cells of the tiered storage cases
+ */
+#define MICRO_TIER_VALUE 4096
+#define MICRO_TIER_CELLS 10000
+
+/**
+ * @brief distinct values of the indexed column in the secondary index cases
+ */
+#define MICRO_INDEX_VALUES 16
+
+/**
+ * @brief the contention cases run up to at least this many threads, however few cores there are
+ */
+#define MICRO_CONTENTION_THREADS 8
+
+/**
+ * @brief Microbenchmark configuration (see usage())
+ */
+struct MicroConfig {
+    uint64_t cells = MICRO_DEFAULT_CELLS;
+    unsigned reps = 5;
+    unsigned warmup = 1;
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> filters;
+    std::string json_path;
+    std::string baseline_path;
+    bool list = false;
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: microbench [options]\n"
+        "  -f <substring>     only run cases whose name contains this (repeatable)\n"
+        "  -n <cells>         cells per Tablet fixture (default 100000)\n"
+        "  -r <reps>          timed repetitions; the median is reported (default 5)\n"
+        "  -w <reps>          untimed warmup repetitions (default 1)\n"
+        "  -t <threads>       most threads for the scaling cases (default: one per core)\n"
+        "  -j <path>          also write results as JSON (- for stdout)\n"
+        "  -b <path>          compare with JSON results from an earlier run\n"
+        "  -l                 list case names and exit\n");
+}
+
+/**
+ * @brief A Tablet holding rows of equal width and a shuffled order to visit their cells in
+ */
+struct TabletFixture {
+    std::unique_ptr<Tablet> tablet;
+    std::vector<CellKey> keys;
+    std::vector<char> bytes;
+
+    TabletFixture(CellEngine cell_engine, uint64_t cells, size_t width, size_t value_size) : bytes(value_size, 'v') {
+        tablet.reset(new Tablet(TABLET_DEFAULT_SHARDS, cell_engine));
+        char row[32], col[32];
+        for (uint64_t i = 0; i < cells; i++) {
+            snprintf(row, sizeof(row), "row%08llu", (unsigned long long) (i / width));
+            snprintf(col, sizeof(col), "col%05llu", (unsigned long long) (i % width));
+            keys.emplace_back(row, col);
+        }
+        std::shuffle(keys.begin(), keys.end(), std::mt19937_64(cells));
+    }
+
+    void fill() {
+        for (const CellKey& key : keys) {
+            tablet->put(key.first, key.second, bytes);
+        }
+    }
+};
+
+static const char* engine_name(CellEngine cell_engine) {
+    return cell_engine == CellEngine::FLAT ? "flat" : "nested";
+}
+
+/**
+ * @brief Tablet::get/put/del over every cell of a fixture, for each engine, row width and value size
+ *
+ * put overwrites existing cells (the steady state of an update-heavy
+ * workload) and copies its value in, as a PUT command does; load inserts
+ * into an empty tablet, and its retained bytes are the per-cell footprint.
+ */
+static void add_tablet_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    for (CellEngine cell_engine : {CellEngine::NESTED, CellEngine::FLAT}) {
+        for (size_t width : {1, 16, 256}) {
+            for (size_t value_size : {16, 1024}) {
+                std::string suffix = std::string("/") + engine_name(cell_engine) + "/w" + std::to_string(width) + "/v" + std::to_string(value_size);
+                auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+                auto prepare = [=]() {
+                    fixture->reset(new TabletFixture(cell_engine, config.cells, width, value_size));
+                    (*fixture)->fill();
+                };
+                auto finish = [=]() { fixture->reset(); };
+
+                cases.push_back(MicroCase{"tablet/get" + suffix, config.cells, prepare, nullptr, [=]() {
+                    TabletFixture& f = **fixture;
+                    for (const CellKey& key : f.keys) {
+                        ValueRef value = f.tablet->get(key.first, key.second);
+                        if (!value) {
+                            abort();
+                        }
+                    }
+                }, finish});
+
+                cases.push_back(MicroCase{"tablet/put" + suffix, config.cells, prepare, nullptr, [=]() {
+                    TabletFixture& f = **fixture;
+                    for (const CellKey& key : f.keys) {
+                        f.tablet->put(key.first, key.second, f.bytes);
+                    }
+                }, finish});
+
+                cases.push_back(MicroCase{"tablet/del" + suffix, config.cells, prepare, [=]() { (*fixture)->fill(); }, [=]() {
+                    TabletFixture& f = **fixture;
+                    for (const CellKey& key : f.keys) {
+                        if (!f.tablet->del(key.first, key.second)) {
+                            abort();
+                        }
+                    }
+                }, finish});
+
+                cases.push_back(MicroCase{"tablet/load" + suffix, config.cells, [=]() {
+                    fixture->reset(new TabletFixture(cell_engine, config.cells, width, value_size));
+                }, [=]() {
+                    (*fixture)->tablet->clear();
+                }, [=]() {
+                    (*fixture)->fill();
+                }, finish});
+            }
+        }
+    }
+}
+
+/**
+ * @brief Concurrent Tablet::get from 1, 2, 4 ... threads; ns/op is wall time over all threads' operations
+ */
+static void add_scaling_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    for (CellEngine cell_engine : {CellEngine::NESTED, CellEngine::FLAT}) {
+        auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+        for (unsigned threads = 1; threads <= config.max_threads; threads *= 2) {
+            std::string name = std::string("tablet/get_mt/") + engine_name(cell_engine) + "/t" + std::to_string(threads);
+            cases.push_back(MicroCase{name, config.cells * threads, [=]() {
+                fixture->reset(new TabletFixture(cell_engine, config.cells, 16, 100));
+                (*fixture)->fill();
+            }, nullptr, [=]() {
+                TabletFixture& f = **fixture;
+                std::vector<std::thread> readers;
+                for (unsigned t = 0; t < threads; t++) {
+                    readers.emplace_back([&f, t, threads]() {
+
+                        // each reader walks every key from its own starting point
+                        size_t n = f.keys.size();
+                        size_t offset = n * t / threads;
+                        for (size_t i = 0; i < n; i++) {
+                            const CellKey& key = f.keys[(i + offset) % n];
+                            if (!f.tablet->get(key.first, key.second)) {
+                                abort();
+                            }
+                        }
+                    });
+                }
+                for (auto& reader : readers) {
+                    reader.join();
+                }
+            }, [=]() { fixture->reset(); }});
+        }
+    }
+}
+
+/**
+ * @brief Threads all incrementing one hot counter: with incrby, and with a get-then-cas loop that retries on conflict
+ *
+ * ns/op is wall time over all threads' increments; the gap between the two
+ * is the cost of round trips and retries that incrby avoids.
+ */
+static void add_contention_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    uint64_t per_thread = std::max<uint64_t>(config.cells / 10, 1);
+    unsigned max_threads = std::max<unsigned>(config.max_threads, MICRO_CONTENTION_THREADS);
+    for (bool use_cas : {false, true}) {
+        auto tablet = std::make_shared<std::unique_ptr<Tablet>>();
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+            std::string name = std::string("tablet/") + (use_cas ? "cas_loop" : "incrby") + "_hot/t" + std::to_string(threads);
+            cases.push_back(MicroCase{name, per_thread * threads, [=]() {
+                tablet->reset(new Tablet());
+            }, nullptr, [=]() {
+                Tablet& tab = **tablet;
+                std::string row = "counters", col = "hot";
+                std::vector<std::thread> writers;
+                for (unsigned t = 0; t < threads; t++) {
+                    writers.emplace_back([&tab, &row, &col, per_thread, use_cas]() {
+                        int64_t result;
+                        uint64_t version;
+                        for (uint64_t i = 0; i < per_thread; i++) {
+                            if (!use_cas) {
+                                tab.incrby(row, col, 1, result, version);
+                                continue;
+                            }
+
+                            // read, add and write back, starting over whenever another thread got in first
+                            while (true) {
+                                ValueRef value = tab.get(row, col, version);
+                                int64_t count = value ? std::atoll(std::string(value->begin(), value->end()).c_str()) : 0;
+                                std::string text = std::to_string(count + 1);
+                                if (tab.cas(row, col, value ? version : 0, make_value(std::vector<char>(text.begin(), text.end())), version)) {
+                                    break;
+                                }
+                            }
+                        }
+                    });
+                }
+                for (auto& writer : writers) {
+                    writer.join();
+                }
+            }, [=]() { tablet->reset(); }});
+        }
+    }
+}
+
+/**
+ * @brief Tablet::collect_shard over every shard as of a view, and Tablet::put while a view is open
+ *
+ * collect is the copy a snapshot or full sync takes, per cell.  put/view_open
+ * overwrites every cell while an older view holds on to the values it
+ * replaces; its difference from tablet/put/nested/w16/v16 is the cost of
+ * keeping them, and its kept B/op what each retained value occupies until
+ * the view closes.
+ */
+static void add_view_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+    auto view = std::make_shared<uint64_t>(0);
+    auto prepare = [=]() {
+        fixture->reset(new TabletFixture(CellEngine::NESTED, config.cells, 16, 16));
+        (*fixture)->fill();
+    };
+    auto finish = [=]() { fixture->reset(); };
+
+    cases.push_back(MicroCase{"tablet/collect/w16", config.cells, prepare, nullptr, [=]() {
+        Tablet& tab = *(*fixture)->tablet;
+        uint64_t view_seq = tab.open_view();
+        std::vector<CellEntry> cells;
+        for (size_t i = 0; i < tab.num_shards(); i++) {
+            cells.clear();
+            tab.collect_shard(i, cells, view_seq);
+        }
+        tab.close_view(view_seq);
+    }, finish});
+
+    cases.push_back(MicroCase{"tablet/put/view_open/w16", config.cells, [=]() {
+        prepare();
+        *view = (*fixture)->tablet->open_view();
+    }, [=]() {
+        Tablet& tab = *(*fixture)->tablet;
+        tab.close_view(*view);
+        tab.reclaim_versions();
+        *view = tab.open_view();
+    }, [=]() {
+        TabletFixture& f = **fixture;
+        for (const CellKey& key : f.keys) {
+            f.tablet->put(key.first, key.second, f.bytes);
+        }
+    }, finish});
+}
+
+/**
+ * @brief lz_compress/lz_decompress on JSON-like documents, and Tablet::get/load of them stored raw and compressed
+ *
+ * The get cases' difference is the latency compression adds to a read; the
+ * load cases' kept B/op is the per-cell footprint, whose ratio is the
+ * memory saved.
+ */
+static void add_compression_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    uint64_t cells = std::min<uint64_t>(config.cells, MICRO_DOCUMENT_CELLS);
+    for (size_t doc_size : {1024, 16384}) {
+        std::string suffix = "/d" + std::to_string(doc_size);
+        auto docs = std::make_shared<std::vector<std::vector<char>>>();
+        auto blocks = std::make_shared<std::vector<std::vector<char>>>();
+        auto make_docs = [=]() {
+            for (uint64_t i = 0; i < MICRO_DOCUMENTS; i++) {
+                std::string doc = make_document(doc_size, i);
+                docs->emplace_back(doc.begin(), doc.end());
+                blocks->emplace_back();
+                lz_compress(doc.data(), doc.size(), blocks->back());
+            }
+        };
+        auto free_docs = [=]() {
+            docs->clear();
+            blocks->clear();
+        };
+
+        cases.push_back(MicroCase{"lz/compress" + suffix, cells, make_docs, nullptr, [=]() {
+            std::vector<char> block;
+            for (uint64_t i = 0; i < cells; i++) {
+                const std::vector<char>& doc = (*docs)[i % MICRO_DOCUMENTS];
+                lz_compress(doc.data(), doc.size(), block);
+            }
+        }, free_docs});
+
+        cases.push_back(MicroCase{"lz/decompress" + suffix, cells, make_docs, nullptr, [=]() {
+            std::vector<char> doc;
+            for (uint64_t i = 0; i < cells; i++) {
+                const std::vector<char>& block = (*blocks)[i % MICRO_DOCUMENTS];
+                if (!lz_decompress(block.data(), block.size(), doc)) {
+                    abort();
+                }
+            }
+        }, free_docs});
+
+        for (bool compress : {false, true}) {
+            std::string mode = compress ? "/lz" : "/raw";
+            auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+            auto fill = [=]() {
+                TabletFixture& f = **fixture;
+                for (size_t i = 0; i < f.keys.size(); i++) {
+                    f.tablet->put(f.keys[i].first, f.keys[i].second, (*docs)[i % MICRO_DOCUMENTS]);
+                }
+            };
+            auto make_fixture = [=]() {
+                make_docs();
+                fixture->reset(new TabletFixture(CellEngine::NESTED, cells, 16, 0));
+                (*fixture)->tablet->set_compression(compress ? doc_size : 0);
+            };
+            auto finish = [=]() {
+                fixture->reset();
+                free_docs();
+            };
+
+            cases.push_back(MicroCase{"tablet/get_doc" + suffix + mode, cells, [=]() {
+                make_fixture();
+                fill();
+            }, nullptr, [=]() {
+                TabletFixture& f = **fixture;
+                for (const CellKey& key : f.keys) {
+                    ValueRef value = f.tablet->get(key.first, key.second);
+                    if (!value || value->size() != doc_size) {
+                        abort();
+                    }
+                }
+            }, finish});
+
+            cases.push_back(MicroCase{"tablet/load_doc" + suffix + mode, cells, make_fixture, [=]() {
+                (*fixture)->tablet->clear();
+            }, fill, finish});
+        }
+    }
+}
+
+/**
+ * @brief Tablet::get and put of values kept in memory and moved to segment files
+ *
+ * The get cases' difference is what a cold read adds (a pread from the page
+ * cache and a checksum); put/cold includes appending the value to the
+ * current segment file.
+ */
+static void add_tier_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    uint64_t cells = std::min<uint64_t>(config.cells, MICRO_TIER_CELLS);
+    for (bool cold : {false, true}) {
+        std::string mode = cold ? "/cold" : "/hot";
+        auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+        auto dir = std::make_shared<std::string>();
+        auto make_fixture = [=]() {
+            fixture->reset(new TabletFixture(CellEngine::NESTED, cells, 16, MICRO_TIER_VALUE));
+            if (cold) {
+                char path[] = "/tmp/microbench-tier-XXXXXX";
+                if (!mkdtemp(path) || !(*fixture)->tablet->set_tier(path, MICRO_TIER_VALUE)) {
+                    fprintf(stderr, "Failed to set up a tier directory (%s)\n", strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                *dir = path;
+            }
+        };
+        auto finish = [=]() {
+            fixture->reset();
+            if (!dir->empty()) {
+                rmdir(dir->c_str());
+            }
+        };
+        std::string suffix = "/v" + std::to_string(MICRO_TIER_VALUE) + mode;
+
+        cases.push_back(MicroCase{"tablet/get_tier" + suffix, cells, [=]() {
+            make_fixture();
+            (*fixture)->fill();
+        }, nullptr, [=]() {
+            TabletFixture& f = **fixture;
+            for (const CellKey& key : f.keys) {
+                ValueRef value = f.tablet->get(key.first, key.second);
+                if (!value || value->size() != MICRO_TIER_VALUE) {
+                    abort();
+                }
+            }
+        }, finish});
+
+        cases.push_back(MicroCase{"tablet/put_tier" + suffix, cells, [=]() {
+            make_fixture();
+            (*fixture)->fill();
+        }, nullptr, [=]() { (*fixture)->fill(); }, finish});
+    }
+}
+
+/**
+ * @brief Tablet::put with and without a secondary index on the written column,
+ *        and Tablet::find against the full scan a client would otherwise run
+ *
+ * Every row has one cell holding one of MICRO_INDEX_VALUES values, and each
+ * put moves its row to the next value, so the put cases' difference is what
+ * keeping the index costs a write.  A find op and a scan op each collect the
+ * rows holding one value.
+ */
+static void add_index_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    auto values = std::make_shared<std::vector<ValueRef>>();
+    for (int i = 0; i < MICRO_INDEX_VALUES; i++) {
+        std::string value = "status-" + std::to_string(i);
+        values->push_back(make_value(std::vector<char>(value.begin(), value.end())));
+    }
+    for (bool indexed : {false, true}) {
+        std::string mode = indexed ? "/indexed" : "/plain";
+        auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+        auto round = std::make_shared<size_t>(0);
+        auto fill = [=]() {
+            TabletFixture& f = **fixture;
+            for (size_t i = 0; i < f.keys.size(); i++) {
+                f.tablet->put(f.keys[i].first, f.keys[i].second, (*values)[(i + *round) % MICRO_INDEX_VALUES]);
+            }
+            ++*round;
+        };
+        auto prepare = [=]() {
+            fixture->reset(new TabletFixture(CellEngine::NESTED, config.cells, 1, 0));
+            if (indexed) {
+                (*fixture)->tablet->add_index("col00000");
+            }
+            fill();
+        };
+        auto finish = [=]() { fixture->reset(); };
+
+        cases.push_back(MicroCase{"tablet/put_index" + mode, config.cells, prepare, nullptr, fill, finish});
+
+        if (!indexed) {
+            cases.push_back(MicroCase{"tablet/find/scan", MICRO_INDEX_VALUES, prepare, nullptr, [=]() {
+                TabletFixture& f = **fixture;
+                std::vector<std::string> rows;
+                for (const ValueRef& value : *values) {
+                    rows.clear();
+                    TabletScan scan(*f.tablet, "", "");
+                    CellEntry cell;
+                    while (scan.next(cell)) {
+                        if (cell.col == "col00000" && *cell.value == *value) {
+                            rows.push_back(cell.row);
+                        }
+                    }
+                    if (rows.empty()) {
+                        abort();
+                    }
+                }
+            }, finish});
+            continue;
+        }
+        cases.push_back(MicroCase{"tablet/find/index", MICRO_INDEX_VALUES, prepare, nullptr, [=]() {
+            TabletFixture& f = **fixture;
+            std::vector<std::string> rows;
+            for (const ValueRef& value : *values) {
+                if (!f.tablet->find("col00000", std::string(value->begin(), value->end()), SIZE_MAX, rows) || rows.empty()) {
+                    abort();
+                }
+            }
+        }, finish});
+    }
+}
+
+/**
+ * @brief read_until_delimiter over lines already waiting in a pipe, one line per chunk
+ */
+static void add_read_cases(std::vector<MicroCase>& cases) {
+    for (size_t line_size : {64, 4096}) {
+        auto fds = std::make_shared<std::pair<int, int>>(-1, -1);
+        uint64_t lines = MICRO_PIPE_BYTES / line_size;
+        cases.push_back(MicroCase{"iotool/read_until_delimiter/l" + std::to_string(line_size), lines, [=]() {
+            int pipe_fds[2];
+            if (pipe(pipe_fds) < 0 || fcntl(pipe_fds[1], F_SETPIPE_SZ, MICRO_PIPE_BYTES) < MICRO_PIPE_BYTES) {
+                fprintf(stderr, "Failed to create a %d byte pipe (%s)\n", MICRO_PIPE_BYTES, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            *fds = {pipe_fds[0], pipe_fds[1]};
+        }, [=]() {
+
+            // queue every line up front so the run never blocks
+            std::string line(line_size - 2, 'x');
+            line += DELIM;
+            std::string all;
+            for (uint64_t i = 0; i < lines; i++) {
+                all += line;
+            }
+            if (do_write(fds->second, all.data(), all.size()) != (ssize_t) all.size()) {
+                abort();
+            }
+        }, [=]() {
+            std::string buf;
+            for (uint64_t i = 0; i < lines; i++) {
+                if (read_until_delimiter(fds->first, buf, line_size, DELIM) != (ssize_t) line_size) {
+                    abort();
+                }
+            }
+        }, [=]() {
+            close(fds->first);
+            close(fds->second);
+        }});
+    }
+}
+
+/**
+ * @brief parse_next_command draining pipelined batches of commands, each from its own buffer
+ */
+static void add_parse_cases(std::vector<MicroCase>& cases) {
+    for (size_t batch : {16, 1024}) {
+        size_t buffers = std::max<size_t>(1, 1024 / batch);
+        auto bufs = std::make_shared<std::vector<std::string>>(buffers);
+        cases.push_back(MicroCase{"iotool/parse_next_command/b" + std::to_string(batch), batch * buffers, nullptr, [=]() {
+            std::string all;
+            char command[64];
+            for (size_t i = 0; i < batch; i++) {
+                snprintf(command, sizeof(command), "GET row%08zu col%05zu" DELIM, i, i % 16);
+                all += command;
+            }
+            for (std::string& buf : *bufs) {
+                buf = all;
+            }
+        }, [=]() {
+            for (std::string& buf : *bufs) {
+                for (size_t i = 0; i < batch; i++) {
+                    if (!parse_next_command(buf, DELIM)) {
+                        abort();
+                    }
+                }
+            }
+        }, nullptr});
+    }
+}
+
+/**
+ * @brief InputBuffer::next_line draining the same pipelined batches, as the reactor's connections do
+ */
+static void add_next_line_cases(std::vector<MicroCase>& cases) {
+    for (size_t batch : {16, 1024}) {
+        size_t buffers = std::max<size_t>(1, 1024 / batch);
+        auto bufs = std::make_shared<std::vector<InputBuffer>>(buffers);
+        cases.push_back(MicroCase{"inbuf/next_line/b" + std::to_string(batch), batch * buffers, nullptr, [=]() {
+            std::string all;
+            char command[64];
+            for (size_t i = 0; i < batch; i++) {
+                snprintf(command, sizeof(command), "GET row%08zu col%05zu" DELIM, i, i % 16);
+                all += command;
+            }
+            for (InputBuffer& buf : *bufs) {
+                buf.append(all.data(), all.size());
+            }
+        }, [=]() {
+            for (InputBuffer& buf : *bufs) {
+                for (size_t i = 0; i < batch; i++) {
+                    if (!buf.next_line(DELIM)) {
+                        abort();
+                    }
+                }
+            }
+        }, nullptr});
+    }
+}
+
+/**
+ * @brief execute_command (parse and run one text command) and on_text_input
+ *        (the same behind framing and stats) against the server's global tablet
+ */
+static void add_command_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+
+    // commands over a fixed rotation of existing cells
+    const size_t rotation = 1024;
+    auto make_commands = [=](const char* format) {
+        std::vector<std::string> commands;
+        char command[256];
+        for (size_t i = 0; i < rotation; i++) {
+            size_t cell = i * 97 % config.cells;
+            snprintf(command, sizeof(command), format, cell / 16, cell % 16, cell / 16, cell % 16);
+            commands.push_back(command);
+        }
+        return commands;
+    };
+    std::string value(100, 'v');
+
+    // DEL removes the cell it names, so it gets one command per cell and a
+    // refilled tablet before every repetition
+    std::vector<std::string> deletes;
+    char command[64];
+    for (size_t cell = 0; cell < config.cells; cell++) {
+        snprintf(command, sizeof(command), "DEL row%08zu col%05zu", cell / 16, cell % 16);
+        deletes.push_back(command);
+    }
+    struct {
+        const char* name;
+        std::vector<std::string> commands;
+        bool refill;
+    } kinds[] = {
+        {"get", make_commands("GET row%08zu col%05zu"), false},
+        {"put", make_commands(("PUT row%08zu col%05zu " + value).c_str()), false},
+        {"del", deletes, true},
+        {"mget2", make_commands("MGET row%08zu col%05zu row%08zu col%05zu"), false},
+        {"miss", make_commands("GET nosuchrow%zu col%zu"), false},
+    };
+
+    // each command's response is retired as soon as it is queued, as if the
+    // reactor had flushed it, so the connection's output buffer is reused
+    for (auto& kind : kinds) {
+        auto commands = std::make_shared<std::vector<std::string>>(kind.commands);
+        auto fixture = std::make_shared<std::unique_ptr<TabletFixture>>();
+        auto conn = std::make_shared<Connection>();
+        auto setup = [=]() {
+            fixture->reset(new TabletFixture(CellEngine::NESTED, config.cells, 16, 100));
+            (*fixture)->fill();
+            tab = (*fixture)->tablet.get();
+        };
+        std::function<void()> refill;
+        if (kind.refill) {
+            refill = [=]() { (*fixture)->fill(); };
+        }
+        auto teardown = [=]() {
+            tab = nullptr;
+            fixture->reset();
+        };
+        cases.push_back(MicroCase{std::string("server/execute_command/") + kind.name, config.cells, setup, refill, [=]() {
+            bool exit_flag = false;
+            for (uint64_t i = 0; i < config.cells; i++) {
+                execute_command((*commands)[i % commands->size()], *conn, exit_flag);
+                if (conn->out_bytes == 0) {
+                    abort();
+                }
+                conn->retire(conn->out_bytes);
+            }
+        }, teardown});
+
+        // the whole text path: framing, dispatch, stats and the prompt
+        cases.push_back(MicroCase{std::string("server/on_text_input/") + kind.name, config.cells, setup, refill, [=]() {
+            for (uint64_t i = 0; i < config.cells; i++) {
+                const std::string& command = (*commands)[i % commands->size()];
+                conn->inbuf.append(command.data(), command.size());
+                conn->inbuf.append(DELIM, sizeof(DELIM) - 1);
+                on_text_input(*conn);
+                if (conn->out_bytes == 0) {
+                    abort();
+                }
+                conn->retire(conn->out_bytes);
+            }
+        }, teardown});
+    }
+}
+
+/**
+ * @brief The per-command instrumentation the server adds to every command: one clock read and a record()
+ */
+static void add_stats_cases(const MicroConfig& config, std::vector<MicroCase>& cases) {
+    cases.push_back(MicroCase{"stats/record", config.cells, nullptr, nullptr, [=]() {
+        uint64_t last_ns = monotonic_ns();
+        for (uint64_t i = 0; i < config.cells; i++) {
+            uint64_t done_ns = monotonic_ns();
+            command_stats.record((StatCommand) (i % NUM_STAT_COMMANDS), done_ns - last_ns, false);
+            last_ns = done_ns;
+        }
+    }, nullptr});
+}
+
+/**
+ * @brief Most allocations per operation a case may make once warm; a run
+ *        that includes one of these cases fails if it makes more.
+ *
+ * GET (hit or miss), DEL and MGET answer from the connection's and the
+ * thread's reused buffers.  PUT allocates the value it stores: the byte
+ * vector and the control block of its shared handle (see execute_command).
+ */
+static const struct {
+    const char* name;
+    double allocs_per_op;
+} alloc_budgets[] = {
+    {"server/execute_command/get", 0},
+    {"server/on_text_input/get", 0},
+    {"server/execute_command/put", 2},
+    {"server/on_text_input/put", 2},
+    {"server/execute_command/del", 0},
+    {"server/on_text_input/del", 0},
+    {"server/execute_command/mget2", 0},
+    {"server/on_text_input/mget2", 0},
+    {"server/execute_command/miss", 0},
+    {"server/on_text_input/miss", 0},
+};
+
+/**
+ * @brief Report a result that exceeds its allocation budget
+ *
+ * @return false if it does
+ */
+static bool within_alloc_budget(const MicroResult& r) {
+    for (const auto& budget : alloc_budgets) {
+        if (r.name == budget.name && r.allocs_per_op > budget.allocs_per_op) {
+            fprintf(stderr, "%s: %.4f allocs/op exceeds its budget of %g\n", r.name.c_str(), r.allocs_per_op,
+                    budget.allocs_per_op);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool selected(const MicroConfig& config, const std::string& name) {
+    if (config.filters.empty()) {
+        return true;
+    }
+    for (const std::string& filter : config.filters) {
+        if (name.find(filter) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+
+    // parse options
+    MicroConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "-l") == 0) {
+            config.list = true;
+            continue;
+        }
+        if (!val) {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(arg, "-f") == 0) {
+            config.filters.push_back(val);
+        } else if (strcmp(arg, "-n") == 0) {
+            config.cells = std::atoll(val);
+        } else if (strcmp(arg, "-r") == 0) {
+            config.reps = std::atoi(val);
+        } else if (strcmp(arg, "-w") == 0) {
+            config.warmup = std::atoi(val);
+        } else if (strcmp(arg, "-t") == 0) {
+            config.max_threads = std::atoi(val);
+        } else if (strcmp(arg, "-j") == 0) {
+            config.json_path = val;
+        } else if (strcmp(arg, "-b") == 0) {
+            config.baseline_path = val;
+        } else {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        i++;
+    }
+    if (config.cells < 256 || config.reps == 0 || config.max_threads == 0) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    // load the baseline to compare against
+    std::vector<MicroResult> baseline;
+    if (!config.baseline_path.empty() && !read_micro_json(config.baseline_path, baseline)) {
+        fprintf(stderr, "Failed to read baseline %s (%s)\n", config.baseline_path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // build the case list
+    std::vector<MicroCase> cases;
+    add_tablet_cases(config, cases);
+    add_scaling_cases(config, cases);
+    add_compression_cases(config, cases);
+    add_tier_cases(config, cases);
+    add_index_cases(config, cases);
+    add_contention_cases(config, cases);
+    add_view_cases(config, cases);
+    add_read_cases(cases);
+    add_parse_cases(cases);
+    add_next_line_cases(cases);
+    add_command_cases(config, cases);
+    add_stats_cases(config, cases);
+    if (config.list) {
+        for (const MicroCase& micro : cases) {
+            printf("%s\n", micro.name.c_str());
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    // run and report each selected case as it finishes
+    FILE* report = config.json_path == "-" ? stderr : stdout;
+    fprintf(report, "%-44s %10s %10s %10s %10s %10s %8s\n", "case", "ns/op", "min ns/op", "allocs/op", "B/op", "kept B/op",
+            baseline.empty() ? "" : "vs base");
+    std::vector<MicroResult> results;
+    for (const MicroCase& micro : cases) {
+        if (!selected(config, micro.name)) {
+            continue;
+        }
+        MicroResult r = run_micro_case(micro, config.warmup, config.reps);
+        results.push_back(r);
+
+        std::string delta;
+        for (const MicroResult& base : baseline) {
+            if (base.name == r.name && base.ns_per_op > 0) {
+                char pct[32];
+                snprintf(pct, sizeof(pct), "%+.1f%%", (r.ns_per_op / base.ns_per_op - 1) * 100);
+                delta = pct;
+            }
+        }
+        fprintf(report, "%-44s %10.1f %10.1f %10.2f %10.1f %10.1f %8s\n", r.name.c_str(), r.ns_per_op, r.min_ns_per_op,
+                r.allocs_per_op, r.bytes_per_op, r.retained_per_op, delta.c_str());
+        fflush(report);
+    }
+
+    // write machine-readable results for later comparison
+    if (!config.json_path.empty() && !write_micro_json(config.json_path, results)) {
+        fprintf(stderr, "Failed to write %s (%s)\n", config.json_path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // hot paths that must not allocate fail the run if they do
+    bool budgets_met = true;
+    for (const MicroResult& r : results) {
+        budgets_met = within_alloc_budget(r) && budgets_met;
+    }
+    if (!budgets_met) {
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,570 @@
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <map>
+#include <set>
+#include <atomic>
+#include <thread>
+#include "Util/iotool.h"
+#include "Net/reactor.h"
+#include "Net/binproto.h"
+#include "Router/ring.h"
+#include "Router/backend.h"
+
+/**
+ * @brief prompt written before each batch of commands
+ */
+#define PROMPT "DataStore% "
+
+/**
+ * @brief command delimiter
+ */
+#define DELIM "\r\n"
+
+/**
+ * @brief response to a malformed command
+ */
+#define USAGE "1) GET <row> <col>\n2) PUT <row> <col> <bytes>\n3) DEL <row> <col>\n-550 Parser Failure"
+
+/**
+ * @brief default worker threads per core (workers block on backend round trips)
+ */
+#define ROUTER_WORKERS_PER_CORE 4
+
+/**
+ * @brief load added to a recently failed member when choosing where to read
+ */
+#define BACKEND_DOWN_PENALTY 1000000
+
+/**
+ * @brief One partition of the key space: a primary, which takes writes, and
+ *        read replicas (backups of it), which share its reads
+ */
+struct Partition {
+    std::vector<Backend*> members;
+
+    /**
+     * @brief rotates which member is tried first, so equally loaded members share reads
+     */
+    std::atomic<size_t> next_read{0};
+};
+
+/**
+ * @brief One client request in a batch: forwarded to a backend, or answered by the router
+ */
+struct Routed {
+    BackendCall call;
+    bool local = false;
+    std::string local_response;
+    uint32_t request_id = 0;
+
+    /**
+     * @brief partition owning the row, and the member the request was sent to
+     */
+    size_t partition = 0;
+    Backend* backend = nullptr;
+};
+
+/**
+ * @brief partitions, and the ring mapping rows onto them
+ */
+std::vector<Partition*> partitions;
+HashRing* ring;
+
+/**
+ * @brief port for router to run on
+ */
+int port;
+
+/**
+ * @brief debug message flag
+ */
+bool debug;
+
+/**
+ * @brief number of worker threads forwarding requests (0 = ROUTER_WORKERS_PER_CORE per core)
+ */
+size_t num_workers = 0;
+
+/**
+ * @brief Pick the member to send a request to
+ *
+ * Writes go to the partition's primary, and so do reads of a row written
+ * earlier in the same batch: the batch's round trips run in parallel, so a
+ * replica could answer before the primary has applied the write.  Other
+ * reads go to the member with the fewest requests in flight, counting those
+ * already assigned from this batch; members that recently failed are used
+ * only if no other is left.
+ *
+ * @param routed request to place
+ * @param assigned requests assigned to each backend so far in this batch
+ * @param exclude member that already failed this request, if any
+ * @param row_written whether an earlier request in the batch writes the row
+ * @return chosen member, or nullptr if none is left
+ */
+Backend* pick_backend(const Routed& routed, std::map<Backend*, int>& assigned, Backend* exclude, bool row_written) {
+    Partition& partition = *partitions[routed.partition];
+    const std::vector<Backend*>& members = partition.members;
+    if (routed.call.opcode != BIN_GET || row_written) {
+        return members[0] == exclude ? nullptr : members[0];
+    }
+    Backend* best = nullptr;
+    int best_load = 0;
+    size_t first = partition.next_read.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < members.size(); i++) {
+        Backend* member = members[(first + i) % members.size()];
+        if (member == exclude) {
+            continue;
+        }
+        int load = member->inflight.load(std::memory_order_relaxed) + assigned[member];
+        if (!member->available()) {
+            load += BACKEND_DOWN_PENALTY;
+        }
+        if (!best || load < best_load) {
+            best = member;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Forward every non-local request of a batch, one pipelined round trip per
+ *        backend, with every backend's round trip in flight at once
+ *
+ * Reads that a failed backend did not answer are retried once on another member.
+ *
+ * @param batch requests in client order
+ */
+void forward(std::vector<Routed>& batch) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+
+        // group unanswered requests by backend, noting the rows written so far
+        std::map<Backend*, int> assigned;
+        std::map<Backend*, std::vector<BackendCall*>> by_backend;
+        std::set<std::string> written;
+        for (Routed& routed : batch) {
+            if (routed.local || routed.call.answered) {
+                continue;
+            }
+            if (attempt > 0 && routed.call.opcode != BIN_GET) {
+                continue;
+            }
+            routed.partition = ring->lookup(routed.call.row);
+            bool is_write = routed.call.opcode != BIN_GET;
+            bool row_written = !is_write && written.count(routed.call.row) > 0;
+            Backend* backend = pick_backend(routed, assigned, attempt > 0 ? routed.backend : nullptr, row_written);
+            if (is_write) {
+                written.insert(routed.call.row);
+            }
+            if (!backend) {
+                continue;
+            }
+            routed.backend = backend;
+            assigned[backend]++;
+            by_backend[backend].push_back(&routed.call);
+        }
+        if (by_backend.empty()) {
+            return;
+        }
+
+        // one round trip per backend, all of them in flight together
+        std::vector<std::pair<Backend*, std::vector<BackendCall*>>> groups(by_backend.begin(), by_backend.end());
+        std::vector<Backend*> failed;
+        Backend::call_many(groups, failed);
+        for (Backend* backend : failed) {
+            fprintf(stderr, "Backend %s failed\n", backend->name().c_str());
+        }
+        if (failed.empty()) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Describe partitions and members
+ *
+ * RSP: 250 OK <partitions>, then one "<partition> <address> <primary|replica> <in flight> <served>" line per member
+ */
+std::string routes() {
+    std::string out = "+250 OK " + std::to_string(partitions.size());
+    for (size_t i = 0; i < partitions.size(); i++) {
+        for (size_t j = 0; j < partitions[i]->members.size(); j++) {
+            Backend* member = partitions[i]->members[j];
+            out += "\n" + std::to_string(i) + " " + member->name() + (j == 0 ? " primary " : " replica ")
+                 + std::to_string(member->inflight.load()) + " " + std::to_string(member->served.load());
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Parse one text command into a request (delim was already parsed out)
+ *
+ * RFC: as server.cpp for GET, PUT, DEL and EXIT, plus
+ *  ROUTES:
+ *   CMD: ROUTES
+ *   RSP: see routes()
+ *
+ * @param command command to parse
+ * @param routed parsed request (local if the router answers it itself)
+ * @param exit_flag set on EXIT
+ */
+void parse_command(const std::string& command, Routed& routed, bool& exit_flag) {
+    routed.local = true;
+
+    // parse method
+    std::stringstream ss(command);
+    std::string method;
+    std::getline(ss, method, ' ');
+    if (method == "EXIT") {
+        exit_flag = true;
+        routed.local_response = "+950 GOODBYE";
+        return;
+    }
+    if (method == "ROUTES") {
+        routed.local_response = routes();
+        return;
+    }
+
+    // parse row and col
+    std::string row, col;
+    std::getline(ss, row, ' ');
+    std::getline(ss, col, ' ');
+    if (ss.fail() || (method != "GET" && method != "PUT" && method != "DEL")) {
+        routed.local_response = USAGE;
+        return;
+    }
+
+    // build the forwarded request
+    routed.local = false;
+    routed.call.opcode = method == "GET" ? BIN_GET : method == "PUT" ? BIN_PUT : BIN_DEL;
+    routed.call.row = std::move(row);
+    routed.call.col = std::move(col);
+    if (routed.call.opcode == BIN_PUT) {
+        size_t bytes_off = std::min(command.size(), method.size() + routed.call.row.size() + routed.call.col.size() + 3);
+        routed.call.value = make_value(std::vector<char>(command.begin() + bytes_off, command.end()));
+    }
+}
+
+/**
+ * @brief Queue the text response to a forwarded request, worded as the server words it
+ */
+void write_text_response(Connection& conn, const BackendCall& call) {
+    if (!call.answered) {
+        conn.write("-550 Backend Unavailable\n", 25);
+        return;
+    }
+    if (call.opcode == BIN_GET) {
+        if (call.status != BIN_OK) {
+            conn.write("-550 Resource Does Not Exist\n", 29);
+            return;
+        }
+        conn.write("+250 OK ", 8);
+        conn.write(call.result);
+        conn.write("\n", 1);
+    } else if (call.status == BIN_OK) {
+        conn.write("+250 OK\n", 8);
+    } else if (call.opcode == BIN_PUT) {
+        conn.write("-550 Resource Creation Failed\n", 30);
+    } else {
+        conn.write("-550 Resource Does Not Exist\n", 29);
+    }
+}
+
+/**
+ * @brief Queue a binary response frame
+ */
+void write_bin_response(Connection& conn, uint8_t opcode, uint32_t request_id, BinStatus status, ValueRef payload) {
+    BinHeader rsp;
+    rsp.magic = BIN_RSP_MAGIC;
+    rsp.opcode = opcode;
+    rsp.row_len = status;
+    rsp.col_len = 0;
+    rsp.flags = 0;
+    rsp.value_len = payload ? payload->size() : 0;
+    rsp.request_id = request_id;
+    std::string header;
+    encode_bin_header(header, rsp);
+    conn.write(header);
+    conn.write(std::move(payload));
+}
+
+/**
+ * @brief Forward every complete binary frame buffered on a connection, queueing responses
+ *
+ * @param conn connection in binary mode whose inbuf received new bytes
+ */
+void on_binary_input(Connection& conn) {
+
+    // forward a PUT whose value was still arriving
+    if (conn.body_done && !conn.finish_body()) {
+        return;
+    }
+
+    // slice whole frames into requests; a large PUT value still arriving is
+    // received into its own buffer once the keys are in
+    std::vector<Routed> batch;
+    size_t pos = 0;
+    bool stream_value = false;
+    BinHeader streamed;
+    while (conn.inbuf.size() - pos >= BIN_HEADER_SIZE) {
+        BinHeader req;
+        decode_bin_header(conn.inbuf.data() + pos, req);
+        batch.emplace_back();
+        Routed& routed = batch.back();
+        routed.request_id = req.request_id;
+        routed.call.opcode = (BinOpcode) req.opcode;
+
+        // reject garbage and close once answered
+        if (req.magic != BIN_REQ_MAGIC || req.value_len > BIN_MAX_VALUE || (req.opcode != BIN_PUT && req.value_len != 0)) {
+            routed.local = true;
+            routed.call.status = BIN_BAD_REQUEST;
+            conn.closing = true;
+            break;
+        }
+
+        // wait for the rest of the frame, reserving room for no more than
+        // the header and keys when the value will be streamed
+        size_t frame_len = BIN_HEADER_SIZE + req.body_len();
+        size_t keys_len = BIN_HEADER_SIZE + req.row_len + req.col_len;
+        if (conn.inbuf.size() - pos < frame_len) {
+            batch.pop_back();
+            if (req.opcode == BIN_PUT && req.value_len >= BODY_STREAM_MIN && conn.inbuf.size() - pos >= keys_len) {
+                stream_value = true;
+                streamed = req;
+                break;
+            }
+            conn.inbuf.reserve(pos + (req.value_len >= BODY_STREAM_MIN ? keys_len : frame_len));
+            break;
+        }
+        const char* body = conn.inbuf.data() + pos + BIN_HEADER_SIZE;
+        pos += frame_len;
+
+        // EXIT and unknown opcodes are answered here
+        if (req.opcode == BIN_EXIT || (req.opcode != BIN_GET && req.opcode != BIN_PUT && req.opcode != BIN_DEL)) {
+            routed.local = true;
+            routed.call.status = req.opcode == BIN_EXIT ? BIN_OK : BIN_BAD_REQUEST;
+            if (req.opcode == BIN_EXIT) {
+                conn.closing = true;
+                break;
+            }
+            continue;
+        }
+        routed.call.row.assign(body, req.row_len);
+        routed.call.col.assign(body + req.row_len, req.col_len);
+        if (req.opcode == BIN_PUT) {
+            const char* value = body + req.row_len + req.col_len;
+            routed.call.value = make_value(std::vector<char>(value, value + req.value_len));
+        }
+    }
+    conn.inbuf.consume(pos);
+
+    // forward, then answer in request order
+    forward(batch);
+    for (Routed& routed : batch) {
+        BinStatus status = routed.local || routed.call.answered ? routed.call.status : BIN_FAILURE;
+        write_bin_response(conn, routed.call.opcode, routed.request_id, status, std::move(routed.call.result));
+    }
+
+    // take the streamed PUT's keys, then forward it alone once its value is in
+    if (stream_value) {
+        auto put = std::make_shared<Routed>();
+        put->request_id = streamed.request_id;
+        put->call.opcode = BIN_PUT;
+        put->call.row.assign(conn.inbuf.data() + BIN_HEADER_SIZE, streamed.row_len);
+        put->call.col.assign(conn.inbuf.data() + BIN_HEADER_SIZE + streamed.row_len, streamed.col_len);
+        conn.inbuf.consume(BIN_HEADER_SIZE + streamed.row_len + streamed.col_len);
+        conn.receive_body(streamed.value_len, [put](Connection& conn, std::vector<char>&& bytes) {
+            put->call.value = make_value(std::move(bytes));
+            std::vector<Routed> single;
+            single.push_back(std::move(*put));
+            forward(single);
+            BinStatus status = single[0].call.answered ? single[0].call.status : BIN_FAILURE;
+            write_bin_response(conn, BIN_PUT, single[0].request_id, status, nullptr);
+        });
+    }
+}
+
+/**
+ * @brief Forward every complete text command buffered on a connection, queueing responses
+ *
+ * @param conn connection in text mode whose inbuf received new bytes
+ */
+void on_text_input(Connection& conn) {
+
+    // parse available commands until there are none, or the client leaves or switches framing
+    std::vector<Routed> batch;
+    bool exit_flag = false;
+    bool binary = false;
+    while (!exit_flag) {
+        auto command_opt = conn.inbuf.next_line(DELIM);
+        if (!command_opt.has_value()) {
+            break;
+        }
+        std::string command(command_opt.value());
+        if (command == "BINARY") {
+            binary = true;
+            break;
+        }
+        batch.emplace_back();
+        parse_command(command, batch.back(), exit_flag);
+    }
+
+    // forward, then answer in command order
+    forward(batch);
+    for (Routed& routed : batch) {
+        if (routed.local) {
+            conn.write(routed.local_response);
+            conn.write("\n", 1);
+        } else {
+            write_text_response(conn, routed.call);
+        }
+    }
+
+    // leave, switch to binary framing, or prompt for the next batch
+    if (exit_flag) {
+        conn.closing = true;
+    } else if (binary) {
+        conn.write("+250 OK BINARY\n", 15);
+        conn.binary = true;
+        on_binary_input(conn);
+    } else if (!batch.empty()) {
+        conn.write(PROMPT, sizeof(PROMPT) - 1);
+    }
+}
+
+/**
+ * @brief Greet a newly accepted connection with the prompt
+ */
+void on_open(Connection& conn) {
+    if (debug) {
+        fprintf(stderr, "[%d] Accepted new connection\n", conn.fd);
+    }
+    conn.write(PROMPT, sizeof(PROMPT) - 1);
+}
+
+/**
+ * @brief Forward every complete request buffered on a connection
+ */
+void on_input(Connection& conn) {
+    if (conn.binary) {
+        on_binary_input(conn);
+    } else {
+        on_text_input(conn);
+    }
+}
+
+/**
+ * @brief Parse "host:port"
+ */
+Backend* parse_backend(const std::string& spec) {
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        return nullptr;
+    }
+    return new Backend(spec.substr(0, colon), std::atoi(spec.c_str() + colon + 1));
+}
+
+int main(int argc, char* argv[]) {
+
+    // parse router port, partitions and options
+    size_t vnodes = RING_DEFAULT_VNODES;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0) {
+            if (argv[i+1]) {
+                port = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-w") == 0) {
+            if (argv[i+1]) {
+                num_workers = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-b") == 0) {
+
+            // one partition: primary,replica,...
+            if (!argv[i+1]) {
+                exit(EXIT_FAILURE);
+            }
+            Partition* partition = new Partition();
+            std::stringstream specs(argv[i+1]);
+            std::string spec;
+            while (std::getline(specs, spec, ',')) {
+                Backend* member = parse_backend(spec);
+                if (!member) {
+                    fprintf(stderr, "Backends must be given as host:port[,host:port...]\n");
+                    exit(EXIT_FAILURE);
+                }
+                partition->members.push_back(member);
+            }
+            if (partition->members.empty()) {
+                exit(EXIT_FAILURE);
+            }
+            partitions.push_back(partition);
+        } else if (strcmp(argv[i], "-V") == 0) {
+            if (argv[i+1]) {
+                vnodes = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-v") == 0) {
+            debug = true;
+        }
+    }
+    if (partitions.empty()) {
+        fprintf(stderr, "At least one partition (-b host:port[,host:port...]) is required\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // place partitions on the ring by their primary's address
+    ring = new HashRing(vnodes);
+    for (size_t i = 0; i < partitions.size(); i++) {
+        ring->add(i, partitions[i]->members[0]->name());
+        if (debug) {
+            fprintf(stderr, "Partition %zu: %zu members, primary %s\n", i, partitions[i]->members.size(), partitions[i]->members[0]->name().c_str());
+        }
+    }
+
+    // workers block on backends, so run several per core
+    if (num_workers == 0) {
+        num_workers = std::max(1u, std::thread::hardware_concurrency()) * ROUTER_WORKERS_PER_CORE;
+    }
+
+    // create, bind and listen on the client socket
+    int router_socket = socket(PF_INET, SOCK_STREAM, 0);
+    if (router_socket < 0) {
+        fprintf(stderr, "Failed to open router socket\n");
+        exit(EXIT_FAILURE);
+    }
+    int opt = 1;
+    if (setsockopt(router_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        fprintf(stderr, "Error setting socket options (%s)\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_in router_address;
+    bzero(&router_address, sizeof(router_address));
+    router_address.sin_family = AF_INET;
+    router_address.sin_port = htons(port);
+    router_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(router_socket, (struct sockaddr*) &router_address, sizeof(router_address)) < 0
+        || listen(router_socket, SOMAXCONN) < 0) {
+        fprintf(stderr, "Failed to listen on port %d (%s)\n", port, strerror(errno));
+        close(router_socket);
+        exit(EXIT_FAILURE);
+    }
+
+    // serve clients from the event loop until it fails
+    Reactor reactor(router_socket, num_workers, on_open, on_input);
+    if (!reactor.run()) {
+        fprintf(stderr, "Event loop failed (%s)\n", strerror(errno));
+        close(router_socket);
+        exit(EXIT_FAILURE);
+    }
+    close(router_socket);
+    exit(EXIT_SUCCESS);
+}
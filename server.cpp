@@ -1,37 +1,78 @@
 #include <iostream>
-#include <sstream>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <ctype.h>
 #include <arpa/inet.h>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <charconv>
 #include "Util/iotool.h"
 #include "Tablet/tablet.h"
+#include "Tablet/scan.h"
+#include "Net/reactor.h"
+#include "Net/uring.h"
+#include "Net/binproto.h"
+#include "Wal/wal.h"
+#include "Snapshot/snapshot.h"
+#include "Repl/primary.h"
+#include "Repl/backup.h"
+#include "Stats/stats.h"
 
 /**
- * @brief max number of threads
+ * @brief prompt written before each batch of commands
  */
-#define MAX_THREADS 100
+#define PROMPT "DataStore% "
 
 /**
- * @brief buffer size for networked read/write
+ * @brief command delimiter
  */
-#define BUF_SIZE 1024 * 1024
+#define DELIM "\r\n"
 
 /**
- * @brief array to hold socks
+ * @brief response to a malformed command
  */
-volatile int socks[MAX_THREADS] = {0};
+#define USAGE "1) GET <row> <col>\n2) PUT <row> <col> <bytes>\n3) DEL <row> <col>\n" \
+              "4) MGET <row> <col> [<row> <col> ...]\n5) MPUT <row> <col> <len> <bytes> [...]\n" \
+              "6) MDEL <row> <col> [<row> <col> ...]\n7) GETROW <row>\n" \
+              "8) SCAN <start_row> <end_row> [<limit>]\n9) PSCAN <prefix> [<limit>]\n" \
+              "10) PUTEX <row> <col> <seconds> <bytes>\n11) EXPIRE <row> <col> <seconds>\n12) TTL <row> <col>\n" \
+              "13) GETV <row> <col>\n14) CAS <row> <col> <version> <bytes>\n15) APPEND <row> <col> <bytes>\n" \
+              "16) INCRBY <row> <col> <delta>\n17) PUTL <row> <col> <len>, then <len> bytes\n18) GETL <row> <col>\n" \
+              "19) FIND <col> <len> <bytes> [<limit>]\n" \
+              "-550 Parser Failure"
 
 /**
- * @brief struct to encapsulate thread args
+ * @brief longest a semi-synchronous write waits for a backup's ack
  */
-struct arg_st {
-    int thread_index;
-};
+#define REPL_SEMISYNC_TIMEOUT_MS 1000
+
+/**
+ * @brief scan cells queued per call of a connection's stream
+ */
+#define SCAN_PAGE_CELLS 256
+
+/**
+ * @brief longest numeric field parsed from a command (with its terminator)
+ */
+#define NUMBER_FIELD_MAX 32
 
 /**
- * @brief main tablet to store data
+ * @brief how often expired cells are swept and the eviction clock advances
  */
-Tablet tab;
+#define SWEEP_INTERVAL_MS 100
+
+/**
+ * @brief main tablet to store data (created once the engine is parsed)
+ */
+Tablet* tab;
+
+/**
+ * @brief cell index engine for tab
+ */
+CellEngine engine = CellEngine::NESTED;
 
 /**
  * @brief port for server to run on
@@ -48,6 +89,445 @@ std::string ip;
  */
 bool debug;
 
+/**
+ * @brief number of worker threads executing commands (0 = one per core)
+ */
+size_t num_workers = 0;
+
+/**
+ * @brief connection I/O implementation
+ */
+IoBackend io_backend = IoBackend::EPOLL;
+
+/**
+ * @brief memory limit for tab in bytes, enforced by eviction (0 = unbounded)
+ */
+uint64_t max_memory = 0;
+
+/**
+ * @brief values of at least this many bytes are stored compressed (0 = never)
+ */
+uint64_t compress_min = 0;
+
+/**
+ * @brief directory for values moved out of memory (empty = keep every value in memory),
+ *        and the smallest value moved there as soon as it is written (0 = none)
+ */
+std::string tier_dir;
+uint64_t tier_min = 0;
+
+/**
+ * @brief columns given a secondary index, for FIND
+ */
+std::vector<std::string> index_cols;
+
+/**
+ * @brief write-ahead log path (empty = memory only), durability mode, and group commit delay
+ */
+std::string wal_path;
+Durability durability = Durability::GROUP;
+uint64_t group_delay_us = 1000;
+
+/**
+ * @brief write-ahead log attached to tab, if enabled
+ */
+Wal* wal = nullptr;
+
+/**
+ * @brief snapshot path (empty = snapshots disabled) and background snapshot interval (0 = never)
+ */
+std::string snapshot_path;
+unsigned snapshot_interval = 0;
+
+/**
+ * @brief serializes snapshots (command and background trigger)
+ */
+std::mutex snapshot_mtx;
+
+/**
+ * @brief replication port served to backups (0 = none) and replication mode
+ */
+int repl_port = 0;
+ReplMode repl_mode = ReplMode::ASYNC;
+
+/**
+ * @brief primary to follow as a read-only backup ("host:port", empty = not a backup)
+ */
+std::string primary_addr;
+
+/**
+ * @brief replication endpoints attached to tab, if enabled
+ */
+ReplPrimary* primary = nullptr;
+ReplBackup* backup = nullptr;
+
+/**
+ * @brief per-command counters and latencies, and the event loop's connection and traffic counters
+ */
+CommandStats command_stats;
+EventLoop* reactor = nullptr;
+
+/**
+ * @brief port serving metrics to Prometheus scrapers (0 = none), and when the server started
+ */
+int metrics_port = 0;
+std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+/**
+ * @brief Monotonic clock in nanoseconds, for command latencies
+ */
+uint64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Gather the server-wide values reported by STATS and the metrics port
+ */
+std::vector<StatValue> server_stat_values() {
+    ReactorStats traffic = reactor ? reactor->stats() : ReactorStats();
+    TabletUsage usage = tab->usage();
+    uint64_t uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
+    return {
+        {"uptime_seconds", "Seconds since the server started.", false, uptime},
+        {"connections_active", "Client connections currently open.", false, traffic.active},
+        {"connections_accepted", "Client connections accepted.", true, traffic.accepted},
+        {"bytes_received", "Bytes read from clients.", true, traffic.bytes_in},
+        {"bytes_sent", "Bytes written to clients.", true, traffic.bytes_out},
+        {"io_syscalls", "System calls the event loop made for client I/O.", true, traffic.syscalls},
+        {"cells", "Cells stored.", false, usage.cells},
+        {"rows", "Rows with at least one cell.", false, usage.rows},
+        {"value_bytes", "Bytes of stored values.", false, usage.value_bytes},
+        {"index_bytes", "Estimated bytes of the cell and row indexes.", false, usage.index_bytes},
+        {"cache_bytes", "Bytes counted against the memory limit (values, keys and per-cell overhead).", false, usage.charged_bytes},
+        {"max_memory_bytes", "Memory limit, 0 if unbounded.", false, max_memory},
+        {"evicted_cells", "Cells evicted to stay under the memory limit.", true, usage.evicted},
+        {"expired_cells", "Cells removed after their deadline passed.", true, usage.expired},
+        {"compressed_cells", "Cells whose value is stored compressed.", false, usage.compressed_cells},
+        {"compressed_bytes", "Stored bytes of compressed values.", false, usage.compressed_bytes},
+        {"compressed_raw_bytes", "Original bytes of compressed values.", false, usage.compressed_raw_bytes},
+        {"compression_ratio_pct", "Original over stored bytes of compressed values, in percent.", false,
+            usage.compressed_bytes ? usage.compressed_raw_bytes * 100 / usage.compressed_bytes : 0},
+        {"decompressions", "Reads that decompressed a value.", true, usage.decompressions},
+        {"decompress_ns", "Nanoseconds spent decompressing values for reads.", true, usage.decompress_ns},
+        {"decompress_mean_ns", "Mean nanoseconds added to a read by decompressing its value.", false,
+            usage.decompressions ? usage.decompress_ns / usage.decompressions : 0},
+        {"cold_cells", "Cells whose value was moved to the segment files.", false, usage.cold_cells},
+        {"cold_bytes", "Bytes of values moved to the segment files.", false, usage.cold_bytes},
+        {"tier_files", "Segment files.", false, usage.tier.files},
+        {"tier_disk_bytes", "Bytes of the segment files.", false, usage.tier.disk_bytes},
+        {"tier_live_bytes", "Bytes of segment file records still in use.", false, usage.tier.live_bytes},
+        {"tier_reads", "Values read back from the segment files.", true, usage.tier.reads},
+        {"tier_read_mean_ns", "Mean nanoseconds a read spends fetching a value from the segment files.", false,
+            usage.tier.reads ? usage.tier.read_ns / usage.tier.reads : 0},
+        {"tier_compactions", "Segment files compacted.", true, usage.tier.compactions},
+        {"tier_removed_files", "Segment files deleted once no value in them was in use.", true, usage.tier.removed_files},
+        {"indexed_cells", "Cells entered in secondary indexes.", false, usage.indexed_cells},
+        {"mvcc_views_open", "Read views open (scans, snapshots and full syncs in progress).", false, usage.views},
+        {"mvcc_retained_versions", "Replaced or deleted values kept for open read views.", false, usage.retained_versions},
+        {"mvcc_retained_bytes", "Bytes of replaced or deleted values kept for open read views.", false, usage.retained_bytes},
+        {"commit_seq", "Sequence number of the latest change.", false, tab->last_seq()},
+    };
+}
+
+/**
+ * @brief Snapshot the tablet and retire the log records it covers
+ *
+ * The log is rotated before the snapshot's sequence number is taken, so the
+ * retired file only holds records the snapshot contains and is deleted once
+ * the snapshot is durable.
+ *
+ * @param seq sequence number the snapshot is complete through
+ * @param cells number of cells written
+ * @return false on failure (the previous snapshot and log stay usable)
+ */
+bool take_snapshot(uint64_t& seq, uint64_t& cells) {
+    std::lock_guard<std::mutex> lock(snapshot_mtx);
+    std::string retired_path = wal_path + ".old";
+    if (wal && !wal->rotate(retired_path)) {
+        return false;
+    }
+    if (!write_snapshot(snapshot_path, *tab, seq, cells)) {
+        return false;
+    }
+    if (wal) {
+        unlink(retired_path.c_str());
+    }
+    return true;
+}
+
+/**
+ * @brief Background thread taking a snapshot every snapshot_interval seconds
+ */
+void snapshot_loop() {
+    while (true) {
+        sleep(snapshot_interval);
+        uint64_t seq, cells;
+        if (!take_snapshot(seq, cells)) {
+            fprintf(stderr, "Background snapshot to %s failed\n", snapshot_path.c_str());
+        } else if (debug) {
+            fprintf(stderr, "Snapshot of %llu cells through seq %llu\n", (unsigned long long) cells, (unsigned long long) seq);
+        }
+    }
+}
+
+/**
+ * @brief Background thread removing expired cells, and old values no read view needs, every SWEEP_INTERVAL_MS
+ */
+void sweep_loop() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SWEEP_INTERVAL_MS));
+        size_t removed = tab->sweep_expired();
+        if (debug && removed > 0) {
+            fprintf(stderr, "Swept %zu expired cells\n", removed);
+        }
+        size_t reclaimed = tab->reclaim_versions();
+        if (debug && reclaimed > 0) {
+            fprintf(stderr, "Reclaimed %zu old values\n", reclaimed);
+        }
+        size_t moved = tab->compact_tier();
+        if (debug && moved > 0) {
+            fprintf(stderr, "Compacted a segment file, moving %zu values\n", moved);
+        }
+    }
+}
+
+/**
+ * @brief Parse a byte count with an optional k, m or g suffix (powers of 1024)
+ *
+ * @param str text to parse
+ * @param bytes parsed count
+ * @return false if the text is not a count
+ */
+bool parse_bytes(const char* str, uint64_t& bytes) {
+    char* end;
+    bytes = strtoull(str, &end, 10);
+    if (end == str || *str == '-') {
+        return false;
+    }
+    if (*end == 'k' || *end == 'K') {
+        bytes <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        bytes <<= 20;
+        end++;
+    } else if (*end == 'g' || *end == 'G') {
+        bytes <<= 30;
+        end++;
+    }
+    return *end == '\0';
+}
+
+/**
+ * @brief Copy a numeric field into a NUL-terminated buffer for the strto* functions
+ *
+ * @param str field to copy
+ * @param buf destination
+ * @return false if the field is empty or too long to be a number
+ */
+bool terminate_field(std::string_view str, char (&buf)[NUMBER_FIELD_MAX]) {
+    if (str.empty() || str.size() >= NUMBER_FIELD_MAX) {
+        return false;
+    }
+    memcpy(buf, str.data(), str.size());
+    buf[str.size()] = '\0';
+    return true;
+}
+
+/**
+ * @brief Parse an unsigned decimal 64-bit integer (a version)
+ *
+ * @param str text to parse
+ * @param value parsed number
+ * @return false if the text is not a number in range
+ */
+bool parse_uint64(std::string_view str, uint64_t& value) {
+    char buf[NUMBER_FIELD_MAX], *end;
+    if (!terminate_field(str, buf)) {
+        return false;
+    }
+    errno = 0;
+    value = strtoull(buf, &end, 10);
+    return isdigit((unsigned char) buf[0]) && *end == '\0' && errno != ERANGE;
+}
+
+/**
+ * @brief Parse a whole number of seconds for a TTL into a deadline
+ *
+ * @param str text to parse
+ * @param expires_ms deadline that many seconds from now (see Tablet::clock_ms()), or 0 for none
+ * @return false if the text is not a count or the deadline would not fit in 64 bits
+ */
+bool parse_deadline(std::string_view str, uint64_t& expires_ms) {
+    uint64_t seconds;
+    if (!parse_uint64(str, seconds)) {
+        return false;
+    }
+    if (seconds == 0) {
+        expires_ms = 0;
+        return true;
+    }
+    uint64_t now = Tablet::clock_ms();
+    if (seconds > (UINT64_MAX - now) / 1000) {
+        return false;
+    }
+    expires_ms = now + seconds * 1000;
+    return true;
+}
+
+/**
+ * @brief Parse a signed decimal 64-bit integer (an increment)
+ *
+ * @param str text to parse
+ * @param value parsed number
+ * @return false if the text is not a number in range
+ */
+bool parse_int64(std::string_view str, int64_t& value) {
+    char buf[NUMBER_FIELD_MAX], *end;
+    if (!terminate_field(str, buf)) {
+        return false;
+    }
+    errno = 0;
+    value = strtoll(buf, &end, 10);
+    return !isspace((unsigned char) buf[0]) && *end == '\0' && errno != ERANGE;
+}
+
+/**
+ * @brief Space-separated fields of a command, read in place without copying
+ *
+ * Splits as std::getline(stream, field, ' ') would: consecutive spaces
+ * give empty fields, and a read fails only once nothing is left.
+ */
+struct Fields {
+
+    /**
+     * @brief the command past the fields read so far
+     */
+    std::string_view rest;
+
+    /**
+     * @brief the last field read ran to the end of the command
+     */
+    bool eof = false;
+
+    explicit Fields(std::string_view command) : rest(command) {}
+
+    /**
+     * @brief Read the next field.
+     *
+     * @return false if nothing is left
+     */
+    bool next(std::string_view& field) {
+        if (rest.empty()) {
+            eof = true;
+            return false;
+        }
+        size_t space = rest.find(' ');
+        field = rest.substr(0, space);
+        eof = space == std::string_view::npos;
+        rest.remove_prefix(eof ? rest.size() : space + 1);
+        return true;
+    }
+};
+
+/**
+ * @brief Queue a status (without its newline)
+ *
+ * @param conn connection to respond on
+ * @param status text to queue
+ * @return whether the status reports success
+ */
+bool respond(Connection& conn, std::string_view status) {
+    conn.write(status);
+    return status[0] == '+';
+}
+
+/**
+ * @brief Queue a number in decimal
+ *
+ * @param conn connection to respond on
+ * @param value number to queue
+ */
+void write_number(Connection& conn, uint64_t value) {
+    char buf[NUMBER_FIELD_MAX];
+    conn.write(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr - buf);
+}
+void write_number(Connection& conn, int64_t value) {
+    char buf[NUMBER_FIELD_MAX];
+    conn.write(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr - buf);
+}
+
+/**
+ * @brief Parse and execute a batch command, locking each Tablet shard once for the batch
+ *
+ * @param kind STAT_MGET, STAT_MPUT or STAT_MDEL
+ * @param fields command fields positioned just after the method
+ * @param conn connection to queue the response on (a line per cell, without the last newline)
+ * @return whether the command succeeded
+ */
+bool execute_batch(StatCommand kind, Fields& fields, Connection& conn) {
+
+    // parse (row, col) pairs, and for MPUT a length-prefixed value after each;
+    // the key list keeps its capacity from one batch to the next
+    static thread_local std::vector<CellKey> keys;
+    std::vector<ValueRef> values;
+    keys.clear();
+    std::string_view row, col, len_str;
+    while (fields.next(row)) {
+        if (!fields.next(col)) {
+            return respond(conn, USAGE);
+        }
+        if (kind == STAT_MPUT) {
+            uint64_t len;
+            if (!fields.next(len_str) || !parse_uint64(len_str, len) || len > fields.rest.size()) {
+                return respond(conn, USAGE);
+            }
+
+            // take exactly len value bytes, then the separator (if any)
+            values.push_back(make_value(std::vector<char>(fields.rest.begin(), fields.rest.begin() + len)));
+            fields.rest.remove_prefix(len);
+            if (!fields.rest.empty() && fields.rest[0] == ' ') {
+                fields.rest.remove_prefix(1);
+            }
+        }
+        keys.emplace_back(row, col);
+    }
+    if (keys.empty()) {
+        return respond(conn, USAGE);
+    }
+
+    // backups only take changes from their primary
+    if (backup && kind != STAT_MGET) {
+        return respond(conn, "-550 Read Only Backup");
+    }
+
+    // execute against the tablet in one pass
+    conn.write("+250 OK ");
+    write_number(conn, keys.size());
+    if (kind == STAT_MGET) {
+        static thread_local std::vector<ValueRef> gotten;
+        tab->multi_get(keys, gotten);
+        for (auto& value : gotten) {
+            if (!value) {
+                conn.write("\n-550 Resource Does Not Exist");
+                continue;
+            }
+            conn.write("\n+250 OK ");
+            conn.write(std::move(value));
+        }
+    } else if (kind == STAT_MPUT) {
+        std::vector<bool> put_succ = tab->multi_put(keys, values);
+        for (bool succ : put_succ) {
+            conn.write(succ ? "\n+250 OK" : "\n-550 Resource Creation Failed");
+        }
+    } else {
+        std::vector<bool> del_succ = tab->multi_del(keys);
+        for (bool succ : del_succ) {
+            conn.write(succ ? "\n+250 OK" : "\n-550 Resource Does Not Exist");
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Parse and execute command according to protocol (delim was already parsed out)
  *
@@ -61,168 +541,764 @@ bool debug;
  *  DEL:
  *   CMD: DEL <row> <col>
  *   RSP: 250 OK, 550 FAILURE
+ *  PUTEX:
+ *   CMD: PUTEX <row> <col> <seconds> <bytes>   (PUT whose cell expires after seconds; a plain PUT clears it)
+ *   RSP: 250 OK, 550 FAILURE
+ *  EXPIRE:
+ *   CMD: EXPIRE <row> <col> <seconds>          (0 keeps the cell indefinitely)
+ *   RSP: 250 OK, 550 FAILURE
+ *  TTL:
+ *   CMD: TTL <row> <col>
+ *   RSP: 250 OK <seconds left, rounded up; -1 if none>, 550 FAILURE
+ *  GETV:
+ *   CMD: GETV <row> <col>
+ *   RSP: 250 OK <version> <bytes>, 550 FAILURE
+ *  GETL:
+ *   CMD: GETL <row> <col>
+ *   RSP: 250 OK <len> <bytes>, 550 FAILURE      (the length lets a client read values holding CRLF)
+ *  CAS:
+ *   CMD: CAS <row> <col> <version> <bytes>     (PUT only if the cell is at version; 0 = only if absent)
+ *   RSP: 250 OK <new version>, 550 Version Mismatch <current version, 0 if absent>
+ *  APPEND:
+ *   CMD: APPEND <row> <col> <bytes>            (creates the cell if absent; keeps its TTL)
+ *   RSP: 250 OK <new length> <new version>, 550 FAILURE
+ *  INCRBY:
+ *   CMD: INCRBY <row> <col> <delta>            (the cell holds a decimal integer; absent counts as 0; keeps its TTL)
+ *   RSP: 250 OK <new value> <new version>, 550 FAILURE
+ *  MGET / MDEL:
+ *   CMD: MGET <row> <col> [<row> <col> ...]
+ *   RSP: 250 OK <n> followed by one GET / DEL response line per cell
+ *  MPUT:
+ *   CMD: MPUT <row> <col> <len> <bytes> [<row> <col> <len> <bytes> ...]
+ *   RSP: 250 OK <n> followed by one PUT response line per cell
+ *  SNAPSHOT:
+ *   CMD: SNAPSHOT
+ *   RSP: 250 OK <seq> <cells>, 550 FAILURE
+ *  BINARY:
+ *   CMD: BINARY (handled by on_input; switches the connection to Net/binproto.h framing)
+ *   RSP: 250 OK BINARY
+ *  STATS:
+ *   CMD: STATS
+ *   RSP: 250 OK <n>, then n "<name> <value>" lines (server totals, then per-command calls,
+ *        failures and latency percentiles)
+ *  REPL:
+ *   CMD: REPL
+ *   RSP: 250 OK PRIMARY <seq> <backups>, then one "<address> <acked seq> <lag>" line per backup;
+ *        250 OK BACKUP <applied seq> <primary seq> <lag> <lag ms> <streaming|syncing|disconnected>;
+ *        250 OK STANDALONE <seq>
+ *  FIND:
+ *   CMD: FIND <col> <len> <bytes> [<limit>]    (col must be indexed, see --index)
+ *   RSP: one "251 <row>" line per row whose cell in col holds the bytes, in order, then 250 OK <rows>;
+ *        550 FAILURE
+ *  PUTL:
+ *   CMD: handled by start_put_value
+ *  GETROW / SCAN / PSCAN:
+ *   CMD: handled by start_scan
  * 
+ * The command is parsed in place and the response is written straight into
+ * the connection's output buffer, so once a connection and its thread are
+ * warm a GET (hit or miss), DEL or MGET allocates nothing.  A PUT allocates
+ * exactly the value it stores, which microbench holds it to: the byte vector
+ * and the control block of the shared handle around it.  The Tablet keeps
+ * the value for as long as the cell and any reader hold it, so neither can
+ * come from a per-connection buffer.
+ *
  * @param command to execute
- * @return response
+ * @param conn connection to queue the response on (without its newline)
+ * @param exit_flag set if the client asked to close the connection
+ * @return whether the command succeeded
  */
-std::string execute_command(const std::string& command, bool& exit_flag) {
-
-    // prepare command for parsing
-    std::stringstream ss(command);
+bool execute_command(std::string_view command, Connection& conn, bool& exit_flag) {
 
     // parse method
-    std::string method;
-    std::getline(ss, method, ' ');
-    if (ss.fail()) {
-        return "1) GET <row> <col>\n2) PUT <row> <col> <bytes>\n3) DEL <row> <col>\n-550 Parser Failure";
+    Fields fields(command);
+    std::string_view method;
+    if (!fields.next(method)) {
+        return respond(conn, USAGE);
     }
 
-    // check if exit
-    if (method == "EXIT") {
-        exit_flag = true;
-        return "+950 GOODBYE";
-    }
+    // commands that are not about one cell
+    StatCommand kind = classify_command(method);
+    switch (kind) {
+
+        // check if exit
+        case STAT_OTHER:
+            if (method == "EXIT") {
+                exit_flag = true;
+                return respond(conn, "+950 GOODBYE");
+            }
+            return respond(conn, USAGE);
+
+        // snapshot whole tablet
+        case STAT_SNAPSHOT: {
+            if (snapshot_path.empty()) {
+                return respond(conn, "-550 Snapshots Disabled");
+            }
+            uint64_t seq, cells;
+            if (!take_snapshot(seq, cells)) {
+                return respond(conn, "-550 Snapshot Failed");
+            }
+            conn.write("+250 OK ");
+            write_number(conn, seq);
+            conn.write(" ");
+            write_number(conn, cells);
+            return true;
+        }
+
+        // report runtime metrics
+        case STAT_STATS: {
+            std::vector<std::string> lines = format_stats_lines(server_stat_values(), command_stats.collect());
+            conn.write("+250 OK ");
+            write_number(conn, lines.size());
+            for (const std::string& line : lines) {
+                conn.write("\n");
+                conn.write(line);
+            }
+            return true;
+        }
+
+        // report replication role and lag
+        case STAT_REPL:
+            conn.write("+250 OK ");
+            if (primary) {
+                conn.write(primary->status());
+            } else if (backup) {
+                conn.write(backup->status());
+            } else {
+                conn.write("STANDALONE ");
+                write_number(conn, tab->last_seq());
+            }
+            return true;
+
+        // look rows up by the value of an indexed column
+        case STAT_FIND: {
+            static thread_local std::string col, value;
+            std::string_view col_field, len_field, limit_field;
+            uint64_t len, limit = SIZE_MAX;
+            if (!fields.next(col_field) || !fields.next(len_field) || !parse_uint64(len_field, len) || len > fields.rest.size()) {
+                return respond(conn, USAGE);
+            }
 
-    // parse row
-    std::string row;
-    std::getline(ss, row, ' ');
-    if (ss.fail()) {
-        return "1) GET <row> <col>\n2) PUT <row> <col> <bytes>\n3) DEL <row> <col>\n-550 Parser Failure";
+            // the value is length-prefixed, as MPUT's are, so it may hold spaces
+            col.assign(col_field);
+            value.assign(fields.rest.data(), len);
+            fields.rest.remove_prefix(len);
+
+            // then, after a separator, an optional limit
+            if (!fields.rest.empty()) {
+                if (fields.rest[0] != ' ') {
+                    return respond(conn, USAGE);
+                }
+                fields.rest.remove_prefix(1);
+                if (!fields.next(limit_field) || !parse_uint64(limit_field, limit) || !fields.eof) {
+                    return respond(conn, USAGE);
+                }
+            }
+            std::vector<std::string> rows;
+            if (!tab->find(col, value, limit, rows)) {
+                return respond(conn, "-550 Column Not Indexed");
+            }
+            for (const std::string& row : rows) {
+                conn.write("+251 ");
+                conn.write(row);
+                conn.write("\n");
+            }
+            conn.write("+250 OK ");
+            write_number(conn, rows.size());
+            return true;
+        }
+
+        // batch methods take a variable number of cells
+        case STAT_MGET:
+        case STAT_MPUT:
+        case STAT_MDEL:
+            return execute_batch(kind, fields, conn);
+
+        default:
+            break;
     }
 
-    // parse col
-    std::string col;
-    std::getline(ss, col, ' ');
-    if (ss.fail()) {
-        return "1) GET <row> <col>\n2) PUT <row> <col> <bytes>\n3) DEL <row> <col>\n-550 Parser Failure";
+    // parse row and col; the tablet's maps are keyed by std::string, so the
+    // keys are copied into per-thread buffers that keep their capacity
+    static thread_local std::string row, col;
+    std::string_view row_field, col_field;
+    if (!fields.next(row_field) || !fields.next(col_field)) {
+        return respond(conn, USAGE);
+    }
+    row.assign(row_field);
+    col.assign(col_field);
+
+    // backups only take changes from their primary
+    bool mutates = kind == STAT_PUT || kind == STAT_DEL || kind == STAT_PUTEX || kind == STAT_EXPIRE || kind == STAT_CAS
+        || kind == STAT_APPEND || kind == STAT_INCRBY;
+    if (backup && mutates) {
+        return respond(conn, "-550 Read Only Backup");
     }
 
     // branch on method
-    if (method == "PUT") {
+    switch (kind) {
 
-        // parse bytes;
-        std::string bytes_str;
-        bytes_str = command.substr(method.size() + row.size() + col.size() + 3);
-        std::vector<char> bytes_vec(bytes_str.begin(), bytes_str.end());
+        case STAT_PUTEX:
+        case STAT_EXPIRE: {
 
-        // execute PUT
-        bool put_succ = tab.put(row, col, bytes_vec);
-        if (!put_succ) {
-            return "-550 Resource Creation Failed";
+            // parse seconds to live
+            std::string_view seconds_field;
+            uint64_t expires_ms;
+            if (!fields.next(seconds_field) || !parse_deadline(seconds_field, expires_ms)) {
+                return respond(conn, USAGE);
+            }
+
+            // execute EXPIRE
+            if (kind == STAT_EXPIRE) {
+                if (!tab->expire(row, col, expires_ms)) {
+                    return respond(conn, "-550 Resource Does Not Exist");
+                }
+                return respond(conn, "+250 OK");
+            }
+
+            // execute PUTEX with the remaining bytes as the value
+            std::vector<char> bytes_vec(fields.rest.begin(), fields.rest.end());
+            if (!tab->put(row, col, make_value(std::move(bytes_vec)), expires_ms)) {
+                return respond(conn, "-550 Resource Creation Failed");
+            }
+            return respond(conn, "+250 OK");
         }
 
-        // respond
-        return "+250 OK";
+        case STAT_GETV: {
 
-    } else if (method == "GET") {
+            // respond with the version ahead of the value
+            uint64_t version;
+            ValueRef gotten = tab->get(row, col, version);
+            if (!gotten) {
+                return respond(conn, "-550 Resource Does Not Exist");
+            }
+            conn.write("+250 OK ");
+            write_number(conn, version);
+            conn.write(" ");
+            conn.write(std::move(gotten));
+            return true;
+        }
+
+        case STAT_GETL: {
 
-        // execute get
-        auto gotten_opt = tab.get(row, col);
-        if (!gotten_opt.has_value()) {
-            return "-550 Resource Does Not Exist";
+            // respond with the length ahead of the value
+            ValueRef gotten = tab->get(row, col);
+            if (!gotten) {
+                return respond(conn, "-550 Resource Does Not Exist");
+            }
+            conn.write("+250 OK ");
+            write_number(conn, gotten->size());
+            conn.write(" ");
+            conn.write(std::move(gotten));
+            return true;
         }
 
-        // unpack data
-        std::vector<char> gotten = gotten_opt.value();
+        case STAT_CAS: {
 
-        // format response
-        std::string formatted_data(gotten.begin(), gotten.end());
+            // parse expected version, then take the remaining bytes as the value
+            std::string_view version_field;
+            uint64_t version;
+            if (!fields.next(version_field) || !parse_uint64(version_field, version)) {
+                return respond(conn, USAGE);
+            }
+            std::vector<char> bytes_vec(fields.rest.begin(), fields.rest.end());
+            bool swapped = tab->cas(row, col, version, make_value(std::move(bytes_vec)), version);
+            conn.write(swapped ? "+250 OK " : "-550 Version Mismatch ");
+            write_number(conn, version);
+            return swapped;
+        }
 
-        // respond
-        return "+250 OK " + formatted_data;
+        case STAT_APPEND: {
 
-    } else if (method == "DEL") {
+            // append the remaining bytes in place of the value
+            size_t length;
+            uint64_t version;
+            if (!tab->append(row, col, fields.rest.data(), fields.rest.size(), length, version)) {
+                return respond(conn, "-550 Resource Unreadable");
+            }
+            conn.write("+250 OK ");
+            write_number(conn, length);
+            conn.write(" ");
+            write_number(conn, version);
+            return true;
+        }
 
-        // execute delete
-        bool del_succ = tab.del(row, col);
-        if (!del_succ) {
-            return "-550 Resource Does Not Exist";
+        case STAT_INCRBY: {
+
+            // parse increment
+            std::string_view delta_field;
+            int64_t delta, result;
+            uint64_t version;
+            if (!fields.next(delta_field) || !fields.eof || !parse_int64(delta_field, delta)) {
+                return respond(conn, USAGE);
+            }
+            if (!tab->incrby(row, col, delta, result, version)) {
+                return respond(conn, "-550 Not An Integer Or Overflow");
+            }
+            conn.write("+250 OK ");
+            write_number(conn, result);
+            conn.write(" ");
+            write_number(conn, version);
+            return true;
         }
 
-        // respond
-        return "+250 OK";
+        case STAT_TTL: {
 
+            // report seconds left, rounded up
+            uint64_t expires_ms;
+            if (!tab->expiry(row, col, expires_ms)) {
+                return respond(conn, "-550 Resource Does Not Exist");
+            }
+            if (expires_ms == 0) {
+                return respond(conn, "+250 OK -1");
+            }
+            uint64_t now = Tablet::clock_ms();
+            uint64_t left = expires_ms > now ? (expires_ms - now + 999) / 1000 : 0;
+            conn.write("+250 OK ");
+            write_number(conn, left);
+            return true;
+        }
+
+        case STAT_PUT: {
+
+            // the remaining bytes are the value; this copy and its shared
+            // handle are the two allocations a PUT cannot avoid, since the
+            // tablet owns the value after this returns
+            std::vector<char> bytes_vec(fields.rest.begin(), fields.rest.end());
+
+            // execute PUT
+            if (!tab->put(row, col, make_value(std::move(bytes_vec)))) {
+                return respond(conn, "-550 Resource Creation Failed");
+            }
+            return respond(conn, "+250 OK");
+        }
+
+        case STAT_GET: {
+
+            // execute get
+            ValueRef gotten = tab->get(row, col);
+            if (!gotten) {
+                return respond(conn, "-550 Resource Does Not Exist");
+            }
+
+            // respond with a handle to the stored value (no copy)
+            conn.write("+250 OK ");
+            conn.write(std::move(gotten));
+            return true;
+        }
+
+        case STAT_DEL:
+
+            // execute delete
+            if (!tab->del(row, col)) {
+                return respond(conn, "-550 Resource Does Not Exist");
+            }
+            return respond(conn, "+250 OK");
+
+        default:
+
+            // if invalid use
+            return respond(conn, USAGE);
+    }
+}
+
+/**
+ * @brief Start streaming the cells of a range read back to the client
+ *
+ * RFC:
+ *  GETROW:
+ *   CMD: GETROW <row>
+ *  SCAN:
+ *   CMD: SCAN <start_row> <end_row> [<limit>]   (rows in [start_row, end_row), at most limit rows)
+ *  PSCAN:
+ *   CMD: PSCAN <prefix> [<limit>]               (rows starting with prefix, at most limit rows)
+ *  RSP: one "251 <row> <col> <len> <bytes>" line per cell in (row, col) order, then 250 OK <cells>
+ *
+ * Cells are queued a page at a time through conn.stream as the client reads
+ * them, so a large range is never held in memory or under a lock at once.
+ *
+ * @param conn connection to respond on
+ * @param command command to execute (delim was already parsed out)
+ * @return false if command is not a well-formed range read (nothing is queued)
+ */
+bool start_scan(Connection& conn, std::string_view command) {
+
+    // parse method and range bounds
+    Fields fields(command);
+    std::string_view method, start_field, end_field, limit_field;
+    if (!fields.next(method) || (method != "GETROW" && method != "SCAN" && method != "PSCAN")
+        || !fields.next(start_field) || start_field.empty()) {
+        return false;
     }
+    std::string start_row(start_field), end_row;
+    if (method == "GETROW") {
+        end_row = start_row + '\0';
+    } else if (method == "SCAN") {
+        if (!fields.next(end_field) || end_field.empty()) {
+            return false;
+        }
+        end_row.assign(end_field);
+    } else {
+        end_row = TabletScan::prefix_end(start_row);
+    }
+
+    // parse optional row limit; GETROW takes nothing more
+    uint64_t limit = SIZE_MAX;
+    if (fields.next(limit_field) && (method == "GETROW" || !parse_uint64(limit_field, limit) || !fields.eof)) {
+        return false;
+    }
+
+    // queue cells a page at a time until the range or the row limit is exhausted
+    std::shared_ptr<TabletScan> scan = std::make_shared<TabletScan>(*tab, start_row, end_row);
+    size_t rows = 0, cells = 0;
+    std::string last_row;
+    conn.stream = [scan, limit, rows, cells, last_row](Connection& conn) mutable {
+        CellEntry cell;
+        for (size_t i = 0; i < SCAN_PAGE_CELLS; i++) {
+            bool more = scan->next(cell);
+            if (more && (cells == 0 || cell.row != last_row)) {
+                more = rows < limit;
+                rows++;
+                last_row = cell.row;
+            }
+            if (!more) {
+                conn.write("+250 OK ");
+                write_number(conn, cells);
+                conn.write("\n", 1);
+                conn.write(PROMPT, sizeof(PROMPT) - 1);
+                return false;
+            }
 
-    // if invalid use
-    return "1) GET <row> <col>\n2) PUT <row> <col> <bytes>\n3) DEL <row> <col>\n-550 Parser Failure";
+            // each line is written piecewise into the output buffer, with the value by reference
+            conn.write("+251 ");
+            conn.write(cell.row);
+            conn.write(" ", 1);
+            conn.write(cell.col);
+            conn.write(" ", 1);
+            write_number(conn, cell.value->size());
+            conn.write(" ", 1);
+            conn.write(std::move(cell.value));
+            conn.write("\n", 1);
+            cells++;
+        }
+        return true;
+    };
+    return true;
 }
 
-void* thread_fn(void* args) {
+/**
+ * @brief Start receiving the value of a length-prefixed PUT
+ *
+ * RFC:
+ *  PUTL:
+ *   CMD: PUTL <row> <col> <len>, then exactly len value bytes and the delimiter
+ *   RSP: 250 OK, 550 FAILURE
+ *
+ * The value is never scanned for the delimiter, so it may hold any bytes, and
+ * it lands in the buffer the Tablet keeps rather than passing through the
+ * input buffer.  A value not followed by the delimiter fails the command and
+ * closes the connection, whose framing is then lost.
+ *
+ * @param conn connection to respond on
+ * @param command command to execute (delim was already parsed out)
+ * @return false if command is not a well-formed PUTL (nothing is consumed)
+ */
+bool start_put_value(Connection& conn, std::string_view command) {
+
+    // parse keys and value length
+    Fields fields(command);
+    std::string_view method, row_field, col_field, len_field;
+    if (!fields.next(method) || method != "PUTL" || !fields.next(row_field)
+        || !fields.next(col_field) || !fields.next(len_field) || !fields.eof) {
+        return false;
+    }
+    uint64_t len;
+    if (!parse_uint64(len_field, len) || len > BIN_MAX_VALUE) {
+        return false;
+    }
+
+    // store the value once it and its delimiter are in; the keys are copied
+    // once, straight into the callback
+    uint64_t start_ns = monotonic_ns();
+    auto finish = [row = std::string(row_field), col = std::string(col_field), len, start_ns](Connection& conn, std::vector<char>&& bytes) {
+        bool framed = memcmp(bytes.data() + len, DELIM, sizeof(DELIM) - 1) == 0;
+        bool put_succ = false;
+        if (!framed) {
+            conn.write("-550 Value Not Followed By Delimiter\n");
+            conn.closing = true;
+        } else if (backup) {
+            conn.write("-550 Read Only Backup\n");
+        } else {
+            bytes.resize(len);
+            put_succ = tab->put(row, col, make_value(std::move(bytes)));
+            conn.write(put_succ ? "+250 OK\n" : "-550 Resource Creation Failed\n");
+        }
+        command_stats.record(STAT_PUTL, monotonic_ns() - start_ns, !put_succ);
+    };
+    conn.receive_body(len + sizeof(DELIM) - 1, std::move(finish));
+    return true;
+}
 
-    // cast, copy, and free input args
-    arg_st arg = *((arg_st*) args);
-    free(args);
+/**
+ * @brief Greet a newly accepted connection with the prompt
+ *
+ * @param conn connection that was just accepted
+ */
+void on_open(Connection& conn) {
 
     // print message
-    fprintf(stderr, "[%d] Accepted new connection\n", arg.thread_index);
+    if (debug) {
+        fprintf(stderr, "[%d] Accepted new connection\n", conn.fd);
+    }
+
+    // write prompt
+    conn.write(PROMPT, sizeof(PROMPT) - 1);
+}
+
+/**
+ * @brief Queue a binary response frame
+ *
+ * @param conn connection to respond on
+ * @param req request being answered
+ * @param status response status
+ * @param payload value to return, if any
+ */
+void write_bin_response(Connection& conn, const BinHeader& req, BinStatus status, ValueRef payload) {
+    BinHeader rsp;
+    rsp.magic = BIN_RSP_MAGIC;
+    rsp.opcode = req.opcode;
+    rsp.row_len = status;
+    rsp.col_len = 0;
+    rsp.flags = 0;
+    rsp.value_len = payload ? payload->size() : 0;
+    rsp.request_id = req.request_id;
+    std::string header;
+    encode_bin_header(header, rsp);
+    conn.write(header);
+    conn.write(std::move(payload));
+}
+
+/**
+ * @brief Execute every complete binary frame buffered on a connection, queueing responses
+ *
+ * Frames are consumed by their declared lengths; the input is never scanned.
+ *
+ * @param conn connection in binary mode whose inbuf received new bytes
+ */
+void on_binary_input(Connection& conn) {
 
-    // set prompt
-    std::string prompt = "DataStore% ";
-    
-    // set delim
-    std::string delim = "\r\n";
+    // finish a PUT whose value was still arriving
+    if (conn.body_done && !conn.finish_body()) {
+        return;
+    }
+
+    // consume whole frames from the front of the input buffer; each frame's
+    // latency runs from the end of the previous one, so one clock read per frame
+    size_t pos = 0;
+    uint64_t last_ns = monotonic_ns();
+    while (conn.inbuf.size() - pos >= BIN_HEADER_SIZE) {
+
+        // decode header and validate it
+        BinHeader req;
+        decode_bin_header(conn.inbuf.data() + pos, req);
+        if (req.magic != BIN_REQ_MAGIC || req.value_len > BIN_MAX_VALUE || (req.opcode != BIN_PUT && req.value_len != 0)) {
+            write_bin_response(conn, req, BIN_BAD_REQUEST, nullptr);
+            conn.closing = true;
+            break;
+        }
+
+        // wait for the rest of the frame, reserving room for it once; a
+        // large value is received straight into its cell buffer once the
+        // keys are in, so only the header and keys are reserved for it
+        size_t frame_len = BIN_HEADER_SIZE + req.body_len();
+        size_t keys_len = BIN_HEADER_SIZE + req.row_len + req.col_len;
+        if (conn.inbuf.size() - pos < frame_len) {
+            if (req.opcode == BIN_PUT && req.value_len >= BODY_STREAM_MIN && conn.inbuf.size() - pos >= keys_len) {
+                const char* keys = conn.inbuf.data() + pos + BIN_HEADER_SIZE;
+                std::string row(keys, req.row_len);
+                std::string col(keys + req.row_len, req.col_len);
+                conn.inbuf.consume(pos + keys_len);
+                pos = 0;
+                uint64_t start_ns = monotonic_ns();
+                conn.receive_body(req.value_len, [req, row, col, start_ns](Connection& conn, std::vector<char>&& bytes) {
+                    bool put_succ = !backup && tab->put(row, col, make_value(std::move(bytes)));
+                    write_bin_response(conn, req, put_succ ? BIN_OK : BIN_FAILURE, nullptr);
+                    command_stats.record(STAT_PUT, monotonic_ns() - start_ns, !put_succ);
+                });
+                return;
+            }
+            conn.inbuf.reserve(pos + (req.value_len >= BODY_STREAM_MIN ? keys_len : frame_len));
+            break;
+        }
+
+        // slice out keys and value
+        const char* body = conn.inbuf.data() + pos + BIN_HEADER_SIZE;
+        std::string row(body, req.row_len);
+        std::string col(body + req.row_len, req.col_len);
+        const char* value = body + req.row_len + req.col_len;
+        pos += frame_len;
+
+        // branch on opcode
+        StatCommand kind = STAT_OTHER;
+        BinStatus status = BIN_BAD_REQUEST;
+        if (req.opcode == BIN_GET) {
+            kind = STAT_GET;
+            ValueRef gotten = tab->get(row, col);
+            status = gotten ? BIN_OK : BIN_NOT_FOUND;
+            write_bin_response(conn, req, status, std::move(gotten));
+        } else if (backup && (req.opcode == BIN_PUT || req.opcode == BIN_DEL)) {
+            kind = req.opcode == BIN_PUT ? STAT_PUT : STAT_DEL;
+            status = BIN_FAILURE;
+            write_bin_response(conn, req, status, nullptr);
+        } else if (req.opcode == BIN_PUT) {
+            kind = STAT_PUT;
+            bool put_succ = tab->put(row, col, make_value(std::vector<char>(value, value + req.value_len)));
+            status = put_succ ? BIN_OK : BIN_FAILURE;
+            write_bin_response(conn, req, status, nullptr);
+        } else if (req.opcode == BIN_DEL) {
+            kind = STAT_DEL;
+            bool del_succ = tab->del(row, col);
+            status = del_succ ? BIN_OK : BIN_NOT_FOUND;
+            write_bin_response(conn, req, status, nullptr);
+        } else if (req.opcode == BIN_EXIT) {
+            write_bin_response(conn, req, BIN_OK, nullptr);
+            conn.closing = true;
+            break;
+        } else {
+            write_bin_response(conn, req, status, nullptr);
+        }
+
+        // count the frame
+        uint64_t done_ns = monotonic_ns();
+        command_stats.record(kind, done_ns - last_ns, status != BIN_OK);
+        last_ns = done_ns;
+    }
+
+    // drop consumed frames
+    conn.inbuf.consume(pos);
+}
+
+/**
+ * @brief Execute every complete text command buffered on a connection, queueing responses
+ *
+ * @param conn connection in text mode whose inbuf received new bytes
+ */
+void on_text_input(Connection& conn) {
 
     // init exit flag
     bool exit_flag = false;
 
-    // loop reading commands from stdin
-    std::string permbuf;
-    std::string tempbuf;
+    // finish a PUTL whose value was still arriving
+    bool executed = false;
+    if (conn.body_done) {
+        if (!conn.finish_body()) {
+            return;
+        }
+        executed = true;
+    }
+
+    // parse available commands from input buffer until there are none; each
+    // command's latency runs from the end of the previous one, so one clock read per command
+    uint64_t last_ns = monotonic_ns();
     while (true) {
 
-        // write prompt
-        do_write(socks[arg.thread_index], prompt.data(), prompt.size());
+        // parse next command (a view into the input buffer, consumed with its delimiter)
+        auto command_opt = conn.inbuf.next_line(DELIM);
 
-        // read until delimiter detected in stream
-        ssize_t num_read = read_until_delimiter(socks[arg.thread_index], tempbuf, BUF_SIZE, delim); // clears tempbuf!
+        // if there are no more commands, break out of execution loop
+        if (!command_opt.has_value()) {
+            break;
+        }
 
-        // add read contents to permanent buffer
-        permbuf += tempbuf;
+        // get command (valid until the input buffer next takes bytes)
+        std::string_view command = command_opt.value();
 
-        // parse available commands from permanent buffer until there are none
-        while (true) {
+        // switch to binary framing for the rest of the connection (no more prompts)
+        if (command == "BINARY") {
+            conn.write("+250 OK BINARY\n", 15);
+            conn.binary = true;
+            on_binary_input(conn);
+            return;
+        }
 
-            // parse next command
-            auto command_opt = parse_next_command(permbuf, delim); // if command found, removes from permanent buffer!
+        // range reads stream their cells; later commands wait until the stream ends
+        StatCommand kind = classify_command(command.substr(0, command.find(' ')));
+        if ((kind == STAT_GETROW || kind == STAT_SCAN || kind == STAT_PSCAN) && start_scan(conn, command)) {
+            command_stats.record(kind, monotonic_ns() - last_ns, false);
+            return;
+        }
 
-            // if there are no more commands, break out of execution loop
-            if (!command_opt.has_value()) {
-                break;
+        // a length-prefixed value is taken straight from the input; later
+        // commands wait until it has arrived
+        if (kind == STAT_PUTL && start_put_value(conn, command)) {
+            executed = true;
+            if (conn.body_done || conn.closing) {
+                return;
             }
+            last_ns = monotonic_ns();
+            continue;
+        }
 
-            // get command
-            std::string command = command_opt.value();
-            std::string response = execute_command(command, exit_flag);
+        // queue response; payloads are gathered from the Tablet's buffers on write
+        bool failed = !execute_command(command, conn, exit_flag);
+        executed = true;
+        conn.write("\n", 1);
 
-            // send response
-            response += "\n";
-            do_write(socks[arg.thread_index], response.c_str(), response.size());
+        // count the command
+        uint64_t done_ns = monotonic_ns();
+        command_stats.record(kind, done_ns - last_ns, failed);
+        last_ns = done_ns;
 
-            // if exit flag was set, break execution look
-            if (exit_flag) {
-                if (debug) {
-                    fprintf(stderr, "[%d] Exiting\n", arg.thread_index);
-                }
-                break;
+        // if exit flag was set, stop reading from this connection
+        if (exit_flag) {
+            if (debug) {
+                fprintf(stderr, "[%d] Exiting\n", conn.fd);
             }
+            conn.closing = true;
+            return;
         }
+    }
 
-        // if exit flag was set, break read loop
-        if (exit_flag) {
-            break;
-        }
+    // write prompt for the next batch
+    if (executed) {
+        conn.write(PROMPT, sizeof(PROMPT) - 1);
     }
+}
+
+/**
+ * @brief Execute every complete command buffered on a connection, queueing responses
+ *
+ * Responses are only flushed after this returns, so syncing the log once at
+ * the end makes every write in the batch durable before it is acknowledged.
+ *
+ * @param conn connection whose inbuf received new bytes
+ */
+void on_input(Connection& conn) {
 
-    // close this connection
-    close(socks[arg.thread_index]);
+    // binary connections are framed by length, not by delimiter
+    if (conn.binary) {
+        on_binary_input(conn);
+    } else {
+        on_text_input(conn);
+    }
 
-    // zero this thread index into socks
-    socks[arg.thread_index] = 0;
+    // make this batch's writes durable before acknowledging them
+    if (wal && !wal->sync()) {
+        fprintf(stderr, "Write-ahead log failed, shutting down\n");
+        exit(EXIT_FAILURE);
+    }
 
-    return NULL;
+    // and, when semi-synchronous, held by a backup
+    if (primary) {
+        primary->sync();
+    }
 }
 
+/*
+ * microbench.cpp includes this file with SERVER_NO_MAIN defined to time the
+ * command handlers in isolation
+ */
+#ifndef SERVER_NO_MAIN
 int main(int argc, char* argv[]) {
 
     // parse server port and whether to run in debug mode
@@ -239,6 +1315,101 @@ int main(int argc, char* argv[]) {
             } else {
                 exit(EXIT_FAILURE);
             }
+        } else if (strcmp(argv[i], "-w") == 0) {
+            if (argv[i+1]) {
+                num_workers = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-l") == 0) {
+            if (argv[i+1]) {
+                wal_path = argv[i+1];
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-d") == 0) {
+            if (!argv[i+1] || !parse_durability(argv[i+1], durability)) {
+                fprintf(stderr, "Durability must be one of sync, group, async\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-g") == 0) {
+            if (argv[i+1]) {
+                group_delay_us = std::atoll(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-s") == 0) {
+            if (argv[i+1]) {
+                snapshot_path = argv[i+1];
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-I") == 0) {
+            if (argv[i+1]) {
+                snapshot_interval = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (!argv[i+1] || !parse_cell_engine(argv[i+1], engine)) {
+                fprintf(stderr, "Engine must be one of nested, flat\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-R") == 0) {
+            if (argv[i+1]) {
+                repl_port = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if (!argv[i+1] || !parse_repl_mode(argv[i+1], repl_mode)) {
+                fprintf(stderr, "Replication mode must be one of async, semisync\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (argv[i+1]) {
+                primary_addr = argv[i+1];
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-M") == 0) {
+            if (argv[i+1]) {
+                metrics_port = std::atoi(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--max-memory") == 0) {
+            if (!argv[i+1] || !parse_bytes(argv[i+1], max_memory)) {
+                fprintf(stderr, "Memory limit must be a byte count, optionally suffixed k, m or g\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--io") == 0) {
+            if (!argv[i+1] || !parse_io_backend(argv[i+1], io_backend)) {
+                fprintf(stderr, "I/O backend must be one of epoll, uring\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            if (!argv[i+1] || !parse_bytes(argv[i+1], compress_min)) {
+                fprintf(stderr, "Compression threshold must be a byte count, optionally suffixed k, m or g\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--tier") == 0) {
+            if (argv[i+1]) {
+                tier_dir = argv[i+1];
+            } else {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--tier-min") == 0) {
+            if (!argv[i+1] || !parse_bytes(argv[i+1], tier_min)) {
+                fprintf(stderr, "Tier threshold must be a byte count, optionally suffixed k, m or g\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--index") == 0) {
+            if (argv[i+1]) {
+                index_cols.push_back(argv[i+1]);
+            } else {
+                exit(EXIT_FAILURE);
+            }
         } else if (strcmp(argv[i], "-v") == 0) {
             debug = true;
         }
@@ -252,6 +1423,100 @@ int main(int argc, char* argv[]) {
     // set server ip
     ip = "0.0.0.0";
 
+    // a backup's state comes entirely from its primary, which re-copies it after a restart
+    if (!primary_addr.empty() && (repl_port != 0 || !wal_path.empty() || !snapshot_path.empty())) {
+        fprintf(stderr, "A backup (-r) cannot also serve replication (-R), log (-l) or snapshot (-s)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // a backup deletes whatever its primary evicts, so it must not evict on its own
+    // (moving values to disk deletes nothing)
+    if (!primary_addr.empty() && max_memory != 0 && tier_dir.empty()) {
+        fprintf(stderr, "A backup (-r) follows its primary's evictions and cannot set --max-memory without --tier\n");
+        exit(EXIT_FAILURE);
+    }
+    if (tier_min != 0 && tier_dir.empty()) {
+        fprintf(stderr, "--tier-min needs a --tier directory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // a ring runs its connections' handlers on its own thread, so a handler
+    // that blocks on an fsync or a backup's ack would stall every connection
+    // the ring serves; those modes need the epoll workers, which share connections
+    if (io_backend == IoBackend::URING && !wal_path.empty() && durability == Durability::SYNC) {
+        fprintf(stderr, "--io uring cannot be combined with -d sync (a ring would wait on every fsync)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (io_backend == IoBackend::URING && repl_port != 0 && repl_mode == ReplMode::SEMISYNC) {
+        fprintf(stderr, "--io uring cannot be combined with -m semisync (a ring would wait on every backup ack)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // create tablet
+    tab = new Tablet(TABLET_DEFAULT_SHARDS, engine);
+    tab->set_max_memory(max_memory);
+    tab->set_compression(compress_min);
+    if (!tier_dir.empty() && !tab->set_tier(tier_dir, tier_min)) {
+        fprintf(stderr, "Failed to use tier directory %s (%s)\n", tier_dir.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // indexes are built as the snapshot and log are loaded
+    for (const std::string& col : index_cols) {
+        tab->add_index(col);
+    }
+
+    // load the latest snapshot
+    uint64_t snapshot_seq = 0;
+    if (!snapshot_path.empty()) {
+        uint64_t cells;
+        if (!load_snapshot(snapshot_path, *tab, 0, snapshot_seq, cells)) {
+            fprintf(stderr, "Failed to load snapshot %s\n", snapshot_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "Loaded %llu cells from %s\n", (unsigned long long) cells, snapshot_path.c_str());
+    }
+
+    // replay the log tail past the snapshot (retired file first, if a snapshot
+    // was interrupted), then log every change from here on
+    if (!wal_path.empty()) {
+        for (const std::string& path : {wal_path + ".old", wal_path}) {
+            uint64_t replayed;
+            if (!Wal::replay(path, *tab, snapshot_seq, replayed)) {
+                fprintf(stderr, "Failed to replay write-ahead log %s (%s)\n", path.c_str(), strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            fprintf(stderr, "Replayed %llu records from %s\n", (unsigned long long) replayed, path.c_str());
+        }
+        wal = new Wal(wal_path, durability, group_delay_us);
+        if (!wal->open()) {
+            fprintf(stderr, "Failed to open write-ahead log %s (%s)\n", wal_path.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        tab->add_listener(wal);
+    }
+
+    // ship every change from here on to backups
+    if (repl_port != 0) {
+        primary = new ReplPrimary(*tab, repl_mode, REPL_SEMISYNC_TIMEOUT_MS);
+        tab->add_listener(primary);
+        if (!primary->start(repl_port)) {
+            fprintf(stderr, "Failed to listen for backups on port %d (%s)\n", repl_port, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // or follow a primary
+    if (!primary_addr.empty()) {
+        size_t colon = primary_addr.rfind(':');
+        if (colon == std::string::npos) {
+            fprintf(stderr, "Primary must be given as host:port\n");
+            exit(EXIT_FAILURE);
+        }
+        backup = new ReplBackup(*tab, primary_addr.substr(0, colon), std::atoi(primary_addr.c_str() + colon + 1));
+        backup->start();
+    }
+
     // create socket
     int server_socket = socket(PF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
@@ -292,66 +1557,38 @@ int main(int argc, char* argv[]) {
     }
 
     // listen on socket
-    listen(server_socket, MAX_THREADS);
-
-    // loop accepting connections
-    while (true) {
-
-        // init address struct for incoming client connection
-        struct sockaddr_in client_address;
-        bzero(&client_address, sizeof(client_address));
-
-        // loop through socks array until one becomes available
-        int next_thread_index = 0;
-        while (socks[next_thread_index] != 0) {
-            next_thread_index++;
-            if (next_thread_index >= MAX_THREADS) {
-                next_thread_index = 0;
-            }
-        }
-
-        // accept incoming connection
-        socklen_t client_addr_size = sizeof(client_address);
-        int client_socket = accept(server_socket, (struct sockaddr*) &client_address, &client_addr_size);
-        if (client_socket < 0) {
-            if (debug) {
-                fprintf(stderr, "Failed to accept connection from client\n");
-            }
-            close(server_socket);
-            exit(EXIT_FAILURE);
-        }
-
-        // store connection in socks array
-        socks[next_thread_index] = client_socket;
-
-        // set up args for handler thread
-        arg_st* args = (arg_st*) malloc(sizeof(arg_st));
-        args->thread_index = next_thread_index;
-
-        // spawn handler thread for connection
-        pthread_t new_thd;
-        int thread_id = pthread_create(&new_thd, NULL, thread_fn, args);
-        if (thread_id != 0) {
-            if (debug) {
-                fprintf(stderr, "Failed to create thread to handle client connection: (%d)\n", errno);
-            }
-            close(server_socket);
-            close(client_socket);
-            free(args);
-            socks[next_thread_index] = 0;
-            exit(EXIT_FAILURE);
-        }
-
-        // detach handler thread for connection
-        if (pthread_detach(new_thd) != 0) {
-            fprintf(stderr, "Failed to detach thread to handle client connection: (%d)\n", errno);
-            close(server_socket);
-            close(client_socket);
-            free(args);
-            socks[next_thread_index] = 0;
-            exit(EXIT_FAILURE);
+    if (listen(server_socket, SOMAXCONN) < 0) {
+        if (debug) {
+            fprintf(stderr, "Failed to listen on server socket\n");
         }
+        close(server_socket);
+        exit(EXIT_FAILURE);
+    }
 
+    // start periodic snapshots, and the expiry sweeper
+    if (!snapshot_path.empty() && snapshot_interval > 0) {
+        std::thread(snapshot_loop).detach();
+    }
+    std::thread(sweep_loop).detach();
+
+    // serve connections from the event loop until it fails, exporting its
+    // metrics to scrapers if asked
+    std::unique_ptr<EventLoop> event_loop;
+    if (io_backend == IoBackend::URING) {
+        event_loop.reset(new UringReactor(server_socket, num_workers, on_open, on_input));
+    } else {
+        event_loop.reset(new Reactor(server_socket, num_workers, on_open, on_input));
+    }
+    reactor = event_loop.get();
+    if (metrics_port != 0 && !start_metrics_server(metrics_port, [] { return format_prometheus(server_stat_values(), command_stats.collect()); })) {
+        fprintf(stderr, "Failed to serve metrics on port %d (%s)\n", metrics_port, strerror(errno));
+        close(server_socket);
+        exit(EXIT_FAILURE);
+    }
+    if (!event_loop->run()) {
+        fprintf(stderr, "Event loop failed (%s)\n", strerror(errno));
+        close(server_socket);
+        exit(EXIT_FAILURE);
     }
 
     // close server socket
@@ -359,4 +1596,5 @@ int main(int argc, char* argv[]) {
 
     // exit
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
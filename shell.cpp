@@ -3,13 +3,20 @@
 #include <errno.h>
 #include <optional>
 #include <sstream>
+#include <string.h>
 #include "Tablet/tablet.h"
+#include "Client/client.h"
 #include "Util/iotool.h"
 
 #define BUF_SIZE 1024 * 1024
 
 Tablet tab;
 
+/**
+ * @brief server the commands go to instead of the local tablet (-c host:port), if any
+ */
+Client* remote = nullptr;
+
 /**
  * @brief Parse and execute command according to protocol (delim was already parsed out)
  *
@@ -65,6 +72,16 @@ std::string execute_command(const std::string& command) {
         std::vector<char> bytes_vec(bytes_str.begin(), bytes_str.end());
 
         // execute PUT
+        if (remote) {
+            ClientResult result = remote->put(row, col, make_value(std::move(bytes_vec))).get();
+            if (result.io_error) {
+                return "-550 Server Unavailable";
+            }
+            if (!result.ok()) {
+                return "-550 Resource Creation Failed";
+            }
+            return "+250 OK";
+        }
         bool put_succ = tab.put(row, col, bytes_vec);
         if (!put_succ) {
             return "-550 Resource Creation Failed";
@@ -76,16 +93,22 @@ std::string execute_command(const std::string& command) {
     } else if (method == "GET") {
 
         // execute get
-        auto gotten_opt = tab.get(row, col);
-        if (!gotten_opt.has_value()) {
+        ValueRef gotten;
+        if (remote) {
+            ClientResult result = remote->get(row, col).get();
+            if (result.io_error) {
+                return "-550 Server Unavailable";
+            }
+            gotten = result.value;
+        } else {
+            gotten = tab.get(row, col);
+        }
+        if (!gotten) {
             return "-550 Resource Does Not Exist";
         }
 
-        // unpack data
-        std::vector<char> gotten = gotten_opt.value();
-
         // format response
-        std::string formatted_data(gotten.begin(), gotten.end());
+        std::string formatted_data(gotten->begin(), gotten->end());
 
         // respond
         return "+250 OK " + formatted_data;
@@ -93,7 +116,16 @@ std::string execute_command(const std::string& command) {
     } else if (method == "DEL") {
 
         // execute delete
-        bool del_succ = tab.del(row, col);
+        bool del_succ;
+        if (remote) {
+            ClientResult result = remote->del(row, col).get();
+            if (result.io_error) {
+                return "-550 Server Unavailable";
+            }
+            del_succ = result.ok();
+        } else {
+            del_succ = tab.del(row, col);
+        }
         if (!del_succ) {
             return "-550 Resource Does Not Exist";
         }
@@ -110,6 +142,28 @@ std::string execute_command(const std::string& command) {
 
 int main(int argc, char** argv) {
 
+    // parse flags: -c <host:port> talks to a server instead of a local tablet
+    std::unique_ptr<Client> client;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            std::string target = argv[++i];
+            size_t colon = target.rfind(':');
+            if (colon == std::string::npos) {
+                fprintf(stderr, "Bad server address %s (expected host:port)\n", target.c_str());
+                exit(EXIT_FAILURE);
+            }
+            client = std::make_unique<Client>(target.substr(0, colon), atoi(target.c_str() + colon + 1), 1);
+            if (!client->connect()) {
+                fprintf(stderr, "Cannot connect to %s\n", client->name().c_str());
+                exit(EXIT_FAILURE);
+            }
+            remote = client.get();
+        } else {
+            fprintf(stderr, "Usage: %s [-c <host:port>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // set prompt
     std::string prompt = "DataStore % ";
 
@@ -138,8 +192,14 @@ int main(int argc, char** argv) {
             response += "\n";
             do_write(STDOUT_FILENO, response.c_str(), response.size());
         }
+
+        // stop at end of input
+        if (num_read <= 0) {
+            break;
+        }
     }
 
-    // exit
+    // exit (closing the connection first)
+    client.reset();
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -0,0 +1,314 @@
+/*
+ * Multi-threaded stress and scaling test of the Tablet.  Threads run a mix of
+ * GET/PUT/DEL against rows only they write and rows every thread writes, then
+ * the tablet's contents are checked against each thread's record of its own
+ * writes.  Throughput is reported per thread count; any mismatch fails the run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Tablet/tablet.h"
+
+/**
+ * @brief operations each thread runs per thread count unless -n says otherwise
+ */
+#define STRESS_DEFAULT_OPS 100000
+
+/**
+ * @brief rows only one thread writes (per thread) and rows every thread writes, and columns per row
+ */
+#define STRESS_OWN_ROWS 1024
+#define STRESS_SHARED_ROWS 64
+#define STRESS_COLS 4
+
+/**
+ * @brief most mismatches printed before the rest are only counted
+ */
+#define STRESS_MAX_REPORTS 10
+
+/**
+ * @brief last write a thread made to a cell: a PUT's sequence number, or one of these
+ */
+#define STRESS_DELETED -1
+#define STRESS_UNTOUCHED -2
+
+/**
+ * @brief Stress configuration (see usage())
+ */
+struct StressConfig {
+    uint64_t ops = STRESS_DEFAULT_OPS;
+    unsigned max_threads = 32;
+    unsigned shared_pct = 20;
+    unsigned mix[3] = {50, 35, 15};
+    CellEngine engine = CellEngine::NESTED;
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: stress [options]\n"
+        "  -n <ops>           operations per thread (default 100000)\n"
+        "  -t <threads>       most threads; runs 1, 2, 4, ... up to this (default 32)\n"
+        "  -s <pct>           share of operations on rows every thread writes (default 20)\n"
+        "  -m <get:put:del>   operation mix weights (default 50:35:15)\n"
+        "  -e <nested|flat>   cell engine (default nested)\n");
+}
+
+/**
+ * @brief Failed checks across all threads, the first few of which are printed
+ */
+static std::atomic<uint64_t> mismatches{0};
+
+static void report(const char* what, const std::string& row, const std::string& col, const std::string& detail) {
+    if (mismatches.fetch_add(1) < STRESS_MAX_REPORTS) {
+        fprintf(stderr, "mismatch: %s at (%s, %s): %s\n", what, row.c_str(), col.c_str(), detail.c_str());
+    }
+}
+
+/**
+ * @brief The value thread @p tid writes with its @p seq'th PUT: "<tid> <seq> " padded
+ *        to a length and with a byte that both depend on the pair
+ */
+static std::vector<char> make_bytes(unsigned tid, int64_t seq) {
+    std::string head = std::to_string(tid) + " " + std::to_string(seq) + " ";
+    std::vector<char> bytes(head.begin(), head.end());
+    bytes.resize(head.size() + 8 + (seq * 7 + tid) % 56, 'a' + (tid + seq) % 26);
+    return bytes;
+}
+
+/**
+ * @brief Decode a value written by make_bytes, checking its padding
+ *
+ * @return false if the value is torn or was never written by any thread
+ */
+static bool parse_bytes(const std::vector<char>& value, unsigned& tid, int64_t& seq) {
+    std::string text(value.begin(), value.end());
+    long long parsed_seq;
+    int consumed = 0;
+    if (sscanf(text.c_str(), "%u %lld %n", &tid, &parsed_seq, &consumed) != 2 || consumed == 0) {
+        return false;
+    }
+    seq = parsed_seq;
+    return value == make_bytes(tid, seq);
+}
+
+static std::string own_row(unsigned tid, size_t row) {
+    return "own" + std::to_string(tid) + "-" + std::to_string(row);
+}
+
+static std::string shared_row(size_t row) {
+    return "shared-" + std::to_string(row);
+}
+
+static std::string col_name(size_t col) {
+    return "c" + std::to_string(col);
+}
+
+/**
+ * @brief One thread's run and its record of the writes it made.
+ *
+ * own[i] is the exact state of its own cell i; shared[i] is its last write
+ * to shared cell i, which the cell must still hold if that write was the
+ * last of all threads'.
+ */
+struct Worker {
+    unsigned tid;
+    std::vector<int64_t> own;
+    std::vector<int64_t> shared;
+
+    explicit Worker(unsigned tid) : tid(tid),
+        own(STRESS_OWN_ROWS * STRESS_COLS, STRESS_DELETED),
+        shared(STRESS_SHARED_ROWS * STRESS_COLS, STRESS_UNTOUCHED) {}
+
+    void run(Tablet& tab, const StressConfig& config, const std::atomic<bool>& go) {
+
+        // pregenerate keys so the timed loop mostly measures the tablet
+        std::vector<std::string> own_rows, shared_rows, cols;
+        for (size_t row = 0; row < STRESS_OWN_ROWS; row++) {
+            own_rows.push_back(own_row(tid, row));
+        }
+        for (size_t row = 0; row < STRESS_SHARED_ROWS; row++) {
+            shared_rows.push_back(shared_row(row));
+        }
+        for (size_t col = 0; col < STRESS_COLS; col++) {
+            cols.push_back(col_name(col));
+        }
+        std::mt19937_64 rng(tid + 1);
+        unsigned weight = config.mix[0] + config.mix[1] + config.mix[2];
+        int64_t seq = 0;
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        for (uint64_t i = 0; i < config.ops; i++) {
+            bool on_shared = rng() % 100 < config.shared_pct;
+            size_t cell = rng() % ((on_shared ? STRESS_SHARED_ROWS : STRESS_OWN_ROWS) * STRESS_COLS);
+            const std::string& row = on_shared ? shared_rows[cell / STRESS_COLS] : own_rows[cell / STRESS_COLS];
+            const std::string& col = cols[cell % STRESS_COLS];
+            int64_t& state = on_shared ? shared[cell] : own[cell];
+            unsigned pick = rng() % weight;
+
+            if (pick < config.mix[0]) {
+
+                // a read of an own cell must see exactly the last write; a shared one only a whole value
+                auto value = tab.get(row, col);
+                unsigned writer;
+                int64_t written;
+                if (value && !parse_bytes(*value, writer, written)) {
+                    report("torn value", row, col, std::string(value->begin(), value->end()));
+                } else if (!on_shared && (value ? written : STRESS_DELETED) != state) {
+                    report("stale read", row, col, "expected seq " + std::to_string(state));
+                }
+            } else if (pick < config.mix[0] + config.mix[1]) {
+                if (!tab.put(row, col, make_bytes(tid, seq))) {
+                    report("put failed", row, col, "");
+                }
+                state = seq++;
+            } else {
+
+                // deleting an own cell succeeds exactly when the model has it
+                bool existed = tab.del(row, col);
+                if (!on_shared && existed != (state != STRESS_DELETED)) {
+                    report("del result", row, col, existed ? "existed" : "missing");
+                }
+                state = STRESS_DELETED;
+            }
+        }
+    }
+};
+
+/**
+ * @brief Check the tablet against every thread's record once they have all finished
+ */
+static void verify(Tablet& tab, const std::vector<Worker>& workers) {
+    uint64_t expected_cells = 0;
+
+    // own cells hold exactly their owner's last write
+    for (const Worker& worker : workers) {
+        for (size_t cell = 0; cell < worker.own.size(); cell++) {
+            std::string row = own_row(worker.tid, cell / STRESS_COLS), col = col_name(cell % STRESS_COLS);
+            auto value = tab.get(row, col);
+            if (worker.own[cell] == STRESS_DELETED) {
+                if (value) {
+                    report("deleted cell present", row, col, "");
+                }
+                continue;
+            }
+            expected_cells++;
+            if (!value || *value != make_bytes(worker.tid, worker.own[cell])) {
+                report("final value", row, col, "expected seq " + std::to_string(worker.own[cell]));
+            }
+        }
+    }
+
+    // a shared cell holds the last write of one of the threads that wrote it
+    for (size_t cell = 0; cell < STRESS_SHARED_ROWS * STRESS_COLS; cell++) {
+        std::string row = shared_row(cell / STRESS_COLS), col = col_name(cell % STRESS_COLS);
+        auto value = tab.get(row, col);
+        unsigned writer;
+        int64_t written;
+        bool explained = false;
+        if (!value) {
+
+            // absent: some thread's last write was a DEL, or no thread wrote it at all
+            bool written_by_any = false;
+            for (const Worker& worker : workers) {
+                explained |= worker.shared[cell] == STRESS_DELETED;
+                written_by_any |= worker.shared[cell] != STRESS_UNTOUCHED;
+            }
+            explained |= !written_by_any;
+        } else if (parse_bytes(*value, writer, written)) {
+            expected_cells++;
+            explained = writer < workers.size() && workers[writer].shared[cell] == written;
+        }
+        if (!explained) {
+            report("shared final value", row, col, value ? std::string(value->begin(), value->end()) : "absent");
+        }
+    }
+
+    // and nothing else is stored
+    uint64_t cells = tab.usage().cells;
+    if (cells != expected_cells) {
+        report("cell count", "*", "*", std::to_string(cells) + " stored, " + std::to_string(expected_cells) + " expected");
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    // parse options
+    StressConfig config;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!val) {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(arg, "-n") == 0) {
+            config.ops = std::atoll(val);
+        } else if (strcmp(arg, "-t") == 0) {
+            config.max_threads = std::max(1, std::atoi(val));
+        } else if (strcmp(arg, "-s") == 0) {
+            config.shared_pct = std::min(100, std::atoi(val));
+        } else if (strcmp(arg, "-m") == 0) {
+            if (sscanf(val, "%u:%u:%u", &config.mix[0], &config.mix[1], &config.mix[2]) != 3
+                || config.mix[0] + config.mix[1] + config.mix[2] == 0) {
+                usage();
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(arg, "-e") == 0 && strcmp(val, "nested") == 0) {
+            config.engine = CellEngine::NESTED;
+        } else if (strcmp(arg, "-e") == 0 && strcmp(val, "flat") == 0) {
+            config.engine = CellEngine::FLAT;
+        } else {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        i++;
+    }
+
+    // run each thread count against a fresh tablet
+    printf("%8s %12s %10s %14s %8s\n", "threads", "ops", "secs", "ops/s", "speedup");
+    double base_rate = 0;
+    for (unsigned threads = 1; threads <= config.max_threads; threads *= 2) {
+        Tablet tab(TABLET_DEFAULT_SHARDS, config.engine);
+        std::vector<Worker> workers;
+        for (unsigned tid = 0; tid < threads; tid++) {
+            workers.emplace_back(tid);
+        }
+        std::atomic<bool> go{false};
+        std::vector<std::thread> pool;
+        for (Worker& worker : workers) {
+            pool.emplace_back([&tab, &config, &go, &worker]() { worker.run(tab, config, go); });
+        }
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        verify(tab, workers);
+
+        // report throughput relative to one thread
+        uint64_t ops = config.ops * threads;
+        double rate = ops / secs;
+        if (threads == 1) {
+            base_rate = rate;
+        }
+        printf("%8u %12llu %10.3f %14.0f %7.2fx\n", threads, (unsigned long long) ops, secs, rate, rate / base_rate);
+        fflush(stdout);
+    }
+
+    // any mismatch fails the run
+    if (mismatches.load() > 0) {
+        fprintf(stderr, "FAILED: %llu mismatches\n", (unsigned long long) mismatches.load());
+        exit(EXIT_FAILURE);
+    }
+    printf("OK: contents matched every thread's writes\n");
+    return 0;
+}